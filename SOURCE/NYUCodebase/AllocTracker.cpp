@@ -0,0 +1,35 @@
+#include "AllocTracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<unsigned long> allocations(0);
+
+unsigned long allocationCount() {
+	return allocations;
+}
+
+#ifdef TRACK_ALLOCATIONS
+
+void* operator new(size_t size) {
+	allocations++;
+	void* block = malloc(size ? size : 1);
+	if (!block)
+		throw std::bad_alloc();
+	return block;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* block) throw() {
+	free(block);
+}
+
+void operator delete[](void* block) throw() {
+	free(block);
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef AllocTracker_h
+#define AllocTracker_h
+
+// Counts every global operator new when built with TRACK_ALLOCATIONS (on in Debug).
+// Without it allocationCount() is always 0.
+unsigned long allocationCount();
+
+#ifdef TRACK_ALLOCATIONS
+#define ALLOCATION_TRACKING 1
+#else
+#define ALLOCATION_TRACKING 0
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#include "Animation.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static const char* clipNames[CLIP_COUNT] = { "stand", "run", "jump", "hit", "groundattack", "airattack", "death" };
+
+bool AnimationSet::load(const std::string& path) {
+	std::ifstream infile(path);
+	if (infile.fail()) {
+		std::cout << "Error opening animation file:" << path << std::endl;
+		return false;
+	}
+
+	sprites.clear();
+	for (int i = 0; i < CLIP_COUNT; i++) {
+		clips[i].loop = true;
+		clips[i].frameAt.assign(1, 0);
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(infile, line)) {
+		lineNumber++;
+		std::istringstream words(line);
+		std::string command;
+		if (!(words >> command) || command[0] == '#')
+			continue;
+
+		if (command == "sprite") {
+			std::string image;
+			words >> image;
+			sprites.push_back(image);
+		}
+		else if (command == "clip") {
+			std::string name, mode, frame;
+			words >> name >> mode;
+			int type = 0;
+			while (type < CLIP_COUNT && name != clipNames[type])
+				type++;
+			if (type == CLIP_COUNT) {
+				std::cout << path << ":" << lineNumber << ": unknown clip " << name << std::endl;
+				continue;
+			}
+
+			AnimationClip& clip = clips[type];
+			clip.loop = mode != "once";
+			clip.frameAt.clear();
+			while (words >> frame) {
+				int sprite = 0, ticks = 1;
+				char colon;
+				std::istringstream parts(frame);
+				parts >> sprite >> colon >> ticks;
+				if (sprite < 0 || sprite >= (int)sprites.size()) {
+					std::cout << path << ":" << lineNumber << ": no sprite " << sprite << std::endl;
+					sprite = 0;
+				}
+				clip.frameAt.insert(clip.frameAt.end(), ticks > 0 ? ticks : 1, sprite);
+			}
+			if (clip.frameAt.empty())
+				clip.frameAt.push_back(0);
+		}
+		else {
+			std::cout << path << ":" << lineNumber << ": unknown command " << command << std::endl;
+		}
+	}
+	return !sprites.empty();
+}
+
+int AnimationSet::frame(int clip, int tick) const {
+	const std::vector<int>& frameAt = clips[clip].frameAt;
+	int length = (int)frameAt.size();
+	if (clips[clip].loop)
+		return frameAt[tick % length];
+	return frameAt[tick < length ? tick : length - 1];
+}
+
+bool AnimationSet::finished(int clip, int tick) const {
+	return !clips[clip].loop && tick >= (int)clips[clip].frameAt.size();
+}
@@ -0,0 +1,32 @@
+#ifndef Animation_h
+#define Animation_h
+
+#include <string>
+#include <vector>
+
+#define ANIMATION_TICK (1.0f / 60.0f)
+
+enum AnimationClipType { CLIP_STAND, CLIP_RUN, CLIP_JUMP, CLIP_HIT, CLIP_GROUND_ATTACK, CLIP_AIR_ATTACK, CLIP_DEATH, CLIP_COUNT };
+
+struct AnimationClip {
+	bool loop;
+	// Sprite index for every tick of the clip, expanded from the frame list at load time
+	std::vector<int> frameAt;
+};
+
+// Per character sprite list and clips, read from a .anim file:
+//   sprite <image>                            (sprites are numbered in order from 0)
+//   clip <name> <loop|once> <sprite>:<ticks> ...
+// Ticks are ANIMATION_TICK long. A "once" clip holds its last frame when done.
+class AnimationSet {
+public:
+	std::vector<std::string> sprites;
+	AnimationClip clips[CLIP_COUNT];
+
+	bool load(const std::string& path);
+
+	int frame(int clip, int tick) const;
+	bool finished(int clip, int tick) const;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "Audio.h"
+#include "Profiler.h"
+
+#include <iostream>
+
+AudioEngine audio;
+
+// Runs on the audio thread right after each buffer is mixed. The buffer is queued
+// behind the one the device is playing, so a sound started before this mix is heard
+// roughly one buffer from now.
+static void postMix(void* userdata, Uint8* stream, int length) {
+	AudioEngine* engine = (AudioEngine*)userdata;
+	Uint64 now = SDL_GetPerformanceCounter();
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	Uint64 bufferTicks = frequency * engine->bufferFrames / engine->frequency;
+
+	Uint64 last = engine->lastMix.exchange(now);
+	if (last != 0 && now - last > bufferTicks + bufferTicks / 2)
+		engine->underruns++;
+
+	Uint64 event = engine->pendingEvent.exchange(0);
+	if (event != 0) {
+		Uint32 latency = (Uint32)((now - event + bufferTicks) * 1000000 / frequency);
+		engine->latencySum += latency;
+		engine->latencyCount++;
+		if (latency > engine->latencyMax)
+			engine->latencyMax = latency;
+	}
+}
+
+AudioEngine::AudioEngine() : ready(false), frequency(AUDIO_FREQUENCY), bufferFrames(AUDIO_DEFAULT_BUFFER),
+	pendingEvent(0), latencySum(0), latencyCount(0), latencyMax(0), underruns(0), lastMix(0), music(nullptr), stolen(0), dropped(0) {}
+
+bool AudioEngine::validBuffer(int bufferFrames) {
+	return bufferFrames >= AUDIO_MIN_BUFFER && bufferFrames <= AUDIO_MAX_BUFFER && (bufferFrames & (bufferFrames - 1)) == 0;
+}
+
+bool AudioEngine::init(int newFrequency, int newBufferFrames, int voiceCount) {
+	if (!validBuffer(newBufferFrames)) {
+		std::cout << "Audio buffer of " << newBufferFrames << " frames is not a power of two from " << AUDIO_MIN_BUFFER << " to " << AUDIO_MAX_BUFFER << std::endl;
+		return false;
+	}
+	if (Mix_OpenAudio(newFrequency, MIX_DEFAULT_FORMAT, 2, newBufferFrames) != 0) {
+		std::cout << "Error opening audio: " << SDL_GetError() << std::endl;
+		return false;
+	}
+	// The device may not give us exactly what we asked for
+	Uint16 format;
+	int channels;
+	Mix_QuerySpec(&frequency, &format, &channels);
+	bufferFrames = newBufferFrames;
+
+	Mix_AllocateChannels(voiceCount);
+	Voice idle = { PRIORITY_AMBIENT, 0 };
+	voices.assign(voiceCount, idle);
+	Mix_SetPostMix(postMix, this);
+	ready = true;
+
+	const char* driver = SDL_GetCurrentAudioDriver();
+	std::cout << "Audio: " << (driver ? driver : "?") << " " << frequency << "Hz, " << bufferFrames << " frame buffer ("
+		<< bufferFrames * 1000.0 / frequency << "ms), " << voiceCount << " voices" << std::endl;
+	return true;
+}
+
+void AudioEngine::shutdown() {
+	if (!ready)
+		return;
+	Mix_SetPostMix(nullptr, nullptr);
+	// Everything the device plays has to go before the device does
+	Mix_HaltChannel(-1);
+	Mix_HaltMusic();
+	for (size_t i = 0; i < samples.size(); i++)
+		Mix_FreeChunk(samples[i]);
+	samples.clear();
+	if (music)
+		Mix_FreeMusic(music);
+	music = nullptr;
+	Mix_CloseAudio();
+	ready = false;
+}
+
+Mix_Chunk* AudioEngine::loadSample(const char* path) {
+	if (!ready)
+		return nullptr;
+	// Mix_LoadWAV converts to the device format up front, so playing never decodes
+	Mix_Chunk* sample = Mix_LoadWAV(path);
+	if (!sample) {
+		std::cout << "Error loading sample " << path << ": " << SDL_GetError() << std::endl;
+		return nullptr;
+	}
+	samples.push_back(sample);
+	return sample;
+}
+
+bool AudioEngine::playMusic(const char* path) {
+	if (!ready)
+		return false;
+	if (music)
+		Mix_FreeMusic(music);
+	music = Mix_LoadMUS(path);
+	return music && Mix_PlayMusic(music, -1) == 0;
+}
+
+int AudioEngine::play(Mix_Chunk* sample, int priority) {
+	if (!ready || !sample)
+		return -1;
+
+	int channel = -1;
+	for (size_t i = 0; i < voices.size() && channel < 0; i++) {
+		if (!Mix_Playing((int)i))
+			channel = (int)i;
+	}
+	if (channel < 0) {
+		for (size_t i = 0; i < voices.size(); i++) {
+			if (voices[i].priority > priority)
+				continue;
+			if (channel < 0 || voices[i].priority < voices[channel].priority ||
+				(voices[i].priority == voices[channel].priority && voices[i].started < voices[channel].started))
+				channel = (int)i;
+		}
+		if (channel < 0) {
+			dropped++;
+			return -1;
+		}
+		stolen++;
+	}
+
+	voices[channel].priority = priority;
+	voices[channel].started = SDL_GetTicks();
+	Uint64 none = 0;
+	pendingEvent.compare_exchange_strong(none, SDL_GetPerformanceCounter());
+	return Mix_PlayChannel(channel, sample, 0);
+}
+
+void AudioEngine::report() {
+	if (!ready)
+		return;
+	Uint32 count = latencyCount;
+	if (count > 0)
+		profiler.gauge("audio latency avg ms", (double)latencySum / count / 1000.0);
+	profiler.gauge("audio latency max ms", latencyMax / 1000.0);
+	profiler.gauge("audio underruns", underruns);
+	profiler.gauge("audio voices stolen", stolen);
+	profiler.gauge("audio sounds dropped", dropped);
+}
@@ -0,0 +1,65 @@
+#ifndef Audio_h
+#define Audio_h
+
+#include <SDL.h>
+#include <SDL_mixer.h>
+#include <atomic>
+#include <vector>
+
+#define AUDIO_FREQUENCY 44100
+#define AUDIO_DEFAULT_BUFFER 512
+#define AUDIO_MIN_BUFFER 256	//frames, smaller underruns on most drivers
+#define AUDIO_MAX_BUFFER 8192	//about 190ms, past that hits are noticeably late
+#define AUDIO_VOICES 16
+
+enum SoundPriority { PRIORITY_AMBIENT, PRIORITY_ATTACK, PRIORITY_HIT, PRIORITY_UI };
+
+struct Voice {
+	int priority;
+	Uint32 started;
+};
+
+// Sound effects play on a pool of mixer channels. A new sound takes a free voice,
+// or steals the oldest voice of the lowest priority that is not above its own.
+// Samples are decoded to PCM once at load time and stay resident. Music is
+// streamed by SDL_mixer from the audio thread.
+class AudioEngine {
+public:
+	AudioEngine();
+
+	// Must run after SDL_Init(SDL_INIT_AUDIO). bufferFrames must be a power of two from
+	// AUDIO_MIN_BUFFER to AUDIO_MAX_BUFFER, 256-512 keeps hit sounds under ~12ms.
+	bool init(int frequency, int bufferFrames, int voices);
+	static bool validBuffer(int bufferFrames);
+	void shutdown();
+
+	Mix_Chunk* loadSample(const char* path);
+	bool playMusic(const char* path);
+	int play(Mix_Chunk* sample, int priority);
+
+	// Hands latency, underrun and voice stealing figures to the profiler
+	void report();
+
+	bool ready;
+	int frequency;
+	int bufferFrames;
+
+	// Written from the audio thread by the post mix callback
+	std::atomic<Uint64> pendingEvent;	//performance counter of the oldest unheard play()
+	std::atomic<Uint64> latencySum;		//microseconds
+	std::atomic<Uint32> latencyCount;
+	std::atomic<Uint32> latencyMax;
+	std::atomic<Uint32> underruns;
+	std::atomic<Uint64> lastMix;
+
+private:
+	std::vector<Voice> voices;
+	std::vector<Mix_Chunk*> samples;
+	Mix_Music* music;
+	unsigned int stolen;
+	unsigned int dropped;
+};
+
+extern AudioEngine audio;
+
+#endif
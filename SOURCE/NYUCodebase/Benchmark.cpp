@@ -0,0 +1,254 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#define BENCH_FIGURES 8
+
+TimeSpread spreadOf(std::vector<double>& samples) {
+	TimeSpread spread = { 0, 0, 0 };
+	if (samples.empty())
+		return spread;
+	std::sort(samples.begin(), samples.end());
+	spread.p50 = samples[(samples.size() - 1) / 2];
+	spread.p99 = samples[(samples.size() - 1) * 99 / 100];
+	spread.max = samples.back();
+	return spread;
+}
+
+TimeSpread spreadOfRuns(std::vector<double>& runTimes, unsigned int ticks) {
+	TimeSpread spread = spreadOf(runTimes);
+	if (ticks > 0) {
+		spread.p50 /= ticks;
+		spread.p99 /= ticks;
+		spread.max /= ticks;
+	}
+	return spread;
+}
+
+void printBench(const ReplayBenchResult& result) {
+	std::cout << result.replay << " (" << result.stage << ", " << result.mode << "): " << result.runs << " runs of " << result.ticks << " ticks"
+		<< (result.matched ? "" : ", DESYNCED") << std::endl;
+	std::cout << "  " << result.ticksPerSecond << " ticks/s, tick over runs: median " << result.tick.p50 * 1000000.0 << "us p99 "
+		<< result.tick.p99 * 1000000.0 << "us slowest " << result.tick.max * 1000000.0 << "us" << std::endl;
+	if (result.frame.max > 0) {
+		std::cout << "  frame p50 " << result.frame.p50 * 1000000.0 << "us p99 " << result.frame.p99 * 1000000.0 << "us max "
+			<< result.frame.max * 1000000.0 << "us" << std::endl;
+	}
+	if (result.allocations >= 0)
+		std::cout << "  " << result.allocations << " allocations" << std::endl;
+}
+
+static std::string quoted(const std::string& text) {
+	std::string out = "\"";
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '"' || text[i] == '\\')
+			out += '\\';
+		out += text[i];
+	}
+	return out + "\"";
+}
+
+bool writeBenchJson(const std::string& path, const std::vector<ReplayBenchResult>& results) {
+	std::ofstream out(path.c_str());
+	if (!out) {
+		std::cout << "Unable to write " << path << std::endl;
+		return false;
+	}
+	out << "{\n\t\"version\": " << BENCH_JSON_VERSION << ",\n\t\"results\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		const ReplayBenchResult& result = results[i];
+		out << (i > 0 ? "," : "") << "\n\t\t{\n";
+		out << "\t\t\t\"replay\": " << quoted(result.replay) << ",\n";
+		out << "\t\t\t\"stage\": " << quoted(result.stage) << ",\n";
+		out << "\t\t\t\"mode\": " << quoted(result.mode) << ",\n";
+		out << "\t\t\t\"ticks\": " << result.ticks << ",\n";
+		out << "\t\t\t\"runs\": " << result.runs << ",\n";
+		out << "\t\t\t\"matched\": " << (result.matched ? "true" : "false") << ",\n";
+		out << "\t\t\t\"ticks_per_second\": " << result.ticksPerSecond << ",\n";
+		out << "\t\t\t\"tick_run_p50_us\": " << result.tick.p50 * 1000000.0 << ",\n";
+		out << "\t\t\t\"tick_run_p99_us\": " << result.tick.p99 * 1000000.0 << ",\n";
+		out << "\t\t\t\"tick_run_max_us\": " << result.tick.max * 1000000.0 << ",\n";
+		out << "\t\t\t\"frame_p50_us\": " << result.frame.p50 * 1000000.0 << ",\n";
+		out << "\t\t\t\"frame_p99_us\": " << result.frame.p99 * 1000000.0 << ",\n";
+		out << "\t\t\t\"frame_max_us\": " << result.frame.max * 1000000.0;
+		if (result.allocations >= 0)
+			out << ",\n\t\t\t\"allocations\": " << result.allocations;
+		out << "\n";
+		out << "\t\t}";
+	}
+	out << "\n\t]\n}\n";
+	return (bool)out;
+}
+
+// Only as much JSON as writeBenchJson writes: an array of flat objects of strings,
+// numbers and booleans under "results"
+static void skipSpace(const std::string& text, size_t& at) {
+	while (at < text.size() && (text[at] == ' ' || text[at] == '\t' || text[at] == '\n' || text[at] == '\r'))
+		at++;
+}
+
+static bool readString(const std::string& text, size_t& at, std::string& value) {
+	if (at >= text.size() || text[at] != '"')
+		return false;
+	value.clear();
+	for (at++; at < text.size() && text[at] != '"'; at++) {
+		if (text[at] == '\\' && at + 1 < text.size())
+			at++;
+		value += text[at];
+	}
+	if (at >= text.size())
+		return false;
+	at++;
+	return true;
+}
+
+static void setField(ReplayBenchResult& result, const std::string& key, const std::string& value) {
+	double number = atof(value.c_str());
+	if (key == "replay") result.replay = value;
+	else if (key == "stage") result.stage = value;
+	else if (key == "mode") result.mode = value;
+	else if (key == "ticks") result.ticks = (unsigned int)number;
+	else if (key == "runs") result.runs = (unsigned int)number;
+	else if (key == "matched") result.matched = value == "true";
+	else if (key == "ticks_per_second") result.ticksPerSecond = number;
+	else if (key == "tick_run_p50_us") result.tick.p50 = number / 1000000.0;
+	else if (key == "tick_run_p99_us") result.tick.p99 = number / 1000000.0;
+	else if (key == "tick_run_max_us") result.tick.max = number / 1000000.0;
+	else if (key == "frame_p50_us") result.frame.p50 = number / 1000000.0;
+	else if (key == "frame_p99_us") result.frame.p99 = number / 1000000.0;
+	else if (key == "frame_max_us") result.frame.max = number / 1000000.0;
+	else if (key == "allocations" && value != "null") result.allocations = (long)number;
+}
+
+bool readBenchJson(const std::string& path, std::vector<ReplayBenchResult>& results) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		std::cout << "Unable to open " << path << std::endl;
+		return false;
+	}
+	std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	size_t at = text.find("\"results\"");
+	at = at == std::string::npos ? at : text.find('[', at);
+	if (at == std::string::npos) {
+		std::cout << path << " has no benchmark results" << std::endl;
+		return false;
+	}
+
+	for (at++;;) {
+		skipSpace(text, at);
+		if (at < text.size() && text[at] == ',')
+			at++;
+		skipSpace(text, at);
+		if (at >= text.size() || text[at] != '{')
+			break;
+		ReplayBenchResult result = ReplayBenchResult();
+		result.allocations = -1;
+		for (at++;;) {
+			skipSpace(text, at);
+			if (at < text.size() && text[at] == ',') {
+				at++;
+				skipSpace(text, at);
+			}
+			std::string key, value;
+			if (!readString(text, at, key))
+				break;
+			skipSpace(text, at);
+			if (at >= text.size() || text[at] != ':')
+				break;
+			at++;
+			skipSpace(text, at);
+			if (!readString(text, at, value)) {
+				size_t end = text.find_first_of(",}\n", at);
+				if (end == std::string::npos)
+					break;
+				value = text.substr(at, end - at);
+				at = end;
+			}
+			setField(result, key, value);
+		}
+		if (at >= text.size() || text[at] != '}') {
+			std::cout << path << " is not benchmark results this build can read" << std::endl;
+			return false;
+		}
+		at++;
+		results.push_back(result);
+	}
+	return true;
+}
+
+// Each figure the comparison looks at, times in microseconds. Only ticks/s is better higher.
+static double figure(const ReplayBenchResult& result, int index) {
+	switch (index) {
+	case 0: return result.ticksPerSecond;
+	case 1: return result.tick.p50 * 1000000.0;
+	case 2: return result.tick.p99 * 1000000.0;
+	case 3: return result.tick.max * 1000000.0;
+	case 4: return result.frame.p50 * 1000000.0;
+	case 5: return result.frame.p99 * 1000000.0;
+	case 6: return result.frame.max * 1000000.0;
+	default: return (double)result.allocations;
+	}
+}
+
+static const char* figureNames[BENCH_FIGURES] = { "ticks/s", "tick us, median run", "tick us, p99 run", "tick us, slowest run", "frame p50 us", "frame p99 us", "frame max us", "allocations" };
+
+int compareBench(const std::vector<ReplayBenchResult>& baseline, const std::vector<ReplayBenchResult>& current, double threshold) {
+	int regressions = 0;
+	for (size_t i = 0; i < current.size(); i++) {
+		const ReplayBenchResult& now = current[i];
+		const ReplayBenchResult* was = nullptr;
+		for (size_t j = 0; j < baseline.size() && !was; j++) {
+			if (baseline[j].replay == now.replay && baseline[j].mode == now.mode)
+				was = &baseline[j];
+		}
+		if (!was) {
+			std::cout << now.replay << " (" << now.mode << "): not in the baseline" << std::endl;
+			continue;
+		}
+		if (!now.matched) {
+			std::cout << now.replay << " (" << now.mode << "): REGRESSION, no longer plays as recorded" << std::endl;
+			regressions++;
+		}
+		for (int k = 0; k < BENCH_FIGURES; k++) {
+			double before = figure(*was, k);
+			double after = figure(now, k);
+			// Nothing to compare against: not drawn, or allocations not counted
+			if (before < 0 || after < 0 || (before == 0 && k != BENCH_FIGURES - 1))
+				continue;
+			bool regressed;
+			double change = 0;
+			if (k == BENCH_FIGURES - 1) {
+				// Allocations are counted, not timed, any more than before is worse
+				regressed = after > before;
+			}
+			else {
+				change = (after - before) / before * 100.0;
+				if (k == 0)
+					change = -change;
+				regressed = change > threshold;
+			}
+			if (!regressed)
+				continue;
+			bool counts = k == 1 || k == 4 || k == BENCH_FIGURES - 1;
+			std::cout << now.replay << " (" << now.mode << "): " << (counts ? "REGRESSION " : "") << figureNames[k] << " " << before
+				<< " -> " << after << (k == BENCH_FIGURES - 1 ? "" : " (" + std::to_string((long long)(change + 0.5)) + "% worse)") << std::endl;
+			if (counts)
+				regressions++;
+		}
+	}
+	std::cout << regressions << " regressions past " << threshold << "% against " << baseline.size() << " baseline results" << std::endl;
+	return regressions;
+}
+
+bool reportBench(const std::vector<ReplayBenchResult>& results, const std::string& jsonPath, const std::string& baselinePath, double threshold) {
+	bool ok = jsonPath.empty() || writeBenchJson(jsonPath, results);
+	if (!baselinePath.empty()) {
+		std::vector<ReplayBenchResult> baseline;
+		ok = readBenchJson(baselinePath, baseline) && compareBench(baseline, results, threshold) == 0 && ok;
+	}
+	return ok;
+}
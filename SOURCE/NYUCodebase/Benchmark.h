@@ -0,0 +1,56 @@
+#ifndef Benchmark_h
+#define Benchmark_h
+
+#include <string>
+#include <vector>
+
+// Results of running recorded matches as benchmarks, NYUServer --bench-replay headless
+// and NYUCodebase --bench-replay drawn offscreen. Written as JSON so runs can be kept
+// and compared:
+//   { "version": 3, "results": [ { "replay": ..., "mode": ..., "ticks_per_second": ... }, ... ] }
+// Times are in microseconds. A result is matched to its baseline by replay and mode.
+// "allocations" is left out by builds that do not count them.
+// A Match::step is far too short to time on its own, so tick times are whole runs over
+// their ticks, "tick_run_p50_us" being the median run and p99 and max the slow ones.
+// Frames end in glFinish and are long enough to time one by one, so frame times are
+// per frame percentiles.
+#define BENCH_JSON_VERSION 3
+#define BENCH_DEFAULT_THRESHOLD 10.0	//percent a figure may get worse before it is a regression
+
+struct TimeSpread {
+	double p50;		//seconds
+	double p99;
+	double max;
+};
+
+struct ReplayBenchResult {
+	std::string replay;		//file name without its folder
+	std::string stage;
+	std::string mode;		//"headless" or "render"
+	unsigned int ticks;		//a run
+	unsigned int runs;
+	bool matched;			//every tick hashed as recorded, on every run
+	double ticksPerSecond;
+	TimeSpread tick;		//Match::step alone, per tick of whole runs
+	TimeSpread frame;		//step and draw until the GPU is done, per frame, render mode only
+	long allocations;		//during the runs, -1 when not counted (builds without TRACK_ALLOCATIONS)
+};
+
+// Sorts samples and reads the spread off them, all 0 if there are none
+TimeSpread spreadOf(std::vector<double>& samples);
+// The spread of runs that each took runTimes seconds for ticks ticks, per tick
+TimeSpread spreadOfRuns(std::vector<double>& runTimes, unsigned int ticks);
+
+void printBench(const ReplayBenchResult& result);
+bool writeBenchJson(const std::string& path, const std::vector<ReplayBenchResult>& results);
+bool readBenchJson(const std::string& path, std::vector<ReplayBenchResult>& results);
+// Prints every figure more than threshold percent worse than its baseline, and any
+// replay that no longer matches. Only medians and allocations count: p99 and max are
+// the runs and frames the OS got in the way of, and ticks/s is the median run again,
+// so those are shown but never count. Returns how many regressions there were.
+int compareBench(const std::vector<ReplayBenchResult>& baseline, const std::vector<ReplayBenchResult>& current, double threshold);
+// Writes results to jsonPath and compares them with baselinePath, each if not empty.
+// False if either fails or anything regressed.
+bool reportBench(const std::vector<ReplayBenchResult>& results, const std::string& jsonPath, const std::string& baselinePath, double threshold);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef Characters_h
+#define Characters_h
+
+// Every fighter in the game and everything that makes one differ from another. The
+// match, the game and the server all look characters up here, so adding a fighter is
+// adding an id and a definition (and its .anim, which holds the frame tables).
+enum CharacterId { CHARACTER_CHUK, CHARACTER_IVEN, CHARACTER_COUNT };
+
+struct AttackDefinition {
+	float reachX;	//hit point relative to the attacker, x is flipped with facing
+	float reachY;
+	float range;
+	int damage;
+	float stun;		//cooldown put on the fighter that was hit
+};
+
+struct CharacterDefinition {
+	const char* name;		//as shown on screen
+	const char* animation;	//clips and sprites, see AnimationSet
+	const char* hitSound;
+	float spriteSize;		//Entity size the sprite is drawn at
+	float spriteOffset;		//how far down the sprite sits from the box, in texture v
+	float halfSize;
+	float runSpeed;
+	float cooldown;			//after attacking
+	AttackDefinition ground;
+	AttackDefinition air;
+};
+
+// Plain constant data, so with the character known at compile time (see Match.cpp)
+// every field folds into the code that uses it
+static const CharacterDefinition characterDefinitions[CHARACTER_COUNT] = {
+	{ "CHUK", "Chuk.anim", "ChukHitsound.wav", 7.0f, -0.15f, 0.7f, 4.5f, 0.7f, { 0.5f, 0.0f, 0.7f, 10, 0.4f }, { 0.0f, -1.0f, 0.7f, 15, 0.5f } },
+	{ "IVEN", "Iven.anim", "IvenHitsound.wav", 5.0f, -0.05f, 0.5f, 3.0f, 1.0f, { 0.5f, 0.0f, 0.5f, 20, 0.5f }, { 0.7f, -0.7f, 0.7f, 25, 0.6f } },
+};
+
+#endif
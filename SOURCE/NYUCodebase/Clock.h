@@ -0,0 +1,43 @@
+#ifndef Clock_h
+#define Clock_h
+
+#ifdef _WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN	//keeps winsock.h out so Net.h can use winsock2.h
+#endif
+#include <windows.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+// High resolution wall clock in seconds. VS2013's std::chrono clocks only tick
+// every millisecond, so Windows goes straight to the performance counter.
+inline double clockSeconds() {
+#ifdef _WINDOWS
+	static LARGE_INTEGER frequency = { 0 };
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart / (double)frequency.QuadPart;
+#else
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Sleeps for about this long, at the OS scheduler's granularity
+inline void sleepSeconds(double seconds) {
+	if (seconds <= 0)
+		return;
+#ifdef _WINDOWS
+	Sleep((DWORD)(seconds * 1000.0));
+#else
+	std::this_thread::sleep_for(std::chrono::microseconds((long long)(seconds * 1000000.0)));
+#endif
+}
+
+#endif
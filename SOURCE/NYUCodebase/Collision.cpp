@@ -0,0 +1,109 @@
+#include "Collision.h"
+
+#include <cmath>
+
+float sweepBox(const float position[2], const float halfSize[2], const float delta[2], const StageRect& rect, int& hitAxis) {
+	// Slab test of the box center against rect grown by the box's half size
+	float entry = -1e30f;
+	float exit = 2.0f;
+	hitAxis = -1;
+	for (int axis = 0; axis < 2; axis++) {
+		float low = rect.position[axis] - rect.halfSize[axis] - halfSize[axis];
+		float high = rect.position[axis] + rect.halfSize[axis] + halfSize[axis];
+		if (delta[axis] == 0) {
+			if (position[axis] <= low || position[axis] >= high)
+				return 1.0f;
+			continue;
+		}
+		float enter = ((delta[axis] > 0 ? low : high) - position[axis]) / delta[axis];
+		float leave = ((delta[axis] > 0 ? high : low) - position[axis]) / delta[axis];
+		if (enter > entry) {
+			entry = enter;
+			hitAxis = axis;
+		}
+		if (leave < exit)
+			exit = leave;
+	}
+	if (hitAxis < 0 || entry < 0 || entry >= 1.0f || entry >= exit)
+		return 1.0f;
+	return entry;
+}
+
+// Box covering the whole move, top, bottom, left, right
+static void sweptBounds(const float position[2], const float halfSize[2], const float delta[2], float swept[4]) {
+	swept[0] = position[1] + halfSize[1] + (delta[1] > 0 ? delta[1] : 0);
+	swept[1] = position[1] - halfSize[1] + (delta[1] < 0 ? delta[1] : 0);
+	swept[2] = position[0] - halfSize[0] + (delta[0] < 0 ? delta[0] : 0);
+	swept[3] = position[0] + halfSize[0] + (delta[0] > 0 ? delta[0] : 0);
+}
+
+// Lowers first to the earliest hit against the rects in the stage cells under swept
+static void firstHit(const Stage& stage, const float position[2], const float halfSize[2], const float delta[2], const float swept[4], float& first, int& hit, int& hitAxis) {
+	int firstColumn, lastColumn, firstRow, lastRow;
+	if (!stage.cellRange(swept, firstColumn, lastColumn, firstRow, lastRow))
+		return;
+	for (int row = firstRow; row <= lastRow; row++) {
+		for (int column = firstColumn; column <= lastColumn; column++) {
+			const StageCell& cell = stage.cells[row * stage.header->columns + column];
+			for (unsigned int i = 0; i < cell.rectCount; i++) {
+				unsigned int index = stage.rectIndex[cell.firstRect + i];
+				int axis;
+				float time = sweepBox(position, halfSize, delta, stage.rects[index], axis);
+				if (time < first) {
+					first = time;
+					hit = (int)index;
+					hitAxis = axis;
+				}
+			}
+		}
+	}
+}
+
+static void finishMove(float position[2], const float delta[2], float first, int hit, int hitAxis) {
+	position[0] += delta[0] * first;
+	position[1] += delta[1] * first;
+	if (hit >= 0) {
+		// Back off along the hit axis, never past where the move started
+		float skin = fabs(delta[hitAxis] * first) < COLLISION_SKIN ? fabs(delta[hitAxis] * first) : COLLISION_SKIN;
+		position[hitAxis] -= delta[hitAxis] > 0 ? skin : -skin;
+	}
+}
+
+int sweepStage(const Stage& stage, float position[2], const float halfSize[2], const float delta[2], int& hitAxis) {
+	hitAxis = -1;
+	if (!stage.header || (delta[0] == 0 && delta[1] == 0))
+		return -1;
+
+	// Broadphase: every grid cell touched by the swept box
+	float swept[4];
+	sweptBounds(position, halfSize, delta, swept);
+	float first = 1.0f;
+	int hit = -1;
+	firstHit(stage, position, halfSize, delta, swept, first, hit, hitAxis);
+	finishMove(position, delta, first, hit, hitAxis);
+	return hit;
+}
+
+int sweepStream(const StageStream& stream, float position[2], const float halfSize[2], const float delta[2], int& hitAxis) {
+	hitAxis = -1;
+	if (delta[0] == 0 && delta[1] == 0)
+		return -1;
+
+	// Every resident chunk touched by the swept box, then its cells
+	float swept[4];
+	sweptBounds(position, halfSize, delta, swept);
+	float first = 1.0f;
+	int hit = -1;
+	int firstColumn, lastColumn, firstRow, lastRow;
+	if (stream.chunkRange(swept, firstColumn, lastColumn, firstRow, lastRow)) {
+		for (int row = firstRow; row <= lastRow; row++) {
+			for (int column = firstColumn; column <= lastColumn; column++) {
+				const Stage* chunk = stream.chunk(column, row);
+				if (chunk)
+					firstHit(*chunk, position, halfSize, delta, swept, first, hit, hitAxis);
+			}
+		}
+	}
+	finishMove(position, delta, first, hit, hitAxis);
+	return hit;
+}
@@ -0,0 +1,23 @@
+#ifndef Collision_h
+#define Collision_h
+
+#include "Stage.h"
+#include "StageStream.h"
+
+// Gap left between a swept box and whatever it stopped against, so the next
+// overlap test against the same rect is not touching
+#define COLLISION_SKIN 0.0001f
+
+// Time of impact in [0, 1) of a box (center, half size) moving by delta into rect,
+// or 1 if it does not hit during the move. Boxes that already overlap rect do not
+// count as hitting it. hitAxis is the axis of the face that was hit.
+float sweepBox(const float position[2], const float halfSize[2], const float delta[2], const StageRect& rect, int& hitAxis);
+
+// Moves the box by delta through the stage, stopping just short of the first rect in
+// the way. Returns the index of the rect hit, or -1 if the full move was made.
+int sweepStage(const Stage& stage, float position[2], const float halfSize[2], const float delta[2], int& hitAxis);
+// The same through the resident chunks of a streamed stage. The index is of the rect
+// within whichever chunk it is in.
+int sweepStream(const StageStream& stream, float position[2], const float halfSize[2], const float delta[2], int& hitAxis);
+
+#endif
@@ -0,0 +1,117 @@
+#include "Compression.h"
+
+#include <cstring>
+
+static unsigned int hash4(const unsigned char* p) {
+	unsigned int value = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+	return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes the part of a length that did not fit in its nibble
+static bool writeLength(unsigned char*& out, const unsigned char* end, int length) {
+	for (length -= 15; length >= 255; length -= 255) {
+		if (out >= end)
+			return false;
+		*out++ = 255;
+	}
+	if (out >= end)
+		return false;
+	*out++ = (unsigned char)length;
+	return true;
+}
+
+static bool readLength(const unsigned char*& in, const unsigned char* end, int& length) {
+	unsigned char byte;
+	do {
+		if (in >= end)
+			return false;
+		byte = *in++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+static bool writeSequence(unsigned char*& out, const unsigned char* end, const unsigned char* literals, int literalCount, int offset, int matchLength) {
+	if (out >= end)
+		return false;
+	unsigned char* token = out++;
+	*token = (unsigned char)((literalCount < 15 ? literalCount : 15) << 4);
+	if (literalCount >= 15 && !writeLength(out, end, literalCount))
+		return false;
+	if (end - out < literalCount)
+		return false;
+	memcpy(out, literals, literalCount);
+	out += literalCount;
+	if (matchLength == 0)
+		return true;
+
+	if (end - out < 2)
+		return false;
+	*out++ = (unsigned char)(offset & 0xff);
+	*out++ = (unsigned char)(offset >> 8);
+	int code = matchLength - LZ_MIN_MATCH;
+	*token |= (unsigned char)(code < 15 ? code : 15);
+	return code < 15 || writeLength(out, end, code);
+}
+
+int lzCompress(const unsigned char* in, int size, unsigned char* out, int capacity) {
+	int table[1 << LZ_HASH_BITS];
+	for (int i = 0; i < (1 << LZ_HASH_BITS); i++)
+		table[i] = -1;
+
+	unsigned char* write = out;
+	const unsigned char* end = out + capacity;
+	int anchor = 0;	//first byte not yet written
+	int position = 0;
+	while (position + LZ_MIN_MATCH <= size) {
+		unsigned int slot = hash4(in + position);
+		int candidate = table[slot];
+		table[slot] = position;
+		if (candidate < 0 || position - candidate > LZ_MAX_OFFSET || memcmp(in + candidate, in + position, LZ_MIN_MATCH) != 0) {
+			position++;
+			continue;
+		}
+		int length = LZ_MIN_MATCH;
+		while (position + length < size && in[candidate + length] == in[position + length])
+			length++;
+		if (!writeSequence(write, end, in + anchor, position - anchor, position - candidate, length))
+			return 0;
+		position += length;
+		anchor = position;
+	}
+	if (!writeSequence(write, end, in + anchor, size - anchor, 0, 0))
+		return 0;
+	return (int)(write - out);
+}
+
+bool lzDecompress(const unsigned char* in, int inSize, unsigned char* out, int size) {
+	const unsigned char* end = in + inSize;
+	int written = 0;
+	while (in < end) {
+		unsigned char token = *in++;
+		int literalCount = token >> 4;
+		if (literalCount == 15 && !readLength(in, end, literalCount))
+			return false;
+		if (end - in < literalCount || size - written < literalCount)
+			return false;
+		memcpy(out + written, in, literalCount);
+		in += literalCount;
+		written += literalCount;
+		if (in == end)
+			break;
+
+		if (end - in < 2)
+			return false;
+		int offset = in[0] | (in[1] << 8);
+		in += 2;
+		int length = (token & 15) + LZ_MIN_MATCH;
+		if ((token & 15) == 15 && !readLength(in, end, length))
+			return false;
+		if (offset == 0 || offset > written || size - written < length)
+			return false;
+		// Byte by byte, a match may overlap what it is copying
+		for (int i = 0; i < length; i++, written++)
+			out[written] = out[written - offset];
+	}
+	return written == size;
+}
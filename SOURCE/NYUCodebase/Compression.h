@@ -0,0 +1,22 @@
+#ifndef Compression_h
+#define Compression_h
+
+// Small LZ77 block coder for save states and other short blobs. A block is a run of
+// sequences, each:
+//   u8 token       literal count in the high 4 bits, match length - LZ_MIN_MATCH in the low 4
+//   [255 ... n]    when a count nibble is 15, the rest of it in bytes of 255 until a smaller one
+//   literals
+//   u16 offset     how far back the match starts, little-endian
+//   [255 ... n]    rest of the match length
+// The last sequence stops after its literals. Nothing is allocated, the hash table lives
+// on the stack.
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+#define LZ_MAX_OFFSET 0xffff
+
+// Returns the compressed size, or 0 when it does not fit in capacity
+int lzCompress(const unsigned char* in, int size, unsigned char* out, int capacity);
+// False unless the block decodes to exactly size bytes
+bool lzDecompress(const unsigned char* in, int inSize, unsigned char* out, int size);
+
+#endif
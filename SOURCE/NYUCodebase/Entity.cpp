@@ -1,4 +1,8 @@
 #include "Entity.h"
+#include "RenderState.h"
+#include "FrameArena.h"
+
+#include <cstring>
 
 Entity::Entity() {}
 
@@ -9,8 +13,6 @@ Entity::Entity(float x, float y, float spriteU, float spriteV, float spriteWidth
 	speed[1] = dy;
 	acceleration[0] = 0;
 	acceleration[1] = 0;
-	entityMatrix.identity();
-	entityMatrix.Translate(x, y, 0);
 	size[0] = 1.0f;
 	size[1] = 1.0f;
 	boundaries[0] = y + 0.05f * size[1] * 2;
@@ -33,8 +35,6 @@ Entity::Entity(float x, float y, float spriteU, float spriteV, float spriteWidth
 	speed[1] = dy;
 	acceleration[0] = 0;
 	acceleration[1] = 0;
-	entityMatrix.identity();
-	entityMatrix.Translate(x, y, 0);
 	size[0] = sizeX;
 	size[1] = sizeY;
 	boundaries[0] = y + 0.05f * size[1] * 2;
@@ -52,45 +52,46 @@ Entity::Entity(float x, float y, float spriteU, float spriteV, float spriteWidth
 }
 
 void Entity::draw(ShaderProgram* program) {
-	entityMatrix.identity();
-	entityMatrix.Translate(position[0], position[1], 0);
-	program->setModelMatrix(entityMatrix);
-
-	std::vector<float> vertexData;
-	std::vector<float> texCoordData;
+	float* vertexData = frameArena.floats(12);
+	float* texCoordData = frameArena.floats(12);
+	if (!vertexData || !texCoordData)
+		return;
 	float texture_x = u;
 	float texture_y = v;
-	vertexData.insert(vertexData.end(), {
-		(-0.1f * size[0]), 0.1f * size[1],
-		(-0.1f * size[0]), -0.1f * size[1],
-		(0.1f * size[0]), 0.1f * size[1],
-		(0.1f * size[0]), -0.1f * size[1],
-		(0.1f * size[0]), 0.1f * size[1],
-		(-0.1f * size[0]), -0.1f * size[1],
-	});
-	texCoordData.insert(texCoordData.end(), {
+	float left = position[0] - 0.1f * size[0];
+	float right = position[0] + 0.1f * size[0];
+	float top = position[1] + 0.1f * size[1];
+	float bottom = position[1] - 0.1f * size[1];
+	float vertices[] = {
+		left, top,
+		left, bottom,
+		right, top,
+		right, bottom,
+		right, top,
+		left, bottom,
+	};
+	float texCoords[] = {
 		texture_x, texture_y,
 		texture_x, texture_y + height,
 		texture_x + width, texture_y,
 		texture_x + width, texture_y + height,
 		texture_x + width, texture_y,
 		texture_x, texture_y + height,
-	});
+	};
+	memcpy(vertexData, vertices, sizeof(vertices));
+	memcpy(texCoordData, texCoords, sizeof(texCoords));
 
-	glUseProgram(program->programID);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	renderState.useProgram(program->programID);
+	renderState.setBlend(true);
+	renderState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	glVertexAttribPointer(program->positionAttribute, 2, GL_FLOAT, false, 0, vertexData.data());
-	glEnableVertexAttribArray(program->positionAttribute);
-	glVertexAttribPointer(program->texCoordAttribute, 2, GL_FLOAT, false, 0, texCoordData.data());
-	glEnableVertexAttribArray(program->texCoordAttribute);
+	glVertexAttribPointer(program->positionAttribute, 2, GL_FLOAT, false, 0, vertexData);
+	renderState.enableAttribute(program->positionAttribute);
+	glVertexAttribPointer(program->texCoordAttribute, 2, GL_FLOAT, false, 0, texCoordData);
+	renderState.enableAttribute(program->texCoordAttribute);
 
-	glBindTexture(GL_TEXTURE_2D, texture[currT]);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-
-	glDisableVertexAttribArray(program->positionAttribute);
-	glDisableVertexAttribArray(program->texCoordAttribute);
+	renderState.bindTexture(texture[currT]);
+	renderState.drawArrays(GL_TRIANGLES, 0, 6);
 }
 
 void Entity::update(float elapsed) {
@@ -125,64 +126,3 @@ void Entity::updateY(float elapsed) {
 		boundaries[1] += speed[1] * elapsed;
 	}
 }
-
-void Entity::animate(float elapsed) {
-	counter += elapsed;
-	if (!dead){//Check Hit
-		if (gettingWrecked){//Hit Animation
-			currT = 6;
-			if (cooldown<0.05f){
-				gettingWrecked = false;
-			}
-		}
-		else if (!inAir){//NOT in AIR
-			if (cooldown >= 0.45f || attacking){
-				attacking = true;
-				currT = 7;
-				if (cooldown < 0.5f){
-					currT = 8;
-				}
-				if (cooldown < 0.05f){
-					attacking = false;
-				}
-			}
-			else if (speed[0] == 0){
-				if (fmod(counter, 1) >= 0.5)
-					currT = 0;
-				else
-					currT = 1;
-			}
-			else{
-				if (fmod(counter, 0.9) >= 0.6)
-					currT = 3;
-				else if (fmod(counter, 0.9) >= 0.3)
-					currT = 4;
-				else
-					currT = 5;
-			}
-		}
-		else{//YES in AIR
-			if (cooldown >= 0.45f || attacking){
-				attacking = true;
-				currT = 9;
-				if (cooldown < 0.15f)
-					attacking = false;
-			}
-			else{
-				currT = 2;
-			}
-		}
-	}
-	else{
-		if (counter > 1.5)
-			counter = 0;
-		currT = 10;
-		if (counter > 0.5){
-			currT = 11;
-			counter = 0.6;
-		}
-	}
-	if (currT >= texture.size())
-		currT = 0;
-	
-}
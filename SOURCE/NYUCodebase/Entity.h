@@ -23,7 +23,6 @@
 
 class Entity {
 public:
-	Matrix entityMatrix;
 	float position[2];		//location (center point of entity)
 	float boundaries[4];	//top, bottom, left, right (from position)
 	float size[2];
@@ -41,7 +40,6 @@ public:
 	float height;
 	std::vector<GLuint> texture;
 	int currT;
-	float counter = 0;
 	bool inAir = false;
 	bool attacking = false;
 	bool gettingWrecked = false;
@@ -51,11 +49,11 @@ public:
 	Entity();
 	Entity(float x, float y, float spriteU, float spriteV, float spriteWidth, float spriteHeight, float dx, float dy, std::vector<GLuint> spriteTexture, Type newType);
 	Entity(float x, float y, float spriteU, float spriteV, float spriteWidth, float spriteHeight, float dx, float dy, std::vector<GLuint> spriteTexture, float sizeX, float sizeY, Type newType);
+	// A quad of size * 0.2 around position, built in world space, flipped by a negative width
 	void draw(ShaderProgram* program);
 	void update(float elapsed);
 	void updateX(float elapsed);
 	void updateY(float elapsed);
-	void animate(float elapsed);
 };
 
 
@@ -0,0 +1,33 @@
+#include "FrameArena.h"
+#include "Profiler.h"
+
+#include <iostream>
+
+static double storage[FRAME_ARENA_SIZE / sizeof(double)];
+
+FrameArena frameArena;
+
+FrameArena::FrameArena() : used(0), peak(0), overflows(0) {}
+
+void* FrameArena::allocate(size_t bytes) {
+	size_t aligned = (bytes + sizeof(double) - 1) & ~(sizeof(double) - 1);
+	if (used + aligned > sizeof(storage)) {
+		if (overflows++ == 0)
+			std::cout << "Frame arena out of space, raise FRAME_ARENA_SIZE" << std::endl;
+		return nullptr;
+	}
+	void* block = (char*)storage + used;
+	used += aligned;
+	return block;
+}
+
+float* FrameArena::floats(size_t count) {
+	return (float*)allocate(count * sizeof(float));
+}
+
+void FrameArena::reset() {
+	if (used > peak)
+		peak = used;
+	profiler.gauge("frame arena bytes", (double)used);
+	used = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef FrameArena_h
+#define FrameArena_h
+
+#include <cstddef>
+
+#define FRAME_ARENA_SIZE (1 << 20)
+
+// Linear allocator for data that only lives until the end of the frame, like the
+// vertex arrays handed to glVertexAttribPointer. reset() at the start of every frame
+// frees everything at once. Backed by static storage, so it never touches the heap.
+class FrameArena {
+public:
+	FrameArena();
+
+	void* allocate(size_t bytes);
+	float* floats(size_t count);
+	void reset();
+
+	size_t used;
+	size_t peak;
+	unsigned int overflows;
+};
+
+extern FrameArena frameArena;
+
+#endif
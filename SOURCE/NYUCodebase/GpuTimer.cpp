@@ -0,0 +1,112 @@
+#include "GpuTimer.h"
+
+#include <SDL.h>
+#include <iostream>
+
+GpuTimer gpuTimer;
+
+static const char* cpuNames[PASS_COUNT] = { "background", "players", "stage", "projectiles", "text", "menu", "upscale" };
+static const char* gpuNames[PASS_COUNT] = { "gpu background", "gpu players", "gpu stage", "gpu projectiles", "gpu text", "gpu menu", "gpu upscale" };
+
+GpuTimer::GpuTimer() : enabled(true), available(false), frameSeconds(0), dropped(0), frame(0), open(false) {
+	for (int i = 0; i < GPU_TIMER_FRAMES; i++)
+		counts[i] = 0;
+}
+
+bool GpuTimer::init() {
+	available = false;
+	if (!enabled)
+		return false;
+	if (!SDL_GL_ExtensionSupported("GL_ARB_timer_query")) {
+		std::cout << "No GPU timer queries, the profiler only has CPU times" << std::endl;
+		return false;
+	}
+	// Allowed by the extension, and some drivers do it
+	GLint bits = 0;
+	glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+	if (bits == 0) {
+		std::cout << "The GPU timestamp counter has no bits, the profiler only has CPU times" << std::endl;
+		return false;
+	}
+	glGenQueries(GPU_TIMER_FRAMES * GPU_TIMER_PASSES * 2, &queries[0][0]);
+	for (int i = 0; i < GPU_TIMER_FRAMES; i++)
+		counts[i] = 0;
+	frame = 0;
+	open = false;
+	available = true;
+	return true;
+}
+
+void GpuTimer::shutdown() {
+	if (available)
+		glDeleteQueries(GPU_TIMER_FRAMES * GPU_TIMER_PASSES * 2, &queries[0][0]);
+	available = false;
+}
+
+void GpuTimer::beginFrame() {
+	if (!available)
+		return;
+	frame = (frame + 1) % GPU_TIMER_FRAMES;
+	// The oldest frame in the ring, GPU_TIMER_FRAMES - 1 frames ago
+	collect(frame);
+	counts[frame] = 0;
+	open = false;
+}
+
+void GpuTimer::endFrame() {
+	end();
+}
+
+void GpuTimer::begin(RenderPass pass) {
+	if (!available)
+		return;
+	end();
+	int count = counts[frame];
+	if (count == GPU_TIMER_PASSES)
+		return;
+	glQueryCounter(queries[frame][count * 2], GL_TIMESTAMP);
+	passes[frame][count] = (unsigned char)pass;
+	open = true;
+}
+
+void GpuTimer::end() {
+	if (!available || !open)
+		return;
+	glQueryCounter(queries[frame][counts[frame] * 2 + 1], GL_TIMESTAMP);
+	counts[frame]++;
+	open = false;
+}
+
+void GpuTimer::collect(int slot) {
+	int count = counts[slot];
+	if (count == 0)
+		return;
+	// Queries finish in order, so the last one being in means they all are
+	GLuint ready = 0;
+	glGetQueryObjectuiv(queries[slot][count * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &ready);
+	if (!ready) {
+		dropped++;
+		profiler.count("gpu frames dropped", 1);
+		return;
+	}
+	GLuint64 first = 0, last = 0;
+	for (int i = 0; i < count; i++) {
+		GLuint64 start, stop;
+		glGetQueryObjectui64v(queries[slot][i * 2], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(queries[slot][i * 2 + 1], GL_QUERY_RESULT, &stop);
+		profiler.time(gpuNames[passes[slot][i]], (stop - start) / 1e9);
+		if (i == 0)
+			first = start;
+		last = stop;
+	}
+	frameSeconds = (last - first) / 1e9;
+	profiler.time("gpu frame", frameSeconds);
+}
+
+PassScope::PassScope(RenderPass pass) : cpu(cpuNames[pass]) {
+	gpuTimer.begin(pass);
+}
+
+PassScope::~PassScope() {
+	gpuTimer.end();
+}
@@ -0,0 +1,62 @@
+#ifndef GpuTimer_h
+#define GpuTimer_h
+
+#ifdef _WINDOWS
+#include <GL/glew.h>
+#endif
+#include <SDL_opengl.h>
+
+#include "Profiler.h"
+
+#define GPU_TIMER_FRAMES 4	//frames a result is given to arrive before it is read, so reading never waits
+#define GPU_TIMER_PASSES 16	//timed passes in one frame
+
+// What is drawn in a frame, in the order it usually goes
+enum RenderPass { PASS_BACKGROUND, PASS_PLAYERS, PASS_STAGE, PASS_PROJECTILES, PASS_TEXT, PASS_MENU, PASS_UPSCALE, PASS_COUNT };
+
+// How long the GPU spent on each RenderPass, from a GL_TIMESTAMP query at either end.
+// Queries go into a ring of GPU_TIMER_FRAMES frames and a frame's results are only read
+// when its slot comes round again; if they are still not in then, that frame is dropped
+// rather than waited for. Times go to the profiler as "gpu <pass>" next to the CPU's.
+// Without ARB_timer_query (or with a counter of 0 bits) it does nothing.
+class GpuTimer {
+public:
+	GpuTimer();
+
+	bool enabled;		//set false before init() to never use queries
+	bool available;		//init() found timer queries
+	double frameSeconds;	//first begin to last end of the newest frame read, 0 until one is
+	unsigned int dropped;	//frames whose results were not in by the time the slot was needed
+
+	bool init();
+	void shutdown();
+
+	// Around everything drawn in a frame
+	void beginFrame();
+	void endFrame();
+	// Passes may not nest, begin() ends whatever pass is still open
+	void begin(RenderPass pass);
+	void end();
+
+private:
+	GLuint queries[GPU_TIMER_FRAMES][GPU_TIMER_PASSES * 2];
+	unsigned char passes[GPU_TIMER_FRAMES][GPU_TIMER_PASSES];
+	int counts[GPU_TIMER_FRAMES];
+	int frame;
+	bool open;
+
+	void collect(int slot);
+};
+
+extern GpuTimer gpuTimer;
+
+// Times the enclosing block as pass, on the CPU as "<pass>" and on the GPU
+class PassScope {
+public:
+	PassScope(RenderPass pass);
+	~PassScope();
+private:
+	ProfileScope cpu;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef Hash_h
+#define Hash_h
+
+#include <cstring>
+
+// The bits of a float as stored, so 0 and -0 hash differently
+inline unsigned int floatBits(float value) {
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+// One word into a running hash, the MurmurHash3 block step
+inline unsigned int hashWord(unsigned int hash, unsigned int word) {
+	word *= 0xcc9e2d51;
+	word = (word << 15) | (word >> 17);
+	word *= 0x1b873593;
+	hash ^= word;
+	hash = (hash << 13) | (hash >> 19);
+	return hash * 5 + 0xe6546b64;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include "JobSystem.h"
+
+#include <chrono>
+
+JobQueue::JobQueue() : top(0), bottom(0) {}
+
+bool JobQueue::push(const Job& job) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (bottom - top == JOB_QUEUE_SIZE)
+		return false;
+	jobs[bottom++ % JOB_QUEUE_SIZE] = job;
+	return true;
+}
+
+bool JobQueue::pop(Job& job) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (bottom == top)
+		return false;
+	job = jobs[--bottom % JOB_QUEUE_SIZE];
+	if (bottom == top)
+		top = bottom = 0;
+	return true;
+}
+
+bool JobQueue::steal(Job& job) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (bottom == top)
+		return false;
+	job = jobs[top++ % JOB_QUEUE_SIZE];
+	if (bottom == top)
+		top = bottom = 0;
+	return true;
+}
+
+JobSystem::JobSystem() : steals(0), threads(1), running(false), loops(0), stolen(0) {}
+
+JobSystem::~JobSystem() {
+	stop();
+}
+
+void JobSystem::start(int newThreads) {
+	stop();
+	threads = newThreads < 1 ? 1 : newThreads > JOB_MAX_THREADS ? JOB_MAX_THREADS : newThreads;
+	running = true;
+	stolen = 0;
+	steals = 0;
+	for (int i = 1; i < threads; i++)
+		workers.push_back(std::thread(&JobSystem::work, this, i));
+}
+
+void JobSystem::stop() {
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		running = false;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+	threads = 1;
+}
+
+int JobSystem::threadCount() const {
+	return threads;
+}
+
+void JobSystem::parallelFor(int count, int grain, JobFunction function, void* data) {
+	if (count <= 0)
+		return;
+	if (grain < 1)
+		grain = 1;
+	if (threads == 1 || count <= grain) {
+		function(data, 0, count);
+		return;
+	}
+
+	std::atomic<int> remaining(count);
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		loops++;
+	}
+	wake.notify_all();
+
+	Job job;
+	job.function = function;
+	job.data = data;
+	job.begin = 0;
+	job.end = count;
+	job.grain = grain;
+	job.remaining = &remaining;
+	execute(job, 0);
+	// Help with whatever is left rather than wait for it
+	while (remaining > 0) {
+		if (!runOne(0))
+			std::this_thread::yield();
+	}
+	loops--;
+	steals = stolen;
+}
+
+void JobSystem::work(int self) {
+	int idle = 0;
+	while (running) {
+		if (runOne(self)) {
+			idle = 0;
+			continue;
+		}
+		if (++idle < JOB_IDLE_SPINS) {
+			std::this_thread::yield();
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(sleepLock);
+		wake.wait_for(guard, std::chrono::milliseconds(1), [this] { return !running || loops > 0; });
+		if (loops == 0)
+			continue;
+		idle = 0;
+	}
+}
+
+// Own queue first, then the others starting from the next thread along
+bool JobSystem::runOne(int self) {
+	Job job;
+	if (queues[self].pop(job)) {
+		execute(job, self);
+		return true;
+	}
+	for (int i = 1; i < threads; i++) {
+		if (queues[(self + i) % threads].steal(job)) {
+			stolen++;
+			execute(job, self);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Splits off the upper half for others to take until the range is down to grain
+void JobSystem::execute(Job job, int self) {
+	while (job.end - job.begin > job.grain) {
+		Job upper = job;
+		upper.begin = job.begin + (job.end - job.begin) / 2;
+		if (!queues[self].push(upper))
+			break;
+		job.end = upper.begin;
+	}
+	job.function(job.data, job.begin, job.end);
+	*job.remaining -= job.end - job.begin;
+}
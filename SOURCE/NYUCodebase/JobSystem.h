@@ -0,0 +1,90 @@
+#ifndef JobSystem_h
+#define JobSystem_h
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define JOB_MAX_THREADS 64
+#define JOB_QUEUE_SIZE 256	//jobs one thread can have waiting, a parallelFor only needs log2(count / grain)
+#define JOB_IDLE_SPINS 64	//yields a worker does looking for work before it sleeps
+
+typedef void (*JobFunction)(void* data, int begin, int end);
+
+struct Job {
+	JobFunction function;
+	void* data;
+	int begin;
+	int end;
+	int grain;
+	std::atomic<int>* remaining;	//items of the parallelFor not yet done
+};
+
+// One thread's jobs. The owner pushes and pops at the bottom, so it works on what it
+// split off last; thieves take from the top, which holds the biggest ranges.
+class JobQueue {
+public:
+	JobQueue();
+
+	bool push(const Job& job);
+	bool pop(Job& job);
+	bool steal(Job& job);
+
+private:
+	std::mutex lock;
+	Job jobs[JOB_QUEUE_SIZE];
+	int top;
+	int bottom;
+};
+
+// Small work-stealing pool for data parallel loops. parallelFor() hands out [0, count)
+// by splitting it in halves down to grain items; idle threads steal the halves. The
+// calling thread works too and the call returns once every item is done, so one
+// parallelFor after another is a phase barrier. Each index should only write its own
+// results, then the order work ran in never shows. Only the thread that called start()
+// may call parallelFor, and not from inside one.
+class JobSystem {
+public:
+	JobSystem();
+	~JobSystem();
+
+	// threads counts the caller, so start(1) runs everything inline
+	void start(int threads);
+	void stop();
+	int threadCount() const;
+
+	void parallelFor(int count, int grain, JobFunction function, void* data);
+	// body(begin, end) for each range
+	template <typename Body>
+	void parallelFor(int count, int grain, Body& body) {
+		parallelFor(count, grain, &callBody<Body>, &body);
+	}
+
+	unsigned int steals;	//ranges run by a thread other than the one that split them, since start()
+
+private:
+	JobQueue queues[JOB_MAX_THREADS];
+	std::vector<std::thread> workers;
+	int threads;
+	std::atomic<bool> running;
+	std::atomic<int> loops;	//parallelFor calls in flight, workers only spin while there are some
+	std::atomic<unsigned int> stolen;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+
+	void work(int self);
+	bool runOne(int self);
+	void execute(Job job, int self);
+
+	template <typename Body>
+	static void callBody(void* data, int begin, int end) {
+		(*(Body*)data)(begin, end);
+	}
+
+	JobSystem(const JobSystem&);
+	JobSystem& operator=(const JobSystem&);
+};
+
+#endif
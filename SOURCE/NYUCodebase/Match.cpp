@@ -0,0 +1,337 @@
+#include "Match.h"
+#include "Collision.h"
+#include "Hash.h"
+
+#include <cmath>
+#include <cstring>
+
+#define MATCH_GRAVITY -9.8f
+#define MATCH_JUMP_SPEED 6.6f
+#define MATCH_DOUBLE_JUMP_DELAY 0.4f
+#define MATCH_KNOCKBACK 2.0f
+#define MATCH_PUSH_OUT 0.0001f	//extra distance when pushing a fighter out of a tile
+
+// Moves along one axis, stopping at the first tile in the way instead of tunnelling through it
+static void sweep(Fighter& fighter, int axis, const Match& match) {
+	if (axis == 1)
+		fighter.speed[1] += MATCH_GRAVITY * MATCH_TICK;
+	float delta[2] = { 0.0f, 0.0f };
+	delta[axis] = fighter.speed[axis] * MATCH_TICK;
+
+	int hitAxis;
+	int hit = match.streamed ? sweepStream(*match.streamed, fighter.position, fighter.halfSize, delta, hitAxis) : sweepStage(*match.stage, fighter.position, fighter.halfSize, delta, hitAxis);
+	if (hit >= 0) {
+		if (axis == 1) {
+			if (delta[1] < 0) {
+				fighter.collided[1] = true;
+				fighter.inAir = false;
+			}
+			else {
+				fighter.collided[0] = true;
+			}
+		}
+		else {
+			fighter.collided[delta[0] < 0 ? 3 : 2] = true;
+		}
+		fighter.speed[axis] = 0.0f;
+	}
+}
+
+// The sweep never enters a tile, this only catches fighters that start inside one
+// (spawns, hot reloaded stages)
+static bool pushOut(Fighter& fighter, int axis, const StageRect* rects, unsigned int rectCount) {
+	for (unsigned int i = 0; i < rectCount; i++) {
+		const StageRect& block = rects[i];
+		if (fabs(fighter.position[0] - block.position[0]) >= fighter.halfSize[0] + block.halfSize[0] ||
+			fabs(fighter.position[1] - block.position[1]) >= fighter.halfSize[1] + block.halfSize[1])
+			continue;
+
+		float distance = fabs(fighter.position[axis] - block.position[axis]);
+		float penetration = fabs(distance - fighter.halfSize[axis] - block.halfSize[axis]) + MATCH_PUSH_OUT;
+		bool above = fighter.position[axis] > block.position[axis];
+		fighter.position[axis] += above ? penetration : -penetration;
+		if (axis == 1) {
+			fighter.collided[above ? 1 : 0] = true;
+			if (above)
+				fighter.inAir = false;
+		}
+		else {
+			fighter.collided[above ? 3 : 2] = true;
+		}
+		fighter.speed[axis] = 0.0f;
+		return true;
+	}
+	return false;
+}
+
+static void pushOut(Fighter& fighter, int axis, const Match& match) {
+	if (!match.streamed) {
+		pushOut(fighter, axis, match.stage->rects, match.stage->header->rectCount);
+		return;
+	}
+	// Only the chunks the fighter is in
+	float bounds[4] = { fighter.position[1] + fighter.halfSize[1], fighter.position[1] - fighter.halfSize[1], fighter.position[0] - fighter.halfSize[0], fighter.position[0] + fighter.halfSize[0] };
+	int firstColumn, lastColumn, firstRow, lastRow;
+	if (!match.streamed->chunkRange(bounds, firstColumn, lastColumn, firstRow, lastRow))
+		return;
+	for (int row = firstRow; row <= lastRow; row++) {
+		for (int column = firstColumn; column <= lastColumn; column++) {
+			const Stage* chunk = match.streamed->chunk(column, row);
+			if (chunk && pushOut(fighter, axis, chunk->rects, chunk->header->rectCount))
+				return;
+		}
+	}
+}
+
+// Specialised per character: C is a constant, so each definition's numbers are built
+// into its own copy and nothing checks who is moving
+template <int C>
+static void move(Fighter& fighter, unsigned char input) {
+	const CharacterDefinition& character = characterDefinitions[C];
+	fighter.speed[0] = 0.0f;
+	if (fighter.cooldown != 0 && !fighter.inAir)
+		return;
+	if (input & INPUT_LEFT) {
+		fighter.speed[0] = -character.runSpeed;
+		fighter.facing = -1;
+	}
+	else if (input & INPUT_RIGHT) {
+		fighter.speed[0] = character.runSpeed;
+		fighter.facing = 1;
+	}
+}
+
+template <int C>
+static void attack(Fighter& fighter, Fighter& target, unsigned char input) {
+	const CharacterDefinition& character = characterDefinitions[C];
+	if (!(input & INPUT_ATTACK) || fighter.cooldown != 0)
+		return;
+	fighter.events |= EVENT_ATTACK;
+	fighter.attacking = true;
+	fighter.clip = fighter.inAir ? CLIP_AIR_ATTACK : CLIP_GROUND_ATTACK;
+	fighter.clipTick = 0;
+	fighter.cooldown = character.cooldown;
+
+	const AttackDefinition& hit = fighter.inAir ? character.air : character.ground;
+	float hitX = fighter.position[0] + fighter.facing * hit.reachX;
+	float hitY = fighter.position[1] + hit.reachY;
+	float distance = sqrt(pow(hitX - target.position[0], 2) + pow(hitY - target.position[1], 2));
+	if (distance < hit.range) {
+		target.speed[1] = MATCH_KNOCKBACK;
+		target.health -= hit.damage;
+		target.gettingWrecked = true;
+		target.cooldown = hit.stun;
+		target.events |= EVENT_HIT;
+	}
+}
+
+// Both fighters' character specific part of a tick, one copy per pairing
+template <int P1, int P2>
+static void act(Fighter fighters[2], const unsigned char inputs[2]) {
+	move<P1>(fighters[0], inputs[0]);
+	move<P2>(fighters[1], inputs[1]);
+	// p1 swings first, so a p1 hit lands before p2 gets to act this tick
+	attack<P1>(fighters[0], fighters[1], inputs[0]);
+	attack<P2>(fighters[1], fighters[0], inputs[1]);
+}
+
+typedef void (*ActFunction)(Fighter fighters[2], const unsigned char inputs[2]);
+static ActFunction actions[CHARACTER_COUNT][CHARACTER_COUNT];
+
+// Fills actions with every pairing when the program starts, counting N down
+// through CHARACTER_COUNT squared, so new characters need no entry here
+template <int N>
+struct ActionTable : ActionTable<N - 1> {
+	ActionTable() {
+		actions[(N - 1) / CHARACTER_COUNT][(N - 1) % CHARACTER_COUNT] = act<(N - 1) / CHARACTER_COUNT, (N - 1) % CHARACTER_COUNT>;
+	}
+};
+
+template <>
+struct ActionTable<0> {};
+
+static ActionTable<CHARACTER_COUNT * CHARACTER_COUNT> actionTable;
+
+static void jump(Fighter& fighter, unsigned char input) {
+	if (fighter.collided[1]) {
+		fighter.firstJump = false;
+		fighter.secondJump = false;
+	}
+	if (!(input & INPUT_JUMP) || fighter.cooldown != 0)
+		return;
+	fighter.inAir = true;
+	if (!fighter.firstJump && !fighter.secondJump && !fighter.collided[1]) {
+		// Walked off a ledge, only the air jump is left
+		fighter.secondJump = true;
+		fighter.speed[1] = MATCH_JUMP_SPEED;
+	}
+	else if (!fighter.firstJump && fighter.collided[1]) {
+		fighter.speed[1] = MATCH_JUMP_SPEED;
+		fighter.timeSinceLastJump = 0.0f;
+		fighter.firstJump = true;
+		fighter.secondJump = false;
+	}
+	else if (fighter.firstJump && !fighter.secondJump && fighter.timeSinceLastJump > MATCH_DOUBLE_JUMP_DELAY) {
+		fighter.secondJump = true;
+		fighter.speed[1] = MATCH_JUMP_SPEED;
+	}
+}
+
+static void animate(Fighter& fighter, const AnimationSet* animation) {
+	fighter.clipTick++;
+
+	bool attackClip = fighter.clip == CLIP_GROUND_ATTACK || fighter.clip == CLIP_AIR_ATTACK;
+	if (fighter.attacking && attackClip && (!animation || animation->finished(fighter.clip, fighter.clipTick)))
+		fighter.attacking = false;
+
+	int next;
+	if (fighter.dead) {
+		next = CLIP_DEATH;
+	}
+	else if (fighter.gettingWrecked) {
+		next = CLIP_HIT;
+		fighter.attacking = false;
+		if (fighter.cooldown < 0.05f)
+			fighter.gettingWrecked = false;
+	}
+	else if (fighter.attacking) {
+		next = attackClip ? fighter.clip : (fighter.inAir ? CLIP_AIR_ATTACK : CLIP_GROUND_ATTACK);
+	}
+	else if (fighter.inAir) {
+		next = CLIP_JUMP;
+	}
+	else if (fighter.speed[0] == 0) {
+		next = CLIP_STAND;
+	}
+	else {
+		next = CLIP_RUN;
+	}
+
+	if (next != fighter.clip) {
+		fighter.clip = next;
+		fighter.clipTick = 0;
+	}
+	fighter.frame = animation ? animation->frame(fighter.clip, fighter.clipTick) : 0;
+}
+
+Match::Match() : stage(nullptr), streamed(nullptr) {
+	characters[0] = CHARACTER_CHUK;
+	characters[1] = CHARACTER_IVEN;
+	animations[0] = nullptr;
+	animations[1] = nullptr;
+	memset(static_cast<MatchState*>(this), 0, sizeof(MatchState));
+}
+
+void Match::start(const Stage* newStage, const AnimationSet* p1Animation, const AnimationSet* p2Animation) {
+	stage = newStage;
+	streamed = nullptr;
+	spawn(p1Animation, p2Animation);
+}
+
+void Match::startStreamed(const StageStream* stream, const AnimationSet* p1Animation, const AnimationSet* p2Animation) {
+	stage = nullptr;
+	streamed = stream;
+	spawn(p1Animation, p2Animation);
+}
+
+const StageHeader* Match::layout() const {
+	if (streamed)
+		return &streamed->header;
+	return stage ? stage->header : nullptr;
+}
+
+void Match::spawn(const AnimationSet* p1Animation, const AnimationSet* p2Animation) {
+	animations[0] = p1Animation;
+	animations[1] = p2Animation;
+	tick = 0;
+	dead = false;
+	deathCounter = 0.0f;
+	over = false;
+
+	memset(fighters, 0, sizeof(fighters));
+	for (int k = 0; k < 2; k++) {
+		Fighter& fighter = fighters[k];
+		fighter.position[0] = layout()->spawn[k][0];
+		fighter.position[1] = layout()->spawn[k][1];
+		fighter.halfSize[0] = characterDefinitions[characters[k]].halfSize;
+		fighter.halfSize[1] = characterDefinitions[characters[k]].halfSize;
+		fighter.facing = k == 0 ? -1.0f : 1.0f;
+		fighter.health = MATCH_START_HEALTH;
+		fighter.clip = CLIP_STAND;
+		fighter.frame = animations[k] ? animations[k]->frame(CLIP_STAND, 0) : 0;
+	}
+	hash = foldTickHash(0, *this);
+}
+
+void Match::step(const unsigned char inputs[2]) {
+	if (over || !layout())
+		return;
+
+	for (int k = 0; k < 2; k++) {
+		fighters[k].events = 0;
+		for (int i = 0; i < 4; i++)
+			fighters[k].collided[i] = false;
+	}
+
+	// All Y's first, then all X's
+	for (int axis = 1; axis >= 0; axis--) {
+		for (int k = 0; k < 2; k++) {
+			sweep(fighters[k], axis, *this);
+			pushOut(fighters[k], axis, *this);
+		}
+	}
+
+	actions[characters[0]][characters[1]](fighters, inputs);
+	for (int k = 0; k < 2; k++)
+		jump(fighters[k], inputs[k]);
+	for (int k = 0; k < 2; k++)
+		animate(fighters[k], animations[k]);
+
+	if (knockedOut(0) || knockedOut(1)) {
+		for (int k = 0; k < 2; k++) {
+			if (fighters[k].health <= 0)
+				fighters[k].dead = true;
+		}
+		dead = true;
+	}
+
+	for (int k = 0; k < 2; k++) {
+		fighters[k].timeSinceLastJump += MATCH_TICK;
+		fighters[k].cooldown -= MATCH_TICK;
+		if (fighters[k].cooldown <= 0)
+			fighters[k].cooldown = 0;
+	}
+	if (dead)
+		deathCounter += MATCH_TICK;
+	if (deathCounter >= MATCH_END_DELAY)
+		over = true;
+	tick++;
+	hash = foldTickHash(hash, *this);
+}
+
+unsigned int foldTickHash(unsigned int hash, const MatchState& state) {
+	const Fighter& a = state.fighters[0];
+	const Fighter& b = state.fighters[1];
+	unsigned int sum =
+		floatBits(a.position[0]) * 0x9e3779b1 + floatBits(a.position[1]) * 0x85ebca6b +
+		floatBits(a.speed[0]) * 0xc2b2ae35 + floatBits(a.speed[1]) * 0x27d4eb2f +
+		floatBits(a.cooldown) * 0x165667b1 + floatBits(a.timeSinceLastJump) * 0xd3a2646d +
+		(unsigned int)a.health * 0xfd7046c5 + (unsigned int)a.clip * 0xb55a4f09 + a.events * 0x7feb352d +
+		floatBits(b.position[0]) * 0x846ca68b + floatBits(b.position[1]) * 0x2c1b3c6d +
+		floatBits(b.speed[0]) * 0x297a2d39 + floatBits(b.speed[1]) * 0xa3ec647b +
+		floatBits(b.cooldown) * 0x5bd1e995 + floatBits(b.timeSinceLastJump) * 0xcc9e2d51 +
+		(unsigned int)b.health * 0x1b873593 + (unsigned int)b.clip * 0xe6546b65 + b.events * 0x68e31da5;
+	return hashWord(hash, sum);
+}
+
+bool Match::knockedOut(int fighter) const {
+	return fighters[fighter].health <= 0 || (layout() && fighters[fighter].position[1] <= layout()->blastLine);
+}
+
+int Match::winner() const {
+	if (knockedOut(0))
+		return 1;
+	if (knockedOut(1))
+		return 0;
+	return -1;
+}
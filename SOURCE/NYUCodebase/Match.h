@@ -0,0 +1,91 @@
+#ifndef Match_h
+#define Match_h
+
+#include "Stage.h"
+#include "Animation.h"
+#include "Characters.h"
+
+class StageStream;
+
+// The match advances in fixed ticks, one animation tick each, whatever the frame
+// rate of whoever is running it
+#define MATCH_TICK_RATE 60
+#define MATCH_TICK (1.0f / MATCH_TICK_RATE)
+#define MATCH_START_HEALTH 100
+#define MATCH_END_DELAY 1.0f	//seconds between a knockout and the match being over
+
+// Buttons held by a player during a tick, one byte per player
+enum InputButton { INPUT_LEFT = 1, INPUT_RIGHT = 2, INPUT_JUMP = 4, INPUT_ATTACK = 8, INPUT_STRONG_ATTACK = 16, INPUT_UP_ATTACK = 32 };
+
+// What happened to a fighter during the last tick, for whoever plays sounds and effects
+enum FighterEvent { EVENT_ATTACK = 1, EVENT_HIT = 2 };
+
+struct Fighter {
+	float position[2];	//center point
+	float speed[2];
+	float halfSize[2];
+	float facing;		//1 is facing right, -1 is facing left
+	float cooldown;
+	float timeSinceLastJump;
+	int health;
+	int clip;
+	int clipTick;
+	int frame;			//sprite index into the character's AnimationSet
+	unsigned int events;
+	bool collided[4];	//top bot left right
+	bool inAir;
+	bool attacking;
+	bool gettingWrecked;
+	bool dead;
+	bool firstJump;
+	bool secondJump;
+};
+
+// Everything that changes while a match runs, and nothing else. Plain data, so a copy
+// is a save state: rollback and training mode just assign it back. SaveState.h has
+// the versioned on-disk form.
+struct MatchState {
+	Fighter fighters[2];
+	unsigned int tick;
+	float deathCounter;
+	bool dead;			//someone is knocked out or off the stage
+	bool over;
+	unsigned int hash;	//running, every tick so far folded in by foldTickHash
+};
+
+// The running hash after one more tick. Only the words a tick moves on its own go in:
+// each fighter's position, speed, cooldown, time since jumping, health, clip and events.
+// The rest of the state follows from those and the inputs. Each word is multiplied by
+// its own odd key and the products summed, so they go side by side, and just the sum
+// goes through a hashWord. Chained, so once two runs part the hashes never meet again.
+// About 9ns, 3 to 5% of a 150-200ns Match::step; NYUServer --check-replay prints it.
+unsigned int foldTickHash(unsigned int hash, const MatchState& state);
+
+// The whole game simulation for one match, with no SDL, GL or audio, so the same
+// code runs in the game and on the match server.
+class Match : public MatchState {
+public:
+	Match();
+
+	const Stage* stage;
+	const StageStream* streamed;	//instead of stage for maps loaded in chunks, whoever steps keeps it updated
+	const AnimationSet* animations[2];	//may be null, frame then stays 0
+	// CharacterId of each fighter, Chuk and Iven unless changed before start. Not part
+	// of MatchState, so replays and save states assume the same pair.
+	int characters[2];
+
+	void start(const Stage* stage, const AnimationSet* p1Animation, const AnimationSet* p2Animation);
+	void startStreamed(const StageStream* stream, const AnimationSet* p1Animation, const AnimationSet* p2Animation);
+	// Spawns and blast line of whichever stage is in use, null if none
+	const StageHeader* layout() const;
+	// Advances one MATCH_TICK with each player's InputButton bits
+	void step(const unsigned char inputs[2]);
+	// Index of the fighter that won, -1 while nobody is out
+	int winner() const;
+	bool knockedOut(int fighter) const;
+
+private:
+	void spawn(const AnimationSet* p1Animation, const AnimationSet* p2Animation);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include "Net.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef _WINDOWS
+#include <ws2tcpip.h>
+#define NET_INVALID INVALID_SOCKET
+typedef int NetLength;
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define NET_INVALID -1
+typedef socklen_t NetLength;
+#endif
+
+bool netInit() {
+#ifdef _WINDOWS
+	WSADATA data;
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+		std::cout << "Error starting winsock" << std::endl;
+		return false;
+	}
+#endif
+	return true;
+}
+
+void netShutdown() {
+#ifdef _WINDOWS
+	WSACleanup();
+#endif
+}
+
+bool resolveAddress(const char* name, unsigned short port, NetAddress& address) {
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	addrinfo* result = nullptr;
+	if (getaddrinfo(name, nullptr, &hints, &result) != 0 || !result) {
+		std::cout << "Could not resolve " << name << std::endl;
+		return false;
+	}
+	address.host = ntohl(((sockaddr_in*)result->ai_addr)->sin_addr.s_addr);
+	address.port = port;
+	freeaddrinfo(result);
+	return true;
+}
+
+bool sameAddress(const NetAddress& a, const NetAddress& b) {
+	return a.host == b.host && a.port == b.port;
+}
+
+UdpSocket::UdpSocket() : handle(NET_INVALID) {}
+
+UdpSocket::~UdpSocket() {
+	close();
+}
+
+bool UdpSocket::open(unsigned short port) {
+	close();
+	handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (handle == NET_INVALID) {
+		std::cout << "Error creating socket" << std::endl;
+		return false;
+	}
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(handle, (sockaddr*)&address, sizeof(address)) != 0) {
+		std::cout << "Error binding UDP port " << port << std::endl;
+		close();
+		return false;
+	}
+
+#ifdef _WINDOWS
+	u_long nonBlocking = 1;
+	bool ok = ioctlsocket(handle, FIONBIO, &nonBlocking) == 0;
+#else
+	bool ok = fcntl(handle, F_SETFL, O_NONBLOCK) == 0;
+#endif
+	if (!ok) {
+		std::cout << "Error making socket non-blocking" << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void UdpSocket::close() {
+	if (handle == NET_INVALID)
+		return;
+#ifdef _WINDOWS
+	closesocket(handle);
+#else
+	::close(handle);
+#endif
+	handle = NET_INVALID;
+}
+
+bool UdpSocket::isOpen() const {
+	return handle != NET_INVALID;
+}
+
+bool UdpSocket::send(const NetAddress& to, const void* data, int size) {
+	if (handle == NET_INVALID)
+		return false;
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(to.host);
+	address.sin_port = htons(to.port);
+	return sendto(handle, (const char*)data, size, 0, (sockaddr*)&address, sizeof(address)) == size;
+}
+
+int UdpSocket::receive(NetAddress& from, void* data, int capacity) {
+	if (handle == NET_INVALID)
+		return 0;
+	sockaddr_in address;
+	NetLength length = sizeof(address);
+	int size = (int)recvfrom(handle, (char*)data, capacity, 0, (sockaddr*)&address, &length);
+	// Would block, or an ICMP port unreachable from a client that went away
+	if (size <= 0)
+		return 0;
+	from.host = ntohl(address.sin_addr.s_addr);
+	from.port = ntohs(address.sin_port);
+	return size;
+}
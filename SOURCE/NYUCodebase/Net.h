@@ -0,0 +1,47 @@
+#ifndef Net_h
+#define Net_h
+
+#ifdef _WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+typedef SOCKET NetSocket;
+#else
+typedef int NetSocket;
+#endif
+
+// IPv4 address and port, both in host byte order
+struct NetAddress {
+	unsigned int host;
+	unsigned short port;
+};
+
+bool netInit();
+void netShutdown();
+bool resolveAddress(const char* name, unsigned short port, NetAddress& address);
+bool sameAddress(const NetAddress& a, const NetAddress& b);
+
+// Non-blocking UDP socket
+class UdpSocket {
+public:
+	UdpSocket();
+	~UdpSocket();
+
+	// Port 0 picks any free port
+	bool open(unsigned short port);
+	void close();
+	bool isOpen() const;
+
+	bool send(const NetAddress& to, const void* data, int size);
+	// Size of the datagram read, 0 when nothing is waiting
+	int receive(NetAddress& from, void* data, int capacity);
+
+private:
+	NetSocket handle;
+
+	UdpSocket(const UdpSocket&);
+	UdpSocket& operator=(const UdpSocket&);
+};
+
+#endif
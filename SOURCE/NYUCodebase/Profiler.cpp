@@ -0,0 +1,100 @@
+#include "Profiler.h"
+#include "Clock.h"
+
+#include <cstring>
+#include <iostream>
+
+Profiler profiler;
+
+Profiler::Profiler() : enabled(false), reportInterval(2.0), entryCount(0), frames(0), frameStart(0), lastReport(0) {}
+
+void Profiler::beginFrame() {
+	if (!enabled)
+		return;
+	frameStart = clockSeconds();
+	if (lastReport == 0)
+		lastReport = frameStart;
+}
+
+void Profiler::endFrame() {
+	if (!enabled)
+		return;
+	double now = clockSeconds();
+	time("frame", now - frameStart);
+
+	for (int i = 0; i < entryCount; i++) {
+		if (entries[i].frame > entries[i].max)
+			entries[i].max = entries[i].frame;
+		if (entries[i].kind == PROFILE_GAUGE)
+			continue;
+		entries[i].total += entries[i].frame;
+		entries[i].frame = 0;
+	}
+	frames++;
+
+	if (now - lastReport >= reportInterval)
+		report(now);
+}
+
+void Profiler::time(const char* name, double seconds) {
+	ProfileEntry* entry = find(name, PROFILE_TIME);
+	if (entry)
+		entry->frame += seconds;
+}
+
+void Profiler::count(const char* name, double value) {
+	ProfileEntry* entry = find(name, PROFILE_COUNT);
+	if (entry)
+		entry->frame += value;
+}
+
+void Profiler::gauge(const char* name, double value) {
+	ProfileEntry* entry = find(name, PROFILE_GAUGE);
+	if (entry)
+		entry->frame = value;
+}
+
+ProfileEntry* Profiler::find(const char* name, ProfileKind kind) {
+	if (!enabled)
+		return nullptr;
+	for (int i = 0; i < entryCount; i++) {
+		if (entries[i].name == name || strcmp(entries[i].name, name) == 0)
+			return &entries[i];
+	}
+	if (entryCount == PROFILER_MAX_ENTRIES)
+		return nullptr;
+	ProfileEntry& entry = entries[entryCount++];
+	entry.name = name;
+	entry.kind = kind;
+	entry.frame = 0;
+	entry.total = 0;
+	entry.max = 0;
+	return &entry;
+}
+
+void Profiler::report(double now) {
+	if (frames == 0)
+		return;
+	std::cout << "---- profile: " << frames << " frames in " << (now - lastReport) << "s" << std::endl;
+	for (int i = 0; i < entryCount; i++) {
+		ProfileEntry& entry = entries[i];
+		std::cout << "  " << entry.name << ": ";
+		if (entry.kind == PROFILE_TIME)
+			std::cout << (entry.total / frames) * 1000.0 << "ms avg, " << entry.max * 1000.0 << "ms max" << std::endl;
+		else if (entry.kind == PROFILE_GAUGE)
+			std::cout << entry.frame << " now, " << entry.max << " max" << std::endl;
+		else
+			std::cout << entry.total / frames << " avg, " << entry.max << " max" << std::endl;
+		entry.total = 0;
+		entry.max = 0;
+	}
+	frames = 0;
+	lastReport = now;
+}
+
+ProfileScope::ProfileScope(const char* name) : name(name), start(profiler.enabled ? clockSeconds() : 0) {}
+
+ProfileScope::~ProfileScope() {
+	if (profiler.enabled)
+		profiler.time(name, clockSeconds() - start);
+}
@@ -0,0 +1,57 @@
+#ifndef Profiler_h
+#define Profiler_h
+
+#define PROFILER_MAX_ENTRIES 64
+
+enum ProfileKind { PROFILE_TIME, PROFILE_COUNT, PROFILE_GAUGE };
+
+struct ProfileEntry {
+	const char* name;
+	ProfileKind kind;
+	double frame;	//accumulated during the current frame, latest value for gauges
+	double total;	//sum of frame values since the last report, unused for gauges
+	double max;		//worst single frame since the last report
+};
+
+// Frame profiler. Everything is fixed size so sampling never allocates.
+// Values are summed within a frame and reported as per-frame averages and maxima
+// every reportInterval seconds.
+class Profiler {
+public:
+	Profiler();
+
+	bool enabled;
+	double reportInterval;
+
+	void beginFrame();
+	void endFrame();
+
+	void time(const char* name, double seconds);
+	void count(const char* name, double value);
+	// Values that are sampled rather than summed per frame (latencies, totals)
+	void gauge(const char* name, double value);
+
+private:
+	ProfileEntry entries[PROFILER_MAX_ENTRIES];
+	int entryCount;
+	int frames;
+	double frameStart;
+	double lastReport;
+
+	ProfileEntry* find(const char* name, ProfileKind kind);
+	void report(double now);
+};
+
+extern Profiler profiler;
+
+// Times the enclosing block into the profiler
+class ProfileScope {
+public:
+	ProfileScope(const char* name);
+	~ProfileScope();
+private:
+	const char* name;
+	double start;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include "Projectiles.h"
+#include "Collision.h"
+
+#include <cmath>
+#include <cstring>
+
+#define SPRAY_SPEED 8.0f
+#define SPRAY_HEIGHT 6.0f	//cherries drop from this far above the spawn points
+
+ProjectilePool::ProjectilePool() : count(0) {
+	for (int i = 0; i < PROJECTILE_CAPACITY; i++)
+		generation[i] = 1;
+	clear();
+}
+
+ProjectileHandle ProjectilePool::spawn(ProjectileKind type, const float from[2], const float velocity[2]) {
+	ProjectileHandle handle = { 0, 0 };
+	if (freeCount == 0) {
+		full++;
+		return handle;
+	}
+	unsigned short slot = freeSlots[--freeCount];
+	unsigned int index = count++;
+	position[index][0] = from[0];
+	position[index][1] = from[1];
+	speed[index][0] = velocity[0];
+	speed[index][1] = velocity[1];
+	life[index] = projectileDefinitions[type].life;
+	kind[index] = (unsigned char)type;
+	slotOf[index] = slot;
+	indexOf[slot] = (unsigned short)index;
+	spawned++;
+
+	handle.slot = slot;
+	handle.generation = generation[slot];
+	return handle;
+}
+
+bool ProjectilePool::alive(ProjectileHandle handle) const {
+	if (handle.slot >= PROJECTILE_CAPACITY || handle.generation == 0 || generation[handle.slot] != handle.generation)
+		return false;
+	// A free slot keeps its generation until it is used again
+	unsigned int index = indexOf[handle.slot];
+	return index < count && slotOf[index] == handle.slot;
+}
+
+void ProjectilePool::despawn(ProjectileHandle handle) {
+	if (alive(handle))
+		remove(indexOf[handle.slot]);
+}
+
+void ProjectilePool::clear() {
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned short slot = slotOf[i];
+		if (++generation[slot] == 0)
+			generation[slot] = 1;
+	}
+	count = 0;
+	// Lowest slots come off the free list first
+	for (int i = 0; i < PROJECTILE_CAPACITY; i++)
+		freeSlots[i] = (unsigned short)(PROJECTILE_CAPACITY - 1 - i);
+	freeCount = PROJECTILE_CAPACITY;
+	spawned = 0;
+	pickups = 0;
+	full = 0;
+}
+
+// Frees the entry's slot and moves the last entry into its place
+void ProjectilePool::remove(unsigned int index) {
+	unsigned short slot = slotOf[index];
+	if (++generation[slot] == 0)
+		generation[slot] = 1;
+	freeSlots[freeCount++] = slot;
+
+	unsigned int last = --count;
+	if (index == last)
+		return;
+	position[index][0] = position[last][0];
+	position[index][1] = position[last][1];
+	speed[index][0] = speed[last][0];
+	speed[index][1] = speed[last][1];
+	life[index] = life[last];
+	kind[index] = kind[last];
+	slotOf[index] = slotOf[last];
+	indexOf[slotOf[index]] = (unsigned short)index;
+}
+
+// Fates move() leaves for step(); PROJECTILE_TO_FIGHTER + k goes to fighter k
+#define PROJECTILE_STAYS 0
+#define PROJECTILE_GOES 1
+#define PROJECTILE_TO_FIGHTER 2
+
+struct ProjectileMove {
+	ProjectilePool* pool;
+	const Match* match;
+
+	void operator()(int begin, int end) {
+		pool->move(*match, begin, end);
+	}
+};
+
+void ProjectilePool::step(Match& match, JobSystem* jobs) {
+	if (!match.layout())
+		return;
+
+	// A streamed stage's chunks only change in StageStream::update() on this thread, so
+	// the jobs can read them while it waits
+	ProjectileMove phase = { this, &match };
+	if (jobs)
+		jobs->parallelFor((int)count, PROJECTILE_GRAIN, phase);
+	else
+		phase(0, (int)count);
+
+	// Back to front, so whatever a removal swaps into the gap has already been dealt with
+	for (int i = (int)count - 1; i >= 0; i--) {
+		if (fate[i] == PROJECTILE_STAYS)
+			continue;
+		if (fate[i] >= PROJECTILE_TO_FIGHTER) {
+			Fighter& fighter = match.fighters[fate[i] - PROJECTILE_TO_FIGHTER];
+			fighter.health += projectileDefinitions[kind[i]].heal;
+			if (fighter.health > MATCH_START_HEALTH)
+				fighter.health = MATCH_START_HEALTH;
+			pickups++;
+		}
+		remove(i);
+	}
+}
+
+// Fighters only change in step()'s second half, so every entry can look at them here
+void ProjectilePool::move(const Match& match, int begin, int end) {
+	const StageHeader* layout = match.layout();
+	for (int i = begin; i < end; i++) {
+		const ProjectileDefinition& definition = projectileDefinitions[kind[i]];
+		float halfSize[2] = { definition.halfSize, definition.halfSize };
+		life[i] -= MATCH_TICK;
+		speed[i][1] += definition.gravity * MATCH_TICK;
+		float delta[2] = { speed[i][0] * MATCH_TICK, speed[i][1] * MATCH_TICK };
+
+		int hitAxis;
+		int hit = match.streamed ? sweepStream(*match.streamed, position[i], halfSize, delta, hitAxis) : sweepStage(*match.stage, position[i], halfSize, delta, hitAxis);
+		fate[i] = life[i] <= 0 || position[i][1] <= layout->blastLine ? PROJECTILE_GOES : PROJECTILE_STAYS;
+		if (hit >= 0) {
+			if (kind[i] == PROJECTILE_SHOT) {
+				fate[i] = PROJECTILE_GOES;
+			}
+			else {
+				// Landed cherries stay put, ones against a wall slide down it
+				speed[i][hitAxis] = 0.0f;
+				if (hitAxis == 1 && delta[1] < 0)
+					speed[i][0] = 0.0f;
+			}
+		}
+
+		for (int k = 0; k < 2 && fate[i] == PROJECTILE_STAYS && definition.heal > 0; k++) {
+			const Fighter& fighter = match.fighters[k];
+			if (fighter.dead ||
+				fabs(position[i][0] - fighter.position[0]) >= fighter.halfSize[0] + halfSize[0] ||
+				fabs(position[i][1] - fighter.position[1]) >= fighter.halfSize[1] + halfSize[1])
+				continue;
+			fate[i] = (unsigned char)(PROJECTILE_TO_FIGHTER + k);
+		}
+	}
+}
+
+void ProjectilePool::spray(const Match& match, unsigned int target, unsigned int& random) {
+	const StageHeader* layout = match.layout();
+	if (!layout)
+		return;
+	if (target > PROJECTILE_CAPACITY)
+		target = PROJECTILE_CAPACITY;
+	float center[2] = { (layout->spawn[0][0] + layout->spawn[1][0]) / 2, (layout->spawn[0][1] + layout->spawn[1][1]) / 2 };
+	float spread = fabs(layout->spawn[0][0] - layout->spawn[1][0]) / 2 + 2.0f;
+
+	unsigned int fired = 0;
+	while (count < target && fired <= target / 10) {
+		random = random * 1103515245 + 12345;
+		float along = ((random >> 16) & 0x7fff) / 32768.0f;
+		if (random & 0x80000000) {
+			float from[2] = { center[0] - spread + along * spread * 2, center[1] + SPRAY_HEIGHT };
+			float velocity[2] = { 0.0f, 0.0f };
+			spawn(PROJECTILE_CHERRY, from, velocity);
+		}
+		else {
+			float angle = along * 6.2831853f;
+			float velocity[2] = { cosf(angle) * SPRAY_SPEED, sinf(angle) * SPRAY_SPEED };
+			spawn(PROJECTILE_SHOT, center, velocity);
+		}
+		fired++;
+	}
+}
+
+void ProjectilePool::copyTo(ProjectileView& view) const {
+	view.count = count;
+	memcpy(view.position, position, count * sizeof(position[0]));
+	memcpy(view.speed, speed, count * sizeof(speed[0]));
+	memcpy(view.kind, kind, count);
+}
+
+unsigned int ProjectilePool::hash() const {
+	unsigned int hash = count;
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int bits[5];
+		memcpy(&bits[0], position[i], sizeof(position[i]));
+		memcpy(&bits[2], speed[i], sizeof(speed[i]));
+		memcpy(&bits[4], &life[i], sizeof(life[i]));
+		for (int j = 0; j < 5; j++)
+			hash = hash * 31 + bits[j];
+		hash = hash * 31 + (kind[i] | slotOf[i] << 16);
+	}
+	return hash;
+}
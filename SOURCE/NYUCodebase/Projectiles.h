@@ -0,0 +1,97 @@
+#ifndef Projectiles_h
+#define Projectiles_h
+
+#include "JobSystem.h"
+#include "Match.h"
+
+#define PROJECTILE_CAPACITY 4096
+#define PROJECTILE_GRAIN 256	//projectiles one job moves
+
+enum ProjectileKind { PROJECTILE_SHOT, PROJECTILE_CHERRY, PROJECTILE_KINDS };
+
+struct ProjectileDefinition {
+	float halfSize;
+	float gravity;
+	float life;		//seconds before it goes by itself
+	int heal;		//to the fighter that picks it up, 0 if fighters cannot
+};
+
+// Shots fly straight through the fighters and go at the first tile they touch. Cherries
+// fall, rest on whatever they land on and go to whichever fighter touches them.
+static const ProjectileDefinition projectileDefinitions[PROJECTILE_KINDS] = {
+	{ 0.1f, 0.0f, 2.0f, 0 },
+	{ 0.15f, -9.8f, 8.0f, 10 },
+};
+
+// Names one projectile. Its slot may be reused once it is gone, the generation tells
+// a handle to the old one from the new one. Generation 0 is never live.
+struct ProjectileHandle {
+	unsigned short slot;
+	unsigned short generation;
+};
+
+// Whatever was live after a tick, for drawing on another thread
+struct ProjectileView {
+	unsigned int count;
+	float position[PROJECTILE_CAPACITY][2];
+	float speed[PROJECTILE_CAPACITY][2];
+	unsigned char kind[PROJECTILE_CAPACITY];
+};
+
+// Every live projectile, packed at the front of fixed arrays so a step is one pass
+// over count entries. Slots keep handles stable while entries move: a despawn swaps
+// the last entry into the gap and repoints its slot. Nothing is allocated after
+// construction, spawning past PROJECTILE_CAPACITY fails.
+// Not part of MatchState: a copy of the pool is far bigger than the rest of a match,
+// so it is kept beside the match by whoever steps it, and replays, save states and
+// rollback leave it out. For that reason nothing in a normal match spawns projectiles:
+// only --projectile-stress in the local game and NYUServer --bench-projectiles fill one.
+class ProjectilePool {
+public:
+	ProjectilePool();
+
+	unsigned int count;
+	float position[PROJECTILE_CAPACITY][2];	//center point
+	float speed[PROJECTILE_CAPACITY][2];
+	float life[PROJECTILE_CAPACITY];
+	unsigned char kind[PROJECTILE_CAPACITY];
+	unsigned short slotOf[PROJECTILE_CAPACITY];
+
+	// Since clear()
+	unsigned int spawned;
+	unsigned int pickups;
+	unsigned int full;	//spawns refused for want of a slot
+
+	// Generation 0 if the pool is full
+	ProjectileHandle spawn(ProjectileKind type, const float from[2], const float velocity[2]);
+	bool alive(ProjectileHandle handle) const;
+	void despawn(ProjectileHandle handle);
+	void clear();
+
+	// Moves everything one MATCH_TICK through the match's stage, then hands over to the
+	// fighters whatever they can pick up and touch. The move is spread over jobs if there
+	// are any; what it found is applied afterwards on the calling thread, back to front,
+	// so the result is the same on any number of threads.
+	void step(Match& match, JobSystem* jobs = nullptr);
+	// The move phase of step() for entries [begin, end): ages, falls and sweeps each one
+	// through the stage and decides its fate. Only writes those entries.
+	void move(const Match& match, int begin, int end);
+	// Tops the pool up to target for stress runs, shots sprayed from between the spawn
+	// points and cherries dropped over the stage. Fires at most a tenth of
+	// the target a tick so they spread out.
+	void spray(const Match& match, unsigned int target, unsigned int& random);
+	void copyTo(ProjectileView& view) const;
+	// Of every live projectile in entry order, for checking a threaded step against a plain one
+	unsigned int hash() const;
+
+private:
+	unsigned short indexOf[PROJECTILE_CAPACITY];	//entry of each slot while live
+	unsigned short generation[PROJECTILE_CAPACITY];
+	unsigned short freeSlots[PROJECTILE_CAPACITY];
+	unsigned int freeCount;
+	unsigned char fate[PROJECTILE_CAPACITY];	//what move() decided, for step() to apply
+
+	void remove(unsigned int index);
+};
+
+#endif
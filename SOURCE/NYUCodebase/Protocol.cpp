@@ -0,0 +1,151 @@
+#include "Protocol.h"
+
+#include <cstring>
+
+enum FighterFlag { FLAG_IN_AIR = 1, FLAG_ATTACKING = 2, FLAG_WRECKED = 4, FLAG_DEAD = 8 };
+enum MatchFlag { FLAG_KNOCKOUT = 1, FLAG_OVER = 2 };
+
+PacketWriter::PacketWriter(unsigned char* data, int capacity) : data(data), size(0), capacity(capacity), overflow(false) {}
+
+void PacketWriter::u8(unsigned int value) {
+	if (size + 1 > capacity) {
+		overflow = true;
+		return;
+	}
+	data[size++] = (unsigned char)value;
+}
+
+void PacketWriter::u16(unsigned int value) {
+	u8(value & 0xff);
+	u8((value >> 8) & 0xff);
+}
+
+void PacketWriter::u32(unsigned int value) {
+	u16(value & 0xffff);
+	u16((value >> 16) & 0xffff);
+}
+
+void PacketWriter::f32(float value) {
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	u32(bits);
+}
+
+void PacketWriter::text(const char* value, int maxLength) {
+	int length = (int)strlen(value);
+	if (length > maxLength - 1)
+		length = maxLength - 1;
+	u8(length);
+	for (int i = 0; i < length; i++)
+		u8((unsigned char)value[i]);
+}
+
+void PacketWriter::varint(unsigned int value) {
+	while (value >= 0x80) {
+		u8((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	u8(value);
+}
+
+PacketReader::PacketReader(const unsigned char* data, int size) : data(data), size(size), position(0), failed(false) {}
+
+unsigned int PacketReader::u8() {
+	if (failed || position + 1 > size) {
+		failed = true;
+		return 0;
+	}
+	return data[position++];
+}
+
+unsigned int PacketReader::u16() {
+	unsigned int low = u8();
+	return low | (u8() << 8);
+}
+
+unsigned int PacketReader::u32() {
+	unsigned int low = u16();
+	return low | (u16() << 16);
+}
+
+float PacketReader::f32() {
+	unsigned int bits = u32();
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+unsigned int PacketReader::varint() {
+	unsigned int value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		unsigned int byte = u8();
+		value |= (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+	failed = true;
+	return 0;
+}
+
+void PacketReader::text(char* value, int maxLength) {
+	int length = (int)u8();
+	int kept = 0;
+	for (int i = 0; i < length; i++) {
+		char c = (char)u8();
+		if (kept < maxLength - 1)
+			value[kept++] = c;
+	}
+	value[kept] = 0;
+}
+
+void writeMatchState(PacketWriter& packet, const Match& match) {
+	packet.u8(PACKET_STATE);
+	packet.u32(match.tick);
+	packet.u8((match.dead ? FLAG_KNOCKOUT : 0) | (match.over ? FLAG_OVER : 0));
+	for (int k = 0; k < 2; k++) {
+		const Fighter& fighter = match.fighters[k];
+		packet.f32(fighter.position[0]);
+		packet.f32(fighter.position[1]);
+		packet.f32(fighter.speed[0]);
+		packet.f32(fighter.speed[1]);
+		packet.u16((unsigned short)(short)fighter.health);
+		packet.u8(fighter.clip);
+		packet.u8(fighter.frame);
+		packet.u8((fighter.facing < 0 ? 0x80 : 0) | (fighter.inAir ? FLAG_IN_AIR : 0) | (fighter.attacking ? FLAG_ATTACKING : 0) |
+			(fighter.gettingWrecked ? FLAG_WRECKED : 0) | (fighter.dead ? FLAG_DEAD : 0));
+		packet.u8(fighter.events);
+	}
+}
+
+bool readMatchState(PacketReader& packet, Match& match) {
+	if (packet.u8() != PACKET_STATE)
+		return false;
+	unsigned int tick = packet.u32();
+	unsigned int flags = packet.u8();
+	Fighter fighters[2];
+	memcpy(fighters, match.fighters, sizeof(fighters));
+	for (int k = 0; k < 2; k++) {
+		Fighter& fighter = fighters[k];
+		fighter.position[0] = packet.f32();
+		fighter.position[1] = packet.f32();
+		fighter.speed[0] = packet.f32();
+		fighter.speed[1] = packet.f32();
+		fighter.health = (short)packet.u16();
+		fighter.clip = packet.u8();
+		fighter.frame = packet.u8();
+		unsigned int fighterFlags = packet.u8();
+		fighter.facing = (fighterFlags & 0x80) ? -1.0f : 1.0f;
+		fighter.inAir = (fighterFlags & FLAG_IN_AIR) != 0;
+		fighter.attacking = (fighterFlags & FLAG_ATTACKING) != 0;
+		fighter.gettingWrecked = (fighterFlags & FLAG_WRECKED) != 0;
+		fighter.dead = (fighterFlags & FLAG_DEAD) != 0;
+		fighter.events = packet.u8();
+	}
+	if (packet.failed)
+		return false;
+	match.tick = tick;
+	match.dead = (flags & FLAG_KNOCKOUT) != 0;
+	match.over = (flags & FLAG_OVER) != 0;
+	memcpy(match.fighters, fighters, sizeof(fighters));
+	return true;
+}
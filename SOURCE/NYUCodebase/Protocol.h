@@ -0,0 +1,66 @@
+#ifndef Protocol_h
+#define Protocol_h
+
+#include "Match.h"
+
+#define PROTOCOL_VERSION 1
+#define PROTOCOL_DEFAULT_PORT 27015
+#define PROTOCOL_MAX_PACKET 512
+#define PROTOCOL_ANY_SLOT 255
+#define PROTOCOL_SPECTATOR_SLOT 254
+#define PROTOCOL_TIMEOUT 5.0	//seconds of silence before the server drops a client
+
+// Every packet starts with its type byte. Multi-byte fields are little-endian whatever
+// the host is, floats go as their IEEE-754 bits.
+//   JOIN     client -> server   version, wanted slot (PROTOCOL_ANY_SLOT for either)
+//   WELCOME  server -> client   slot (PROTOCOL_ANY_SLOT when the match is full), stage name
+//   INPUT    client -> server   slot, sequence (u32), InputButton bits
+//   STATE    server -> client   tick (u32), match flags, both fighters
+//   LEAVE    client -> server   slot
+//   SPECTATE client -> server   version, answered by WELCOME with PROTOCOL_SPECTATOR_SLOT
+//   FEED     server -> spectator  batch of delta coded ticks, see Spectator.h
+//   ACK      spectator -> server  keyframe number the spectator now holds
+// Inputs and states are sent every tick and superseded by the next one, so nothing is resent.
+enum PacketType { PACKET_JOIN, PACKET_WELCOME, PACKET_INPUT, PACKET_STATE, PACKET_LEAVE, PACKET_SPECTATE, PACKET_FEED, PACKET_ACK };
+
+class PacketWriter {
+public:
+	PacketWriter(unsigned char* data, int capacity);
+
+	void u8(unsigned int value);
+	void u16(unsigned int value);
+	void u32(unsigned int value);
+	void f32(float value);
+	void text(const char* value, int maxLength);
+	// 7 bits a byte, small values take one byte
+	void varint(unsigned int value);
+
+	unsigned char* data;
+	int size;
+	int capacity;
+	bool overflow;
+};
+
+class PacketReader {
+public:
+	PacketReader(const unsigned char* data, int size);
+
+	unsigned int u8();
+	unsigned int u16();
+	unsigned int u32();
+	float f32();
+	unsigned int varint();
+	// Copies a string into value (maxLength bytes including the terminator)
+	void text(char* value, int maxLength);
+
+	const unsigned char* data;
+	int size;
+	int position;
+	bool failed;	//read past the end, every later read returns 0
+};
+
+// Everything a client needs to draw the match. Cooldowns and jump state stay on the server.
+void writeMatchState(PacketWriter& packet, const Match& match);
+bool readMatchState(PacketReader& packet, Match& match);
+
+#endif
@@ -0,0 +1,128 @@
+#include "RenderState.h"
+#include "Profiler.h"
+
+#include <cstring>
+
+RenderState renderState;
+
+RenderState::RenderState() : issued(0), elided(0), draws(0) {
+	invalidate();
+}
+
+bool RenderState::skip(bool unchanged) {
+	if (unchanged)
+		elided++;
+	else
+		issued++;
+	return unchanged;
+}
+
+void RenderState::useProgram(GLuint newProgram) {
+	if (skip(program == newProgram))
+		return;
+	program = newProgram;
+	glUseProgram(program);
+}
+
+void RenderState::bindTexture(GLuint newTexture) {
+	if (skip(texture == newTexture))
+		return;
+	texture = newTexture;
+	glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void RenderState::deleteTexture(GLuint oldTexture) {
+	// Deleting the bound texture silently rebinds 0
+	if (texture == oldTexture)
+		texture = 0;
+	issued++;
+	glDeleteTextures(1, &oldTexture);
+}
+
+void RenderState::setBlend(bool enabled) {
+	if (skip(blend == (int)enabled))
+		return;
+	blend = enabled;
+	if (enabled)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+}
+
+void RenderState::blendFunc(GLenum source, GLenum destination) {
+	if (skip(blendSource == source && blendDestination == destination))
+		return;
+	blendSource = source;
+	blendDestination = destination;
+	glBlendFunc(source, destination);
+}
+
+void RenderState::enableAttribute(GLuint index) {
+	if (index < RENDER_STATE_ATTRIBUTES) {
+		if (skip(attributes[index] == 1))
+			return;
+		attributes[index] = 1;
+	}
+	else {
+		issued++;
+	}
+	glEnableVertexAttribArray(index);
+}
+
+void RenderState::disableAttribute(GLuint index) {
+	if (index < RENDER_STATE_ATTRIBUTES) {
+		if (skip(attributes[index] == 0))
+			return;
+		attributes[index] = 0;
+	}
+	else {
+		issued++;
+	}
+	glDisableVertexAttribArray(index);
+}
+
+void RenderState::uniformMatrix(GLint location, const float* matrix) {
+	// Uniforms belong to the program, so the cache is keyed on both
+	CachedUniform* slot = nullptr;
+	for (int i = 0; i < uniformCount; i++) {
+		if (uniforms[i].program == program && uniforms[i].location == location) {
+			slot = &uniforms[i];
+			break;
+		}
+	}
+	if (skip(slot && memcmp(slot->value, matrix, sizeof(slot->value)) == 0))
+		return;
+	if (!slot && uniformCount < RENDER_STATE_UNIFORMS) {
+		slot = &uniforms[uniformCount++];
+		slot->program = program;
+		slot->location = location;
+	}
+	if (slot)
+		memcpy(slot->value, matrix, sizeof(slot->value));
+	glUniformMatrix4fv(location, 1, GL_FALSE, matrix);
+}
+
+void RenderState::drawArrays(GLenum mode, GLint first, GLsizei count) {
+	draws++;
+	glDrawArrays(mode, first, count);
+}
+
+void RenderState::invalidate() {
+	program = (GLuint)-1;
+	texture = (GLuint)-1;
+	blend = -1;
+	blendSource = 0;
+	blendDestination = 0;
+	for (int i = 0; i < RENDER_STATE_ATTRIBUTES; i++)
+		attributes[i] = -1;
+	uniformCount = 0;
+}
+
+void RenderState::report() {
+	profiler.count("gl calls issued", issued);
+	profiler.count("gl calls elided", elided);
+	profiler.count("draw calls", draws);
+	issued = 0;
+	elided = 0;
+	draws = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef RenderState_h
+#define RenderState_h
+
+#ifdef _WINDOWS
+#include <GL/glew.h>
+#endif
+#include <SDL_opengl.h>
+
+#define RENDER_STATE_ATTRIBUTES 16
+#define RENDER_STATE_UNIFORMS 32
+
+struct CachedUniform {
+	GLuint program;
+	GLint location;
+	float value[16];
+};
+
+// Shadow copy of the GL state we touch. Every setter compares against the
+// shadow first and only calls into the driver when something actually changes.
+// All GL state changes made by the game should go through here, otherwise the
+// shadow goes stale; call invalidate() after anything that bypasses it.
+class RenderState {
+public:
+	RenderState();
+
+	void useProgram(GLuint program);
+	void bindTexture(GLuint texture);
+	void deleteTexture(GLuint texture);
+	void setBlend(bool enabled);
+	void blendFunc(GLenum source, GLenum destination);
+	void enableAttribute(GLuint index);
+	void disableAttribute(GLuint index);
+	void uniformMatrix(GLint location, const float* matrix);
+	void drawArrays(GLenum mode, GLint first, GLsizei count);
+
+	void invalidate();
+	// Hands this frame's issued/elided call counts to the profiler and resets them
+	void report();
+
+	unsigned int issued;
+	unsigned int elided;
+	unsigned int draws;
+
+private:
+	GLuint program;
+	GLuint texture;
+	int blend;	//-1 unknown
+	GLenum blendSource;
+	GLenum blendDestination;
+	int attributes[RENDER_STATE_ATTRIBUTES];	//-1 unknown
+	CachedUniform uniforms[RENDER_STATE_UNIFORMS];
+	int uniformCount;
+
+	bool skip(bool unchanged);
+};
+
+extern RenderState renderState;
+
+#endif
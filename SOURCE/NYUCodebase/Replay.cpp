@@ -0,0 +1,215 @@
+#include "Replay.h"
+#include "Protocol.h"
+#include "Hash.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#define REPLAY_HEADER_SIZE (16 + STAGE_NAME_LENGTH)
+
+// Fields go in one at a time, so padding never gets hashed
+unsigned int hashMatchState(const MatchState& state) {
+	unsigned int hash = hashWord(0, state.tick);
+	hash = hashWord(hash, floatBits(state.deathCounter));
+	hash = hashWord(hash, (state.dead ? 1 : 0) | (state.over ? 2 : 0));
+	hash = hashWord(hash, state.hash);
+	for (int k = 0; k < 2; k++) {
+		const Fighter& fighter = state.fighters[k];
+		for (int i = 0; i < 2; i++) {
+			hash = hashWord(hash, floatBits(fighter.position[i]));
+			hash = hashWord(hash, floatBits(fighter.speed[i]));
+			hash = hashWord(hash, floatBits(fighter.halfSize[i]));
+		}
+		hash = hashWord(hash, floatBits(fighter.facing));
+		hash = hashWord(hash, floatBits(fighter.cooldown));
+		hash = hashWord(hash, floatBits(fighter.timeSinceLastJump));
+		hash = hashWord(hash, (unsigned int)fighter.health);
+		hash = hashWord(hash, (unsigned int)fighter.clip);
+		hash = hashWord(hash, (unsigned int)fighter.clipTick);
+		hash = hashWord(hash, (unsigned int)fighter.frame);
+		hash = hashWord(hash, fighter.events);
+		unsigned int flags = 0;
+		for (int i = 0; i < 4; i++)
+			flags |= fighter.collided[i] ? 1 << i : 0;
+		flags |= (fighter.inAir ? 16 : 0) | (fighter.attacking ? 32 : 0) | (fighter.gettingWrecked ? 64 : 0) |
+			(fighter.dead ? 128 : 0) | (fighter.firstJump ? 256 : 0) | (fighter.secondJump ? 512 : 0);
+		hash = hashWord(hash, flags);
+	}
+	return hash;
+}
+
+template <typename T>
+static int compareField(const char* name, int fighter, T recorded, T replayed) {
+	if (recorded == replayed)
+		return 0;
+	if (fighter >= 0)
+		std::cout << "  p" << fighter + 1 << ".";
+	else
+		std::cout << "  ";
+	std::cout << name << ": recorded " << recorded << ", replayed " << replayed << std::endl;
+	return 1;
+}
+
+int printStateDifferences(const MatchState& recorded, const MatchState& replayed) {
+	// Enough digits that two floats that differ print differently
+	std::streamsize precision = std::cout.precision(9);
+	int differences = 0;
+	differences += compareField("tick", -1, recorded.tick, replayed.tick);
+	differences += compareField("deathCounter", -1, recorded.deathCounter, replayed.deathCounter);
+	differences += compareField("dead", -1, recorded.dead, replayed.dead);
+	differences += compareField("over", -1, recorded.over, replayed.over);
+	differences += compareField("hash", -1, recorded.hash, replayed.hash);
+	for (int k = 0; k < 2; k++) {
+		const Fighter& a = recorded.fighters[k];
+		const Fighter& b = replayed.fighters[k];
+		differences += compareField("position.x", k, a.position[0], b.position[0]);
+		differences += compareField("position.y", k, a.position[1], b.position[1]);
+		differences += compareField("speed.x", k, a.speed[0], b.speed[0]);
+		differences += compareField("speed.y", k, a.speed[1], b.speed[1]);
+		differences += compareField("halfSize.x", k, a.halfSize[0], b.halfSize[0]);
+		differences += compareField("halfSize.y", k, a.halfSize[1], b.halfSize[1]);
+		differences += compareField("facing", k, a.facing, b.facing);
+		differences += compareField("cooldown", k, a.cooldown, b.cooldown);
+		differences += compareField("timeSinceLastJump", k, a.timeSinceLastJump, b.timeSinceLastJump);
+		differences += compareField("health", k, a.health, b.health);
+		differences += compareField("clip", k, a.clip, b.clip);
+		differences += compareField("clipTick", k, a.clipTick, b.clipTick);
+		differences += compareField("frame", k, a.frame, b.frame);
+		differences += compareField("events", k, a.events, b.events);
+		differences += compareField("collided.top", k, a.collided[0], b.collided[0]);
+		differences += compareField("collided.bot", k, a.collided[1], b.collided[1]);
+		differences += compareField("collided.left", k, a.collided[2], b.collided[2]);
+		differences += compareField("collided.right", k, a.collided[3], b.collided[3]);
+		differences += compareField("inAir", k, a.inAir, b.inAir);
+		differences += compareField("attacking", k, a.attacking, b.attacking);
+		differences += compareField("gettingWrecked", k, a.gettingWrecked, b.gettingWrecked);
+		differences += compareField("dead", k, a.dead, b.dead);
+		differences += compareField("firstJump", k, a.firstJump, b.firstJump);
+		differences += compareField("secondJump", k, a.secondJump, b.secondJump);
+	}
+	std::cout.precision(precision);
+	return differences;
+}
+
+Replay::Replay() {}
+
+void Replay::begin(const MatchState& state, const std::string& newStageName) {
+	if (ticks.capacity() < REPLAY_MAX_TICKS) {
+		ticks.reserve(REPLAY_MAX_TICKS);
+		snapshots.reserve(REPLAY_MAX_TICKS / REPLAY_SNAPSHOT_INTERVAL + 1);
+	}
+	stageName = newStageName;
+	ticks.clear();
+	snapshots.clear();
+	snapshot(state);
+}
+
+void Replay::record(const unsigned char inputs[2], const MatchState& after) {
+	if (!recording())
+		return;
+	ReplayTick tick;
+	tick.inputs[0] = inputs[0];
+	tick.inputs[1] = inputs[1];
+	tick.hash = after.hash;
+	ticks.push_back(tick);
+	if (ticks.size() % REPLAY_SNAPSHOT_INTERVAL == 0)
+		snapshot(after);
+}
+
+bool Replay::recording() const {
+	return !snapshots.empty() && ticks.size() < REPLAY_MAX_TICKS;
+}
+
+void Replay::snapshot(const MatchState& state) {
+	ReplaySnapshot shot;
+	shot.tick = (unsigned int)ticks.size();
+	shot.size = writeSaveState(state, stageName.c_str(), true, shot.data, sizeof(shot.data));
+	snapshots.push_back(shot);
+}
+
+bool Replay::save(const std::string& path) const {
+	int size = REPLAY_HEADER_SIZE + (int)ticks.size() * 6;
+	for (size_t i = 0; i < snapshots.size(); i++)
+		size += 6 + snapshots[i].size;
+	std::vector<unsigned char> data(size);
+	PacketWriter file(&data[0], size);
+	file.u32(REPLAY_MAGIC);
+	file.u16(REPLAY_VERSION);
+	file.u16(REPLAY_SNAPSHOT_INTERVAL);
+	file.u32((unsigned int)ticks.size());
+	file.u32((unsigned int)snapshots.size());
+	file.text(stageName.c_str(), STAGE_NAME_LENGTH);
+	for (size_t i = 0; i < ticks.size(); i++) {
+		file.u8(ticks[i].inputs[0]);
+		file.u8(ticks[i].inputs[1]);
+		file.u32(ticks[i].hash);
+	}
+	for (size_t i = 0; i < snapshots.size(); i++) {
+		file.u32(snapshots[i].tick);
+		file.u16(snapshots[i].size);
+		for (int j = 0; j < snapshots[i].size; j++)
+			file.u8(snapshots[i].data[j]);
+	}
+
+	std::ofstream out(path.c_str(), std::ios::binary);
+	if (!out) {
+		std::cout << "Unable to write replay " << path << std::endl;
+		return false;
+	}
+	out.write((const char*)file.data, file.size);
+	return out.good();
+}
+
+bool Replay::load(const std::string& path) {
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in) {
+		std::cout << "Unable to open replay " << path << std::endl;
+		return false;
+	}
+	std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (data.empty())
+		data.push_back(0);
+	PacketReader file(&data[0], (int)data.size());
+	unsigned int magic = file.u32();
+	unsigned int version = file.u16();
+	unsigned int interval = file.u16();
+	unsigned int tickCount = file.u32();
+	unsigned int snapshotCount = file.u32();
+	char name[STAGE_NAME_LENGTH];
+	file.text(name, sizeof(name));
+	if (file.failed || magic != REPLAY_MAGIC || version > REPLAY_VERSION || interval == 0 || snapshotCount == 0 ||
+		tickCount > data.size() / 6) {
+		std::cout << path << " is not a replay this build can read" << std::endl;
+		return false;
+	}
+	if (version < 2) {
+		std::cout << path << " is a version " << version << " replay, its hashes are of the whole state and not the running hash, record it again" << std::endl;
+		return false;
+	}
+
+	stageName = name;
+	ticks.resize(tickCount);
+	for (unsigned int i = 0; i < tickCount; i++) {
+		ticks[i].inputs[0] = (unsigned char)file.u8();
+		ticks[i].inputs[1] = (unsigned char)file.u8();
+		ticks[i].hash = file.u32();
+	}
+	snapshots.clear();
+	for (unsigned int i = 0; i < snapshotCount && !file.failed; i++) {
+		ReplaySnapshot shot;
+		shot.tick = file.u32();
+		shot.size = (int)file.u16();
+		if (shot.size > SAVESTATE_MAX_SIZE)
+			break;
+		for (int j = 0; j < shot.size; j++)
+			shot.data[j] = (unsigned char)file.u8();
+		snapshots.push_back(shot);
+	}
+	if (file.failed || snapshots.size() != snapshotCount) {
+		std::cout << "Replay " << path << " is cut short" << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,115 @@
+#include "Resolution.h"
+#include "RenderState.h"
+#include "Profiler.h"
+
+#include <cmath>
+#include <iostream>
+
+ResolutionScaler::ResolutionScaler() : enabled(true), minScale(RESOLUTION_MIN_SCALE), maxScale(RESOLUTION_MAX_SCALE), scale(RESOLUTION_MAX_SCALE),
+	smoothed(RESOLUTION_TARGET * RESOLUTION_HEADROOM), windowWidth(0), windowHeight(0), renderWidth(0), renderHeight(0), framebuffer(0), colour(0) {}
+
+bool ResolutionScaler::init(int windowWidth, int windowHeight) {
+	this->windowWidth = windowWidth;
+	this->windowHeight = windowHeight;
+	if (maxScale > RESOLUTION_LIMIT)
+		maxScale = RESOLUTION_LIMIT;
+	if (minScale > maxScale)
+		minScale = maxScale;
+	scale = maxScale;
+	smoothed = RESOLUTION_TARGET * RESOLUTION_HEADROOM;
+	resize();
+	if (!enabled) {
+		shutdown();
+		return false;
+	}
+
+	int width = (int)ceil(windowWidth * maxScale);
+	int height = (int)ceil(windowHeight * maxScale);
+	glGenTextures(1, &colour);
+	renderState.bindTexture(colour);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colour, 0);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!complete) {
+		std::cout << "No offscreen framebuffer of " << width << "x" << height << ", drawing at the window's resolution" << std::endl;
+		shutdown();
+		return false;
+	}
+	return true;
+}
+
+void ResolutionScaler::shutdown() {
+	if (framebuffer)
+		glDeleteFramebuffers(1, &framebuffer);
+	if (colour)
+		renderState.deleteTexture(colour);
+	framebuffer = 0;
+	colour = 0;
+	enabled = false;
+	scale = 1.0f;
+	resize();
+}
+
+void ResolutionScaler::begin() {
+	if (!enabled) {
+		glViewport(0, 0, windowWidth, windowHeight);
+		return;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, renderWidth, renderHeight);
+	// Clears would otherwise fill the whole buffer, sized for maxScale
+	glScissor(0, 0, renderWidth, renderHeight);
+	glEnable(GL_SCISSOR_TEST);
+}
+
+void ResolutionScaler::end() {
+	if (!enabled)
+		return;
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+		renderWidth == windowWidth && renderHeight == windowHeight ? GL_NEAREST : GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, windowWidth, windowHeight);
+}
+
+void ResolutionScaler::update(double seconds) {
+	smoothed += (seconds - smoothed) * RESOLUTION_SMOOTHING;
+	if (!enabled)
+		return;
+
+	double ratio = RESOLUTION_TARGET * RESOLUTION_HEADROOM / smoothed;
+	if (fabs(ratio - 1.0) < RESOLUTION_DEADBAND)
+		return;
+	float wanted = scale * (float)sqrt(ratio);
+	if (wanted > scale + RESOLUTION_MAX_STEP)
+		wanted = scale + RESOLUTION_MAX_STEP;
+	if (wanted < scale - RESOLUTION_MAX_STEP)
+		wanted = scale - RESOLUTION_MAX_STEP;
+	if (wanted > maxScale)
+		wanted = maxScale;
+	if (wanted < minScale)
+		wanted = minScale;
+	scale = wanted;
+	resize();
+}
+
+void ResolutionScaler::resize() {
+	renderWidth = (int)(windowWidth * scale + 0.5f);
+	renderHeight = (int)(windowHeight * scale + 0.5f);
+	if (renderWidth < 1)
+		renderWidth = 1;
+	if (renderHeight < 1)
+		renderHeight = 1;
+}
+
+void ResolutionScaler::report() {
+	profiler.gauge("render scale %", scale * 100.0);
+	profiler.gauge("frame ms smoothed", smoothed * 1000.0);
+}
@@ -0,0 +1,58 @@
+#ifndef Resolution_h
+#define Resolution_h
+
+#ifdef _WINDOWS
+#include <GL/glew.h>
+#endif
+#include <SDL_opengl.h>
+
+#define RESOLUTION_TARGET (1.0 / 60.0)	//seconds a frame may take
+#define RESOLUTION_HEADROOM 0.85	//aims for this much of the target, so a spike does not drop a frame
+#define RESOLUTION_DEADBAND 0.1		//frame times this close to the aim leave the scale alone
+#define RESOLUTION_SMOOTHING 0.1	//weight of the newest frame in the average the controller watches
+#define RESOLUTION_MAX_STEP 0.05f	//scale change in one frame
+#define RESOLUTION_MIN_SCALE 0.5f
+#define RESOLUTION_MAX_SCALE 1.0f
+#define RESOLUTION_LIMIT 2.0f		//highest max scale allowed, 2x supersampling
+
+// The game draws into an offscreen framebuffer at scale times the window size, which is
+// then stretched over the window. Each frame's time is fed back into the scale: cost
+// goes with the pixel count, so a frame taking r times the aim scales by 1/sqrt(r).
+// The colour buffer is allocated once at maxScale and only a corner of it is drawn to,
+// so changing the scale never reallocates. Without framebuffer objects, or when
+// disabled, drawing goes straight to the window as it always did.
+class ResolutionScaler {
+public:
+	ResolutionScaler();
+
+	bool enabled;
+	float minScale;
+	float maxScale;
+	float scale;
+	double smoothed;	//seconds, running average of frame time
+
+	int windowWidth;	//of the drawable, in pixels
+	int windowHeight;
+	int renderWidth;	//being drawn at
+	int renderHeight;
+
+	bool init(int windowWidth, int windowHeight);
+	void shutdown();
+
+	// Around everything drawn in a frame: begin() targets the offscreen buffer, end()
+	// stretches it over the window and leaves the window's framebuffer bound
+	void begin();
+	void end();
+	// seconds the frame took to draw, including the GPU
+	void update(double seconds);
+	// Scale and frame time to the profiler
+	void report();
+
+private:
+	GLuint framebuffer;
+	GLuint colour;
+
+	void resize();
+};
+
+#endif
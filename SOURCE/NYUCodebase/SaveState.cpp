@@ -0,0 +1,189 @@
+#include "SaveState.h"
+#include "Protocol.h"
+#include "Compression.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+enum SaveMatchFlag { SAVE_DEAD = 1, SAVE_OVER = 2 };
+enum SaveFighterFlag {
+	SAVE_COLLIDED = 1,	//4 bits, top bot left right
+	SAVE_IN_AIR = 16, SAVE_ATTACKING = 32, SAVE_WRECKED = 64, SAVE_FIGHTER_DEAD = 128,
+	SAVE_FIRST_JUMP = 256, SAVE_SECOND_JUMP = 512
+};
+
+static unsigned int checksum(const unsigned char* data, int size) {
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 16777619u;
+	return hash;
+}
+
+static void writeBody(PacketWriter& body, const MatchState& state, const char* stageName) {
+	body.text(stageName, STAGE_NAME_LENGTH);
+	body.u32(state.tick);
+	body.f32(state.deathCounter);
+	body.u8((state.dead ? SAVE_DEAD : 0) | (state.over ? SAVE_OVER : 0));
+	for (int k = 0; k < 2; k++) {
+		const Fighter& fighter = state.fighters[k];
+		for (int i = 0; i < 2; i++)
+			body.f32(fighter.position[i]);
+		for (int i = 0; i < 2; i++)
+			body.f32(fighter.speed[i]);
+		for (int i = 0; i < 2; i++)
+			body.f32(fighter.halfSize[i]);
+		body.f32(fighter.facing);
+		body.f32(fighter.cooldown);
+		body.f32(fighter.timeSinceLastJump);
+		body.u32((unsigned int)fighter.health);
+		body.u32((unsigned int)fighter.clip);
+		body.u32((unsigned int)fighter.clipTick);
+		body.u32((unsigned int)fighter.frame);
+		body.u32(fighter.events);
+		unsigned int flags = 0;
+		for (int i = 0; i < 4; i++)
+			flags |= fighter.collided[i] ? SAVE_COLLIDED << i : 0;
+		flags |= (fighter.inAir ? SAVE_IN_AIR : 0) | (fighter.attacking ? SAVE_ATTACKING : 0) |
+			(fighter.gettingWrecked ? SAVE_WRECKED : 0) | (fighter.dead ? SAVE_FIGHTER_DEAD : 0) |
+			(fighter.firstJump ? SAVE_FIRST_JUMP : 0) | (fighter.secondJump ? SAVE_SECOND_JUMP : 0);
+		body.u16(flags);
+	}
+	body.u32(state.hash);
+}
+
+static void readBody(PacketReader& body, unsigned int version, MatchState& state, char* stageName) {
+	body.text(stageName, STAGE_NAME_LENGTH);
+	state.tick = body.u32();
+	state.deathCounter = body.f32();
+	unsigned int matchFlags = body.u8();
+	state.dead = (matchFlags & SAVE_DEAD) != 0;
+	state.over = (matchFlags & SAVE_OVER) != 0;
+	for (int k = 0; k < 2; k++) {
+		Fighter& fighter = state.fighters[k];
+		for (int i = 0; i < 2; i++)
+			fighter.position[i] = body.f32();
+		for (int i = 0; i < 2; i++)
+			fighter.speed[i] = body.f32();
+		for (int i = 0; i < 2; i++)
+			fighter.halfSize[i] = body.f32();
+		fighter.facing = body.f32();
+		fighter.cooldown = body.f32();
+		fighter.timeSinceLastJump = body.f32();
+		fighter.health = (int)body.u32();
+		fighter.clip = (int)body.u32();
+		fighter.clipTick = (int)body.u32();
+		fighter.frame = (int)body.u32();
+		fighter.events = body.u32();
+		unsigned int flags = body.u16();
+		for (int i = 0; i < 4; i++)
+			fighter.collided[i] = (flags & (SAVE_COLLIDED << i)) != 0;
+		fighter.inAir = (flags & SAVE_IN_AIR) != 0;
+		fighter.attacking = (flags & SAVE_ATTACKING) != 0;
+		fighter.gettingWrecked = (flags & SAVE_WRECKED) != 0;
+		fighter.dead = (flags & SAVE_FIGHTER_DEAD) != 0;
+		fighter.firstJump = (flags & SAVE_FIRST_JUMP) != 0;
+		fighter.secondJump = (flags & SAVE_SECOND_JUMP) != 0;
+	}
+	if (version >= 2)
+		state.hash = body.u32();
+}
+
+int writeSaveState(const MatchState& state, const char* stageName, bool compress, unsigned char* data, int capacity) {
+	unsigned char raw[SAVESTATE_MAX_SIZE];
+	PacketWriter body(raw, sizeof(raw));
+	writeBody(body, state, stageName);
+	if (body.overflow || capacity < SAVESTATE_HEADER_SIZE)
+		return 0;
+
+	// Stored as is when coding does not make it any smaller
+	int stored = 0;
+	if (compress) {
+		stored = lzCompress(raw, body.size, data + SAVESTATE_HEADER_SIZE, capacity - SAVESTATE_HEADER_SIZE);
+		if (stored >= body.size)
+			stored = 0;
+	}
+	if (stored == 0) {
+		if (capacity - SAVESTATE_HEADER_SIZE < body.size)
+			return 0;
+		memcpy(data + SAVESTATE_HEADER_SIZE, raw, body.size);
+	}
+
+	PacketWriter header(data, SAVESTATE_HEADER_SIZE);
+	header.u32(SAVESTATE_MAGIC);
+	header.u16(SAVESTATE_VERSION);
+	header.u16(stored ? SAVESTATE_COMPRESSED : 0);
+	header.u32(checksum(raw, body.size));
+	header.u16(body.size);
+	header.u16(stored ? stored : body.size);
+	return SAVESTATE_HEADER_SIZE + (stored ? stored : body.size);
+}
+
+bool readSaveState(const unsigned char* data, int size, MatchState& state, char* stageName) {
+	PacketReader header(data, size);
+	unsigned int magic = header.u32();
+	unsigned int version = header.u16();
+	unsigned int flags = header.u16();
+	unsigned int sum = header.u32();
+	int bodySize = (int)header.u16();
+	int storedSize = (int)header.u16();
+	if (header.failed || magic != SAVESTATE_MAGIC)
+		return false;
+	if (version > SAVESTATE_VERSION) {
+		std::cout << "Save state is version " << version << ", this build reads up to " << SAVESTATE_VERSION << std::endl;
+		return false;
+	}
+	if (bodySize > SAVESTATE_MAX_SIZE || storedSize > size - SAVESTATE_HEADER_SIZE)
+		return false;
+
+	unsigned char raw[SAVESTATE_MAX_SIZE];
+	const unsigned char* stored = data + SAVESTATE_HEADER_SIZE;
+	if (flags & SAVESTATE_COMPRESSED) {
+		if (!lzDecompress(stored, storedSize, raw, bodySize))
+			return false;
+	}
+	else {
+		if (storedSize != bodySize)
+			return false;
+		memcpy(raw, stored, bodySize);
+	}
+	if (checksum(raw, bodySize) != sum)
+		return false;
+
+	MatchState loaded = state;
+	char name[STAGE_NAME_LENGTH];
+	PacketReader body(raw, bodySize);
+	readBody(body, version, loaded, name);
+	if (body.failed)
+		return false;
+	state = loaded;
+	memcpy(stageName, name, STAGE_NAME_LENGTH);
+	return true;
+}
+
+bool saveStateFile(const std::string& path, const MatchState& state, const char* stageName, bool compress) {
+	unsigned char data[SAVESTATE_MAX_SIZE];
+	int size = writeSaveState(state, stageName, compress, data, sizeof(data));
+	std::ofstream file(path.c_str(), std::ios::binary);
+	if (size == 0 || !file) {
+		std::cout << "Unable to write save state " << path << std::endl;
+		return false;
+	}
+	file.write((const char*)data, size);
+	return file.good();
+}
+
+bool loadStateFile(const std::string& path, MatchState& state, char* stageName) {
+	unsigned char data[SAVESTATE_MAX_SIZE];
+	std::ifstream file(path.c_str(), std::ios::binary);
+	if (!file) {
+		std::cout << "Unable to open save state " << path << std::endl;
+		return false;
+	}
+	file.read((char*)data, sizeof(data));
+	if (!readSaveState(data, (int)file.gcount(), state, stageName)) {
+		std::cout << "Save state " << path << " is damaged or not a save state" << std::endl;
+		return false;
+	}
+	return true;
+}
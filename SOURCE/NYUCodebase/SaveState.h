@@ -0,0 +1,39 @@
+#ifndef SaveState_h
+#define SaveState_h
+
+#include "Match.h"
+#include "Stage.h"
+
+#include <string>
+
+// A save state is a MatchState and the stage it was on, laid out the same whatever the
+// compiler, padding or byte order of the machine that wrote it:
+//   u32 magic       SAVESTATE_MAGIC
+//   u16 version     SAVESTATE_VERSION of the writer
+//   u16 flags       SAVESTATE_COMPRESSED when the body is LZ coded (Compression.h)
+//   u32 checksum    FNV-1a of the uncoded body
+//   u16 bodySize    uncoded
+//   u16 storedSize  as it follows
+//   body: text stage, u32 tick, f32 deathCounter, u8 match flags, then for each fighter
+//     f32 position[2] speed[2] halfSize[2] facing cooldown timeSinceLastJump,
+//     u32 health clip clipTick frame events, u16 fighter flags,
+//     then u32 running hash (version 2)
+// Multi-byte fields are little-endian as in Protocol.h. A new field goes on the end of
+// the body with a version bump, and reading an older version leaves it as it was.
+#define SAVESTATE_MAGIC 0x31535653 // "SVS1"
+#define SAVESTATE_VERSION 2
+#define SAVESTATE_MAX_SIZE 512
+#define SAVESTATE_HEADER_SIZE 16
+
+enum SaveStateFlag { SAVESTATE_COMPRESSED = 1 };
+
+// Returns the size written, 0 when it does not fit in capacity
+int writeSaveState(const MatchState& state, const char* stageName, bool compress, unsigned char* data, int capacity);
+// Leaves state alone unless the whole save reads back and its checksum matches.
+// stageName gets STAGE_NAME_LENGTH bytes.
+bool readSaveState(const unsigned char* data, int size, MatchState& state, char* stageName);
+
+bool saveStateFile(const std::string& path, const MatchState& state, const char* stageName, bool compress);
+bool loadStateFile(const std::string& path, MatchState& state, char* stageName);
+
+#endif
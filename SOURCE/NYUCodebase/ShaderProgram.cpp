@@ -1,5 +1,6 @@
 
 #include "ShaderProgram.h"
+#include "RenderState.h"
 
 ShaderProgram::ShaderProgram(const char *vertexShaderFile, const char *fragmentShaderFile) {
     
@@ -20,13 +21,18 @@ ShaderProgram::ShaderProgram(const char *vertexShaderFile, const char *fragmentS
         printf("Error linking shader program!\n");
     }
     
-    modelMatrixUniform = glGetUniformLocation(programID, "modelMatrix");
-    projectionMatrixUniform = glGetUniformLocation(programID, "projectionMatrix");
-    viewMatrixUniform = glGetUniformLocation(programID, "viewMatrix");
+    findLocations();
+}
+
+ShaderProgram::ShaderProgram(GLuint programID, GLuint vertexShader, GLuint fragmentShader) : programID(programID), vertexShader(vertexShader), fragmentShader(fragmentShader) {
+    findLocations();
+}
+
+void ShaderProgram::findLocations() {
+    viewProjectionMatrixUniform = glGetUniformLocation(programID, "viewProjectionMatrix");
     
     positionAttribute = glGetAttribLocation(programID, "position");
     texCoordAttribute = glGetAttribLocation(programID, "texCoord");
-    
 }
 
 ShaderProgram::~ShaderProgram() {
@@ -80,17 +86,7 @@ GLuint ShaderProgram::loadShaderFromString(const std::string &shaderContents, GL
     return shaderID;
 }
 
-void ShaderProgram::setViewMatrix(const Matrix &matrix) {
-    glUseProgram(programID);
-    glUniformMatrix4fv(viewMatrixUniform, 1, GL_FALSE, matrix.ml);
-}
-
-void ShaderProgram::setModelMatrix(const Matrix &matrix) {
-    glUseProgram(programID);
-    glUniformMatrix4fv(modelMatrixUniform, 1, GL_FALSE, matrix.ml);
-}
-
-void ShaderProgram::setProjectionMatrix(const Matrix &matrix) {
-    glUseProgram(programID);
-    glUniformMatrix4fv(projectionMatrixUniform, 1, GL_FALSE, matrix.ml);    
+void ShaderProgram::setViewProjectionMatrix(const Matrix &matrix) {
+    renderState.useProgram(programID);
+    renderState.uniformMatrix(viewProjectionMatrixUniform, matrix.ml);
 }
@@ -13,20 +13,21 @@
 class ShaderProgram {
     public:
         ShaderProgram(const char *vertexShaderFile, const char *fragmentShaderFile);
+        // Takes over a program already linked (or loaded from a binary) by ShaderRegistry
+        ShaderProgram(GLuint programID, GLuint vertexShader, GLuint fragmentShader);
         ~ShaderProgram();
     
-        void setModelMatrix(const Matrix &matrix);
-        void setProjectionMatrix(const Matrix &matrix);
-        void setViewMatrix(const Matrix &matrix);
+        // view * projection; vertices are already in world space
+        void setViewProjectionMatrix(const Matrix &matrix);
     
         GLuint loadShaderFromString(const std::string &shaderContents, GLenum type);
         GLuint loadShaderFromFile(const std::string &shaderFile, GLenum type);
+        // Uniform and attribute locations, once linked
+        void findLocations();
     
         GLuint programID;
     
-        GLuint projectionMatrixUniform;
-        GLuint modelMatrixUniform;
-        GLuint viewMatrixUniform;
+        GLuint viewProjectionMatrixUniform;
     
         GLuint positionAttribute;
         GLuint texCoordAttribute;
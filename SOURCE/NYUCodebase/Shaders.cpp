@@ -0,0 +1,263 @@
+#include "Shaders.h"
+#include "Clock.h"
+
+#include <SDL.h>
+#include <vector>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// Looked up at run time: older GLEW and the macOS headers don't have all of them
+typedef void (APIENTRY* GetProgramBinaryFunction)(GLuint program, GLsizei size, GLsizei* length, GLenum* format, void* binary);
+typedef void (APIENTRY* ProgramBinaryFunction)(GLuint program, GLenum format, const void* binary, GLsizei length);
+typedef void (APIENTRY* ProgramParameterFunction)(GLuint program, GLenum name, GLint value);
+typedef void (APIENTRY* MaxCompilerThreadsFunction)(GLuint count);
+
+struct ShaderDefinition {
+	const char* name;
+	const char* vertex;
+	const char* fragment;
+};
+
+static const ShaderDefinition definitions[SHADER_COUNT] = {
+	{ "textured", "vertex_textured.glsl", "fragment_textured.glsl" },	//sprites, text and tiles
+	{ "flat", "vertex.glsl", "fragment.glsl" },	//plain white, for shapes with no texture
+};
+
+ShaderRegistry shaders;
+
+// 64 bit FNV-1a, continued from hash
+static unsigned long long hashText(unsigned long long hash, const std::string& text) {
+	for (size_t i = 0; i < text.size(); i++) {
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ULL;
+	}
+	// Keeps "ab" + "c" apart from "a" + "bc"
+	hash ^= 0xff;
+	hash *= 1099511628211ULL;
+	return hash;
+}
+
+static std::string glText(GLenum name) {
+	const GLubyte* text = glGetString(name);
+	return text ? (const char*)text : "";
+}
+
+static bool readSource(const std::string& path, std::string& source) {
+	std::ifstream infile(path);
+	if (infile.fail()) {
+		std::cout << "Error opening shader file:" << path << std::endl;
+		return false;
+	}
+	std::stringstream buffer;
+	buffer << infile.rdbuf();
+	source = buffer.str();
+	return true;
+}
+
+static GLuint startCompile(const std::string& source, GLenum type) {
+	GLuint shader = glCreateShader(type);
+	const char* text = source.c_str();
+	GLint length = (GLint)source.size();
+	glShaderSource(shader, 1, &text, &length);
+	glCompileShader(shader);
+	return shader;
+}
+
+// Prints the compile log of a shader that failed, true if it compiled
+static bool compiled(GLuint shader, const std::string& path) {
+	GLint success;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (success == GL_TRUE)
+		return true;
+	GLchar messages[512];
+	glGetShaderInfoLog(shader, sizeof(messages), 0, &messages[0]);
+	std::cout << path << ": " << messages << std::endl;
+	return false;
+}
+
+static bool loadBinary(const std::string& path, const unsigned int key[2], ProgramBinaryFunction programBinary, GLuint& program) {
+	std::ifstream infile(path, std::ios::binary);
+	ShaderCacheHeader header;
+	if (infile.fail() || !infile.read((char*)&header, sizeof(header)))
+		return false;
+	if (header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.key[0] != key[0] || header.key[1] != key[1] || header.length == 0)
+		return false;
+	std::vector<char> binary(header.length);
+	if (!infile.read(&binary[0], binary.size()))
+		return false;
+
+	program = glCreateProgram();
+	programBinary(program, header.format, &binary[0], (GLsizei)binary.size());
+	// Drivers may still turn a binary down, say after an update that kept the version string
+	GLint success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (success == GL_TRUE)
+		return true;
+	glDeleteProgram(program);
+	program = 0;
+	return false;
+}
+
+static void saveBinary(const std::string& path, const unsigned int key[2], GetProgramBinaryFunction getProgramBinary, GLuint program) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	ShaderCacheHeader header;
+	header.magic = SHADER_CACHE_MAGIC;
+	header.version = SHADER_CACHE_VERSION;
+	header.key[0] = key[0];
+	header.key[1] = key[1];
+	GLenum format = 0;
+	GLsizei written = 0;
+	getProgramBinary(program, length, &written, &format, &binary[0]);
+	if (written <= 0)
+		return;
+	header.format = format;
+	header.length = (unsigned int)written;
+
+	std::ofstream outfile(path, std::ios::binary);
+	outfile.write((const char*)&header, sizeof(header));
+	outfile.write(&binary[0], written);
+	if (!outfile.good())
+		std::cout << "Could not write shader cache " << path << std::endl;
+}
+
+ShaderRegistry::ShaderRegistry() : useCache(true), parallel(false) {
+	stats.seconds = 0;
+	stats.cached = 0;
+	stats.compiled = 0;
+	stats.failed = 0;
+	for (int i = 0; i < SHADER_COUNT; i++)
+		programs[i] = nullptr;
+}
+
+bool ShaderRegistry::load(const std::string& folder) {
+	double started = clockSeconds();
+	shutdown();
+	stats.cached = 0;
+	stats.compiled = 0;
+	stats.failed = 0;
+
+	GetProgramBinaryFunction getProgramBinary = nullptr;
+	ProgramBinaryFunction programBinary = nullptr;
+	ProgramParameterFunction programParameter = nullptr;
+	if (useCache && SDL_GL_ExtensionSupported("GL_ARB_get_program_binary")) {
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		getProgramBinary = (GetProgramBinaryFunction)SDL_GL_GetProcAddress("glGetProgramBinary");
+		programBinary = (ProgramBinaryFunction)SDL_GL_GetProcAddress("glProgramBinary");
+		programParameter = (ProgramParameterFunction)SDL_GL_GetProcAddress("glProgramParameteri");
+		// A driver can have the extension and still offer no format to save in
+		if (formats == 0 || !getProgramBinary || !programBinary || !programParameter)
+			getProgramBinary = nullptr;
+	}
+	bool binaries = getProgramBinary != nullptr;
+
+	parallel = false;
+	MaxCompilerThreadsFunction maxCompilerThreads = nullptr;
+	if (SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile"))
+		maxCompilerThreads = (MaxCompilerThreadsFunction)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+	else if (SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile"))
+		maxCompilerThreads = (MaxCompilerThreadsFunction)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsARB");
+	if (maxCompilerThreads) {
+		// As many threads as the driver likes
+		maxCompilerThreads(0xFFFFFFFF);
+		parallel = true;
+	}
+
+	std::string driver = glText(GL_VENDOR) + "\n" + glText(GL_RENDERER) + "\n" + glText(GL_VERSION);
+	GLuint built[SHADER_COUNT];
+	GLuint vertex[SHADER_COUNT];
+	GLuint fragment[SHADER_COUNT];
+	unsigned int keys[SHADER_COUNT][2];
+	bool linking[SHADER_COUNT];
+
+	// Cached programs load now, the rest start compiling
+	for (int i = 0; i < SHADER_COUNT; i++) {
+		const ShaderDefinition& definition = definitions[i];
+		built[i] = 0;
+		vertex[i] = 0;
+		fragment[i] = 0;
+		linking[i] = false;
+		std::string vertexSource, fragmentSource;
+		if (!readSource(folder + definition.vertex, vertexSource) || !readSource(folder + definition.fragment, fragmentSource)) {
+			stats.failed++;
+			continue;
+		}
+		unsigned long long key = hashText(hashText(hashText(14695981039346656037ULL, vertexSource), fragmentSource), driver);
+		keys[i][0] = (unsigned int)key;
+		keys[i][1] = (unsigned int)(key >> 32);
+		if (binaries && loadBinary(folder + definition.name + ".programbin", keys[i], programBinary, built[i])) {
+			stats.cached++;
+			continue;
+		}
+		vertex[i] = startCompile(vertexSource, GL_VERTEX_SHADER);
+		fragment[i] = startCompile(fragmentSource, GL_FRAGMENT_SHADER);
+		linking[i] = true;
+	}
+
+	// Linking doesn't wait for the compiles either, a failed one just fails the link
+	for (int i = 0; i < SHADER_COUNT; i++) {
+		if (!linking[i])
+			continue;
+		built[i] = glCreateProgram();
+		glAttachShader(built[i], vertex[i]);
+		glAttachShader(built[i], fragment[i]);
+		if (binaries)
+			programParameter(built[i], GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(built[i]);
+	}
+
+	// Only now is anything asked for a result
+	for (int i = 0; i < SHADER_COUNT; i++) {
+		const ShaderDefinition& definition = definitions[i];
+		if (linking[i]) {
+			GLint success;
+			glGetProgramiv(built[i], GL_LINK_STATUS, &success);
+			if (success != GL_TRUE) {
+				bool vertexCompiled = compiled(vertex[i], folder + definition.vertex);
+				bool fragmentCompiled = compiled(fragment[i], folder + definition.fragment);
+				if (vertexCompiled && fragmentCompiled)
+					std::cout << "Error linking shader program " << definition.name << std::endl;
+				glDeleteProgram(built[i]);
+				glDeleteShader(vertex[i]);
+				glDeleteShader(fragment[i]);
+				stats.failed++;
+				continue;
+			}
+			stats.compiled++;
+			if (binaries)
+				saveBinary(folder + definition.name + ".programbin", keys[i], getProgramBinary, built[i]);
+		}
+		if (built[i])
+			programs[i] = new ShaderProgram(built[i], vertex[i], fragment[i]);
+	}
+
+	stats.seconds = clockSeconds() - started;
+	return stats.failed == 0;
+}
+
+void ShaderRegistry::shutdown() {
+	for (int i = 0; i < SHADER_COUNT; i++) {
+		delete programs[i];
+		programs[i] = nullptr;
+	}
+}
+
+ShaderProgram* ShaderRegistry::get(ShaderId id) const {
+	return programs[id];
+}
+
+void ShaderRegistry::print() const {
+	std::cout << "Shaders: " << SHADER_COUNT << " programs in " << stats.seconds * 1000.0 << "ms, " << stats.cached << " from the cache, "
+		<< stats.compiled << " compiled" << (parallel && stats.compiled > 1 ? " in parallel" : "");
+	if (stats.failed > 0)
+		std::cout << ", " << stats.failed << " failed";
+	std::cout << std::endl;
+}
@@ -0,0 +1,63 @@
+#ifndef Shaders_h
+#define Shaders_h
+
+#include "ShaderProgram.h"
+
+#include <string>
+
+// A linked program is cached as <name>.programbin next to its sources:
+// ShaderCacheHeader, then length bytes of glGetProgramBinary output. The key hashes
+// both sources and the GL vendor, renderer and version strings, so an edit or a driver
+// update means compiling again.
+#define SHADER_CACHE_MAGIC 0x31425053 // "SPB1"
+#define SHADER_CACHE_VERSION 1
+
+// Every program the game draws with, see the table in Shaders.cpp
+enum ShaderId { SHADER_TEXTURED, SHADER_FLAT, SHADER_COUNT };
+
+struct ShaderCacheHeader {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int key[2];
+	unsigned int format;	//binary format the driver gave
+	unsigned int length;
+};
+
+struct ShaderStats {
+	double seconds;		//everything load() did
+	int cached;			//programs loaded from a binary
+	int compiled;
+	int failed;
+};
+
+// Builds all the programs at once at startup. Those with a current cache entry are
+// loaded from their binary; the rest are all compiled, then all linked, and only then
+// checked, so a driver with KHR_parallel_shader_compile works on them side by side.
+// Without ARB_get_program_binary everything is compiled every time.
+class ShaderRegistry {
+public:
+	ShaderRegistry();
+
+	bool useCache;
+	bool parallel;		//the driver was asked to compile on its own threads
+	ShaderStats stats;
+
+	// Sources and cache files are in folder; false if any program failed
+	bool load(const std::string& folder);
+	// Deletes the programs, while the context is still there
+	void shutdown();
+	// Null if it failed to build
+	ShaderProgram* get(ShaderId id) const;
+	// How long load() took and where the programs came from, to the console
+	void print() const;
+
+private:
+	ShaderProgram* programs[SHADER_COUNT];
+
+	ShaderRegistry(const ShaderRegistry&);
+	ShaderRegistry& operator=(const ShaderRegistry&);
+};
+
+extern ShaderRegistry shaders;
+
+#endif
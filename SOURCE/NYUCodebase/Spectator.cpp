@@ -0,0 +1,248 @@
+#include "Spectator.h"
+
+#include <cmath>
+#include <cstring>
+
+enum FeedFighterFlag { FEED_LEFT = 1, FEED_IN_AIR = 2, FEED_ATTACKING = 4, FEED_WRECKED = 8, FEED_DEAD = 16 };
+enum FeedMatchFlag { FEED_KNOCKOUT = 1, FEED_OVER = 2 };
+
+static int quantize(float value, float scale) {
+	return (int)floor(value * scale + 0.5f);
+}
+
+static unsigned int zigzag(int value) {
+	return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+static int unzigzag(unsigned int value) {
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static void writeFrame(PacketWriter& packet, const SpectatorFrame& frame, const SpectatorFrame& base) {
+	unsigned int mask = 0;
+	for (int i = 0; i < FIELD_COUNT; i++) {
+		if (frame.fields[i] != base.fields[i])
+			mask |= 1u << i;
+	}
+	packet.varint(mask);
+	for (int i = 0; i < FIELD_COUNT; i++) {
+		if (mask & (1u << i))
+			packet.varint(zigzag(frame.fields[i] - base.fields[i]));
+	}
+}
+
+static void readFrame(PacketReader& packet, SpectatorFrame& frame, const SpectatorFrame& base) {
+	unsigned int mask = packet.varint();
+	for (int i = 0; i < FIELD_COUNT; i++)
+		frame.fields[i] = base.fields[i] + ((mask & (1u << i)) ? unzigzag(packet.varint()) : 0);
+}
+
+void quantizeMatch(const Match& match, SpectatorFrame& frame) {
+	frame.fields[FIELD_MATCH_FLAGS] = (match.dead ? FEED_KNOCKOUT : 0) | (match.over ? FEED_OVER : 0);
+	for (int k = 0; k < 2; k++) {
+		const Fighter& fighter = match.fighters[k];
+		int* fields = frame.fields + k * FIELD_FIGHTER_COUNT;
+		fields[FIELD_X] = quantize(fighter.position[0], SPECTATE_POSITION_SCALE);
+		fields[FIELD_Y] = quantize(fighter.position[1], SPECTATE_POSITION_SCALE);
+		fields[FIELD_SPEED_X] = quantize(fighter.speed[0], SPECTATE_SPEED_SCALE);
+		fields[FIELD_SPEED_Y] = quantize(fighter.speed[1], SPECTATE_SPEED_SCALE);
+		fields[FIELD_HEALTH] = fighter.health;
+		fields[FIELD_CLIP] = fighter.clip;
+		fields[FIELD_FRAME] = fighter.frame;
+		fields[FIELD_FLAGS] = (fighter.facing < 0 ? FEED_LEFT : 0) | (fighter.inAir ? FEED_IN_AIR : 0) |
+			(fighter.attacking ? FEED_ATTACKING : 0) | (fighter.gettingWrecked ? FEED_WRECKED : 0) | (fighter.dead ? FEED_DEAD : 0);
+		fields[FIELD_EVENTS] = fighter.events;
+	}
+}
+
+void dequantizeMatch(const SpectatorFrame& frame, Match& match) {
+	match.dead = (frame.fields[FIELD_MATCH_FLAGS] & FEED_KNOCKOUT) != 0;
+	match.over = (frame.fields[FIELD_MATCH_FLAGS] & FEED_OVER) != 0;
+	for (int k = 0; k < 2; k++) {
+		Fighter& fighter = match.fighters[k];
+		const int* fields = frame.fields + k * FIELD_FIGHTER_COUNT;
+		fighter.position[0] = fields[FIELD_X] / SPECTATE_POSITION_SCALE;
+		fighter.position[1] = fields[FIELD_Y] / SPECTATE_POSITION_SCALE;
+		fighter.speed[0] = fields[FIELD_SPEED_X] / SPECTATE_SPEED_SCALE;
+		fighter.speed[1] = fields[FIELD_SPEED_Y] / SPECTATE_SPEED_SCALE;
+		fighter.health = fields[FIELD_HEALTH];
+		fighter.clip = fields[FIELD_CLIP];
+		fighter.frame = fields[FIELD_FRAME];
+		int flags = fields[FIELD_FLAGS];
+		fighter.facing = (flags & FEED_LEFT) ? -1.0f : 1.0f;
+		fighter.inAir = (flags & FEED_IN_AIR) != 0;
+		fighter.attacking = (flags & FEED_ATTACKING) != 0;
+		fighter.gettingWrecked = (flags & FEED_WRECKED) != 0;
+		fighter.dead = (flags & FEED_DEAD) != 0;
+		fighter.events = fields[FIELD_EVENTS];
+	}
+}
+
+SpectatorEncoder::SpectatorEncoder() {
+	reset();
+}
+
+void SpectatorEncoder::reset() {
+	frameNumber = 0;
+	keyCount = 0;
+	newestKey = -1;
+	batchFirst = 0;
+	batchCount = 0;
+}
+
+bool SpectatorEncoder::record(const Match& match) {
+	if (batchCount == SPECTATE_BATCH)
+		clearBatch();
+	if (batchCount == 0)
+		batchFirst = frameNumber;
+	SpectatorFrame& frame = batch[batchCount++];
+	quantizeMatch(match, frame);
+
+	if (frameNumber % SPECTATE_KEYFRAME_INTERVAL == 0) {
+		newestKey = (newestKey + 1) % SPECTATE_KEYFRAMES;
+		keyframes[newestKey] = frame;
+		keyNumbers[newestKey] = frameNumber;
+		if (keyCount < SPECTATE_KEYFRAMES)
+			keyCount++;
+	}
+	frameNumber++;
+	return batchCount == SPECTATE_BATCH;
+}
+
+void SpectatorEncoder::clearBatch() {
+	batchCount = 0;
+}
+
+const SpectatorFrame* SpectatorEncoder::keyframe(unsigned int number) const {
+	for (int i = 0; i < keyCount; i++) {
+		if (keyNumbers[i] == number)
+			return &keyframes[i];
+	}
+	return nullptr;
+}
+
+bool SpectatorEncoder::hasKeyframe(unsigned int number) const {
+	return keyframe(number) != nullptr;
+}
+
+unsigned int SpectatorEncoder::latestKeyframe() const {
+	return newestKey >= 0 ? keyNumbers[newestKey] : 0;
+}
+
+int SpectatorEncoder::write(unsigned int acked, bool withKeyframe, unsigned char* data, int capacity) const {
+	if (newestKey < 0 || batchCount == 0)
+		return 0;
+	const SpectatorFrame* base = keyframe(acked);
+	if (!base) {
+		// Nothing in common with this spectator, code against the keyframe we send along
+		acked = latestKeyframe();
+		base = &keyframes[newestKey];
+		withKeyframe = true;
+	}
+
+	PacketWriter packet(data, capacity);
+	packet.u8(PACKET_FEED);
+	packet.u32(acked);
+	packet.u8(withKeyframe ? 1 : 0);
+	if (withKeyframe) {
+		SpectatorFrame zero;
+		memset(&zero, 0, sizeof(zero));
+		packet.u32(latestKeyframe());
+		writeFrame(packet, keyframes[newestKey], zero);
+	}
+	packet.u32(batchFirst);
+	packet.u8(batchCount);
+	for (int i = 0; i < batchCount; i++)
+		writeFrame(packet, batch[i], i == 0 ? *base : batch[i - 1]);
+	return packet.overflow ? 0 : packet.size;
+}
+
+SpectatorDecoder::SpectatorDecoder() {
+	reset();
+}
+
+void SpectatorDecoder::reset() {
+	started = false;
+	newest = 0;
+	ackWanted = false;
+	ackNumber = SPECTATE_NO_KEYFRAME;
+	rejected = 0;
+	keyCount = 0;
+	newestKey = -1;
+	for (int i = 0; i < SPECTATE_HISTORY; i++)
+		historyValid[i] = false;
+}
+
+bool SpectatorDecoder::read(PacketReader& packet) {
+	if (packet.u8() != PACKET_FEED)
+		return false;
+	unsigned int baseNumber = packet.u32();
+	bool hasKey = packet.u8() != 0;
+	if (hasKey) {
+		SpectatorFrame zero;
+		memset(&zero, 0, sizeof(zero));
+		SpectatorFrame key;
+		unsigned int keyNumber = packet.u32();
+		readFrame(packet, key, zero);
+		if (packet.failed) {
+			rejected++;
+			return false;
+		}
+		bool known = false;
+		for (int i = 0; i < keyCount; i++)
+			known = known || keyNumbers[i] == keyNumber;
+		if (!known) {
+			newestKey = (newestKey + 1) % SPECTATE_KEYFRAMES;
+			keyframes[newestKey] = key;
+			keyNumbers[newestKey] = keyNumber;
+			if (keyCount < SPECTATE_KEYFRAMES)
+				keyCount++;
+		}
+		ackWanted = true;
+		ackNumber = keyNumber;
+	}
+
+	const SpectatorFrame* base = nullptr;
+	for (int i = 0; i < keyCount; i++) {
+		if (keyNumbers[i] == baseNumber)
+			base = &keyframes[i];
+	}
+	if (!base) {
+		rejected++;
+		return false;
+	}
+
+	unsigned int first = packet.u32();
+	int count = (int)packet.u8();
+	SpectatorFrame frames[SPECTATE_BATCH];
+	if (count > SPECTATE_BATCH) {
+		rejected++;
+		return false;
+	}
+	for (int i = 0; i < count; i++)
+		readFrame(packet, frames[i], i == 0 ? *base : frames[i - 1]);
+	if (packet.failed) {
+		rejected++;
+		return false;
+	}
+
+	for (int i = 0; i < count; i++) {
+		unsigned int number = first + i;
+		int slot = number % SPECTATE_HISTORY;
+		history[slot] = frames[i];
+		historyNumbers[slot] = number;
+		historyValid[slot] = true;
+		if (!started || (int)(number - newest) > 0)
+			newest = number;
+		started = true;
+	}
+	return true;
+}
+
+bool SpectatorDecoder::frame(unsigned int number, SpectatorFrame& out) const {
+	int slot = number % SPECTATE_HISTORY;
+	if (!historyValid[slot] || historyNumbers[slot] != number)
+		return false;
+	out = history[slot];
+	return true;
+}
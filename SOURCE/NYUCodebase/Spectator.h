@@ -0,0 +1,100 @@
+#ifndef Spectator_h
+#define Spectator_h
+
+#include "Match.h"
+#include "Protocol.h"
+
+// Spectator feed. Every tick the match is quantized into a SpectatorFrame. Frames go out
+// SPECTATE_BATCH at a time in one FEED packet:
+//   u32 base       keyframe the first frame is coded against
+//   u8 hasKey      1 if a full keyframe follows
+//   [u32 number, frame coded against all zeroes]
+//   u32 first      frame number of the first frame in the batch
+//   u8 count
+//   count frames, the first against base and the rest against the frame before
+// A coded frame is a varint mask of the fields that changed, then a zigzag varint
+// difference for each of them. The base is the newest keyframe the spectator has
+// acked, so a lost packet never breaks the ones after it. Spectators sharing a base
+// get the same bytes, so a batch is coded once however many are watching.
+#define SPECTATE_BATCH 6			//ticks per packet, 10 packets a second
+#define SPECTATE_KEYFRAME_INTERVAL 120	//ticks between keyframes
+#define SPECTATE_KEYFRAMES 4		//keyframes kept to code against
+#define SPECTATE_KEY_RESEND 30		//ticks before an unacked keyframe is sent again
+#define SPECTATE_HISTORY 64			//decoded frames the viewer keeps
+#define SPECTATE_DELAY (3 * SPECTATE_BATCH)	//ticks the viewer plays behind the newest frame
+#define SPECTATE_POSITION_SCALE 256.0f
+#define SPECTATE_SPEED_SCALE 64.0f
+#define SPECTATE_NO_KEYFRAME 0xffffffff	//acked number of a spectator that has none yet
+#define SPECTATE_KEEPALIVE 1.0		//seconds between ACKs a viewer sends anyway
+
+enum SpectatorField {
+	FIELD_MATCH_FLAGS,
+	FIELD_X, FIELD_Y, FIELD_SPEED_X, FIELD_SPEED_Y, FIELD_HEALTH, FIELD_CLIP, FIELD_FRAME, FIELD_FLAGS, FIELD_EVENTS,
+	FIELD_FIGHTER_COUNT = FIELD_EVENTS,	//fields per fighter
+	FIELD_COUNT = 1 + 2 * FIELD_FIGHTER_COUNT
+};
+
+struct SpectatorFrame {
+	int fields[FIELD_COUNT];	//fighter k's fields start at 1 + k * FIELD_FIGHTER_COUNT
+};
+
+void quantizeMatch(const Match& match, SpectatorFrame& frame);
+// Fills in what a viewer draws. Cooldowns and jump state are not in the feed.
+void dequantizeMatch(const SpectatorFrame& frame, Match& match);
+
+// Server side, one per match
+class SpectatorEncoder {
+public:
+	SpectatorEncoder();
+
+	void reset();
+	// Call after every tick, true once a batch is full and should be sent
+	bool record(const Match& match);
+	// Codes the full batch for a spectator holding keyframe acked. Returns the packet size.
+	int write(unsigned int acked, bool withKeyframe, unsigned char* data, int capacity) const;
+	void clearBatch();
+
+	bool hasKeyframe(unsigned int number) const;
+	unsigned int latestKeyframe() const;
+
+	unsigned int frameNumber;	//frames recorded since reset, keeps counting across rematches
+
+private:
+	SpectatorFrame keyframes[SPECTATE_KEYFRAMES];
+	unsigned int keyNumbers[SPECTATE_KEYFRAMES];
+	int keyCount;
+	int newestKey;
+	SpectatorFrame batch[SPECTATE_BATCH];
+	unsigned int batchFirst;
+	int batchCount;
+
+	const SpectatorFrame* keyframe(unsigned int number) const;
+};
+
+// Viewer side
+class SpectatorDecoder {
+public:
+	SpectatorDecoder();
+
+	void reset();
+	// False for a packet that cannot be used: damaged, or coded against a keyframe we never got
+	bool read(PacketReader& packet);
+	bool frame(unsigned int number, SpectatorFrame& out) const;
+
+	bool started;
+	unsigned int newest;	//highest frame number decoded
+	bool ackWanted;			//a keyframe arrived, tell the server
+	unsigned int ackNumber;
+	unsigned int rejected;
+
+private:
+	SpectatorFrame keyframes[SPECTATE_KEYFRAMES];
+	unsigned int keyNumbers[SPECTATE_KEYFRAMES];
+	int keyCount;
+	int newestKey;
+	SpectatorFrame history[SPECTATE_HISTORY];
+	unsigned int historyNumbers[SPECTATE_HISTORY];
+	bool historyValid[SPECTATE_HISTORY];
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef SpscQueue_h
+#define SpscQueue_h
+
+#include <atomic>
+
+#define SPSC_CACHE_LINE 64
+
+// Bounded FIFO from one writer thread to one reader thread, neither ever waits or
+// locks. Each side owns one index and keeps a copy of the other's, only reloading it
+// when the queue looks full (or empty), so a push is normally a store of the value
+// and one release store. The indices sit on their own cache lines so the two
+// threads don't keep taking the line from each other. Capacity must be a power of two.
+template <typename T, unsigned int Capacity>
+class SpscQueue {
+public:
+	SpscQueue() : tail(0), cachedHead(0), head(0), cachedTail(0) {
+		static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+	}
+
+	// Writer side, false when full
+	bool push(const T& value) {
+		unsigned int at = tail.load(std::memory_order_relaxed);
+		if (at - cachedHead == Capacity) {
+			cachedHead = head.load(std::memory_order_acquire);
+			if (at - cachedHead == Capacity)
+				return false;
+		}
+		slots[at & (Capacity - 1)] = value;
+		tail.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Reader side, false when empty
+	bool pop(T& value) {
+		unsigned int at = head.load(std::memory_order_relaxed);
+		if (at == cachedTail) {
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (at == cachedTail)
+				return false;
+		}
+		value = slots[at & (Capacity - 1)];
+		head.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T slots[Capacity];
+	char padding0[SPSC_CACHE_LINE];
+	std::atomic<unsigned int> tail;	//writer's
+	unsigned int cachedHead;
+	char padding1[SPSC_CACHE_LINE];
+	std::atomic<unsigned int> head;	//reader's
+	unsigned int cachedTail;
+	char padding2[SPSC_CACHE_LINE];
+
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+};
+
+#endif
@@ -0,0 +1,352 @@
+#include "Stage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define STAGE_EPSILON 0.001f
+
+static time_t modifiedTime(const std::string& path) {
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return 0;
+	return info.st_mtime;
+}
+
+static bool sameRow(const StageRect& a, const StageRect& b) {
+	return fabs(a.position[1] - b.position[1]) < STAGE_EPSILON && fabs(a.halfSize[1] - b.halfSize[1]) < STAGE_EPSILON;
+}
+
+static bool sameColumn(const StageRect& a, const StageRect& b) {
+	return fabs(a.position[0] - b.position[0]) < STAGE_EPSILON && fabs(a.halfSize[0] - b.halfSize[0]) < STAGE_EPSILON;
+}
+
+static bool byRow(const StageRect& a, const StageRect& b) {
+	if (!sameRow(a, b))
+		return a.position[1] < b.position[1];
+	return a.position[0] < b.position[0];
+}
+
+static bool byColumn(const StageRect& a, const StageRect& b) {
+	if (!sameColumn(a, b))
+		return a.position[0] < b.position[0];
+	return a.position[1] < b.position[1];
+}
+
+// Joins rects that touch edge to edge along one axis into a single rect
+static void merge(std::vector<StageRect>& rects, int axis) {
+	std::sort(rects.begin(), rects.end(), axis == 0 ? byRow : byColumn);
+	std::vector<StageRect> merged;
+	for (size_t i = 0; i < rects.size(); i++) {
+		if (!merged.empty()) {
+			StageRect& last = merged.back();
+			bool lined = axis == 0 ? sameRow(last, rects[i]) : sameColumn(last, rects[i]);
+			float lastEnd = last.position[axis] + last.halfSize[axis];
+			float start = rects[i].position[axis] - rects[i].halfSize[axis];
+			if (lined && fabs(lastEnd - start) < STAGE_EPSILON) {
+				float end = rects[i].position[axis] + rects[i].halfSize[axis];
+				float begin = last.position[axis] - last.halfSize[axis];
+				last.position[axis] = (begin + end) / 2;
+				last.halfSize[axis] = (end - begin) / 2;
+				continue;
+			}
+		}
+		merged.push_back(rects[i]);
+	}
+	rects.swap(merged);
+}
+
+static int cellCoordinate(float value, float origin, float cellSize, unsigned int count) {
+	int cell = (int)floor((value - origin) / cellSize);
+	if (cell < 0)
+		return 0;
+	if (cell >= (int)count)
+		return (int)count - 1;
+	return cell;
+}
+
+Stage::Stage() : header(nullptr), rects(nullptr), cells(nullptr), rectIndex(nullptr), vertexData(nullptr), texCoordData(nullptr), sourceTime(0) {}
+
+bool Stage::open(const std::string& name) {
+	sourcePath = name + ".stage";
+	binaryPath = name + ".stagebin";
+	sourceTime = modifiedTime(sourcePath);
+
+	if (modifiedTime(binaryPath) >= sourceTime && load(binaryPath))
+		return true;
+	if (!compile(sourcePath))
+		return false;
+	save(binaryPath);
+	return true;
+}
+
+bool Stage::peek(const std::string& name, StageHeader& head) {
+	std::string source = name + ".stage";
+	std::string binary = name + ".stagebin";
+	if (modifiedTime(binary) >= modifiedTime(source)) {
+		std::ifstream infile(binary, std::ios::binary);
+		if (infile.read((char*)&head, sizeof(head)) && head.magic == STAGE_MAGIC && head.version == STAGE_VERSION)
+			return true;
+	}
+	std::vector<StageRect> tiles;
+	return parse(source, head, tiles);
+}
+
+bool Stage::poll() {
+	time_t current = modifiedTime(sourcePath);
+	if (current == 0 || current == sourceTime)
+		return false;
+	sourceTime = current;
+	if (!compile(sourcePath))
+		return false;
+	save(binaryPath);
+	return true;
+}
+
+bool Stage::parse(const std::string& source, StageHeader& head, std::vector<StageRect>& tiles) {
+	std::ifstream infile(source);
+	if (infile.fail()) {
+		std::cout << "Error opening stage file:" << source << std::endl;
+		return false;
+	}
+
+	memset(&head, 0, sizeof(head));
+	head.magic = STAGE_MAGIC;
+	head.version = STAGE_VERSION;
+	head.blastLine = -19.0f;
+	head.tileSize = 0.2f;
+	head.cellSize = STAGE_CELL_SIZE;
+	int spawns = 0;
+	tiles.clear();
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(infile, line)) {
+		lineNumber++;
+		std::istringstream words(line);
+		std::string command;
+		if (!(words >> command) || command[0] == '#')
+			continue;
+
+		if (command == "background") {
+			std::string file;
+			words >> file;
+			memcpy(head.background, file.c_str(), std::min(file.size(), (size_t)STAGE_NAME_LENGTH - 1));
+		}
+		else if (command == "blast") {
+			words >> head.blastLine;
+		}
+		else if (command == "tile") {
+			words >> head.tileSize;
+		}
+		else if (command == "cell") {
+			words >> head.cellSize;
+		}
+		else if (command == "spawn" && spawns < 2) {
+			words >> head.spawn[spawns][0] >> head.spawn[spawns][1];
+			spawns++;
+		}
+		else if (command == "run") {
+			// run x y stepX stepY count: a straight line of tiles
+			float x, y, dx, dy;
+			int count;
+			if (!(words >> x >> y >> dx >> dy >> count)) {
+				std::cout << source << ":" << lineNumber << ": bad run" << std::endl;
+				continue;
+			}
+			for (int i = 0; i < count; i++) {
+				StageRect tile;
+				tile.position[0] = x + i * dx;
+				tile.position[1] = y + i * dy;
+				tile.halfSize[0] = head.tileSize / 2;
+				tile.halfSize[1] = head.tileSize / 2;
+				tiles.push_back(tile);
+			}
+		}
+		else {
+			std::cout << source << ":" << lineNumber << ": unknown command " << command << std::endl;
+		}
+	}
+	return true;
+}
+
+bool Stage::compile(const std::string& source) {
+	StageHeader head;
+	std::vector<StageRect> tiles;
+	return parse(source, head, tiles) && build(head, tiles);
+}
+
+bool Stage::build(const StageHeader& layout, std::vector<StageRect>& tiles) {
+	StageHeader head = layout;
+
+	// Render mesh keeps one quad per tile, collision gets the merged shapes
+	std::vector<StageRect> shapes(tiles);
+	merge(shapes, 0);
+	merge(shapes, 1);
+
+	// Spatial grid over the tile extents
+	float low[2] = { 0, 0 }, high[2] = { 0, 0 };
+	for (size_t i = 0; i < tiles.size(); i++) {
+		for (int axis = 0; axis < 2; axis++) {
+			float start = tiles[i].position[axis] - tiles[i].halfSize[axis];
+			float end = tiles[i].position[axis] + tiles[i].halfSize[axis];
+			if (i == 0 || start < low[axis])
+				low[axis] = start;
+			if (i == 0 || end > high[axis])
+				high[axis] = end;
+		}
+	}
+	if (head.cellSize <= 0)
+		head.cellSize = STAGE_CELL_SIZE;
+	head.gridOrigin[0] = low[0];
+	head.gridOrigin[1] = low[1];
+	head.columns = std::max(1, (int)ceil((high[0] - low[0]) / head.cellSize));
+	head.rows = std::max(1, (int)ceil((high[1] - low[1]) / head.cellSize));
+
+	std::vector<std::vector<StageRect> > cellTiles(head.columns * head.rows);
+	for (size_t i = 0; i < tiles.size(); i++) {
+		int column = cellCoordinate(tiles[i].position[0], head.gridOrigin[0], head.cellSize, head.columns);
+		int row = cellCoordinate(tiles[i].position[1], head.gridOrigin[1], head.cellSize, head.rows);
+		cellTiles[row * head.columns + column].push_back(tiles[i]);
+	}
+
+	std::vector<StageCell> grid(cellTiles.size());
+	std::vector<unsigned int> indices;
+	unsigned int vertex = 0;
+	tiles.clear();
+	for (size_t c = 0; c < grid.size(); c++) {
+		StageCell& cell = grid[c];
+		cell.firstVertex = vertex;
+		cell.vertexCount = (unsigned int)cellTiles[c].size() * 6;
+		vertex += cell.vertexCount;
+		tiles.insert(tiles.end(), cellTiles[c].begin(), cellTiles[c].end());
+
+		float left = head.gridOrigin[0] + (c % head.columns) * head.cellSize;
+		float bottom = head.gridOrigin[1] + (c / head.columns) * head.cellSize;
+		cell.bounds[0] = bottom;
+		cell.bounds[1] = bottom + head.cellSize;
+		cell.bounds[2] = left + head.cellSize;
+		cell.bounds[3] = left;
+		for (size_t i = 0; i < cellTiles[c].size(); i++) {
+			const StageRect& tile = cellTiles[c][i];
+			cell.bounds[0] = std::max(cell.bounds[0], tile.position[1] + tile.halfSize[1]);
+			cell.bounds[1] = std::min(cell.bounds[1], tile.position[1] - tile.halfSize[1]);
+			cell.bounds[2] = std::min(cell.bounds[2], tile.position[0] - tile.halfSize[0]);
+			cell.bounds[3] = std::max(cell.bounds[3], tile.position[0] + tile.halfSize[0]);
+		}
+
+		// Collision shapes overlapping the cell square
+		cell.firstRect = (unsigned int)indices.size();
+		for (size_t r = 0; r < shapes.size(); r++) {
+			if (shapes[r].position[0] - shapes[r].halfSize[0] < left + head.cellSize &&
+				shapes[r].position[0] + shapes[r].halfSize[0] > left &&
+				shapes[r].position[1] - shapes[r].halfSize[1] < bottom + head.cellSize &&
+				shapes[r].position[1] + shapes[r].halfSize[1] > bottom)
+				indices.push_back((unsigned int)r);
+		}
+		cell.rectCount = (unsigned int)indices.size() - cell.firstRect;
+	}
+
+	head.rectCount = (unsigned int)shapes.size();
+	head.rectIndexCount = (unsigned int)indices.size();
+	head.vertexCount = (unsigned int)tiles.size() * 6;
+
+	size_t meshFloats = head.vertexCount * 2;
+	size_t offset = sizeof(StageHeader);
+	blob.assign(offset + shapes.size() * sizeof(StageRect) + grid.size() * sizeof(StageCell) + indices.size() * sizeof(unsigned int) + meshFloats * 2 * sizeof(float), 0);
+	memcpy(&blob[0], &head, sizeof(head));
+	if (!shapes.empty())
+		memcpy(&blob[offset], &shapes[0], shapes.size() * sizeof(StageRect));
+	offset += shapes.size() * sizeof(StageRect);
+	memcpy(&blob[offset], &grid[0], grid.size() * sizeof(StageCell));
+	offset += grid.size() * sizeof(StageCell);
+	if (!indices.empty())
+		memcpy(&blob[offset], &indices[0], indices.size() * sizeof(unsigned int));
+	offset += indices.size() * sizeof(unsigned int);
+
+	float* vertices = (float*)&blob[offset];
+	float* texCoords = vertices + meshFloats;
+	for (size_t i = 0; i < tiles.size(); i++) {
+		float left = tiles[i].position[0] - tiles[i].halfSize[0];
+		float right = tiles[i].position[0] + tiles[i].halfSize[0];
+		float top = tiles[i].position[1] + tiles[i].halfSize[1];
+		float bottom = tiles[i].position[1] - tiles[i].halfSize[1];
+		float quad[] = { left, top, left, bottom, right, top, right, bottom, right, top, left, bottom };
+		float uv[] = { 0, 0, 0, 1, 1, 0, 1, 1, 1, 0, 0, 1 };
+		memcpy(vertices + i * 12, quad, sizeof(quad));
+		memcpy(texCoords + i * 12, uv, sizeof(uv));
+	}
+	return bind();
+}
+
+bool Stage::save(const std::string& binary) const {
+	std::ofstream outfile(binary, std::ios::binary);
+	if (outfile.fail() || blob.empty())
+		return false;
+	outfile.write(&blob[0], blob.size());
+	return outfile.good();
+}
+
+bool Stage::load(const std::string& binary) {
+	std::ifstream infile(binary, std::ios::binary | std::ios::ate);
+	if (infile.fail())
+		return false;
+	std::streamsize length = infile.tellg();
+	if (length < (std::streamsize)sizeof(StageHeader))
+		return false;
+	infile.seekg(0);
+	blob.resize((size_t)length);
+	if (!infile.read(&blob[0], length))
+		return false;
+	return bind();
+}
+
+bool Stage::compileFile(const std::string& source, const std::string& binary) {
+	Stage stage;
+	return stage.compile(source) && stage.save(binary);
+}
+
+size_t Stage::size() const {
+	return blob.size();
+}
+
+bool Stage::bind() {
+	header = nullptr;
+	if (blob.size() < sizeof(StageHeader))
+		return false;
+	const StageHeader* head = (const StageHeader*)&blob[0];
+	if (head->magic != STAGE_MAGIC || head->version != STAGE_VERSION) {
+		std::cout << "Stage data is stale, recompiling" << std::endl;
+		return false;
+	}
+	size_t expected = sizeof(StageHeader) + head->rectCount * sizeof(StageRect) + head->columns * head->rows * sizeof(StageCell) +
+		head->rectIndexCount * sizeof(unsigned int) + head->vertexCount * 4 * sizeof(float);
+	if (blob.size() != expected) {
+		std::cout << "Stage data is corrupt, recompiling" << std::endl;
+		return false;
+	}
+	header = head;
+	rects = (const StageRect*)&blob[sizeof(StageHeader)];
+	cells = (const StageCell*)(rects + head->rectCount);
+	rectIndex = (const unsigned int*)(cells + head->columns * head->rows);
+	vertexData = (const float*)(rectIndex + head->rectIndexCount);
+	texCoordData = vertexData + head->vertexCount * 2;
+	return true;
+}
+
+bool Stage::cellRange(const float bounds[4], int& firstColumn, int& lastColumn, int& firstRow, int& lastRow) const {
+	float right = header->gridOrigin[0] + header->columns * header->cellSize;
+	float top = header->gridOrigin[1] + header->rows * header->cellSize;
+	if (bounds[3] < header->gridOrigin[0] || bounds[2] > right || bounds[0] < header->gridOrigin[1] || bounds[1] > top)
+		return false;
+	firstColumn = cellCoordinate(bounds[2], header->gridOrigin[0], header->cellSize, header->columns);
+	lastColumn = cellCoordinate(bounds[3], header->gridOrigin[0], header->cellSize, header->columns);
+	firstRow = cellCoordinate(bounds[1], header->gridOrigin[1], header->cellSize, header->rows);
+	lastRow = cellCoordinate(bounds[0], header->gridOrigin[1], header->cellSize, header->rows);
+	return true;
+}
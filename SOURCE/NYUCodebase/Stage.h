@@ -0,0 +1,93 @@
+#ifndef Stage_h
+#define Stage_h
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+// Stages are written as text (.stage) and compiled into a binary blob (.stagebin):
+// StageHeader, then rectCount StageRects (merged collision shapes), then the
+// columns * rows StageCells of the spatial grid, then rectIndexCount cell to rect
+// indices, then vertexCount * 2 floats of positions and vertexCount * 2 floats of
+// texcoords. The mesh is ordered cell by cell, row-major.
+#define STAGE_MAGIC 0x31475453 // "STG1"
+#define STAGE_VERSION 2
+#define STAGE_NAME_LENGTH 64
+#define STAGE_CELL_SIZE 2.0f
+
+struct StageRect {
+	float position[2];	//center point
+	float halfSize[2];	//half width, half height
+};
+
+struct StageCell {
+	float bounds[4];	//top, bottom, left, right of the tiles in this cell
+	unsigned int firstVertex;
+	unsigned int vertexCount;
+	unsigned int firstRect;	//into the rect index list
+	unsigned int rectCount;
+};
+
+struct StageHeader {
+	unsigned int magic;
+	unsigned int version;
+	float blastLine;
+	float spawn[2][2];	//p1 x y, p2 x y
+	float tileSize;
+	unsigned int rectCount;
+	unsigned int vertexCount;
+	float gridOrigin[2];	//bottom left corner of cell 0
+	float cellSize;
+	unsigned int columns;
+	unsigned int rows;
+	unsigned int rectIndexCount;
+	char background[STAGE_NAME_LENGTH];
+};
+
+class Stage {
+public:
+	Stage();
+
+	std::string sourcePath;
+	std::string binaryPath;
+
+	// Filled in by bind(), all pointers point into blob
+	const StageHeader* header;
+	const StageRect* rects;
+	const StageCell* cells;
+	const unsigned int* rectIndex;
+	const float* vertexData;
+	const float* texCoordData;
+
+	// Loads name.stagebin, recompiling it from name.stage first if it is missing or stale
+	bool open(const std::string& name);
+	// Recompiles and reloads if the .stage file changed on disk since the last load
+	bool poll();
+
+	bool compile(const std::string& source);
+	// Builds the collision shapes, grid and mesh for these tiles, reorders tiles
+	bool build(const StageHeader& layout, std::vector<StageRect>& tiles);
+	bool save(const std::string& binary) const;
+	bool load(const std::string& binary);
+
+	// Grid cells overlapping bounds (top, bottom, left, right), false if none
+	bool cellRange(const float bounds[4], int& firstColumn, int& lastColumn, int& firstRow, int& lastRow) const;
+
+	// Bytes of stage data held
+	size_t size() const;
+
+	// Just the header of name, from the .stagebin if it is current, without loading the
+	// rest or compiling anything
+	static bool peek(const std::string& name, StageHeader& head);
+	// Reads the header settings and tiles of a .stage file
+	static bool parse(const std::string& source, StageHeader& head, std::vector<StageRect>& tiles);
+	static bool compileFile(const std::string& source, const std::string& binary);
+
+private:
+	std::vector<char> blob;
+	time_t sourceTime;
+
+	bool bind();
+};
+
+#endif
@@ -0,0 +1,434 @@
+#include "StageStream.h"
+#include "Clock.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+static time_t modifiedTime(const std::string& path) {
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return 0;
+	return info.st_mtime;
+}
+
+static int chunkCoordinate(float value, float origin, float size, unsigned int count) {
+	int chunk = (int)floor((value - origin) / size);
+	if (chunk < 0)
+		return 0;
+	if (chunk >= (int)count)
+		return (int)count - 1;
+	return chunk;
+}
+
+// Roughly what a chunk takes once built, for deciding whether to prefetch it. The
+// mesh (six vertices of position and texcoord per tile) is most of it.
+static size_t chunkEstimate(unsigned int tileCount) {
+	return sizeof(StageHeader) + tileCount * (6 * 4 * sizeof(float) + sizeof(StageRect));
+}
+
+StageStream::StageStream() : tileCount(0), budget(STAGE_STREAM_DEFAULT_BUDGET), bytes(0), pending(0), stopping(false) {
+	memset(&header, 0, sizeof(header));
+	memset(&stats, 0, sizeof(stats));
+}
+
+StageStream::~StageStream() {
+	close();
+}
+
+bool StageStream::compile(const std::string& source, const std::string& binary) {
+	StageHeader head;
+	std::vector<StageRect> tiles;
+	if (!Stage::parse(source, head, tiles))
+		return false;
+
+	StageChunkHeader chunkHead;
+	memset(&chunkHead, 0, sizeof(chunkHead));
+	chunkHead.magic = STAGE_CHUNK_MAGIC;
+	chunkHead.version = STAGE_CHUNK_VERSION;
+	chunkHead.blastLine = head.blastLine;
+	memcpy(chunkHead.spawn, head.spawn, sizeof(head.spawn));
+	chunkHead.tileSize = head.tileSize;
+	chunkHead.chunkSize = STAGE_CHUNK_SIZE;
+	chunkHead.tileCount = (unsigned int)tiles.size();
+	memcpy(chunkHead.background, head.background, sizeof(head.background));
+
+	float low[2] = { 0, 0 }, high[2] = { 0, 0 };
+	for (size_t i = 0; i < tiles.size(); i++) {
+		for (int axis = 0; axis < 2; axis++) {
+			if (i == 0 || tiles[i].position[axis] < low[axis])
+				low[axis] = tiles[i].position[axis];
+			if (i == 0 || tiles[i].position[axis] > high[axis])
+				high[axis] = tiles[i].position[axis];
+		}
+	}
+	chunkHead.gridOrigin[0] = low[0];
+	chunkHead.gridOrigin[1] = low[1];
+	chunkHead.columns = (unsigned int)floor((high[0] - low[0]) / chunkHead.chunkSize) + 1;
+	chunkHead.rows = (unsigned int)floor((high[1] - low[1]) / chunkHead.chunkSize) + 1;
+
+	std::vector<std::vector<float> > centers(chunkHead.columns * chunkHead.rows);
+	for (size_t i = 0; i < tiles.size(); i++) {
+		int column = chunkCoordinate(tiles[i].position[0], chunkHead.gridOrigin[0], chunkHead.chunkSize, chunkHead.columns);
+		int row = chunkCoordinate(tiles[i].position[1], chunkHead.gridOrigin[1], chunkHead.chunkSize, chunkHead.rows);
+		centers[row * chunkHead.columns + column].push_back(tiles[i].position[0]);
+		centers[row * chunkHead.columns + column].push_back(tiles[i].position[1]);
+	}
+
+	std::vector<StageChunkEntry> entries(centers.size());
+	unsigned int offset = (unsigned int)(sizeof(StageChunkHeader) + entries.size() * sizeof(StageChunkEntry));
+	for (size_t i = 0; i < entries.size(); i++) {
+		entries[i].offset = offset;
+		entries[i].tileCount = (unsigned int)centers[i].size() / 2;
+		offset += (unsigned int)(centers[i].size() * sizeof(float));
+	}
+
+	std::ofstream outfile(binary, std::ios::binary);
+	if (outfile.fail()) {
+		std::cout << "Could not write " << binary << std::endl;
+		return false;
+	}
+	outfile.write((const char*)&chunkHead, sizeof(chunkHead));
+	outfile.write((const char*)&entries[0], entries.size() * sizeof(StageChunkEntry));
+	for (size_t i = 0; i < centers.size(); i++) {
+		if (!centers[i].empty())
+			outfile.write((const char*)&centers[i][0], centers[i].size() * sizeof(float));
+	}
+	return outfile.good();
+}
+
+bool StageStream::open(const std::string& name) {
+	close();
+	std::string source = name + ".stage";
+	path = name + ".stagechunks";
+	if (modifiedTime(path) < modifiedTime(source) && !compile(source, path))
+		return false;
+
+	for (int attempt = 0; attempt < 2; attempt++) {
+		std::ifstream infile(path, std::ios::binary | std::ios::ate);
+		std::streamsize length = infile.fail() ? 0 : (std::streamsize)infile.tellg();
+		StageChunkHeader chunkHead;
+		bool valid = length >= (std::streamsize)sizeof(chunkHead);
+		if (valid) {
+			infile.seekg(0);
+			infile.read((char*)&chunkHead, sizeof(chunkHead));
+			valid = infile.good() && chunkHead.magic == STAGE_CHUNK_MAGIC && chunkHead.version == STAGE_CHUNK_VERSION;
+		}
+		std::vector<StageChunkEntry> entries;
+		if (valid) {
+			entries.resize(chunkHead.columns * chunkHead.rows);
+			valid = !entries.empty() && infile.read((char*)&entries[0], entries.size() * sizeof(StageChunkEntry)).good();
+			for (size_t i = 0; valid && i < entries.size(); i++)
+				valid = entries[i].offset + entries[i].tileCount * 2 * sizeof(float) <= (size_t)length;
+		}
+		if (!valid) {
+			if (attempt == 0 && compile(source, path))
+				continue;
+			std::cout << "Could not open stage chunks " << path << std::endl;
+			return false;
+		}
+
+		memset(&header, 0, sizeof(header));
+		header.magic = STAGE_MAGIC;
+		header.version = STAGE_VERSION;
+		header.blastLine = chunkHead.blastLine;
+		memcpy(header.spawn, chunkHead.spawn, sizeof(header.spawn));
+		header.tileSize = chunkHead.tileSize;
+		header.gridOrigin[0] = chunkHead.gridOrigin[0];
+		header.gridOrigin[1] = chunkHead.gridOrigin[1];
+		header.cellSize = chunkHead.chunkSize;
+		header.columns = chunkHead.columns;
+		header.rows = chunkHead.rows;
+		memcpy(header.background, chunkHead.background, sizeof(header.background));
+		header.background[STAGE_NAME_LENGTH - 1] = 0;
+		tileCount = chunkHead.tileCount;
+
+		chunks.resize(entries.size());
+		for (size_t i = 0; i < entries.size(); i++) {
+			chunks[i].stage = nullptr;
+			chunks[i].offset = entries[i].offset;
+			chunks[i].tileCount = entries[i].tileCount;
+			chunks[i].requested = false;
+			chunks[i].requestTime = 0;
+		}
+		break;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	stopping = false;
+	loader = std::thread(&StageStream::load, this);
+	return true;
+}
+
+void StageStream::close() {
+	if (loader.joinable()) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		loader.join();
+	}
+	std::lock_guard<std::mutex> guard(residency);
+	for (size_t i = 0; i < chunks.size(); i++)
+		delete chunks[i].stage;
+	for (size_t i = 0; i < ready.size(); i++)
+		delete ready[i].second;
+	chunks.clear();
+	resident.clear();
+	requests.clear();
+	ready.clear();
+	bytes = 0;
+	pending = 0;
+}
+
+// Loader thread: reads the tiles of one requested chunk at a time and builds them
+void StageStream::load() {
+	std::ifstream infile(path, std::ios::binary);
+	std::vector<float> centers;
+	std::vector<StageRect> tiles;
+	StageHeader layout = header;
+	layout.cellSize = STAGE_CELL_SIZE;
+
+	for (;;) {
+		int index;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !requests.empty(); });
+			if (stopping)
+				return;
+			index = requests.back();
+			requests.pop_back();
+		}
+
+		const Chunk& chunk = chunks[index];
+		centers.resize(chunk.tileCount * 2);
+		tiles.clear();
+		infile.seekg(chunk.offset);
+		if (centers.empty() || infile.read((char*)&centers[0], centers.size() * sizeof(float))) {
+			for (unsigned int i = 0; i < chunk.tileCount; i++) {
+				StageRect tile;
+				tile.position[0] = centers[i * 2];
+				tile.position[1] = centers[i * 2 + 1];
+				tile.halfSize[0] = layout.tileSize / 2;
+				tile.halfSize[1] = layout.tileSize / 2;
+				tiles.push_back(tile);
+			}
+		}
+		else {
+			// Stands in as an empty chunk, so nothing waits on it forever
+			std::cout << "Could not read chunk " << index << " of " << path << std::endl;
+			infile.clear();
+		}
+		Stage* stage = new Stage();
+		stage->build(layout, tiles);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			ready.push_back(std::make_pair(index, stage));
+		}
+		loaded.notify_all();
+	}
+}
+
+void StageStream::request(int index, bool urgent) {
+	Chunk& chunk = chunks[index];
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::vector<int>::iterator queued = std::find(requests.begin(), requests.end(), index);
+		if (urgent) {
+			if (queued != requests.end())
+				requests.erase(queued);
+			else if (chunk.requested)
+				return;	//being built right now
+			requests.push_back(index);
+		}
+		else {
+			if (chunk.requested)
+				return;
+			// Called nearest first, so the nearest ends up closest to the back
+			requests.insert(requests.begin(), index);
+		}
+	}
+	if (!chunk.requested) {
+		chunk.requested = true;
+		chunk.requestTime = clockSeconds();
+		pending += chunkEstimate(chunk.tileCount);
+	}
+	wake.notify_one();
+}
+
+// Puts in the chunks the loader has finished
+void StageStream::install() {
+	std::vector<std::pair<int, Stage*> > arrived;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (ready.empty())
+			return;
+		arrived.swap(ready);
+	}
+	double now = clockSeconds();
+	std::lock_guard<std::mutex> guard(residency);
+	for (size_t i = 0; i < arrived.size(); i++) {
+		Chunk& chunk = chunks[arrived[i].first];
+		chunk.stage = arrived[i].second;
+		chunk.requested = false;
+		pending -= chunkEstimate(chunk.tileCount);
+		bytes += chunk.stage->size();
+		resident.push_back(arrived[i].first);
+
+		double latency = now - chunk.requestTime;
+		stats.loads++;
+		stats.latencyTotal += latency;
+		if (latency > stats.latencyMax)
+			stats.latencyMax = latency;
+	}
+	if (bytes > stats.peakBytes)
+		stats.peakBytes = bytes;
+}
+
+void StageStream::evict(int index) {
+	std::lock_guard<std::mutex> guard(residency);
+	Chunk& chunk = chunks[index];
+	bytes -= chunk.stage->size();
+	delete chunk.stage;
+	chunk.stage = nullptr;
+	resident.erase(std::find(resident.begin(), resident.end(), index));
+	stats.evictions++;
+}
+
+// How far the chunk's tiles are from the nearest position, along the worse axis
+float StageStream::distance(int index, const float (*positions)[2], int count) const {
+	float half = header.cellSize / 2 + header.tileSize / 2;
+	float center[2] = {
+		header.gridOrigin[0] + (index % header.columns) * header.cellSize + header.cellSize / 2,
+		header.gridOrigin[1] + (index / header.columns) * header.cellSize + header.cellSize / 2
+	};
+	float nearest = 1e30f;
+	for (int k = 0; k < count; k++) {
+		float gap = 0;
+		for (int axis = 0; axis < 2; axis++)
+			gap = std::max(gap, (float)fabs(positions[k][axis] - center[axis]) - half);
+		nearest = std::min(nearest, gap);
+	}
+	return nearest;
+}
+
+void StageStream::update(const float (*positions)[2], int count) {
+	if (chunks.empty())
+		return;
+	install();
+
+	// Anything a fighter could reach this tick has to be here before it runs
+	double waitStart = 0;
+	for (int k = 0; k < count; k++) {
+		float around[4] = { positions[k][1] + STAGE_STREAM_REQUIRED, positions[k][1] - STAGE_STREAM_REQUIRED, positions[k][0] - STAGE_STREAM_REQUIRED, positions[k][0] + STAGE_STREAM_REQUIRED };
+		int firstColumn, lastColumn, firstRow, lastRow;
+		if (!chunkRange(around, firstColumn, lastColumn, firstRow, lastRow))
+			continue;
+		for (int row = firstRow; row <= lastRow; row++) {
+			for (int column = firstColumn; column <= lastColumn; column++) {
+				int index = row * header.columns + column;
+				if (chunks[index].tileCount == 0 || chunks[index].stage)
+					continue;
+				if (waitStart == 0)
+					waitStart = clockSeconds();
+				request(index, true);
+				while (!chunks[index].stage) {
+					{
+						std::unique_lock<std::mutex> guard(lock);
+						loaded.wait(guard, [this] { return !ready.empty(); });
+					}
+					install();
+				}
+			}
+		}
+	}
+	if (waitStart != 0) {
+		std::lock_guard<std::mutex> guard(residency);
+		stats.stalls++;
+		stats.stallTime += clockSeconds() - waitStart;
+	}
+
+	// Ask for what is coming up, nearest first, as long as it looks like it fits
+	candidates.clear();
+	for (int k = 0; k < count; k++) {
+		float around[4] = { positions[k][1] + STAGE_STREAM_PREFETCH, positions[k][1] - STAGE_STREAM_PREFETCH, positions[k][0] - STAGE_STREAM_PREFETCH, positions[k][0] + STAGE_STREAM_PREFETCH };
+		int firstColumn, lastColumn, firstRow, lastRow;
+		if (!chunkRange(around, firstColumn, lastColumn, firstRow, lastRow))
+			continue;
+		for (int row = firstRow; row <= lastRow; row++) {
+			for (int column = firstColumn; column <= lastColumn; column++) {
+				int index = row * header.columns + column;
+				const Chunk& chunk = chunks[index];
+				if (chunk.tileCount == 0 || chunk.stage || chunk.requested)
+					continue;
+				bool listed = false;
+				for (size_t i = 0; i < candidates.size() && !listed; i++)
+					listed = candidates[i].second == index;
+				if (!listed)
+					candidates.push_back(std::make_pair(distance(index, positions, count), index));
+			}
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		if (bytes + pending + chunkEstimate(chunks[candidates[i].second].tileCount) > budget)
+			break;
+		request(candidates[i].second, false);
+	}
+
+	// Drop what is far away, then the farthest until back inside the budget
+	for (size_t i = resident.size(); i-- > 0;) {
+		if (distance(resident[i], positions, count) > STAGE_STREAM_KEEP)
+			evict(resident[i]);
+	}
+	while (bytes > budget) {
+		int farthest = -1;
+		float farthestDistance = STAGE_STREAM_REQUIRED;
+		for (size_t i = 0; i < resident.size(); i++) {
+			float gap = distance(resident[i], positions, count);
+			if (gap > farthestDistance) {
+				farthest = resident[i];
+				farthestDistance = gap;
+			}
+		}
+		if (farthest < 0)
+			break;
+		evict(farthest);
+	}
+}
+
+const Stage* StageStream::chunk(int column, int row) const {
+	if (column < 0 || row < 0 || column >= (int)header.columns || row >= (int)header.rows)
+		return nullptr;
+	return chunks[row * header.columns + column].stage;
+}
+
+bool StageStream::chunkRange(const float bounds[4], int& firstColumn, int& lastColumn, int& firstRow, int& lastRow) const {
+	if (chunks.empty())
+		return false;
+	// Tiles stick out of their chunk by up to half a tile
+	float margin = header.tileSize / 2;
+	float right = header.gridOrigin[0] + header.columns * header.cellSize;
+	float top = header.gridOrigin[1] + header.rows * header.cellSize;
+	if (bounds[3] + margin < header.gridOrigin[0] || bounds[2] - margin > right || bounds[0] + margin < header.gridOrigin[1] || bounds[1] - margin > top)
+		return false;
+	firstColumn = chunkCoordinate(bounds[2] - margin, header.gridOrigin[0], header.cellSize, header.columns);
+	lastColumn = chunkCoordinate(bounds[3] + margin, header.gridOrigin[0], header.cellSize, header.columns);
+	firstRow = chunkCoordinate(bounds[1] - margin, header.gridOrigin[1], header.cellSize, header.rows);
+	lastRow = chunkCoordinate(bounds[0] + margin, header.gridOrigin[1], header.cellSize, header.rows);
+	return true;
+}
+
+int StageStream::residentChunks() const {
+	return (int)resident.size();
+}
+
+size_t StageStream::residentBytes() const {
+	return bytes;
+}
@@ -0,0 +1,117 @@
+#ifndef StageStream_h
+#define StageStream_h
+
+#include "Stage.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stages too big to keep whole are cut into square chunks of STAGE_CHUNK_SIZE world
+// units and written as .stagechunks: StageChunkHeader, then columns * rows
+// StageChunkEntries, row-major from gridOrigin, then each chunk's tile centers as
+// tileCount x, y float pairs. A tile belongs to the chunk its center is in.
+// A loader thread reads and builds chunks near the fighters, each as its own small
+// Stage, and far ones are dropped again.
+#define STAGE_CHUNK_MAGIC 0x31435453 // "STC1"
+#define STAGE_CHUNK_VERSION 1
+#define STAGE_CHUNK_SIZE 16.0f
+#define STAGE_STREAM_REQUIRED 4.0f	//world units around a fighter that must be resident before a tick runs
+#define STAGE_STREAM_PREFETCH 24.0f	//loaded ahead within this
+#define STAGE_STREAM_KEEP 40.0f		//dropped beyond this, the gap keeps chunks on the edge from flickering
+#define STAGE_STREAM_DEFAULT_BUDGET (4 * 1024 * 1024)
+
+struct StageChunkHeader {
+	unsigned int magic;
+	unsigned int version;
+	float blastLine;
+	float spawn[2][2];
+	float tileSize;
+	float gridOrigin[2];	//bottom left corner of chunk 0
+	float chunkSize;
+	unsigned int columns;
+	unsigned int rows;
+	unsigned int tileCount;
+	char background[STAGE_NAME_LENGTH];
+};
+
+struct StageChunkEntry {
+	unsigned int offset;	//from the start of the file
+	unsigned int tileCount;
+};
+
+struct StageStreamStats {
+	unsigned int loads;
+	unsigned int evictions;
+	unsigned int stalls;		//ticks that had to wait for a chunk
+	double stallTime;			//seconds spent waiting
+	double latencyTotal;		//seconds from asking for a chunk to it being in use
+	double latencyMax;
+	size_t peakBytes;
+};
+
+class StageStream {
+public:
+	StageStream();
+	~StageStream();
+
+	// The whole map; cellSize is the chunk size and columns, rows count chunks
+	StageHeader header;
+	unsigned int tileCount;	//in the whole map
+	size_t budget;	//bytes of resident chunks, only the required ones may go over it
+	StageStreamStats stats;
+	// Held while chunks are put in or taken out and while stats change. The thread
+	// calling update() can read chunks without it, any other thread (drawing) has to hold it.
+	std::mutex residency;
+
+	// Opens name.stagechunks, rebuilding it from name.stage first if it is missing or stale
+	bool open(const std::string& name);
+	void close();
+
+	// Call before every Match::step, from the thread that steps it. Waits for any chunk
+	// close enough to matter this tick, so what collides never depends on load timing.
+	void update(const float (*positions)[2], int count);
+
+	// The chunk at column, row of the chunk grid, null if it is empty or not resident
+	const Stage* chunk(int column, int row) const;
+	// Chunks that hold tiles overlapping bounds (top, bottom, left, right), false if none
+	bool chunkRange(const float bounds[4], int& firstColumn, int& lastColumn, int& firstRow, int& lastRow) const;
+	int residentChunks() const;
+	size_t residentBytes() const;
+
+	static bool compile(const std::string& source, const std::string& binary);
+
+private:
+	struct Chunk {
+		Stage* stage;
+		unsigned int offset;
+		unsigned int tileCount;
+		bool requested;
+		double requestTime;
+	};
+
+	std::vector<Chunk> chunks;
+	std::vector<int> resident;
+	size_t bytes;
+	size_t pending;	//estimated bytes of chunks asked for and not in yet
+	std::string path;
+	std::vector<std::pair<float, int> > candidates;	//distance, chunk; reused by update()
+
+	std::thread loader;
+	std::mutex lock;	//guards everything below
+	std::condition_variable wake;
+	std::condition_variable loaded;
+	std::vector<int> requests;	//next to load at the back
+	std::vector<std::pair<int, Stage*> > ready;
+	bool stopping;
+
+	void load();
+	void request(int index, bool urgent);
+	void install();
+	void evict(int index);
+	float distance(int index, const float (*positions)[2], int count) const;
+};
+
+#endif
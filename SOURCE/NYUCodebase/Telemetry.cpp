@@ -0,0 +1,227 @@
+#include "Telemetry.h"
+#include "Protocol.h"
+#include "Clock.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#define TELEMETRY_HEADER_SIZE 8
+#define TELEMETRY_RECORD_SIZE 16
+
+TelemetryLog::TelemetryLog() : rotateBytes(TELEMETRY_ROTATE_BYTES), keepFiles(TELEMETRY_KEEP_FILES), flushInterval(TELEMETRY_FLUSH_INTERVAL),
+	queued(0), dropped(0), written(0), startsWritten(0), started(0), inMatch(false), fileBytes(0), stopping(false), opened(false) {
+	memset(stages, 0, sizeof(stages));
+}
+
+TelemetryLog::~TelemetryLog() {
+	close();
+}
+
+bool TelemetryLog::open(const std::string& prefix) {
+	this->prefix = prefix;
+	stamp = std::to_string((long long)time(NULL));
+	files.clear();
+	if (!nextFile())
+		return false;
+	opened = true;
+	stopping = false;
+	writer = std::thread(&TelemetryLog::write, this);
+	return true;
+}
+
+void TelemetryLog::close() {
+	if (!opened)
+		return;
+	stopping = true;
+	writer.join();
+	file.close();
+	opened = false;
+	inMatch = false;
+}
+
+bool TelemetryLog::active() const {
+	return opened;
+}
+
+void TelemetryLog::begin(const char* stageName) {
+	inMatch = false;
+	if (!opened)
+		return;
+	// The slot this match would take still holds a name the writer has not reached
+	if (started - startsWritten.load(std::memory_order_acquire) >= TELEMETRY_STAGE_SLOTS) {
+		dropped++;
+		return;
+	}
+	unsigned int slot = started % TELEMETRY_STAGE_SLOTS;
+	size_t length = std::min(strlen(stageName), (size_t)STAGE_NAME_LENGTH - 1);
+	memcpy(stages[slot], stageName, length);
+	stages[slot][length] = 0;
+	TelemetryEvent event;
+	event.tick = 0;
+	event.type = TELEMETRY_START;
+	event.fighter = 0;
+	event.value = (unsigned short)slot;
+	event.position[0] = 0.0f;
+	event.position[1] = 0.0f;
+	if (!queue.push(event)) {
+		dropped++;
+		return;
+	}
+	queued++;
+	started++;
+	inMatch = true;
+}
+
+void TelemetryLog::push(unsigned char type, int fighter, unsigned int value, unsigned int tick, const float position[2]) {
+	TelemetryEvent event;
+	event.tick = tick;
+	event.type = type;
+	event.fighter = (unsigned char)fighter;
+	event.value = (unsigned short)value;
+	event.position[0] = position[0];
+	event.position[1] = position[1];
+	if (queue.push(event))
+		queued++;
+	else
+		dropped++;
+}
+
+// Everything is read off the two states; the match keeps no history of its own, so
+// logging changes nothing about how it plays or hashes
+void TelemetryLog::observe(const MatchState& before, const Match& after) {
+	if (!inMatch)
+		return;
+	const StageHeader* layout = after.layout();
+	for (int k = 0; k < 2; k++) {
+		const Fighter& was = before.fighters[k];
+		const Fighter& now = after.fighters[k];
+		if (now.events & EVENT_ATTACK)
+			push(TELEMETRY_ATTACK, k, 0, after.tick, now.position);
+		if (now.events & EVENT_HIT)
+			push(TELEMETRY_HIT, 1 - k, was.health - now.health, after.tick, now.position);
+		if ((now.firstJump && !was.firstJump) || (now.secondJump && !was.secondJump))
+			push(TELEMETRY_JUMP, k, 0, after.tick, now.position);
+		bool wasOut = was.health <= 0 || (layout && was.position[1] <= layout->blastLine);
+		if (!wasOut && after.knockedOut(k))
+			push(TELEMETRY_KNOCKOUT, k, now.health > 0 ? 1 : 0, after.tick, now.position);
+	}
+	if (after.over && !before.over) {
+		float origin[2] = { 0.0f, 0.0f };
+		push(TELEMETRY_END, 0, after.winner() + 1, after.tick, origin);
+		inMatch = false;
+	}
+}
+
+// Writer thread: drains the queue a page at a time, then sleeps until there is more
+void TelemetryLog::write() {
+	unsigned char page[TELEMETRY_PAGE];
+	PacketWriter out(page, sizeof(page));
+	for (;;) {
+		bool finishing = stopping;
+		TelemetryEvent event;
+		while (queue.pop(event)) {
+			if (event.type == TELEMETRY_START) {
+				if (fileBytes + out.size > rotateBytes) {
+					file.write((const char*)page, out.size);
+					fileBytes += out.size;
+					out.size = 0;
+					nextFile();
+				}
+			}
+			if (out.size + TELEMETRY_RECORD_SIZE + 1 + STAGE_NAME_LENGTH > out.capacity) {
+				file.write((const char*)page, out.size);
+				fileBytes += out.size;
+				out.size = 0;
+			}
+			out.u8(event.type);
+			out.u8(event.fighter);
+			out.u16(event.value);
+			out.u32(event.tick);
+			out.f32(event.position[0]);
+			out.f32(event.position[1]);
+			if (event.type == TELEMETRY_START) {
+				out.text(stages[event.value], STAGE_NAME_LENGTH);
+				// Only now may begin() put another name in the slot
+				startsWritten.fetch_add(1, std::memory_order_release);
+			}
+			written.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (out.size > 0) {
+			file.write((const char*)page, out.size);
+			file.flush();
+			fileBytes += out.size;
+			out.size = 0;
+		}
+		if (finishing)
+			return;
+		sleepSeconds(flushInterval);
+	}
+}
+
+// Starts the next file and lets the oldest go past keepFiles
+bool TelemetryLog::nextFile() {
+	if (file.is_open())
+		file.close();
+	std::string path = prefix + "-" + stamp + "-" + std::to_string((long long)files.size()) + ".tlog";
+	file.clear();
+	file.open(path.c_str(), std::ios::binary);
+	if (!file) {
+		std::cout << "Unable to write telemetry to " << path << std::endl;
+		return false;
+	}
+	unsigned char header[TELEMETRY_HEADER_SIZE];
+	PacketWriter out(header, sizeof(header));
+	out.u32(TELEMETRY_MAGIC);
+	out.u16(TELEMETRY_VERSION);
+	out.u16(0);
+	file.write((const char*)header, out.size);
+	fileBytes = out.size;
+
+	files.push_back(path);
+	if (keepFiles > 0 && files.size() > (size_t)keepFiles)
+		remove(files[files.size() - keepFiles - 1].c_str());
+	return true;
+}
+
+bool loadTelemetry(const std::string& path, std::vector<TelemetryEvent>& events, std::vector<std::string>& stageNames) {
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in) {
+		std::cout << "Unable to open telemetry " << path << std::endl;
+		return false;
+	}
+	std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (data.empty())
+		data.push_back(0);
+	PacketReader file(&data[0], (int)data.size());
+	unsigned int magic = file.u32();
+	unsigned int version = file.u16();
+	file.u16();
+	if (file.failed || magic != TELEMETRY_MAGIC || version > TELEMETRY_VERSION) {
+		std::cout << path << " is not telemetry this build can read" << std::endl;
+		return false;
+	}
+
+	while (file.position < file.size) {
+		TelemetryEvent event;
+		event.type = (unsigned char)file.u8();
+		event.fighter = (unsigned char)file.u8();
+		event.value = (unsigned short)file.u16();
+		event.tick = file.u32();
+		event.position[0] = file.f32();
+		event.position[1] = file.f32();
+		if (event.type == TELEMETRY_START) {
+			char name[STAGE_NAME_LENGTH];
+			file.text(name, sizeof(name));
+			event.value = (unsigned short)stageNames.size();
+			stageNames.push_back(name);
+		}
+		// A game that stopped mid-write leaves part of a record at the end
+		if (file.failed || event.type > TELEMETRY_END || event.fighter > 1)
+			break;
+		events.push_back(event);
+	}
+	return true;
+}
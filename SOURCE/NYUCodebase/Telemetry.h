@@ -0,0 +1,96 @@
+#ifndef Telemetry_h
+#define Telemetry_h
+
+#include "Match.h"
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Match analytics. The simulation compares each tick with the one before and queues
+// what happened; a writer thread stores it as .tlog files:
+//   u32 magic, u16 version, u16 0
+//   records: u8 type, u8 fighter, u16 value, u32 tick, f32 x, f32 y
+//   a START record is followed by its text stage
+// A file only ever starts at a START, so each one can be read on its own.
+// NYUServer --summarize-telemetry turns them into per match figures.
+#define TELEMETRY_MAGIC 0x314d4c54 // "TLM1"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_QUEUE_SIZE 4096	//events, a tick makes at most about eight
+#define TELEMETRY_STAGE_SLOTS 16	//stage names of the last matches started, see TelemetryEvent
+#define TELEMETRY_FLUSH_INTERVAL 0.1	//seconds the writer sleeps when it has caught up
+#define TELEMETRY_ROTATE_BYTES (1024 * 1024)
+#define TELEMETRY_KEEP_FILES 8
+#define TELEMETRY_PAGE 4096			//bytes the writer gathers before writing them out
+
+enum TelemetryType { TELEMETRY_START, TELEMETRY_ATTACK, TELEMETRY_HIT, TELEMETRY_JUMP, TELEMETRY_KNOCKOUT, TELEMETRY_END };
+
+// 16 bytes, so a queue slot is a quarter of a cache line
+struct TelemetryEvent {
+	unsigned int tick;
+	unsigned char type;
+	unsigned char fighter;	//who did it: the attacker for ATTACK and HIT, the one out for KNOCKOUT
+	// HIT damage, KNOCKOUT 1 off the blast line and 0 out of health, END winner + 1.
+	// START indexes the stage slot its name was put in. A match whose slot the writer
+	// has not got to yet is not logged, so names never go through the queue.
+	unsigned short value;
+	float position[2];	//of whoever it happened to, the one hit for HIT
+};
+
+class TelemetryLog {
+public:
+	TelemetryLog();
+	~TelemetryLog();
+
+	size_t rotateBytes;
+	int keepFiles;
+	double flushInterval;
+
+	// Writes to prefix-<time started>-<n>.tlog; a new file is started at the first match
+	// to begin past rotateBytes and only the last keepFiles are kept
+	bool open(const std::string& prefix);
+	// Writes out everything queued
+	void close();
+	bool active() const;
+
+	// The producer side. Calls must not overlap, but may come from different threads
+	// if a lock hands the match between them, as simLock does in the game.
+	void begin(const char* stageName);
+	// Queues what changed between two consecutive ticks of the match begun
+	void observe(const MatchState& before, const Match& after);
+	// Queues one event as is, dropping it when the queue is full
+	void push(unsigned char type, int fighter, unsigned int value, unsigned int tick, const float position[2]);
+
+	unsigned int queued;	//producer side
+	unsigned int dropped;	//found the queue full
+	std::atomic<unsigned int> written;	//records, writer side
+	std::atomic<unsigned int> startsWritten;
+	// Files written, oldest first, once closed
+	std::vector<std::string> files;
+
+private:
+	SpscQueue<TelemetryEvent, TELEMETRY_QUEUE_SIZE> queue;
+	char stages[TELEMETRY_STAGE_SLOTS][STAGE_NAME_LENGTH];
+	unsigned int started;	//matches begun
+	bool inMatch;
+
+	std::string prefix;
+	std::string stamp;
+	std::ofstream file;
+	size_t fileBytes;
+	std::thread writer;
+	std::atomic<bool> stopping;
+	bool opened;
+
+	void write();
+	bool nextFile();
+};
+
+// Reads a .tlog back. START records get the stage name in stageNames, their value
+// becomes its index there.
+bool loadTelemetry(const std::string& path, std::vector<TelemetryEvent>& events, std::vector<std::string>& stageNames);
+
+#endif
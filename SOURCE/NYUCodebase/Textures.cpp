@@ -0,0 +1,409 @@
+#include "Textures.h"
+#include "RenderState.h"
+#include "Profiler.h"
+#include "Clock.h"
+
+#include <SDL_image.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+TextureManager textures;
+
+// Bytes of an RGBA mip chain down to 1x1, without its top drop levels
+static unsigned int chainBytes(int width, int height, int drop) {
+	unsigned int bytes = 0;
+	for (int level = 0;; level++) {
+		if (level >= drop)
+			bytes += (unsigned int)width * height * 4;
+		if (width == 1 && height == 1)
+			return bytes;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+}
+
+// Halves an RGBA image. Colour is averaged weighted by alpha, so fully transparent
+// texels (usually black) don't bleed into the visible ones next to them.
+static void downsample(const unsigned char* source, int width, int height, unsigned char* target) {
+	int targetWidth = width > 1 ? width / 2 : 1;
+	int targetHeight = height > 1 ? height / 2 : 1;
+	for (int y = 0; y < targetHeight; y++) {
+		int rows[2] = { y * 2, y * 2 + 1 < height ? y * 2 + 1 : height - 1 };
+		for (int x = 0; x < targetWidth; x++) {
+			int columns[2] = { x * 2, x * 2 + 1 < width ? x * 2 + 1 : width - 1 };
+			unsigned int colour[3] = { 0, 0, 0 };
+			unsigned int plain[3] = { 0, 0, 0 };
+			unsigned int alpha = 0;
+			for (int j = 0; j < 2; j++) {
+				for (int i = 0; i < 2; i++) {
+					const unsigned char* texel = source + (rows[j] * width + columns[i]) * 4;
+					for (int c = 0; c < 3; c++) {
+						colour[c] += texel[c] * texel[3];
+						plain[c] += texel[c];
+					}
+					alpha += texel[3];
+				}
+			}
+			unsigned char* out = target + (y * targetWidth + x) * 4;
+			for (int c = 0; c < 3; c++)
+				out[c] = (unsigned char)(alpha > 0 ? (colour[c] + alpha / 2) / alpha : (plain[c] + 2) / 4);
+			out[3] = (unsigned char)((alpha + 2) / 4);
+		}
+	}
+}
+
+static SDL_Surface* loadSurface(const std::string& path) {
+	SDL_Surface* loaded = IMG_Load(path.c_str());
+	if (!loaded) {
+		std::cout << "Could not load texture " << path << ": " << IMG_GetError() << std::endl;
+		return nullptr;
+	}
+	// R, G, B, A bytes in memory whatever the file was, which is what GL_RGBA expects
+	SDL_Surface* surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ABGR8888, 0);
+	SDL_FreeSurface(loaded);
+	if (!surface)
+		std::cout << "Could not convert texture " << path << ": " << SDL_GetError() << std::endl;
+	return surface;
+}
+
+// Decodes an image into its whole RGBA mip chain, level 0 first. Runs on the loader
+// thread as well, so it only touches what it is given.
+static bool decodeChain(const std::string& path, int& width, int& height, std::vector<unsigned char>& chain) {
+	SDL_Surface* surface = loadSurface(path);
+	if (!surface)
+		return false;
+	width = surface->w;
+	height = surface->h;
+	chain.resize(chainBytes(width, height, 0));
+	if (SDL_MUSTLOCK(surface))
+		SDL_LockSurface(surface);
+	for (int y = 0; y < height; y++)
+		memcpy(&chain[(size_t)y * width * 4], (const unsigned char*)surface->pixels + y * surface->pitch, width * 4);
+	if (SDL_MUSTLOCK(surface))
+		SDL_UnlockSurface(surface);
+	SDL_FreeSurface(surface);
+
+	unsigned char* level = &chain[0];
+	int levelWidth = width;
+	int levelHeight = height;
+	while (levelWidth > 1 || levelHeight > 1) {
+		unsigned char* next = level + (size_t)levelWidth * levelHeight * 4;
+		downsample(level, levelWidth, levelHeight, next);
+		level = next;
+		levelWidth = levelWidth > 1 ? levelWidth / 2 : 1;
+		levelHeight = levelHeight > 1 ? levelHeight / 2 : 1;
+	}
+	return true;
+}
+
+TextureManager::TextureManager() : budget(0), keepSeconds(TEXTURE_KEEP_SECONDS), resident(0), stopping(false) {}
+
+TextureManager::~TextureManager() {
+	shutdown();
+}
+
+GLuint TextureManager::load(const char* path) {
+	// Simply never released
+	return acquire(path);
+}
+
+GLuint TextureManager::acquire(const char* path) {
+	TextureEntry* entry = find(path);
+	if (!entry)
+		entry = &add(path);
+	entry->refs++;
+	entry->wanted = clockSeconds();
+	if (entry->state != TEXTURE_RESIDENT && !finish(*entry)) {
+		entries.erase(entries.begin() + (entry - &entries[0]));
+		return 0;
+	}
+	return entry->id;
+}
+
+void TextureManager::release(GLuint id) {
+	if (id == 0)
+		return;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].id != id)
+			continue;
+		// Kept for a while, whoever wants it next may come soon
+		if (entries[i].refs > 0)
+			entries[i].refs--;
+		entries[i].wanted = clockSeconds();
+		return;
+	}
+}
+
+void TextureManager::prefetch(const char* path) {
+	TextureEntry* entry = find(path);
+	if (entry) {
+		entry->wanted = clockSeconds();
+		return;
+	}
+	entry = &add(path);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		requests.push_back(entry->path);
+		if (!loader.joinable()) {
+			stopping = false;
+			loader = std::thread(&TextureManager::decode, this);
+		}
+	}
+	wake.notify_one();
+}
+
+void TextureManager::update() {
+	collect();
+	double now = clockSeconds();
+	int uploads = 0;
+	for (size_t i = 0; i < entries.size();) {
+		TextureEntry& entry = entries[i];
+		if (entry.refs == 0 && now - entry.wanted > keepSeconds) {
+			evict(i);
+			continue;
+		}
+		// One at a time, so a prefetch never costs a frame more than one upload
+		if (entry.state == TEXTURE_DECODED && uploads < TEXTURE_UPLOADS_PER_FRAME) {
+			finish(entry);
+			uploads++;
+		}
+		i++;
+	}
+}
+
+void TextureManager::shutdown() {
+	if (!loader.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	loader.join();
+	requests.clear();
+	done.clear();
+}
+
+void TextureManager::fitBudget() {
+	std::vector<int> drops(entries.size(), 0);
+	unsigned int total = 0;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].state == TEXTURE_RESIDENT)
+			total += chainBytes(entries[i].width, entries[i].height, 0);
+	}
+
+	// Taking a level off the largest texture saves the most and leaves the small
+	// ones, which are usually already close to their on-screen size, sharp
+	while (budget > 0 && total > budget) {
+		int largest = -1;
+		unsigned int largestBytes = 0;
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].state != TEXTURE_RESIDENT || drops[i] >= TEXTURE_MAX_DROP)
+				continue;
+			unsigned int bytes = chainBytes(entries[i].width, entries[i].height, drops[i]);
+			if (bytes > largestBytes) {
+				largest = (int)i;
+				largestBytes = bytes;
+			}
+		}
+		if (largest < 0)
+			break;
+		drops[largest]++;
+		total -= largestBytes - chainBytes(entries[largest].width, entries[largest].height, drops[largest]);
+	}
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		TextureEntry& entry = entries[i];
+		if (entry.state != TEXTURE_RESIDENT || drops[i] == entry.drop)
+			continue;
+		if (!decodeChain(entry.path, entry.width, entry.height, entry.chain))
+			continue;
+		upload(entry, drops[i]);
+		std::vector<unsigned char>().swap(entry.chain);
+	}
+
+	if (budget > 0 && resident > budget)
+		std::cout << "Textures need " << resident / 1024 << " KB even at 1/" << (1 << TEXTURE_MAX_DROP) << " resolution, over the " << budget / 1024 << " KB budget" << std::endl;
+}
+
+// Loader thread: decodes the requested images in the order they were asked for
+void TextureManager::decode() {
+	for (;;) {
+		Decoded result;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !requests.empty(); });
+			if (stopping)
+				return;
+			decoding = requests.front();
+			requests.erase(requests.begin());
+			result.path = decoding;
+		}
+		result.width = 0;
+		result.height = 0;
+		decodeChain(result.path, result.width, result.height, result.chain);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			// VS2013 makes no move constructors, the chain is swapped over instead
+			done.push_back(Decoded());
+			done.back().path.swap(result.path);
+			done.back().width = result.width;
+			done.back().height = result.height;
+			done.back().chain.swap(result.chain);
+			decoding.clear();
+		}
+		decoded.notify_all();
+	}
+}
+
+TextureEntry* TextureManager::find(const char* path) {
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].path == path)
+			return &entries[i];
+	}
+	return nullptr;
+}
+
+TextureEntry& TextureManager::add(const char* path) {
+	entries.push_back(TextureEntry());
+	TextureEntry& entry = entries.back();
+	entry.id = 0;
+	entry.path = path;
+	entry.state = TEXTURE_QUEUED;
+	entry.width = 0;
+	entry.height = 0;
+	entry.drop = 0;
+	entry.bytes = 0;
+	entry.refs = 0;
+	entry.wanted = clockSeconds();
+	return entry;
+}
+
+// Hands what the loader finished to its entries. Never adds or removes one, so
+// references into entries stay good.
+void TextureManager::collect() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (size_t i = 0; i < done.size(); i++) {
+		TextureEntry* entry = find(done[i].path.c_str());
+		// Evicted or loaded by an acquire() in the meantime
+		if (!entry || entry->state != TEXTURE_QUEUED)
+			continue;
+		if (done[i].width == 0) {
+			entry->state = TEXTURE_MISSING;
+			continue;
+		}
+		entry->width = done[i].width;
+		entry->height = done[i].height;
+		entry->chain.swap(done[i].chain);
+		entry->state = TEXTURE_DECODED;
+	}
+	done.clear();
+}
+
+// Makes entry resident now, taking it from the loader or decoding it here
+bool TextureManager::finish(TextureEntry& entry) {
+	ProfileScope scope("texture load");
+	if (entry.state != TEXTURE_DECODED) {
+		// Not prefetched, or not far enough along: the frame waits for it
+		profiler.count("texture loads waited on", 1);
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			std::vector<std::string>::iterator queued = std::find(requests.begin(), requests.end(), entry.path);
+			if (queued != requests.end())
+				requests.erase(queued);
+			decoded.wait(guard, [this, &entry] { return decoding != entry.path; });
+		}
+		collect();
+	}
+	if (entry.state != TEXTURE_DECODED) {
+		if (!decodeChain(entry.path, entry.width, entry.height, entry.chain)) {
+			entry.state = TEXTURE_MISSING;
+			return false;
+		}
+		entry.state = TEXTURE_DECODED;
+	}
+
+	// Start as small as needed to stay inside the budget now; fitBudget() rebalances
+	int drop = 0;
+	while (budget > 0 && drop < TEXTURE_MAX_DROP && resident + chainBytes(entry.width, entry.height, drop) > budget)
+		drop++;
+	glGenTextures(1, &entry.id);
+	upload(entry, drop);
+	std::vector<unsigned char>().swap(entry.chain);
+	entry.state = TEXTURE_RESIDENT;
+	profiler.count("textures loaded", 1);
+	return true;
+}
+
+void TextureManager::evict(size_t index) {
+	TextureEntry& entry = entries[index];
+	if (entry.state == TEXTURE_RESIDENT) {
+		renderState.deleteTexture(entry.id);
+		resident -= entry.bytes;
+		profiler.count("textures evicted", 1);
+	}
+	else if (entry.state == TEXTURE_QUEUED) {
+		std::lock_guard<std::mutex> guard(lock);
+		std::vector<std::string>::iterator queued = std::find(requests.begin(), requests.end(), entry.path);
+		if (queued != requests.end())
+			requests.erase(queued);
+	}
+	entries.erase(entries.begin() + index);
+}
+
+// Uploads the levels of entry.chain from drop down
+void TextureManager::upload(TextureEntry& entry, int drop) {
+	int width = entry.width;
+	int height = entry.height;
+	const unsigned char* level = &entry.chain[0];
+
+	renderState.bindTexture(entry.id);
+	resident -= entry.bytes;
+	entry.bytes = 0;
+	for (int mip = 0;; mip++) {
+		if (mip >= drop) {
+			glTexImage2D(GL_TEXTURE_2D, mip - drop, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, level);
+			entry.bytes += (unsigned int)width * height * 4;
+		}
+		if (width == 1 && height == 1)
+			break;
+		level += (size_t)width * height * 4;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	resident += entry.bytes;
+	entry.drop = drop;
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+unsigned int TextureManager::residentBytes() const {
+	return resident;
+}
+
+void TextureManager::report() {
+	profiler.gauge("texture MB resident", resident / (1024.0 * 1024.0));
+}
+
+void TextureManager::print(bool detail) const {
+	std::cout << "Textures: " << entries.size() << " using " << resident / 1024 << " KB";
+	if (budget > 0)
+		std::cout << " of a " << budget / 1024 << " KB budget";
+	std::cout << std::endl;
+	if (!detail)
+		return;
+	for (size_t i = 0; i < entries.size(); i++) {
+		const TextureEntry& entry = entries[i];
+		if (entry.state != TEXTURE_RESIDENT) {
+			std::cout << "  " << entry.path << ": " << (entry.state == TEXTURE_MISSING ? "missing" : "loading") << std::endl;
+			continue;
+		}
+		std::cout << "  " << entry.path << " " << entry.width << "x" << entry.height;
+		if (entry.drop > 0)
+			std::cout << " at 1/" << (1 << entry.drop);
+		std::cout << ": " << entry.bytes / 1024 << " KB" << std::endl;
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef Textures_h
+#define Textures_h
+
+#ifdef _WINDOWS
+#include <GL/glew.h>
+#endif
+#include <SDL.h>
+#include <SDL_opengl.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TEXTURE_MAX_DROP 2	//mip levels a texture may lose to the budget: half, then quarter resolution
+#define TEXTURE_KEEP_SECONDS 5.0	//an unused texture stays this long after it was last wanted
+#define TEXTURE_UPLOADS_PER_FRAME 1	//prefetched textures put on the GPU by one update()
+
+enum TextureState { TEXTURE_QUEUED, TEXTURE_DECODED, TEXTURE_RESIDENT, TEXTURE_MISSING };
+
+struct TextureEntry {
+	GLuint id;		//0 until resident
+	std::string path;
+	TextureState state;
+	int width;		//of the image on disk
+	int height;
+	int drop;		//top mip levels left out, 0 is full resolution
+	unsigned int bytes;	//resident on the GPU, whole mip chain
+	int refs;		//acquires not released yet
+	double wanted;	//when it was last acquired, released or prefetched
+	std::vector<unsigned char> chain;	//decoded mip levels, only while DECODED
+};
+
+// Every texture the game draws is loaded here with a full mip chain, built on the CPU
+// with an alpha weighted box filter so transparent texels don't darken sprite edges.
+// With a budget set, the biggest textures give up their top mip levels (half, then
+// quarter resolution) until everything fits; the GL name stays the same, so entities
+// holding it never notice.
+// Textures are counted: one nobody holds and nobody has prefetched for
+// TEXTURE_KEEP_SECONDS is deleted by update(). prefetch() decodes on a loader thread
+// so the acquire() that follows only uploads; an acquire() that gets there first
+// decodes on the spot and counts as a stall. Only the GL thread may call in.
+class TextureManager {
+public:
+	TextureManager();
+	~TextureManager();
+
+	unsigned int budget;	//bytes, 0 for no limit
+	double keepSeconds;
+
+	// Resident for as long as the program runs
+	GLuint load(const char* path);
+	// Resident until released, 0 if it could not be loaded
+	GLuint acquire(const char* path);
+	void release(GLuint id);
+	// Starts decoding in the background and keeps it from being evicted; call again
+	// every frame it is still likely to be wanted
+	void prefetch(const char* path);
+	// Uploads what the loader finished and evicts what went unused, once a frame
+	void update();
+	void shutdown();
+	// Chooses every texture's resolution again, largest first, and re-uploads the ones that changed
+	void fitBudget();
+
+	unsigned int residentBytes() const;
+	// Resident bytes to the profiler
+	void report();
+	// Resident bytes and budget to the console, every texture when detail is set
+	void print(bool detail) const;
+
+private:
+	struct Decoded {
+		std::string path;
+		int width;	//0 if it could not be loaded
+		int height;
+		std::vector<unsigned char> chain;
+	};
+
+	std::vector<TextureEntry> entries;
+	unsigned int resident;
+
+	std::thread loader;
+	std::mutex lock;	//guards everything below
+	std::condition_variable wake;
+	std::condition_variable decoded;
+	std::vector<std::string> requests;	//next to decode at the front
+	std::string decoding;
+	std::vector<Decoded> done;
+	bool stopping;
+
+	void decode();
+	TextureEntry* find(const char* path);
+	TextureEntry& add(const char* path);
+	void collect();
+	bool finish(TextureEntry& entry);
+	void evict(size_t index);
+	void upload(TextureEntry& entry, int drop);
+};
+
+extern TextureManager textures;
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef TripleBuffer_h
+#define TripleBuffer_h
+
+#include <atomic>
+
+// Hands the newest value from one writer thread to one reader thread without either
+// ever waiting. The writer fills its own slot and swaps it with the middle one; the
+// reader swaps the middle slot with its own when something new is there. Values the
+// reader was too slow for are skipped, never queued.
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer() : back(0), middle(1), front(2) {}
+
+	// Writer side: fill writeSlot() completely, then publish() it
+	T& writeSlot() {
+		return slots[back];
+	}
+	void publish() {
+		back = middle.exchange(back | FRESH) & INDEX;
+	}
+
+	// Reader side: true when a newer value was published since the last call
+	bool update() {
+		if (!(middle.load() & FRESH))
+			return false;
+		front = middle.exchange(front) & INDEX;
+		return true;
+	}
+	const T& read() const {
+		return slots[front];
+	}
+
+private:
+	enum { INDEX = 3, FRESH = 4 };
+
+	T slots[3];
+	int back;
+	std::atomic<int> middle;	//slot index, FRESH once written and not yet read
+	int front;
+
+	TripleBuffer(const TripleBuffer&);
+	TripleBuffer& operator=(const TripleBuffer&);
+};
+
+#endif
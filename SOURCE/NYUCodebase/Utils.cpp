@@ -1,74 +1,84 @@
 #include "Utils.h"
+#include "RenderState.h"
+#include "FrameArena.h"
+#include "Textures.h"
 
-void Ut::DrawText(ShaderProgram* program, int fontTexture, std::string text, float size, float spacing) {
+#include <cstring>
+
+void Ut::DrawText(ShaderProgram* program, int fontTexture, const char* text, float x, float y, float size, float spacing) {
 	float texture_size = 1.0 / 16.0f;
-	std::vector<float> vertexData;
-	std::vector<float> texCoordData;
+	size_t length = strlen(text);
+	float* vertexData = frameArena.floats(length * 12);
+	float* texCoordData = frameArena.floats(length * 12);
+	if (length == 0 || !vertexData || !texCoordData)
+		return;
 
-	for (size_t i = 0; i < text.size(); i++) {
+	for (size_t i = 0; i < length; i++) {
 		float texture_x = (float)(((int)text[i]) % 16) / 16.0f;
 		float texture_y = (float)(((int)text[i]) / 16) / 16.0f;
-		vertexData.insert(vertexData.end(), {
-			((size + spacing) * i) + (-0.5f * size), 0.5f * size,
-			((size + spacing) * i) + (-0.5f * size), -0.5f * size,
-			((size + spacing) * i) + (0.5f * size), 0.5f * size,
-			((size + spacing) * i) + (0.5f * size), -0.5f * size,
-			((size + spacing) * i) + (0.5f * size), 0.5f * size,
-			((size + spacing) * i) + (-0.5f * size), -0.5f * size,
-		});
-		texCoordData.insert(texCoordData.end(), {
+		float left = x + (size + spacing) * i - 0.5f * size;
+		float right = left + size;
+		float top = y + 0.5f * size;
+		float bottom = y - 0.5f * size;
+		float vertices[] = {
+			left, top,
+			left, bottom,
+			right, top,
+			right, bottom,
+			right, top,
+			left, bottom,
+		};
+		float texCoords[] = {
 			texture_x, texture_y,
 			texture_x, texture_y + texture_size,
 			texture_x + texture_size, texture_y,
 			texture_x + texture_size, texture_y + texture_size,
 			texture_x + texture_size, texture_y,
 			texture_x, texture_y + texture_size,
-		});
+		};
+		memcpy(vertexData + i * 12, vertices, sizeof(vertices));
+		memcpy(texCoordData + i * 12, texCoords, sizeof(texCoords));
 	}
-	glUseProgram(program->programID);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	glVertexAttribPointer(program->positionAttribute, 2, GL_FLOAT, false, 0, vertexData.data());
-	glEnableVertexAttribArray(program->positionAttribute);
-	glVertexAttribPointer(program->texCoordAttribute, 2, GL_FLOAT, false, 0, texCoordData.data());
-	glEnableVertexAttribArray(program->texCoordAttribute);
-	glBindTexture(GL_TEXTURE_2D, fontTexture);
-	glDrawArrays(GL_TRIANGLES, 0, text.size() * 6);
+	renderState.useProgram(program->programID);
+	renderState.setBlend(true);
+	renderState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	glDisableVertexAttribArray(program->positionAttribute);
-	glDisableVertexAttribArray(program->texCoordAttribute);
+	glVertexAttribPointer(program->positionAttribute, 2, GL_FLOAT, false, 0, vertexData);
+	renderState.enableAttribute(program->positionAttribute);
+	glVertexAttribPointer(program->texCoordAttribute, 2, GL_FLOAT, false, 0, texCoordData);
+	renderState.enableAttribute(program->texCoordAttribute);
+	renderState.bindTexture(fontTexture);
+	renderState.drawArrays(GL_TRIANGLES, 0, length * 6);
 }
 
 
 GLuint Ut::LoadTexture(const char* image_path) {
-	SDL_Surface* surface = IMG_Load(image_path);
-
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_2D, textureID);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface->w, surface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	SDL_FreeSurface(surface);
+	return textures.load(image_path);
+}
 
-	return textureID;
+void Ut::IntToText(int value, char* buffer) {
+	char digits[12];
+	int count = 0;
+	unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+	do {
+		digits[count++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0)
+		*buffer++ = '-';
+	while (count > 0)
+		*buffer++ = digits[--count];
+	*buffer = 0;
 }
 
 float Ut::map(float x, float in_min, float in_max, float out_min, float out_max) {
 	return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
 }
 
-void Ut::refresh(Matrix projectionMatrix, Matrix viewMatrix, Matrix modelMatrix, ShaderProgram* program) {
+void Ut::refresh(Matrix& projectionMatrix, Matrix& viewMatrix, ShaderProgram* program) {
 	projectionMatrix.identity();
-	modelMatrix.identity();
 	viewMatrix.identity();
 
 	projectionMatrix.setOrthoProjection(-4.0, 4.0, -2.25f, 2.25f, -1.0f, 1.0f);
-	program->setModelMatrix(modelMatrix);
-	program->setProjectionMatrix(projectionMatrix);
-	program->setViewMatrix(viewMatrix);
+	program->setViewProjectionMatrix(viewMatrix * projectionMatrix);
 }
\ No newline at end of file
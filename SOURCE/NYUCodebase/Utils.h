@@ -25,10 +25,13 @@ enum Type { PLAYER, BLOCK, WIZARD };
 
 class Ut {
 public:
-	void DrawText(ShaderProgram* program, int fontTexture, std::string text, float size, float spacing);
+	// Draws text with the middle of its first character at x, y
+	void DrawText(ShaderProgram* program, int fontTexture, const char* text, float x, float y, float size, float spacing);
+	// Writes value as decimal into buffer (12 chars is enough for any int), no allocation
+	void IntToText(int value, char* buffer);
 	GLuint LoadTexture(const char* image_path);
 	float map(float x, float in_min, float in_max, float out_min, float out_max);
-	void refresh(Matrix projectionMatrix, Matrix viewMatrix, Matrix modelMatrix, ShaderProgram* program);
+	void refresh(Matrix& projectionMatrix, Matrix& viewMatrix, ShaderProgram* program);
 };
 
 #endif
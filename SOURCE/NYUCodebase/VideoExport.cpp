@@ -0,0 +1,262 @@
+#include "VideoExport.h"
+#include "Clock.h"
+#include "RenderState.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef _WINDOWS
+#define popen _popen
+#define pclose _pclose
+#define PIPE_MODE "wb"	//text mode would turn every 0x0a into 0x0d 0x0a
+#else
+#define PIPE_MODE "w"
+#include <csignal>
+#endif
+
+VideoExporter::VideoExporter() : width(0), height(0), format(VIDEO_Y4M), fps(0), framebuffer(0), colour(0), issued(0), mapped(0),
+	pipe(nullptr), stopping(false), failed(false) {
+	memset(&stats, 0, sizeof(stats));
+	memset(buffers, 0, sizeof(buffers));
+}
+
+VideoExporter::~VideoExporter() {
+	if (writer.joinable())
+		close();
+}
+
+bool VideoExporter::open(const std::string& output, int width, int height, int fps) {
+	this->width = width;
+	this->height = height;
+	this->fps = fps;
+	format = output.size() > 5 && output.compare(output.size() - 5, 5, ".rgba") == 0 ? VIDEO_RGBA : VIDEO_Y4M;
+	if (width <= 0 || height <= 0 || (format == VIDEO_Y4M && (width % 2 || height % 2))) {
+		std::cout << "Video size " << width << "x" << height << " does not work, Y4M needs it even" << std::endl;
+		return false;
+	}
+
+	if (!output.empty() && output[0] == '|') {
+#ifndef _WINDOWS
+		// An encoder that quits early should fail the export, not kill the game
+		signal(SIGPIPE, SIG_IGN);
+#endif
+		pipe = popen(output.c_str() + 1, PIPE_MODE);
+		if (!pipe) {
+			std::cout << "Could not start " << output.c_str() + 1 << std::endl;
+			return false;
+		}
+	}
+	else {
+		file.open(output.c_str(), std::ios::binary);
+		if (!file) {
+			std::cout << "Could not write " << output << std::endl;
+			return false;
+		}
+	}
+
+	glGenTextures(1, &colour);
+	renderState.bindTexture(colour);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colour, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "Offscreen framebuffer of " << width << "x" << height << " is not supported" << std::endl;
+		return false;
+	}
+	glViewport(0, 0, width, height);
+
+	glGenBuffers(VIDEO_PBO_COUNT, buffers);
+	for (int i = 0; i < VIDEO_PBO_COUNT; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	// Every frame buffer is allocated here, exporting a frame never touches the heap
+	frames.assign(VIDEO_QUEUE_FRAMES, std::vector<unsigned char>((size_t)width * height * 4));
+	converted.resize(format == VIDEO_Y4M ? (size_t)width * height * 3 / 2 : (size_t)width * height * 4);
+	available.clear();
+	queued.clear();
+	available.reserve(VIDEO_QUEUE_FRAMES);
+	queued.reserve(VIDEO_QUEUE_FRAMES);
+	for (int i = VIDEO_QUEUE_FRAMES - 1; i >= 0; i--)
+		available.push_back(i);
+	issued = 0;
+	mapped = 0;
+	stopping = false;
+	failed = false;
+	memset(&stats, 0, sizeof(stats));
+
+	if (format == VIDEO_Y4M) {
+		std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" + std::to_string(fps) + ":1 Ip A1:1 C420jpeg\n";
+		if (!put((const unsigned char*)header.data(), header.size()))
+			return false;
+	}
+	writer = std::thread(&VideoExporter::write, this);
+	return true;
+}
+
+bool VideoExporter::capture() {
+	// The slot about to be reused holds the readback from VIDEO_PBO_COUNT frames ago
+	if (issued - mapped == VIDEO_PBO_COUNT && !drain())
+		return false;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[issued % VIDEO_PBO_COUNT]);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	issued++;
+	return true;
+}
+
+// Copies the oldest readback in flight into a free frame and queues it for the writer
+bool VideoExporter::drain() {
+	double started = clockSeconds();
+	int frame;
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (available.empty() && !failed)
+			freed.wait(guard);
+		if (failed)
+			return false;
+		frame = available.back();
+		available.pop_back();
+	}
+	double gotFrame = clockSeconds();
+	stats.writerWait += gotFrame - started;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[mapped % VIDEO_PBO_COUNT]);
+	const void* pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (pixels) {
+		memcpy(&frames[frame][0], pixels, frames[frame].size());
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	mapped++;
+	stats.readbackWait += clockSeconds() - gotFrame;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (!pixels) {
+		std::cout << "Could not map a video readback" << std::endl;
+		available.push_back(frame);
+		failed = true;
+		return false;
+	}
+	queued.push_back(frame);
+	stats.frames++;
+	wake.notify_one();
+	return true;
+}
+
+bool VideoExporter::close() {
+	while (mapped < issued && drain()) {}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		wake.notify_one();
+	}
+	if (writer.joinable())
+		writer.join();
+
+	if (pipe) {
+		if (pclose(pipe) != 0)
+			failed = true;
+		pipe = nullptr;
+	}
+	if (file.is_open())
+		file.close();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (framebuffer)
+		glDeleteFramebuffers(1, &framebuffer);
+	if (colour)
+		renderState.deleteTexture(colour);
+	if (buffers[0])
+		glDeleteBuffers(VIDEO_PBO_COUNT, buffers);
+	framebuffer = 0;
+	colour = 0;
+	memset(buffers, 0, sizeof(buffers));
+	return !failed;
+}
+
+// Writer thread: frames go out in the order they were drawn
+void VideoExporter::write() {
+	static const char frameHeader[] = "FRAME\n";
+	for (;;) {
+		int frame;
+		bool ok;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (queued.empty() && !stopping)
+				wake.wait(guard);
+			if (queued.empty())
+				return;
+			frame = queued.front();
+			queued.erase(queued.begin());
+			ok = !failed;
+		}
+
+		double started = clockSeconds();
+		if (ok) {
+			convert(&frames[frame][0]);
+			if (format == VIDEO_Y4M)
+				ok = put((const unsigned char*)frameHeader, sizeof(frameHeader) - 1);
+			ok = ok && put(&converted[0], converted.size());
+		}
+		stats.writeTime += clockSeconds() - started;
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (!ok)
+			failed = true;
+		available.push_back(frame);
+		freed.notify_one();
+	}
+}
+
+bool VideoExporter::put(const unsigned char* data, size_t size) {
+	if (pipe) {
+		if (fwrite(data, 1, size, pipe) != size) {
+			std::cout << "The video encoder stopped taking frames" << std::endl;
+			return false;
+		}
+	}
+	else if (!file.write((const char*)data, size)) {
+		std::cout << "Could not write the video" << std::endl;
+		return false;
+	}
+	stats.bytes += size;
+	return true;
+}
+
+// GL rows run bottom to top, video rows top to bottom. Y4M is BT.601 studio range Y'CbCr
+// with each chroma sample the average of a 2x2 block.
+void VideoExporter::convert(const unsigned char* rgba) {
+	int stride = width * 4;
+	if (format == VIDEO_RGBA) {
+		for (int y = 0; y < height; y++)
+			memcpy(&converted[(size_t)y * stride], rgba + (size_t)(height - 1 - y) * stride, stride);
+		return;
+	}
+
+	unsigned char* luma = &converted[0];
+	unsigned char* cb = luma + (size_t)width * height;
+	unsigned char* cr = cb + (size_t)width * height / 4;
+	for (int y = 0; y < height; y += 2) {
+		const unsigned char* rows[2] = { rgba + (size_t)(height - 1 - y) * stride, rgba + (size_t)(height - 2 - y) * stride };
+		for (int x = 0; x < width; x += 2) {
+			int red = 0, green = 0, blue = 0;
+			for (int j = 0; j < 2; j++) {
+				for (int i = 0; i < 2; i++) {
+					const unsigned char* texel = rows[j] + (x + i) * 4;
+					luma[(size_t)(y + j) * width + x + i] = (unsigned char)(((66 * texel[0] + 129 * texel[1] + 25 * texel[2] + 128) >> 8) + 16);
+					red += texel[0];
+					green += texel[1];
+					blue += texel[2];
+				}
+			}
+			size_t chroma = (size_t)(y / 2) * (width / 2) + x / 2;
+			cb[chroma] = (unsigned char)(((-38 * red - 74 * green + 112 * blue + 512) >> 10) + 128);
+			cr[chroma] = (unsigned char)(((112 * red - 94 * green - 18 * blue + 512) >> 10) + 128);
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef VideoExport_h
+#define VideoExport_h
+
+#ifdef _WINDOWS
+#include <GL/glew.h>
+#endif
+#include <SDL_opengl.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define VIDEO_PBO_COUNT 3		//readbacks in flight, a frame is mapped this many captures after it was drawn
+#define VIDEO_QUEUE_FRAMES 8	//frames waiting for the writer before capture() has to wait for it
+
+// Where the frames go: a .y4m file, raw RGBA rows top to bottom, or Y4M into the
+// standard input of an encoder started with the command after a leading '|'
+enum VideoFormat { VIDEO_Y4M, VIDEO_RGBA };
+
+struct VideoExportStats {
+	unsigned int frames;		//handed to the writer
+	double readbackWait;		//seconds capture() spent mapping finished readbacks
+	double writerWait;			//seconds capture() spent waiting for a free frame
+	double writeTime;			//seconds the writer thread spent converting and writing
+	unsigned long long bytes;	//written
+};
+
+// Renders offscreen into a width x height framebuffer and streams what is drawn there
+// out as video. Each capture() starts an asynchronous glReadPixels into the next pixel
+// buffer of a ring of VIDEO_PBO_COUNT and only maps the one started that many frames
+// ago, which the GPU has long finished, so reading back never waits on the frame just
+// drawn. Mapped pixels are copied into a free frame and a writer thread flips,
+// converts and writes it while the next frames render.
+class VideoExporter {
+public:
+	VideoExporter();
+	~VideoExporter();
+
+	VideoExportStats stats;
+
+	// Creates the framebuffer and leaves it bound with a matching viewport. Y4M needs an even size.
+	bool open(const std::string& output, int width, int height, int fps);
+	// Call once a frame has been drawn. False once the writer has failed, e.g. the encoder quit.
+	bool capture();
+	// Writes out the frames still in flight, stops the writer and puts back the default framebuffer
+	bool close();
+
+	int width;
+	int height;
+
+private:
+	VideoFormat format;
+	int fps;
+	GLuint framebuffer;
+	GLuint colour;
+	GLuint buffers[VIDEO_PBO_COUNT];
+	unsigned int issued;	//readbacks started
+	unsigned int mapped;	//readbacks copied out
+
+	std::ofstream file;
+	FILE* pipe;
+
+	std::vector<std::vector<unsigned char> > frames;	//VIDEO_QUEUE_FRAMES of width * height * 4
+	std::vector<unsigned char> converted;	//writer thread only
+	std::thread writer;
+	std::mutex lock;	//guards everything below
+	std::condition_variable wake;
+	std::condition_variable freed;
+	std::vector<int> available;
+	std::vector<int> queued;	//oldest first
+	bool stopping;
+	bool failed;
+
+	bool drain();
+	void write();
+	bool put(const unsigned char* data, size_t size);
+	void convert(const unsigned char* rgba);
+};
+
+#endif
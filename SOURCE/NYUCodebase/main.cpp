@@ -14,6 +14,42 @@
 #include "Matrix.h"
 #include "Utils.h"
 #include "Entity.h"
+#include "Stage.h"
+#include "StageStream.h"
+#include "RenderState.h"
+#include "Profiler.h"
+#include "Audio.h"
+#include "FrameArena.h"
+#include "AllocTracker.h"
+#include "Match.h"
+#include "Net.h"
+#include "Protocol.h"
+#include "Spectator.h"
+#include "SaveState.h"
+#include "Replay.h"
+#include "TripleBuffer.h"
+#include "Textures.h"
+#include "Clock.h"
+#include "VideoExport.h"
+#include "Resolution.h"
+#include "Telemetry.h"
+#include "GpuTimer.h"
+#include "Shaders.h"
+#include "Projectiles.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#ifdef _WINDOWS
+#include <mmsystem.h>
+#endif
 
 #ifdef _WINDOWS
 #define RESOURCE_FOLDER ""
@@ -22,21 +58,22 @@
 #endif
 
 // GLOBAL GAME VARIABLES____________________________________________________________________________________________________________________________
-int MOA = Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 4096);
-Mix_Chunk *chukatk,*ivenatk;
-Mix_Music *music;
+Mix_Chunk* hitSounds[CHARACTER_COUNT];
 // SDL & Rendering Objects
 SDL_Window* displayWindow;
 GLuint fontTexture;
-std::vector<GLuint> playerSpriteTexture, player2SpriteTexture;
+// Per CharacterId, as listed in Characters.h
+std::vector<GLuint> characterTextures[CHARACTER_COUNT];
+AnimationSet characterAnimations[CHARACTER_COUNT];
 GLuint groundTexture;
 GLuint powerupTexture;
-GLuint HALDUN, temple, fd, bf;
+GLuint HALDUN;
+GLuint backgroundTexture = 0;
 
 Matrix projectionMatrix;
 Matrix viewMatrix;
-Matrix modelMatrix;
 
+// Built by shaders, from the binary cache unless --no-shader-cache
 ShaderProgram* program;
 Ut ut; // drawText(), LoadTexture()
 
@@ -44,28 +81,22 @@ Ut ut; // drawText(), LoadTexture()
 enum GameState { STATE_MAIN_MENU, STATE_GAME_LEVEL};
 enum GameStage { FINAL_DESTINATION, BATTLEFIELD, TEMPLE };
 int stage = FINAL_DESTINATION;
+const char* stageFiles[] = { "FinalDestination", "Battlefield", "Temple" };
+Uint32 lastStageCheck = 0;
+#define STAGE_CHECK_INTERVAL 500
 int state;
 bool gameOver = false;
 bool gameRunning = true;
 float lastFrameTicks = 0.0f;
 float elapsed;
-bool dead = false;
-float deathCounter = 0.0f;
-#define FIXED_TIMESTEP 0.0166666f
-#define MAX_TIMESTEPS 6
-#define ANAPEN 0.0001f
-#define p1CD 0.7f
-#define p2CD 1.0f
-
-// Player Attributes. p1 is players[0]. p2 is players[1]
-float playerSpeed = 3.0f;
+#define MAX_TIMESTEPS 6	//ticks the simulation runs back to back to catch up before it drops them
+#define WARMUP_FRAMES 120
+int steadyFrames = 0;
+
+// Player Controls. p1 is players[0]. p2 is players[1]
 bool p1controlsMoveLeft = false;
 bool p1controlsMoveRight = false;
 bool p1controlsJump = false;
-bool p1firstJump = false;
-bool p1secondJump = false;
-float p1timeSinceLastJump = 0.0f;
-int p1Health = 100;
 bool p1NormalAttack;
 bool p1StrongAttack;
 bool p1UpAttack;
@@ -73,399 +104,854 @@ bool p1UpAttack;
 bool p2controlsMoveLeft = false;
 bool p2controlsMoveRight = false;
 bool p2controlsJump = false;
-bool p2firstJump = false;
-bool p2secondJump = false;
-float p2timeSinceLastJump = 0.0f;
-int p2Health = 100;
 bool p2NormalAttack;
 bool p2StrongAttack;
 bool p2UpAttack;
 
+// Online play (--connect host port): NYUServer runs the match, we send p1's keys as
+// whichever player it gives us and draw the states it sends back.
+// Spectating (--spectate host port) draws the server's spectator feed instead.
+bool online = false;
+bool spectating = false;
+UdpSocket connection;
+NetAddress server;
+int onlineSlot = -1;
+unsigned int inputSequence = 0;
+SpectatorDecoder feed;
+unsigned int feedFrame = 0;
+bool feedPlaying = false;
+Uint32 lastFeedAck = 0;
+#define JOIN_ATTEMPTS 10
+#define JOIN_WAIT 300
+
+// Training mode: F5 saves the match, F9 puts it back. Local matches only.
+unsigned char trainingSave[SAVESTATE_MAX_SIZE];
+int trainingSaveSize = 0;
+#define TRAINING_SAVE_FILE "training.sav"
+
+// Local matches are recorded and written out when they end, for NYUServer --check-replay
+Replay replay;
+#define LAST_REPLAY_FILE "last.replay"
+
+// --telemetry prefix: local matches are logged for NYUServer --summarize-telemetry. The
+// simulation thread queues what each tick changed, a writer thread does the file work.
+TelemetryLog telemetry;
+MatchState tickBefore;	//simulation thread only
+
+// Shots and cherries, stepped after the match on the simulation thread and drawn from
+// each SimSnapshot. Only --projectile-stress N spawns any, keeping N of them flying in
+// local matches; the pool is not part of the replay, so those matches are not recorded.
+ProjectilePool projectiles;
+unsigned int projectileStress = 0;
+unsigned int stressRandom = 1;	//simulation thread only
+// Moves the projectiles with the simulation thread, started by it and only for stress
+// runs; otherwise the pool is too small to split
+JobSystem simJobs;
+
+// The match runs on its own thread at MATCH_TICK_RATE, so a slow swap or vsync wait
+// never holds up a tick. Each tick goes out as a SimSnapshot through a triple buffer and
+// the main thread draws the newest one, blended with the tick before. The main thread
+// only changes match under simLock: starting a match, training saves, stage reloads.
+// The simulation thread only ever writes its MatchState part, so the rest (characters,
+// stage, streamed) is the main thread's to read without the lock.
+struct TickJitter {
+	unsigned int ticks;
+	double intervalMin;	//seconds between tick starts
+	double intervalMax;
+	unsigned int late;		//started more than SIM_LATE after they were due
+	unsigned int dropped;	//let go after falling MAX_TIMESTEPS behind
+};
+
+struct SimSnapshot {
+	MatchState previous;	//the tick before current, to blend from
+	MatchState current;
+	double time;			//clockSeconds() when current was made
+	unsigned int generation;	//which start or load of the match this came from
+	int winner;
+	TickJitter jitter;		//over the last whole SIM_JITTER_WINDOW
+	ProjectileView projectiles;	//after current
+};
+
+#define SIM_SPIN_MARGIN 0.002	//seconds before a tick is due that the thread stops sleeping and yields
+#define SIM_LATE 0.001
+#define SIM_JITTER_WINDOW 1.0
+
+std::thread simThread;
+std::atomic<bool> simAlive(true);
+std::mutex simLock;
+bool simRunning = false;		//under simLock
+unsigned int simGeneration = 0;	//under simLock, bumped whenever match is replaced from the main thread
+TripleBuffer<SimSnapshot> snapshots;
+std::atomic<int> playerButtons[2];	//InputButton bits, written by the main thread
+std::atomic<unsigned int> pendingSounds(0);	//bit k: fighter k attacked since the main thread last looked
+unsigned int shownGeneration = 0;
+MatchState shown;	//what is on screen, main thread only
+int shownWinner = -1;
+float shownBlend = 1.0f;	//how far shown is from the snapshot's previous tick to its current one
+int renderStall = 0;	//--render-stall ms, an artificially slow swap
+
+// --stream-stage Name: local matches are on Name.stage, loaded in chunks around the
+// fighters instead of whole, for maps far bigger than the screen. No replays, they
+// can only be checked against the whole stage.
+std::string streamName;
+StageStream streamedStage;
+
+// The game draws at a resolution that follows frame time, stretched over the window.
+// The GPU's share of it comes from gpuTimer's queries; --no-gpu-timer (or a driver
+// without them) waits for the GPU at the end of each frame instead.
+ResolutionScaler resolution;
+bool showResolution = false;	//F3
+
+// --export-replay file.replay output: renders a recorded match offscreen, as fast as it
+// draws, into a video (VideoExport.h) and quits. No window shows and there is no sound.
+std::string exportReplayPath;
+std::string exportOutput;
+int exportWidth = 1280;
+int exportHeight = 720;
+int exportFps = MATCH_TICK_RATE;
+#define EXPORT_HOLD_SECONDS 2	//the result stays up this long after the last tick
+
+// --bench-replay file.replay: plays a recorded match offscreen at the export size, a
+// frame a tick with nothing held back, and prints tick and frame times (Benchmark.h).
+// --json writes them out, --baseline compares them against an earlier --json and
+// --threshold sets how much worse a figure may get. NYUServer --bench-replay is the same
+// without drawing.
+#define BENCH_RENDER_RUNS 5	//times the replay is drawn, frame times are over every frame of them all
+std::string benchReplayPath;
+std::string benchJsonPath;
+std::string benchBaselinePath;
+double benchThreshold = BENCH_DEFAULT_THRESHOLD;
+
 // Game Object containers
+Match match;
 std::vector<Entity> players;
-std::vector<Entity> blocks;
-std::vector<Entity> backgrounds;//BF, FD, Temple
+Stage currentStage;
+Entity background;
 Entity Hadimioglu;
 
 // FUNCTIONS I CAN'T STICK ANYWHERE ELSE____________________________________________________________________________________________________________________________
-void setUpStage(int& mapstage, std::vector<Entity>& blocks) {
-	// Final Destination
+void loadBackground(const StageHeader& layout) {
+	if (backgroundTexture)
+		textures.release(backgroundTexture);
+	backgroundTexture = textures.acquire(layout.background);
+	// Backgrounds differ in size, so the budget may now allow more or less elsewhere
+	textures.fitBudget();
+	background = Entity(2.5f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0, 0, { backgroundTexture }, 355.0f, 200.0f, WIZARD);
+}
 
-	if (mapstage == FINAL_DESTINATION) {
-		for (int i = 0; i < 50; i++) {
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, 0.0f - (4 * 0.5f), 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-		}
+// Sprites are only resident while a match that uses them is on
+void acquireCharacters() {
+	for (int c = 0; c < CHARACTER_COUNT; c++) {
+		if (!characterTextures[c].empty() || (match.characters[0] != c && match.characters[1] != c))
+			continue;
+		for (size_t i = 0; i < characterAnimations[c].sprites.size(); i++)
+			characterTextures[c].push_back(textures.acquire(characterAnimations[c].sprites[i].c_str()));
+		textures.fitBudget();
 	}
-	else if (mapstage == BATTLEFIELD) {
-		for (int i = -5; i < 55; i++) {
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, -2.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-		}
-
-		for (int i = 0; i < 50; i++) {
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-			if (i == 10)
-				i = 40;
-		}
+}
 
-		for (int i = 20; i < 30; i++) {
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, 2.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-		}
+// Gives the match's textures back when it ends; they stay until unused for a while
+void releaseMatchTextures() {
+	for (int c = 0; c < CHARACTER_COUNT; c++) {
+		for (size_t i = 0; i < characterTextures[c].size(); i++)
+			textures.release(characterTextures[c][i]);
+		characterTextures[c].clear();
 	}
-	else if (mapstage == TEMPLE) {
-		for (int i = -5; i < 130; i++) {
-			if (i == 55)
-				i = 69;
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, -1.8f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-		}
+	if (backgroundTexture)
+		textures.release(backgroundTexture);
+	backgroundTexture = 0;
+}
 
-		for (int i = 5; i < 45; i++) {
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, 2.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-		}
+// The splash is only resident on the menu
+void enterMainMenu() {
+	HALDUN = textures.acquire("HaldunMode.png");
+	Hadimioglu = Entity(0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0, 0, { HALDUN }, 21.5f, 21.5f, WIZARD);
+	state = STATE_MAIN_MENU;
+}
 
-		for (int i = -5; i < 70; i++) {
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, -5.5f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-		}
+void leaveMainMenu() {
+	textures.release(HALDUN);
+	HALDUN = 0;
+}
 
-		for (int i = 0; i < 18; i++) {
-			blocks.push_back(Entity(11.3, -2.0f - (i * 0.2f), 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-		}
+bool setUpStage(int& mapstage, Stage& level) {
+	// Stage layouts live in <name>.stage, compiled to <name>.stagebin on first use
+	if (!level.open(std::string(RESOURCE_FOLDER) + stageFiles[mapstage]))
+		return false;
+	loadBackground(*level.header);
+	lastStageCheck = SDL_GetTicks();
+	return true;
+}
+
+bool setUpStreamedStage() {
+	if (!streamedStage.open(std::string(RESOURCE_FOLDER) + streamName))
+		return false;
+	loadBackground(streamedStage.header);
+	return true;
+}
+
+// Sprites for the two fighters, where the match put them
+void createPlayers() {
+	acquireCharacters();
+	const float (*spawn)[2] = match.layout()->spawn;
+	players.clear();
+	for (int k = 0; k < 2; k++) {
+		const CharacterDefinition& character = characterDefinitions[match.characters[k]];
+		players.push_back(Entity(spawn[k][0], spawn[k][1], 0.0f, character.spriteOffset, 1.0f, 1.0f, 0, 0, characterTextures[match.characters[k]],
+			character.spriteSize, character.spriteSize, PLAYER));
+	}
+}
 
-		for (int i = 90; i < 110; i++) {
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, 2.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
-			blocks.push_back(Entity(-2.5f + (i)* 0.2f, 4.8f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, { groundTexture }, BLOCK));
+// What save states name the stage as
+const char* matchStageName() {
+	return match.streamed ? streamName.c_str() : stageFiles[stage];
+}
+
+// Asks the server for a player slot, or to watch. The answer also names the stage it is running.
+bool joinServer() {
+	unsigned char data[PROTOCOL_MAX_PACKET];
+	for (int attempt = 0; attempt < JOIN_ATTEMPTS; attempt++) {
+		PacketWriter join(data, sizeof(data));
+		join.u8(spectating ? PACKET_SPECTATE : PACKET_JOIN);
+		join.u8(PROTOCOL_VERSION);
+		if (!spectating)
+			join.u8(PROTOCOL_ANY_SLOT);
+		connection.send(server, join.data, join.size);
+
+		Uint32 sent = SDL_GetTicks();
+		while (SDL_GetTicks() - sent < JOIN_WAIT) {
+			NetAddress from;
+			int size = connection.receive(from, data, sizeof(data));
+			if (size == 0) {
+				SDL_Delay(5);
+				continue;
+			}
+			PacketReader welcome(data, size);
+			if (!sameAddress(from, server) || welcome.u8() != PACKET_WELCOME)
+				continue;
+			unsigned int slot = welcome.u8();
+			char stageName[STAGE_NAME_LENGTH];
+			welcome.text(stageName, sizeof(stageName));
+			if (welcome.failed)
+				continue;
+			if (slot == PROTOCOL_ANY_SLOT) {
+				std::cout << "Server is full" << std::endl;
+				return false;
+			}
+			onlineSlot = slot;
+			feed.reset();
+			feedPlaying = false;
+			for (int i = 0; i < 3; i++) {
+				if (std::string(stageFiles[i]) == stageName)
+					stage = i;
+			}
+			return true;
 		}
 	}
+	std::cout << "No answer from server" << std::endl;
+	return false;
 }
 
 // RENDERING AND UPDATING CODE____________________________________________________________________________________________________________________________
 void RenderMainMenu() {
+	PassScope pass(PASS_MENU);
 	//draws text
-	modelMatrix.identity();
-	modelMatrix.Translate(-3.7f, 2.0f, 0.0f);
-	program->setModelMatrix(modelMatrix);
-	ut.DrawText(program, fontTexture, "IVEN VS CHUK", 0.2f, 0.0001f);
-
-	modelMatrix.identity();
-	modelMatrix.Translate(-0.5f, 2.0f, 0.0f);
-	program->setModelMatrix(modelMatrix);
+	ut.DrawText(program, fontTexture, "IVEN VS CHUK", -3.7f, 2.0f, 0.2f, 0.0001f);
+
 	if (stage == FINAL_DESTINATION)
-		ut.DrawText(program, fontTexture, "MAP: FINAL DESTINATION", 0.2f, 0.0001f);
+		ut.DrawText(program, fontTexture, "MAP: FINAL DESTINATION", -0.5f, 2.0f, 0.2f, 0.0001f);
 	else if (stage == BATTLEFIELD)
-		ut.DrawText(program, fontTexture, "MAP: BATTLEFIELD", 0.2f, 0.0001f);
+		ut.DrawText(program, fontTexture, "MAP: BATTLEFIELD", -0.5f, 2.0f, 0.2f, 0.0001f);
 	else
-		ut.DrawText(program, fontTexture, "MAP: TEMPLE", 0.2f, 0.0001f);
+		ut.DrawText(program, fontTexture, "MAP: TEMPLE", -0.5f, 2.0f, 0.2f, 0.0001f);
 	
-	modelMatrix.identity();
-	modelMatrix.Translate(-0.5f, -1.25f, 0.0f);
-	program->setModelMatrix(modelMatrix);
 	Hadimioglu.draw(program);
 
-	modelMatrix.identity();
-	modelMatrix.Translate(-3.9f, -1.5f, 0.0f);
-	program->setModelMatrix(modelMatrix);
-	ut.DrawText(program, fontTexture, "USE ARROW/WASD KEYS TO MOVE & SELECT MAP", 0.2f, 0.0001f);
+	ut.DrawText(program, fontTexture, "USE ARROW/WASD KEYS TO MOVE & SELECT MAP", -3.9f, -1.5f, 0.2f, 0.0001f);
 
-	modelMatrix.identity();
-	modelMatrix.Translate(-2.2f, -1.75f, 0.0f);
-	program->setModelMatrix(modelMatrix);
-	ut.DrawText(program, fontTexture, "NUMPAD 1 / B TO ATTACK", 0.2f, 0.0001f);
+	ut.DrawText(program, fontTexture, "NUMPAD 1 / B TO ATTACK", -2.2f, -1.75f, 0.2f, 0.0001f);
 
 
-	modelMatrix.identity();
-	modelMatrix.Translate(-3.3f, -2.0f, 0.0f);
-	program->setModelMatrix(modelMatrix);
-	ut.DrawText(program, fontTexture, "PRESS SPACE TO START. ESC TO EXIT", 0.2f, 0.0001f);
+	ut.DrawText(program, fontTexture, "PRESS SPACE TO START. ESC TO EXIT", -3.3f, -2.0f, 0.2f, 0.0001f);
 
 }
 
+// Stage whose background is being prefetched, read from its header when the selection changes
+int prefetchedStage = -1;
+char prefetchedBackground[STAGE_NAME_LENGTH] = "";
+
 void UpdateMainMenu(float elapsed) {
-	// does nothing really. We just have static text to worry about here.
+	// Whatever the selected match needs starts loading while the player browses, and
+	// what they browsed past gets evicted again
+	if (stage != prefetchedStage) {
+		prefetchedStage = stage;
+		prefetchedBackground[0] = 0;
+		StageHeader head;
+		if (streamName.empty() && Stage::peek(std::string(RESOURCE_FOLDER) + stageFiles[stage], head))
+			memcpy(prefetchedBackground, head.background, STAGE_NAME_LENGTH);
+	}
+	if (prefetchedBackground[0])
+		textures.prefetch(prefetchedBackground);
+	for (int k = 0; k < 2; k++) {
+		const AnimationSet& animation = characterAnimations[match.characters[k]];
+		for (size_t i = 0; i < animation.sprites.size(); i++)
+			textures.prefetch(animation.sprites[i].c_str());
+	}
 }
 
-void RenderGameLevel() {
-	backgrounds[stage].draw(program);
-	players[1].draw(program);
-	players[0].draw(program);
-	for (size_t i = 0; i < blocks.size(); i++) {
-		blocks[i].draw(program);
+// World space rectangle (top, bottom, left, right) covered by the current view and projection
+void cameraBounds(float bounds[4]) {
+	Matrix inverse = (viewMatrix * projectionMatrix).inverse();
+	for (int corner = 0; corner < 4; corner++) {
+		float x = (corner & 1) ? 1.0f : -1.0f;
+		float y = (corner & 2) ? 1.0f : -1.0f;
+		float worldX = inverse.m[0][0] * x + inverse.m[1][0] * y + inverse.m[3][0];
+		float worldY = inverse.m[0][1] * x + inverse.m[1][1] * y + inverse.m[3][1];
+		if (corner == 0 || worldY > bounds[0]) bounds[0] = worldY;
+		if (corner == 0 || worldY < bounds[1]) bounds[1] = worldY;
+		if (corner == 0 || worldX < bounds[2]) bounds[2] = worldX;
+		if (corner == 0 || worldX > bounds[3]) bounds[3] = worldX;
 	}
-	float averageViewX = (players[0].position[0] + players[1].position[0]) / 2;
-	float averageViewY = (players[0].position[1] + players[1].position[1]) / 2;
-	viewMatrix.identity();
+}
 
-	if (gameOver) {
-		modelMatrix.identity();
-		modelMatrix.Translate(averageViewX - 2.0f, averageViewY, 0.0f);
-		program->setModelMatrix(modelMatrix);
-		if (players[0].position[1] <= -19.0f || p1Health <= 0) {
-			ut.DrawText(program, fontTexture, "IVEN WINS", 0.5f, 0.0001f);
+bool overlaps(const float a[4], const float b[4]) {
+	return a[1] < b[0] && a[0] > b[1] && a[2] < b[3] && a[3] > b[2];
+}
+
+void drawVisible(Entity& entity, const float view[4]) {
+	float halfWidth = 0.1f * entity.size[0];
+	float halfHeight = 0.1f * entity.size[1];
+	float bounds[4] = { entity.position[1] + halfHeight, entity.position[1] - halfHeight, entity.position[0] - halfWidth, entity.position[0] + halfWidth };
+	if (!overlaps(bounds, view)) {
+		profiler.count("entities culled", 1);
+		return;
+	}
+	profiler.count("entities drawn", 1);
+	entity.draw(program);
+}
+
+// Draws the cells of level that overlap view, returns how many vertices that was
+unsigned int drawStageCells(const Stage& level, const float view[4]) {
+	glVertexAttribPointer(program->positionAttribute, 2, GL_FLOAT, false, 0, level.vertexData);
+	renderState.enableAttribute(program->positionAttribute);
+	glVertexAttribPointer(program->texCoordAttribute, 2, GL_FLOAT, false, 0, level.texCoordData);
+	renderState.enableAttribute(program->texCoordAttribute);
+
+	unsigned int drawn = 0;
+	int firstColumn, lastColumn, firstRow, lastRow;
+	if (level.cellRange(view, firstColumn, lastColumn, firstRow, lastRow)) {
+		for (int row = firstRow; row <= lastRow; row++) {
+			unsigned int first = 0, count = 0;
+			for (int column = firstColumn; column <= lastColumn; column++) {
+				const StageCell& cell = level.cells[row * level.header->columns + column];
+				if (cell.vertexCount == 0 || !overlaps(cell.bounds, view))
+					continue;
+				if (count > 0 && first + count != cell.firstVertex) {
+					renderState.drawArrays(GL_TRIANGLES, first, count);
+					drawn += count;
+					count = 0;
+				}
+				if (count == 0)
+					first = cell.firstVertex;
+				count += cell.vertexCount;
+			}
+			if (count > 0) {
+				renderState.drawArrays(GL_TRIANGLES, first, count);
+				drawn += count;
+			}
 		}
-		else if (players[1].position[1] <= -19.0f || p2Health <= 0) {
-			ut.DrawText(program, fontTexture, "CHUK WINS", 0.5f, 0.0001f);
+	}
+	return drawn;
+}
+
+void RenderStage(const float view[4]) {
+	// The stage is one prebuilt world space mesh ordered by grid cell, so each row of
+	// visible cells is at most one contiguous draw
+
+	renderState.useProgram(program->programID);
+	renderState.setBlend(true);
+	renderState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	renderState.bindTexture(groundTexture);
+
+	if (!match.streamed) {
+		unsigned int drawn = drawStageCells(currentStage, view);
+		profiler.count("tiles drawn", drawn / 6);
+		profiler.count("tiles culled", (currentStage.header->vertexCount - drawn) / 6);
+		return;
+	}
+
+	// A streamed stage is the same per resident chunk. The simulation thread puts
+	// chunks in and takes them out, so they are only read under its lock.
+	std::lock_guard<std::mutex> lock(streamedStage.residency);
+	unsigned int drawn = 0, chunks = 0;
+	int firstColumn, lastColumn, firstRow, lastRow;
+	if (streamedStage.chunkRange(view, firstColumn, lastColumn, firstRow, lastRow)) {
+		for (int row = firstRow; row <= lastRow; row++) {
+			for (int column = firstColumn; column <= lastColumn; column++) {
+				const Stage* chunk = streamedStage.chunk(column, row);
+				if (!chunk)
+					continue;
+				drawn += drawStageCells(*chunk, view);
+				chunks++;
+			}
 		}
 	}
-	else {
-		
+	profiler.count("tiles drawn", drawn / 6);
+	profiler.count("chunks drawn", chunks);
+	profiler.gauge("chunks resident", streamedStage.residentChunks());
+	profiler.gauge("chunk KB resident", streamedStage.residentBytes() / 1024.0);
+	profiler.gauge("chunk stalls", streamedStage.stats.stalls);
+}
+
+// Every live shot and cherry as one batch of cherry quads, each blended back from where
+// the newest tick left it by its speed
+void RenderProjectiles(const float view[4]) {
+	const SimSnapshot& shot = snapshots.read();
+	if (shot.generation != shownGeneration)
+		return;
+	const ProjectileView& live = shot.projectiles;
+	profiler.gauge("projectiles live", live.count);
+	if (live.count == 0)
+		return;
+	float* vertexData = frameArena.floats(live.count * 12);
+	float* texCoordData = frameArena.floats(live.count * 12);
+	if (!vertexData || !texCoordData)
+		return;
+
+	float back = (shownBlend - 1.0f) * MATCH_TICK;
+	unsigned int drawn = 0;
+	for (unsigned int i = 0; i < live.count; i++) {
+		float size = projectileDefinitions[live.kind[i]].halfSize;
+		float x = live.position[i][0] + live.speed[i][0] * back;
+		float y = live.position[i][1] + live.speed[i][1] * back;
+		float bounds[4] = { y + size, y - size, x - size, x + size };
+		if (!overlaps(bounds, view))
+			continue;
+		float vertices[] = {
+			bounds[2], bounds[0],
+			bounds[2], bounds[1],
+			bounds[3], bounds[0],
+			bounds[3], bounds[1],
+			bounds[3], bounds[0],
+			bounds[2], bounds[1],
+		};
+		static const float texCoords[] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f };
+		memcpy(vertexData + drawn * 12, vertices, sizeof(vertices));
+		memcpy(texCoordData + drawn * 12, texCoords, sizeof(texCoords));
+		drawn++;
+	}
+	profiler.count("projectiles drawn", drawn);
+	profiler.count("projectiles culled", live.count - drawn);
+	if (drawn == 0)
+		return;
+
+	renderState.useProgram(program->programID);
+	renderState.setBlend(true);
+	renderState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	renderState.bindTexture(powerupTexture);
+	glVertexAttribPointer(program->positionAttribute, 2, GL_FLOAT, false, 0, vertexData);
+	renderState.enableAttribute(program->positionAttribute);
+	glVertexAttribPointer(program->texCoordAttribute, 2, GL_FLOAT, false, 0, texCoordData);
+	renderState.enableAttribute(program->texCoordAttribute);
+	renderState.drawArrays(GL_TRIANGLES, 0, drawn * 6);
+}
+
+void RenderGameLevel() {
+	float averageViewX = (players[0].position[0] + players[1].position[0]) / 2;
+	float averageViewY = (players[0].position[1] + players[1].position[1]) / 2;
 
+	// The camera freezes where it was once the game is over
+	if (!gameOver) {
 		float distance = sqrt(pow(players[0].position[0] - players[1].position[0], 2) + pow(players[0].position[1] - players[1].position[1], 2));
 		float scale = ut.map(distance, 0.0f, 18.0f, 1.0f, 0.05f);
 		if (scale < 0.3f)
 			scale = 0.3f;
 
+		viewMatrix.identity();
 		viewMatrix.Scale(scale, scale, 1.0f);
 		viewMatrix.Translate(-averageViewX, -averageViewY, 0.0f);
 
-		program->setViewMatrix(viewMatrix);
+		program->setViewProjectionMatrix(viewMatrix * projectionMatrix);
 	}
 
-	modelMatrix.identity();
-	modelMatrix.Translate(players[0].position[0] - 0.25f, players[0].position[1] + 0.4f, 0.0f);
-	program->setModelMatrix(modelMatrix);
-	ut.DrawText(program, fontTexture, std::to_string(p1Health), 0.2f, 0.000001f);
+	float view[4];
+	cameraBounds(view);
+	{
+		PassScope pass(PASS_BACKGROUND);
+		drawVisible(background, view);
+	}
+	{
+		PassScope pass(PASS_PLAYERS);
+		drawVisible(players[1], view);
+		drawVisible(players[0], view);
+	}
+	{
+		PassScope pass(PASS_STAGE);
+		RenderStage(view);
+	}
+	{
+		PassScope pass(PASS_PROJECTILES);
+		RenderProjectiles(view);
+	}
 
-	modelMatrix.identity();
-	modelMatrix.Translate(players[1].position[0] - 0.25f, players[1].position[1] + 0.6f, 0.0f);
-	program->setModelMatrix(modelMatrix);
-	ut.DrawText(program, fontTexture, std::to_string(p2Health), 0.2f, 0.000001f);
+	PassScope pass(PASS_TEXT);
+	if (gameOver) {
+		if (shownWinner >= 0) {
+			// Put together on the stack, the steady frame must not allocate
+			char wins[32];
+			const char* name = characterDefinitions[match.characters[shownWinner]].name;
+			size_t length = std::min(strlen(name), sizeof(wins) - 6);
+			memcpy(wins, name, length);
+			memcpy(wins + length, " WINS", 6);
+			ut.DrawText(program, fontTexture, wins, averageViewX - 2.0f, averageViewY, 0.5f, 0.0001f);
+		}
+	}
+
+	char health[12];
+	ut.IntToText(shown.fighters[0].health, health);
+	ut.DrawText(program, fontTexture, health, players[0].position[0] - 0.25f, players[0].position[1] + 0.4f, 0.2f, 0.000001f);
+
+	ut.IntToText(shown.fighters[1].health, health);
+	ut.DrawText(program, fontTexture, health, players[1].position[0] - 0.25f, players[1].position[1] + 0.6f, 0.2f, 0.000001f);
 }
 
-void UpdateGameLevel(float elapsed) {
-	for (int i = 0; i < 4; i++) {
-		players[0].collided[i] = false;
-		players[1].collided[i] = false;
-	}
-	float penetration;
-
-	// Update all Y's first
-	players[0].updateY(elapsed);
-	players[1].updateY(elapsed);
-
-	for (int k = 0; k < players.size(); k++) {
-		for (size_t i = 0; i < blocks.size(); i++) {
-			if (players[k].boundaries[1] < blocks[i].boundaries[0] &&
-				players[k].boundaries[0] > blocks[i].boundaries[1] &&
-				players[k].boundaries[2] < blocks[i].boundaries[3] &&
-				players[k].boundaries[3] > blocks[i].boundaries[2])
-			{
-				float y_distance = fabs(players[k].position[1] - blocks[i].position[1]);
-				float playerHeightHalf = 0.05f * players[k].size[1] * 2;
-				float blockHeightHalf = 0.05f * blocks[i].size[1] * 2;
-				penetration = fabs(y_distance - playerHeightHalf - blockHeightHalf);
-
-				if (players[k].position[1] > blocks[i].position[1]) {
-					players[k].position[1] += penetration + ANAPEN;
-					players[k].boundaries[0] += penetration + ANAPEN;
-					players[k].boundaries[1] += penetration + ANAPEN;
-					players[k].collided[1] = true;
-					players[k].inAir = false;
-				}
-				else {
-					players[k].position[1] -= (penetration + ANAPEN);
-					players[k].boundaries[0] -= (penetration + ANAPEN);
-					players[k].boundaries[1] -= (penetration + ANAPEN);
-					players[k].collided[0] = true;
-				}
-				players[k].speed[1] = 0.0f;
-				break;
-			}
-		}
+// Puts a simulated fighter into the sprite that draws it, alpha of the way from how it
+// was on the tick before
+void showFighter(Entity& sprite, const Fighter& before, const Fighter& fighter, float alpha) {
+	sprite.position[0] = before.position[0] + (fighter.position[0] - before.position[0]) * alpha;
+	sprite.position[1] = before.position[1] + (fighter.position[1] - before.position[1]) * alpha;
+	sprite.width = fighter.facing;
+	sprite.currT = fighter.frame < (int)sprite.texture.size() ? fighter.frame : 0;
+}
+
+// The main thread has just replaced match (under simLock): show it as is and ignore
+// snapshots the simulation made from the old one
+void showMatch() {
+	simGeneration++;
+	shownGeneration = simGeneration;
+	shown = match;
+	shownWinner = match.winner();
+	shownBlend = 1.0f;
+	projectiles.clear();
+	for (int k = 0; k < 2; k++)
+		showFighter(players[k], match.fighters[k], match.fighters[k], 1.0f);
+}
+
+unsigned char buttons(bool left, bool right, bool jump, bool attack, bool strongAttack, bool upAttack) {
+	return (left ? INPUT_LEFT : 0) | (right ? INPUT_RIGHT : 0) | (jump ? INPUT_JUMP : 0) |
+		(attack ? INPUT_ATTACK : 0) | (strongAttack ? INPUT_STRONG_ATTACK : 0) | (upAttack ? INPUT_UP_ATTACK : 0);
+}
+
+// Online the server runs the match: send our buttons for this tick, take the newest state back
+void UpdateOnline(unsigned char input) {
+	unsigned char data[PROTOCOL_MAX_PACKET];
+	PacketWriter packet(data, sizeof(data));
+	packet.u8(PACKET_INPUT);
+	packet.u8(onlineSlot);
+	packet.u32(++inputSequence);
+	packet.u8(input);
+	connection.send(server, packet.data, packet.size);
+
+	for (int k = 0; k < 2; k++)
+		match.fighters[k].events = 0;
+	NetAddress from;
+	int size;
+	while ((size = connection.receive(from, data, sizeof(data))) > 0) {
+		PacketReader state(data, size);
+		Match received = match;
+		if (!sameAddress(from, server) || !readMatchState(state, received))
+			continue;
+		// States can arrive out of order, an older one is dropped whole. After a match is
+		// over the server starts a rematch from tick 0.
+		if (received.tick < match.tick && !match.over)
+			continue;
+		unsigned int events[2] = { match.fighters[0].events, match.fighters[1].events };
+		// Only the state, who is playing and where belong to the main thread
+		static_cast<MatchState&>(match) = received;
+		for (int k = 0; k < 2; k++)
+			match.fighters[k].events |= events[k];
 	}
-	
-	// Update all X's next
-	players[0].updateX(elapsed);
-	players[1].updateX(elapsed);
-	for (int k = 0; k < players.size(); k++) {
-		Entity player = players[k];
-		for (size_t i = 0; i < blocks.size(); i++) {
-			if (players[k].boundaries[1] < blocks[i].boundaries[0] &&
-				players[k].boundaries[0] > blocks[i].boundaries[1] &&
-				players[k].boundaries[2] < blocks[i].boundaries[3] &&
-				players[k].boundaries[3] > blocks[i].boundaries[2])
-			{
-				float x_distance = fabs(players[k].position[0] - blocks[i].position[0]);
-				float playerWidthHalf = 0.05f * players[k].size[0] * 2;
-				float blockWidthHalf = 0.05f * blocks[i].size[0] * 2;
-				penetration = fabs(x_distance - (playerWidthHalf + blockWidthHalf));
-
-				if (players[k].position[0] > blocks[i].position[0]) {
-					players[k].position[0] += penetration + ANAPEN;
-					players[k].boundaries[2] += penetration + ANAPEN;
-					players[k].boundaries[3] += penetration + ANAPEN;
-					players[k].collided[3] = true;
-				}
-				else {
-					players[k].position[0] -= (penetration + ANAPEN);
-					players[k].boundaries[2] -= (penetration + ANAPEN);
-					players[k].boundaries[3] -= (penetration + ANAPEN);
-					players[k].collided[2] = true;
-				}
-				players[k].speed[0] = 0.0f;
-				break;
-			}
-		}
+}
+
+// Plays the feed SPECTATE_DELAY ticks behind the newest frame, so a late or lost
+// packet does not stall the picture
+void UpdateSpectator() {
+	unsigned char data[PROTOCOL_MAX_PACKET];
+	NetAddress from;
+	int size;
+	while ((size = connection.receive(from, data, sizeof(data))) > 0) {
+		PacketReader packet(data, size);
+		if (sameAddress(from, server))
+			feed.read(packet);
+	}
+	if (feed.ackWanted || SDL_GetTicks() - lastFeedAck > SPECTATE_KEEPALIVE * 1000) {
+		PacketWriter ack(data, sizeof(data));
+		ack.u8(PACKET_ACK);
+		ack.u32(feed.ackNumber);
+		connection.send(server, ack.data, ack.size);
+		feed.ackWanted = false;
+		lastFeedAck = SDL_GetTicks();
+	}
+	if (!feed.started)
+		return;
+
+	unsigned int target = feed.newest - SPECTATE_DELAY;
+	int behind = (int)(target - feedFrame);
+	if (!feedPlaying || behind > SPECTATE_HISTORY / 2 || behind < -SPECTATE_HISTORY / 2) {
+		feedFrame = target;
+		feedPlaying = true;
+	}
+	else if ((int)(feed.newest - feedFrame) > 0) {
+		feedFrame++;
 	}
 
-	players[0].speed[0] = 0.0f;
-	players[1].speed[0] = 0.0f;
-	
-	// handle controls
-	// Player 1
-	if (p1controlsMoveLeft && (players[0].cooldown == 0 || players[0].inAir)){
-		players[0].speed[0] = -playerSpeed*1.5;
-		players[0].width = -1;
-	}
-	else if (p1controlsMoveRight && (players[0].cooldown == 0 || players[0].inAir)){
-		players[0].speed[0] = playerSpeed*1.5;
-		players[0].width = 1;
-	}
-	// Player 2
-	if (p2controlsMoveLeft && (players[1].cooldown == 0 || players[1].inAir)){
-		players[1].speed[0] = -playerSpeed;
-		players[1].width = -1;
-	}
-	else if (p2controlsMoveRight && (players[1].cooldown == 0 || players[1].inAir)){
-		players[1].speed[0] = playerSpeed;
-		players[1].width = 1;
-	}
-	// Player 1 Attacks
-	if (p1NormalAttack && players[0].cooldown == 0) {
-		Mix_PlayChannel(1, chukatk, 0);
-		if (!players[0].inAir) {
-			players[0].cooldown = p1CD;
-			float hitX = players[0].position[0] + (players[0].width * 0.5f);
-			float hitY = players[0].position[1];
-			float distance = sqrt(pow(hitX - players[1].position[0], 2) + pow(hitY - players[1].position[1], 2));
-
-			if (distance < 0.7f) {
-				players[1].speed[1] = 2.0f;
-				p2Health -= 10;
-				players[1].gettingWrecked = true;
-				players[1].cooldown = 0.4;
-			}
-		}
-		else {
-			players[0].cooldown = p1CD;
-			float hitX = players[0].position[0];
-			float hitY = players[0].position[1] - 1.0f;
-			float distance = sqrt(pow(hitX - players[1].position[0], 2) + pow(hitY - players[1].position[1], 2));
-
-			if (distance < 0.7f) {
-				players[1].speed[1] = 2.0f;
-				p2Health -= 15;
-				players[1].gettingWrecked = true;
-				players[1].cooldown = 0.5;
-			}
+	SpectatorFrame frame;
+	for (int k = 0; k < 2; k++)
+		match.fighters[k].events = 0;
+	if (feed.frame(feedFrame, frame))
+		dequantizeMatch(frame, match);
+}
+
+void saveTraining() {
+	ProfileScope scope("save state");
+	std::lock_guard<std::mutex> lock(simLock);
+	trainingSaveSize = writeSaveState(match, matchStageName(), true, trainingSave, sizeof(trainingSave));
+	// Also on disk, so the same moment can be replayed on NYUServer --load-state
+	saveStateFile(TRAINING_SAVE_FILE, match, matchStageName(), true);
+	steadyFrames = 0;	//the file write allocates
+}
+
+void loadTraining() {
+	ProfileScope scope("load state");
+	std::lock_guard<std::mutex> lock(simLock);
+	char stageName[STAGE_NAME_LENGTH];
+	if (trainingSaveSize == 0 || !readSaveState(trainingSave, trainingSaveSize, match, stageName))
+		return;
+	showMatch();
+	gameOver = match.over;
+	simRunning = !match.over;
+	// The recording carries on from the loaded state
+	if (!match.streamed && !projectileStress)
+		replay.begin(match, stageFiles[stage]);
+}
+
+// One MATCH_TICK, on the simulation thread with simLock held
+void TickGameLevel() {
+	unsigned char p1Input = (unsigned char)playerButtons[0].load();
+	if (spectating) {
+		UpdateSpectator();
+	}
+	else if (online) {
+		UpdateOnline(p1Input);
+	}
+	else {
+		unsigned char inputs[2] = { p1Input, (unsigned char)playerButtons[1].load() };
+		if (telemetry.active())
+			tickBefore = match;
+		if (match.streamed) {
+			float positions[2][2] = {
+				{ match.fighters[0].position[0], match.fighters[0].position[1] },
+				{ match.fighters[1].position[0], match.fighters[1].position[1] }
+			};
+			streamedStage.update(positions, 2);
 		}
+		match.step(inputs);
+		if (projectileStress)
+			projectiles.spray(match, projectileStress, stressRandom);
+		// Before observing, so telemetry sees the hits and pickups too
+		projectiles.step(match, &simJobs);
+		telemetry.observe(tickBefore, match);
+		if (!match.streamed && !projectileStress)
+			replay.record(inputs, match);
 	}
-	// Player 2 Attacks
-	if (p2NormalAttack && players[1].cooldown == 0) {
-		players[1].cooldown = p2CD;
-		Mix_PlayChannel(1, ivenatk, 0);
-		if (!players[1].inAir) {
-			players[1].cooldown = p2CD;
-			float hitX = players[1].position[0] + (players[1].width * 0.5f);
-			float hitY = players[1].position[1];
-			float distance = sqrt(pow(hitX - players[0].position[0], 2) + pow(hitY - players[0].position[1], 2));
-
-			if (distance < 0.5f) {
-				players[0].speed[1] = 2.0f;
-				p1Health -= 20;
-				players[0].gettingWrecked = true;
-				players[0].cooldown = 0.5;
-			}
+	pendingSounds.fetch_or(((match.fighters[0].events & EVENT_ATTACK) ? 1 : 0) | ((match.fighters[1].events & EVENT_ATTACK) ? 2 : 0));
+}
+
+void simulate() {
+	MatchState last;
+	memset(&last, 0, sizeof(last));
+	unsigned int lastGeneration = 0;
+	TickJitter window, finished;
+	memset(&window, 0, sizeof(window));
+	memset(&finished, 0, sizeof(finished));
+	double windowStart = clockSeconds();
+	double next = windowStart;
+	double lastStart = 0;
+	// Every core but the main thread's
+	simJobs.start(projectileStress ? (int)std::thread::hardware_concurrency() - 1 : 1);
+	while (simAlive) {
+		double now = clockSeconds();
+		if (now < next) {
+			// Sleep most of the way, the OS wakes us late by up to its timer resolution
+			if (next - now > SIM_SPIN_MARGIN)
+				sleepSeconds(next - now - SIM_SPIN_MARGIN);
+			else
+				std::this_thread::yield();
+			continue;
 		}
-		else {
-			players[1].cooldown = p2CD;
-			float hitX = players[1].position[0] + (players[1].width * 0.7f);
-			float hitY = players[1].position[1] - 0.7f;
-			float distance = sqrt(pow(hitX - players[0].position[0], 2) + pow(hitY - players[0].position[1], 2));
-
-			if (distance < 0.7f) {
-				players[0].speed[1] = 2.0f;
-				p1Health -= 25;
-				players[0].gettingWrecked = true;
-				players[0].cooldown = 0.6;
+		if (now - next > MATCH_TICK * MAX_TIMESTEPS) {
+			window.dropped += (unsigned int)((now - next) / MATCH_TICK);
+			next = now;
+		}
+		if (now - next > SIM_LATE)
+			window.late++;
+		next += MATCH_TICK;
+
+		{
+			std::lock_guard<std::mutex> lock(simLock);
+			if (!simRunning) {
+				lastStart = 0;
+				continue;
 			}
+			TickGameLevel();
+			SimSnapshot& shot = snapshots.writeSlot();
+			shot.previous = lastGeneration == simGeneration ? last : match;
+			shot.current = match;
+			shot.time = clockSeconds();
+			shot.generation = simGeneration;
+			shot.winner = match.winner();
+			shot.jitter = finished;
+			projectiles.copyTo(shot.projectiles);
+			last = match;
+			lastGeneration = simGeneration;
+			if (match.over)
+				simRunning = false;
+			snapshots.publish();
 		}
-	}
-	// Player 1 JUMP
-	if (players[0].collided[1]) {
-		p1firstJump = false;
-		p1secondJump = false;
-	}
-	if (p1controlsJump && players[0].cooldown == 0) {
-		players[0].inAir = true;
-		if (!p1firstJump && players[0].collided[1]) {
-			players[0].speed[1] = 6.6f;
-			p1timeSinceLastJump = 0.0f;
-			p1firstJump = true;
-			p1secondJump = false;
+
+		if (lastStart > 0) {
+			double interval = now - lastStart;
+			if (window.ticks == 0 || interval < window.intervalMin)
+				window.intervalMin = interval;
+			if (interval > window.intervalMax)
+				window.intervalMax = interval;
 		}
-		else if (p1firstJump && !p1secondJump && p1timeSinceLastJump > 0.4f ) {
-			p1secondJump = true;
-			players[0].speed[1] = 6.6f;
+		window.ticks++;
+		lastStart = now;
+		if (now - windowStart >= SIM_JITTER_WINDOW) {
+			finished = window;
+			memset(&window, 0, sizeof(window));
+			windowStart = now;
 		}
 	}
-	if (!p1firstJump && !p1secondJump && p1controlsJump && !players[0].collided[1] && players[0].cooldown == 0) {
-		p1secondJump = true;
-		players[0].speed[1] = 6.6f;
-	}
-	// Player 2 JUMP
-	if (players[1].collided[1]) {
-		p2firstJump = false;
-		p2secondJump = false;
-	}
-	if (p2controlsJump && players[1].cooldown == 0) {
-		players[1].inAir = true;
-		if (!p2firstJump && players[1].collided[1]) {
-			players[1].speed[1] = 6.6f;
-			p2timeSinceLastJump = 0.0f;
-			p2firstJump = true;
-			p2secondJump = false;
-		}
-		else if (p2firstJump && !p2secondJump && p2timeSinceLastJump > 0.4f) {
-			p2secondJump = true;
-			players[1].speed[1] = 6.6f;
-		}
+	simJobs.stop();
+}
+
+// Shows the newest tick the simulation thread has finished, blended with the one before
+// by how far into the next tick we are. Drawing lags the simulation by up to a tick.
+void UpdateGameLevel(float elapsed) {
+	if (snapshots.update()) {
+		const TickJitter& jitter = snapshots.read().jitter;
+		profiler.gauge("sim ticks/s", jitter.ticks);
+		profiler.gauge("sim tick interval min ms", jitter.intervalMin * 1000.0);
+		profiler.gauge("sim tick interval max ms", jitter.intervalMax * 1000.0);
+		profiler.gauge("sim ticks late", jitter.late);
+		profiler.gauge("sim ticks dropped", jitter.dropped);
 	}
-	if (!p2firstJump && !p2secondJump && p2controlsJump && !players[1].collided[1] && players[1].cooldown == 0) {
-		p2secondJump = true;
-		players[1].speed[1] = 6.6f;
+	const SimSnapshot& shot = snapshots.read();
+	if (shot.generation == shownGeneration) {
+		float alpha = (float)((clockSeconds() - shot.time) / MATCH_TICK);
+		if (alpha > 1.0f)
+			alpha = 1.0f;
+		shown = shot.current;
+		shownWinner = shot.winner;
+		shownBlend = alpha;
+		for (int k = 0; k < 2; k++)
+			showFighter(players[k], shot.previous.fighters[k], shot.current.fighters[k], alpha);
 	}
 
-	players[0].animate(elapsed);
-	players[1].animate(elapsed);
-	
-	if (players[1].position[1] <= -19.0f || players[0].position[1] <= -19.0f || p1Health <= 0 || p2Health <= 0) {
-		if (p1Health <= 0) {
-			players[0].dead = true;
-		}
-		if (p2Health <= 0) {
-			players[1].dead = true;
-		}
-		dead = true;
+	unsigned int sounds = pendingSounds.exchange(0);
+	for (int k = 0; k < 2; k++) {
+		if (sounds & (1 << k))
+			audio.play(hitSounds[match.characters[k]], PRIORITY_ATTACK);
 	}
 
-	if (deathCounter >= 1.0f) {
+	if (shown.over && gameRunning) {
+		// The sim thread stopped recording when the match ended, the replay is ours to
+		// save without simLock
+		if (!online && !match.streamed && !projectileStress) {
+			replay.save(LAST_REPLAY_FILE);
+			steadyFrames = 0;	//the file write allocates
+		}
 		gameOver = true;
 		gameRunning = false;
 	}
 }
 
+// Render scale, resolution and frame time in the top left corner, at the window's own
+// resolution. Built in a fixed buffer, the frame must not allocate.
+void RenderResolutionHud() {
+	char text[64];
+	char* end = text;
+	const char* parts[] = { "RES ", "% ", "X", " ", "MS" };
+	int values[] = { (int)(resolution.scale * 100.0f + 0.5f), resolution.renderWidth, resolution.renderHeight, (int)(resolution.smoothed * 1000.0 + 0.5) };
+	for (int i = 0; i < 5; i++) {
+		for (const char* c = parts[i]; *c; c++)
+			*end++ = *c;
+		if (i < 4) {
+			ut.IntToText(values[i], end);
+			while (*end)
+				end++;
+		}
+	}
+	*end = 0;
+
+	PassScope pass(PASS_TEXT);
+	program->setViewProjectionMatrix(projectionMatrix);
+	ut.DrawText(program, fontTexture, text, -3.9f, 2.1f, 0.12f, 0.0001f);
+	program->setViewProjectionMatrix(viewMatrix * projectionMatrix);
+}
+
 void Render() {
-	glClear(GL_COLOR_BUFFER_BIT);
-	switch (state) {
-	case STATE_MAIN_MENU:
-		RenderMainMenu();
-		break;
-	case STATE_GAME_LEVEL:
-		RenderGameLevel();
-		break;
+	double started = clockSeconds();
+	textures.update();
+	{
+		ProfileScope scope("render");
+		gpuTimer.beginFrame();
+		resolution.begin();
+		glClear(GL_COLOR_BUFFER_BIT);
+		switch (state) {
+		case STATE_MAIN_MENU:
+			RenderMainMenu();
+			break;
+		case STATE_GAME_LEVEL:
+			RenderGameLevel();
+			break;
+		}
+		{
+			PassScope pass(PASS_UPSCALE);
+			resolution.end();
+		}
+		if (showResolution)
+			RenderResolutionHud();
+		gpuTimer.endFrame();
 	}
+	renderState.report();
+	audio.report();
+	textures.report();
+	resolution.report();
+
+	// The swap may wait for vsync, which says nothing about how long the frame took.
+	// The timer queries say how long the GPU took a few frames ago without waiting for
+	// it; without them the GPU's part is waited for here.
+	double seconds = clockSeconds() - started;
+	if (resolution.enabled && gpuTimer.available) {
+		if (gpuTimer.frameSeconds > seconds)
+			seconds = gpuTimer.frameSeconds;
+	}
+	else if (resolution.enabled) {
+		ProfileScope scope("gpu wait");
+		glFinish();
+		seconds = clockSeconds() - started;
+	}
+	resolution.update(seconds);
+
+	ProfileScope scope("swap");
 	SDL_GL_SwapWindow(displayWindow);
 }
 
 void Update(float elapsed) {
+	ProfileScope scope("update");
 	switch (state) {
 	case STATE_MAIN_MENU:
 		UpdateMainMenu(elapsed);
@@ -476,79 +962,329 @@ void Update(float elapsed) {
 	}
 }
 
+// Loads a replay into replay and match, at its first snapshot and ready to draw
+bool openReplay(const std::string& path) {
+	char stageName[STAGE_NAME_LENGTH];
+	if (!replay.load(path) || !readSaveState(replay.snapshots[0].data, replay.snapshots[0].size, match, stageName))
+		return false;
+	stage = -1;
+	for (int i = 0; i < 3; i++) {
+		if (replay.stageName == stageFiles[i])
+			stage = i;
+	}
+	if (stage < 0) {
+		std::cout << path << " is on " << replay.stageName << ", which is not one of the stages" << std::endl;
+		return false;
+	}
+	if (!setUpStage(stage, currentStage))
+		return false;
+	match.stage = &currentStage;
+	match.animations[0] = &characterAnimations[match.characters[0]];
+	match.animations[1] = &characterAnimations[match.characters[1]];
+	createPlayers();
+	showMatch();
+	state = STATE_GAME_LEVEL;
+	return true;
+}
+
+// Steps the replay from its first snapshot and draws frames at exportFps, each blended
+// between the ticks either side of it the way the live game does, into the exporter.
+int exportReplay() {
+	if (!openReplay(exportReplayPath))
+		return 1;
+
+	VideoExporter video;
+	if (!video.open(exportOutput, exportWidth, exportHeight, exportFps)) {
+		video.close();
+		return 1;
+	}
+	size_t tickCount = replay.ticks.size();
+	unsigned int frameCount = (unsigned int)((tickCount + EXPORT_HOLD_SECONDS * MATCH_TICK_RATE) * exportFps / MATCH_TICK_RATE);
+	MatchState previous = match;
+	size_t stepped = 0;
+	bool desynced = false;
+	double started = clockSeconds();
+	for (unsigned int frame = 0; frame < frameCount; frame++) {
+		frameArena.reset();
+		double tickTime = (double)frame * MATCH_TICK_RATE / exportFps;
+		size_t due = (size_t)tickTime < tickCount ? (size_t)tickTime : tickCount;
+		while (stepped < due) {
+			previous = match;
+			match.step(replay.ticks[stepped].inputs);
+			if (!desynced && match.hash != replay.ticks[stepped].hash) {
+				std::cout << "Desync at tick " << stepped + 1 << ", NYUServer --check-replay tells why; the video goes on with what this build does" << std::endl;
+				desynced = true;
+			}
+			stepped++;
+		}
+		float alpha = stepped < tickCount ? (float)(tickTime - stepped) : 1.0f;
+		shown = match;
+		shownWinner = match.winner();
+		gameOver = match.over;
+		for (int k = 0; k < 2; k++)
+			showFighter(players[k], previous.fighters[k], match.fighters[k], alpha);
+
+		glClear(GL_COLOR_BUFFER_BIT);
+		RenderGameLevel();
+		if (!video.capture())
+			break;
+	}
+	bool written = video.close();
+	double wall = clockSeconds() - started;
+
+	const VideoExportStats& stats = video.stats;
+	double seconds = (double)stats.frames / exportFps;
+	std::cout << exportOutput << ": " << stats.frames << " frames at " << exportWidth << "x" << exportHeight << ", " << exportFps << " fps, "
+		<< seconds << "s of video in " << wall << "s, " << (wall > 0 ? seconds / wall : 0) << "x real time, " << stats.bytes / (1024 * 1024) << " MB" << std::endl;
+	if (stats.frames > 0) {
+		std::cout << "  per frame: readback " << stats.readbackWait / stats.frames * 1000.0 << "ms, waiting for the writer " << stats.writerWait / stats.frames * 1000.0
+			<< "ms, writer thread " << stats.writeTime / stats.frames * 1000.0 << "ms" << std::endl;
+	}
+	return written && stats.frames == frameCount ? 0 : 1;
+}
+
+int benchRenderedReplay() {
+	if (!openReplay(benchReplayPath))
+		return 1;
+	// Drawn into a framebuffer of its own, a hidden window's may never be drawn at all
+	GLuint colour, framebuffer;
+	glGenTextures(1, &colour);
+	renderState.bindTexture(colour);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, exportWidth, exportHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colour, 0);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glViewport(0, 0, exportWidth, exportHeight);
+
+	ReplayBenchResult result = ReplayBenchResult();
+	size_t slash = benchReplayPath.find_last_of("/\\");
+	result.replay = slash == std::string::npos ? benchReplayPath : benchReplayPath.substr(slash + 1);
+	result.stage = replay.stageName;
+	result.mode = "render";
+	result.ticks = (unsigned int)replay.ticks.size();
+	result.runs = BENCH_RENDER_RUNS;
+	result.matched = true;
+	result.allocations = ALLOCATION_TRACKING ? 0 : -1;
+
+	// A frame is the tick and drawing it, up to the GPU finishing, so frames never overlap
+	// and each is timed. A step alone is too short for the clock, so steps are summed over
+	// a run as the headless bench does.
+	Match start = match;
+	std::vector<double> tickTimes(BENCH_RENDER_RUNS), runTimes(BENCH_RENDER_RUNS), frameTimes;
+	frameTimes.reserve(replay.ticks.size() * BENCH_RENDER_RUNS);
+	for (int run = 0; complete && run < BENCH_RENDER_RUNS; run++) {
+		match = start;
+		MatchState previous = match;
+		double stepping = 0;
+		unsigned long allocationsBefore = allocationCount();
+		double runStarted = clockSeconds();
+		for (size_t tick = 0; tick < replay.ticks.size(); tick++) {
+			double started = clockSeconds();
+			frameArena.reset();
+			previous = match;
+			match.step(replay.ticks[tick].inputs);
+			stepping += clockSeconds() - started;
+			if (match.hash != replay.ticks[tick].hash)
+				result.matched = false;
+			shown = match;
+			shownWinner = match.winner();
+			gameOver = match.over;
+			for (int k = 0; k < 2; k++)
+				showFighter(players[k], previous.fighters[k], match.fighters[k], 1.0f);
+
+			glClear(GL_COLOR_BUFFER_BIT);
+			RenderGameLevel();
+			glFinish();
+			frameTimes.push_back(clockSeconds() - started);
+		}
+		runTimes[run] = clockSeconds() - runStarted;
+		tickTimes[run] = stepping;
+		if (ALLOCATION_TRACKING)
+			result.allocations += (long)(allocationCount() - allocationsBefore);
+	}
+	result.tick = spreadOfRuns(tickTimes, result.ticks);
+	result.frame = spreadOf(frameTimes);
+	double median = spreadOf(runTimes).p50;
+	result.ticksPerSecond = median > 0 ? result.ticks / median : 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	renderState.deleteTexture(colour);
+	if (!complete) {
+		std::cout << "Offscreen framebuffer of " << exportWidth << "x" << exportHeight << " is not supported" << std::endl;
+		return 1;
+	}
+	std::cout << exportWidth << "x" << exportHeight << " offscreen" << std::endl;
+	printBench(result);
+	std::vector<ReplayBenchResult> results(1, result);
+	return reportBench(results, benchJsonPath, benchBaselinePath, benchThreshold) && result.matched ? 0 : 1;
+}
 
+// A whole number and nothing else, for command line values
+bool readNumber(const char* text, int& value) {
+	char* end;
+	long number = strtol(text, &end, 10);
+	if (end == text || *end != 0 || number < INT_MIN || number > INT_MAX)
+		return false;
+	value = (int)number;
+	return true;
+}
 
 // MAIN FUNCTION. SETUP____________________________________________________________________________________________________________________________
 int main(int argc, char *argv[])
 {
+	// Offline stage compiler: NYUCodebase --compile-stage Temple.stage Temple.stagebin
+	if (argc == 4 && std::string(argv[1]) == "--compile-stage")
+		return Stage::compileFile(argv[2], argv[3]) ? 0 : 1;
+
+	int audioBuffer = AUDIO_DEFAULT_BUFFER;
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--profile")
+			profiler.enabled = true;
+		else if (std::string(argv[i]) == "--audio-buffer" && i + 1 < argc) {
+			if (!readNumber(argv[++i], audioBuffer) || !AudioEngine::validBuffer(audioBuffer)) {
+				std::cout << "--audio-buffer takes a power of two from " << AUDIO_MIN_BUFFER << " to " << AUDIO_MAX_BUFFER << " frames" << std::endl;
+				return 1;
+			}
+		}
+		// Pretends every swap takes this many ms, ticks should stay MATCH_TICK apart anyway
+		else if (std::string(argv[i]) == "--render-stall" && i + 1 < argc)
+			renderStall = atoi(argv[++i]);
+		// Caps GPU texture memory, in MB; the largest textures drop to half or quarter resolution to fit
+		else if (std::string(argv[i]) == "--texture-budget" && i + 1 < argc)
+			textures.budget = (unsigned int)atoi(argv[++i]) * 1024 * 1024;
+		// Chunk memory for --stream-stage, in KB
+		else if (std::string(argv[i]) == "--stream-budget" && i + 1 < argc)
+			streamedStage.budget = (size_t)atoi(argv[++i]) * 1024;
+		else if (std::string(argv[i]) == "--stream-stage" && i + 1 < argc)
+			streamName = argv[++i];
+		// Writes a replay out as video: a .y4m or .rgba file, or "|command" to pipe Y4M into an encoder
+		else if (std::string(argv[i]) == "--export-replay" && i + 2 < argc) {
+			exportReplayPath = argv[++i];
+			exportOutput = argv[++i];
+		}
+		// WIDTHxHEIGHT, the picture is stretched if it is not 16:9
+		else if (std::string(argv[i]) == "--export-size" && i + 1 < argc) {
+			std::string size = argv[++i];
+			size_t x = size.find('x');
+			exportWidth = atoi(size.c_str());
+			exportHeight = x == std::string::npos ? 0 : atoi(size.c_str() + x + 1);
+		}
+		else if (std::string(argv[i]) == "--export-fps" && i + 1 < argc)
+			exportFps = atoi(argv[++i]);
+		// Limits of the dynamic resolution as fractions of the window, e.g. 0.5 1; above 1 supersamples
+		else if (std::string(argv[i]) == "--resolution-scale" && i + 2 < argc) {
+			resolution.minScale = (float)atof(argv[++i]);
+			resolution.maxScale = (float)atof(argv[++i]);
+		}
+		else if (std::string(argv[i]) == "--fixed-resolution")
+			resolution.enabled = false;
+		else if (std::string(argv[i]) == "--no-gpu-timer")
+			gpuTimer.enabled = false;
+		else if (std::string(argv[i]) == "--no-shader-cache")
+			shaders.useCache = false;
+		else if (std::string(argv[i]) == "--projectile-stress" && i + 1 < argc) {
+			int target;
+			if (!readNumber(argv[++i], target) || target < 0 || target > PROJECTILE_CAPACITY) {
+				std::cout << "--projectile-stress takes a count from 0 to " << PROJECTILE_CAPACITY << std::endl;
+				return 1;
+			}
+			projectileStress = (unsigned int)target;
+		}
+		else if (std::string(argv[i]) == "--bench-replay" && i + 1 < argc)
+			benchReplayPath = argv[++i];
+		else if (std::string(argv[i]) == "--json" && i + 1 < argc)
+			benchJsonPath = argv[++i];
+		else if (std::string(argv[i]) == "--baseline" && i + 1 < argc)
+			benchBaselinePath = argv[++i];
+		else if (std::string(argv[i]) == "--threshold" && i + 1 < argc)
+			benchThreshold = atof(argv[++i]);
+		else if (std::string(argv[i]) == "--telemetry" && i + 1 < argc) {
+			if (!telemetry.open(argv[++i]))
+				return 1;
+		}
+		else if ((std::string(argv[i]) == "--connect" || std::string(argv[i]) == "--spectate") && i + 2 < argc) {
+			spectating = std::string(argv[i]) == "--spectate";
+			const char* host = argv[++i];
+			unsigned short port = (unsigned short)atoi(argv[++i]);
+			online = netInit() && resolveAddress(host, port, server) && connection.open(0);
+			if (!online)
+				return 1;
+		}
+	}
+
+	bool exporting = !exportReplayPath.empty() || !benchReplayPath.empty();
+	if (exporting && exportFps < 1)
+		exportFps = MATCH_TICK_RATE;
+
 	srand(time(NULL));
-	SDL_Init(SDL_INIT_VIDEO);
-	displayWindow = SDL_CreateWindow("Brian Chuk's Basic Platformer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1600, 900, SDL_WINDOW_OPENGL);
+	SDL_Init(exporting ? SDL_INIT_VIDEO : SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+	if (!exporting)
+		audio.init(AUDIO_FREQUENCY, audioBuffer, AUDIO_VOICES);
+	// Exporting draws into its own framebuffer, the window is only there for a GL context
+	displayWindow = SDL_CreateWindow("Brian Chuk's Basic Platformer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1600, 900, SDL_WINDOW_OPENGL | (exporting ? SDL_WINDOW_HIDDEN : 0));
 	SDL_GLContext context = SDL_GL_CreateContext(displayWindow);
 	SDL_GL_MakeCurrent(displayWindow, context);
 #ifdef _WINDOWS
 	glewInit();
 #endif
-
-	program = new ShaderProgram(RESOURCE_FOLDER"vertex_textured.glsl", RESOURCE_FOLDER"fragment_textured.glsl");
+	if (!exporting) {
+		int drawableWidth, drawableHeight;
+		SDL_GL_GetDrawableSize(displayWindow, &drawableWidth, &drawableHeight);
+		resolution.init(drawableWidth, drawableHeight);
+	}
+	gpuTimer.init();
+
+	shaders.load(RESOURCE_FOLDER);
+	shaders.print();
+	program = shaders.get(SHADER_TEXTURED);
+	if (!program) {
+		SDL_Quit();
+		return 1;
+	}
 	SDL_Event event;
 	bool done = false;
 
 	projectionMatrix.setOrthoProjection(-4.0, 4.0, -2.25f, 2.25f, -1.0f, 1.0f);
-	program->setModelMatrix(modelMatrix);
-	program->setProjectionMatrix(projectionMatrix);
-	program->setViewMatrix(viewMatrix);
+	program->setViewProjectionMatrix(viewMatrix * projectionMatrix);
 
 	//Create GLUint textures
 	fontTexture = ut.LoadTexture("font1.png");
-	HALDUN = ut.LoadTexture("HaldunMode.png");
-	Hadimioglu = Entity(0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0, 0, { HALDUN }, 21.5f, 21.5f, WIZARD);
-	
-	fd = ut.LoadTexture("FinalDestination.png");
-	backgrounds.push_back(Entity(2.5f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0, 0, { fd }, 355.0f, 200.0f, WIZARD));
-	bf = ut.LoadTexture("Battlefield.png");
-	backgrounds.push_back(Entity(2.5f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0, 0, { bf }, 355.0f, 200.0f, WIZARD));
-	temple = ut.LoadTexture("Temple.png");
-	backgrounds.push_back(Entity(2.5f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0, 0, { temple }, 355.0f, 200.0f, WIZARD));
 	
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukStanding1.png"));//Standing: 0-1
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukStanding2.png"));
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukJumping.png"));//Jumping: 2
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukRunning.png"));//Running: 3-5
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukRunning.png"));
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukRunning.png"));
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukGettingHit.png"));//Getting Hit: 6
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukGNormal1.png"));//Ground Attack: 7-8
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukGNormal2.png"));
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukANormal.png"));//Air Attack: 9
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukDeath1.png"));//Death: 10-11
-	playerSpriteTexture.push_back(ut.LoadTexture("ChukDeath2.png"));
-
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenStanding1.png"));//Standing: 0-1
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenStanding2.png"));
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenJumping.png"));//Jumping: 2
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenRunning1.png"));//Running: 3-5
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenRunning2.png"));
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenRunning3.png"));
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenGettingHit.png"));//Getting Hit: 6
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenGNormal.png"));//Ground Attack: 7-8
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenGNormal.png"));
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenANormal.png"));//Air Attack: 9
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenDeath1.png"));//Death: 10-11
-	player2SpriteTexture.push_back(ut.LoadTexture("IvenDeath2.png"));
+	//Animation clips; their sprites, the splash and stage backgrounds are loaded when needed
+	for (int c = 0; c < CHARACTER_COUNT; c++)
+		characterAnimations[c].load(std::string(RESOURCE_FOLDER) + characterDefinitions[c].animation);
 	groundTexture = ut.LoadTexture("castleCenter.png");
 	powerupTexture = ut.LoadTexture("cherry.png");
 
+	if (exporting) {
+		int result = benchReplayPath.empty() ? exportReplay() : benchRenderedReplay();
+		textures.shutdown();
+		SDL_Quit();
+		return result;
+	}
+	enterMainMenu();
+	textures.print(profiler.enabled);
+
 	//Sounds
-	music = Mix_LoadMUS("VVVVVV Soundtrack 0616 Passion For Exploring.mp3");
-	Mix_PlayMusic(music, -1);
+	audio.playMusic("VVVVVV Soundtrack 0616 Passion For Exploring.mp3");
 
-	chukatk = Mix_LoadWAV("ChukHitsound.wav");
-	ivenatk = Mix_LoadWAV("IvenHitsound.wav");
-	//Mix_PlayChannel(1, chukatk, 0);
-	//Mix_PlayChannel(2, ivenatk, 0);
+	for (int c = 0; c < CHARACTER_COUNT; c++)
+		hitSounds[c] = audio.loadSample(characterDefinitions[c].hitSound);
+
+#ifdef _WINDOWS
+	// Sleep() otherwise rounds up to the 15.6ms system tick, about one whole match tick
+	timeBeginPeriod(1);
+#endif
+	simThread = std::thread(simulate);
 
 	while (!done) {
+		profiler.beginFrame();
+		frameArena.reset();
+		unsigned long allocationsBefore = allocationCount();
 		// Keyboard Controls
 		while (SDL_PollEvent(&event)) {
 			if (event.type == SDL_QUIT || event.type == SDL_WINDOWEVENT_CLOSE || event.key.keysym.scancode == SDL_SCANCODE_ESCAPE)
@@ -560,29 +1296,37 @@ int main(int argc, char *argv[])
 						if (gameOver == true) {
 							gameOver = false;
 							gameRunning = true;
-							state = STATE_MAIN_MENU;
-							ut.refresh(projectionMatrix, viewMatrix, modelMatrix, program);
+							releaseMatchTextures();
+							enterMainMenu();
+							ut.refresh(projectionMatrix, viewMatrix, program);
 						}
 						else if (state == STATE_MAIN_MENU) {
 
-							//Initialize entities
-							players.clear();
-							players.push_back(Entity(5.0f, -1.0f, 0.0f, -0.15f, 1.0f, 1.0f, 0, 0, playerSpriteTexture, 7.0f, 7.0f, PLAYER));//Chuk
-							players.push_back(Entity(0.0f, -1.0f, 0.0f, -0.05f, 1.0f, 1.0f, 0, 0, player2SpriteTexture, 5.0f, 5.0f, PLAYER));//Iven
-							players[0].width = -1;
-							players[0].isStatic = false;
-							players[0].acceleration[1] = -9.8f;
-							players[1].isStatic = false;
-							players[1].acceleration[1] = -9.8f;
-							p1Health = 100;
-							p2Health = 100;
-
 							//Build map
-							blocks.clear();
-							setUpStage(stage, blocks);
-							dead = false;
-							deathCounter = 0.0f;
+							if (online && !joinServer())
+								break;
+							std::lock_guard<std::mutex> lock(simLock);
+							bool streamed = !streamName.empty() && !online;
+							if (streamed ? !setUpStreamedStage() : !setUpStage(stage, currentStage))
+								break;
+							if (streamed)
+								match.startStreamed(&streamedStage, &characterAnimations[match.characters[0]], &characterAnimations[match.characters[1]]);
+							else
+								match.start(&currentStage, &characterAnimations[match.characters[0]], &characterAnimations[match.characters[1]]);
+
+							//Initialize entities
+							leaveMainMenu();
+							createPlayers();
+							showMatch();
+							simRunning = true;
+
+							trainingSaveSize = 0;
+							if (!online && !streamed && !projectileStress)
+								replay.begin(match, stageFiles[stage]);
+							if (!online)
+								telemetry.begin(matchStageName());
 							state = STATE_GAME_LEVEL;
+							steadyFrames = 0;
 						}
 					}
 					if (event.key.keysym.scancode == SDL_SCANCODE_KP_1 || event.key.keysym.scancode == SDL_SCANCODE_I) {
@@ -615,7 +1359,18 @@ int main(int argc, char *argv[])
 					if (event.key.keysym.scancode == SDL_SCANCODE_W) {
 						p2controlsJump = true;
 					}
+					if (event.key.keysym.scancode == SDL_SCANCODE_F3)
+						showResolution = !showResolution;
+					if (state == STATE_GAME_LEVEL && !online) {
+						if (event.key.keysym.scancode == SDL_SCANCODE_F5)
+							saveTraining();
+						if (event.key.keysym.scancode == SDL_SCANCODE_F9)
+							loadTraining();
+					}
 					if (state == STATE_MAIN_MENU) {
+						// Online the server picks the stage
+						if (online)
+							break;
 						if (event.key.keysym.scancode == SDL_SCANCODE_LEFT || event.key.keysym.scancode == SDL_SCANCODE_A) {
 							if (stage > 0)
 								stage--;
@@ -690,45 +1445,67 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		// The simulation thread samples these once a tick
+		playerButtons[0] = buttons(p1controlsMoveLeft, p1controlsMoveRight, p1controlsJump, p1NormalAttack, p1StrongAttack, p1UpAttack);
+		playerButtons[1] = buttons(p2controlsMoveLeft, p2controlsMoveRight, p2controlsJump, p2NormalAttack, p2StrongAttack, p2UpAttack);
+
 		float ticks = (float)SDL_GetTicks() / 1000.0f;
 		elapsed = ticks - lastFrameTicks;
 		lastFrameTicks = ticks;
 
-		if (gameRunning) {
-			float fixedElapsed = elapsed;
-			if (fixedElapsed > FIXED_TIMESTEP * MAX_TIMESTEPS) {
-				fixedElapsed = FIXED_TIMESTEP * MAX_TIMESTEPS;
+		// Hot reload: pick up edits to the .stage file without restarting the match
+		if (state == STATE_GAME_LEVEL && !match.streamed && SDL_GetTicks() - lastStageCheck > STAGE_CHECK_INTERVAL) {
+			lastStageCheck = SDL_GetTicks();
+			std::lock_guard<std::mutex> lock(simLock);
+			if (currentStage.poll()) {
+				loadBackground(*currentStage.header);
+				steadyFrames = 0;
 			}
-			while (fixedElapsed >= FIXED_TIMESTEP) {
-				fixedElapsed -= FIXED_TIMESTEP;
-				Update(FIXED_TIMESTEP);
-			}
-
-			///
-			p1timeSinceLastJump += fixedElapsed;
-			p2timeSinceLastJump += fixedElapsed;
-			if (players.size() >= 2){
-				players[0].cooldown -= fixedElapsed;
-				players[1].cooldown -= fixedElapsed;
-
-				if (players[0].cooldown <= 0)
-					players[0].cooldown = 0;
-
-				if (players[1].cooldown <= 0)
-					players[1].cooldown = 0;
-			}
-			if (dead)
-				deathCounter += fixedElapsed;
-			///
+		}
 
-			Update(fixedElapsed);
+		if (gameRunning) {
+			Update(elapsed);
 			Render();
+			if (renderStall > 0)
+				SDL_Delay(renderStall);
+		}
+		// Once warmed up, a gameplay frame must not touch the heap
+		unsigned long frameAllocations = allocationCount() - allocationsBefore;
+		profiler.count("allocations", frameAllocations);
+		if (state == STATE_GAME_LEVEL && gameRunning) {
+			steadyFrames++;
+			// except while a streamed stage is building chunks on its loader thread
+			assert(!ALLOCATION_TRACKING || steadyFrames <= WARMUP_FRAMES || frameAllocations == 0 || match.streamed);
+		}
+		else {
+			steadyFrames = 0;
 		}
+		profiler.endFrame();
+	}
+
+	simAlive = false;
+	simThread.join();
+	if (telemetry.active()) {
+		telemetry.close();
+		std::cout << "Telemetry: " << telemetry.written.load() << " events written, " << telemetry.dropped << " dropped" << std::endl;
 	}
+#ifdef _WINDOWS
+	timeEndPeriod(1);
+#endif
 
-	Mix_FreeChunk(chukatk);
-	Mix_FreeChunk(ivenatk);
-	Mix_FreeMusic(music);
+	if (online) {
+		unsigned char data[8];
+		PacketWriter leave(data, sizeof(data));
+		leave.u8(PACKET_LEAVE);
+		leave.u8(onlineSlot);
+		if (!spectating)
+			connection.send(server, leave.data, leave.size);
+		connection.close();
+		netShutdown();
+	}
+	audio.shutdown();
+	textures.shutdown();
+	shaders.shutdown();
 
 	SDL_Quit();
 	return 0;
@@ -1,15 +1,13 @@
 attribute vec4 position;
 attribute vec2 texCoord;
 
-uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+// Positions arrive in world space, sprites and text are placed on the CPU
+uniform mat4 viewProjectionMatrix;
 
 varying vec2 texCoordVar;
 
 void main()
 {
-	vec4 p = viewMatrix * modelMatrix  * position;
     texCoordVar = texCoord;
-	gl_Position = projectionMatrix * p;
+	gl_Position = viewProjectionMatrix * position;
 }
\ No newline at end of file
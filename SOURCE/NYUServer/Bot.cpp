@@ -0,0 +1,131 @@
+#include "Bot.h"
+
+#include <cmath>
+
+Bot::Bot() : slot(-1), spectating(false), statesReceived(0), lastTick(0), matchesSeen(0), lastJoin(0), lastAck(0), sequence(0), random(1), sawOver(false) {}
+
+bool Bot::connect(const NetAddress& newServer, unsigned int seed, bool spectate) {
+	server = newServer;
+	spectating = spectate;
+	random = seed ? seed : 1;
+	return socket.open(0);
+}
+
+void Bot::update(double now) {
+	if (spectating) {
+		watch(now);
+		return;
+	}
+	unsigned char data[PROTOCOL_MAX_PACKET];
+	NetAddress from;
+	int size;
+	while ((size = socket.receive(from, data, sizeof(data))) > 0) {
+		if (!sameAddress(from, server))
+			continue;
+		PacketReader packet(data, size);
+		if (data[0] == PACKET_WELCOME) {
+			packet.u8();
+			unsigned int given = packet.u8();
+			if (!packet.failed && given != PROTOCOL_ANY_SLOT)
+				slot = (int)given;
+		}
+		else if (data[0] == PACKET_STATE && readMatchState(packet, view)) {
+			statesReceived++;
+			lastTick = view.tick;
+			if (view.over && !sawOver)
+				matchesSeen++;
+			sawOver = view.over;
+		}
+	}
+
+	PacketWriter packet(data, sizeof(data));
+	if (slot < 0) {
+		if (now - lastJoin < BOT_JOIN_RETRY)
+			return;
+		lastJoin = now;
+		packet.u8(PACKET_JOIN);
+		packet.u8(PROTOCOL_VERSION);
+		packet.u8(PROTOCOL_ANY_SLOT);
+	}
+	else {
+		packet.u8(PACKET_INPUT);
+		packet.u8(slot);
+		packet.u32(++sequence);
+		packet.u8(think());
+	}
+	socket.send(server, packet.data, packet.size);
+}
+
+void Bot::watch(double now) {
+	unsigned char data[PROTOCOL_MAX_PACKET];
+	NetAddress from;
+	int size;
+	while ((size = socket.receive(from, data, sizeof(data))) > 0) {
+		if (!sameAddress(from, server))
+			continue;
+		PacketReader packet(data, size);
+		if (data[0] == PACKET_WELCOME) {
+			packet.u8();
+			if (packet.u8() == PROTOCOL_SPECTATOR_SLOT)
+				slot = PROTOCOL_SPECTATOR_SLOT;
+		}
+		else if (data[0] == PACKET_FEED) {
+			bool started = feed.started;
+			unsigned int newest = feed.newest;
+			if (feed.read(packet)) {
+				statesReceived += started ? feed.newest - newest : SPECTATE_BATCH;
+				lastTick = feed.newest;
+			}
+		}
+	}
+
+	PacketWriter packet(data, sizeof(data));
+	if (slot < 0) {
+		if (now - lastJoin < BOT_JOIN_RETRY)
+			return;
+		lastJoin = now;
+		packet.u8(PACKET_SPECTATE);
+		packet.u8(PROTOCOL_VERSION);
+	}
+	else if (feed.ackWanted || now - lastAck >= SPECTATE_KEEPALIVE) {
+		feed.ackWanted = false;
+		lastAck = now;
+		packet.u8(PACKET_ACK);
+		packet.u32(feed.ackNumber);
+	}
+	else {
+		return;
+	}
+	socket.send(server, packet.data, packet.size);
+}
+
+void Bot::leave() {
+	if (slot < 0 || spectating)
+		return;
+	unsigned char data[8];
+	PacketWriter packet(data, sizeof(data));
+	packet.u8(PACKET_LEAVE);
+	packet.u8(slot);
+	socket.send(server, packet.data, packet.size);
+}
+
+unsigned char Bot::think() {
+	random = random * 1103515245 + 12345;
+	unsigned int roll = (random >> 16) % 100;
+	if (statesReceived == 0)
+		return 0;
+
+	const Fighter& self = view.fighters[slot];
+	const Fighter& other = view.fighters[1 - slot];
+	float dx = other.position[0] - self.position[0];
+	float dy = other.position[1] - self.position[1];
+
+	unsigned char input = 0;
+	if (fabs(dx) > 0.6f || roll < 10)
+		input |= dx < 0 ? INPUT_LEFT : INPUT_RIGHT;
+	if ((dy > 1.0f && roll < 20) || roll < 2)
+		input |= INPUT_JUMP;
+	if (fabs(dx) < 1.2f && fabs(dy) < 1.2f && roll < 30)
+		input |= INPUT_ATTACK;
+	return input;
+}
@@ -0,0 +1,47 @@
+#ifndef Bot_h
+#define Bot_h
+
+#include "Match.h"
+#include "Net.h"
+#include "Protocol.h"
+#include "Spectator.h"
+
+#define BOT_JOIN_RETRY 0.5	//seconds between JOINs until the server answers
+
+// A stand-in player for testing the server end to end: joins a match over UDP,
+// chases and swings at the other fighter using the states it gets back. A spectating
+// bot only watches the feed, decoding and acking it like the game's viewer does.
+class Bot {
+public:
+	Bot();
+
+	bool connect(const NetAddress& server, unsigned int seed, bool spectate);
+	// Reads states and sends one input, call once a tick
+	void update(double now);
+	void leave();
+
+	int slot;	//-1 until welcomed
+	bool spectating;
+	unsigned int statesReceived;	//states, or feed frames when spectating
+	unsigned int lastTick;
+	unsigned int matchesSeen;	//matches that ended while this bot was in them
+
+private:
+	UdpSocket socket;
+	NetAddress server;
+	Match view;
+	SpectatorDecoder feed;
+	double lastJoin;
+	double lastAck;
+	unsigned int sequence;
+	unsigned int random;
+	bool sawOver;
+
+	unsigned char think();
+	void watch(double now);
+
+	Bot(const Bot&);
+	Bot& operator=(const Bot&);
+};
+
+#endif
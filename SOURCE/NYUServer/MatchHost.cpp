@@ -0,0 +1,296 @@
+#include "MatchHost.h"
+#include "Clock.h"
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+MatchHost::MatchHost() : id(0), budget(MATCH_TICK), thread(0), port(0), recordReplays(false), stage(nullptr), nextTick(0), overTicks(0), replaysWritten(0) {
+	animations[0] = nullptr;
+	animations[1] = nullptr;
+	memset(clients, 0, sizeof(clients));
+	memset(&stats, 0, sizeof(stats));
+	spectators.reserve(HOST_MAX_SPECTATORS);
+}
+
+bool MatchHost::open(int newId, unsigned short newPort, const std::string& newStageName, const Stage* newStage, const AnimationSet* p1Animation, const AnimationSet* p2Animation) {
+	id = newId;
+	port = newPort;
+	stageName = newStageName;
+	stage = newStage;
+	animations[0] = p1Animation;
+	animations[1] = p2Animation;
+	match.start(stage, animations[0], animations[1]);
+	return socket.open(port);
+}
+
+double MatchHost::service(double now) {
+	receive(now);
+	{
+		std::lock_guard<std::mutex> lock(statsLock);
+		stats.clients = clientCount();
+		stats.spectators = (int)spectators.size();
+	}
+
+	// Nobody here, so no ticks: an idle match costs one packet check per HOST_IDLE_POLL
+	if (clientCount() == 0) {
+		nextTick = 0;
+		return now + HOST_IDLE_POLL;
+	}
+	if (nextTick == 0) {
+		restart();
+		nextTick = now;
+	}
+
+	int ran = 0;
+	while (now >= nextTick && ran < HOST_MAX_CATCH_UP) {
+		if (now - nextTick > MATCH_TICK) {
+			std::lock_guard<std::mutex> lock(statsLock);
+			stats.late++;
+		}
+		runTick();
+		nextTick += MATCH_TICK;
+		ran++;
+	}
+	if (now >= nextTick) {
+		// Too far behind to catch up, drop the backlog rather than fast-forward the players
+		std::lock_guard<std::mutex> lock(statsLock);
+		stats.skipped += (unsigned int)((now - nextTick) / MATCH_TICK) + 1;
+		nextTick = now + MATCH_TICK;
+	}
+	if (ran > 0)
+		broadcast();
+	return nextTick;
+}
+
+int MatchHost::clientCount() const {
+	return (clients[0].connected ? 1 : 0) + (clients[1].connected ? 1 : 0);
+}
+
+void MatchHost::takeStats(TickStats& out) {
+	std::lock_guard<std::mutex> lock(statsLock);
+	out = stats;
+	int connected = stats.clients;
+	int watching = stats.spectators;
+	memset(&stats, 0, sizeof(stats));
+	stats.clients = connected;
+	stats.spectators = watching;
+}
+
+void MatchHost::receive(double now) {
+	unsigned char data[PROTOCOL_MAX_PACKET];
+	NetAddress from;
+	int size;
+	while ((size = socket.receive(from, data, sizeof(data))) > 0) {
+		PacketReader packet(data, size);
+		handle(from, packet, now);
+	}
+
+	for (int slot = 0; slot < 2; slot++) {
+		if (clients[slot].connected && now - clients[slot].lastHeard > PROTOCOL_TIMEOUT) {
+			std::cout << "match " << id << ": player " << slot + 1 << " timed out" << std::endl;
+			clients[slot].connected = false;
+		}
+	}
+	for (size_t i = 0; i < spectators.size();) {
+		if (now - spectators[i].lastHeard > PROTOCOL_TIMEOUT) {
+			spectators[i] = spectators.back();
+			spectators.pop_back();
+		}
+		else {
+			i++;
+		}
+	}
+}
+
+void MatchHost::handle(const NetAddress& from, PacketReader& packet, double now) {
+	unsigned int type = packet.u8();
+	if (type == PACKET_JOIN) {
+		unsigned int version = packet.u8();
+		unsigned int wanted = packet.u8();
+		if (packet.failed || version != PROTOCOL_VERSION)
+			return;
+
+		// A client resending JOIN because our WELCOME got lost keeps its slot
+		int slot = -1;
+		for (int i = 0; i < 2 && slot < 0; i++) {
+			if (clients[i].connected && sameAddress(clients[i].address, from))
+				slot = i;
+		}
+		for (int i = 0; i < 2 && slot < 0; i++) {
+			if (!clients[i].connected && (wanted == PROTOCOL_ANY_SLOT || wanted == (unsigned int)i))
+				slot = i;
+		}
+		if (slot >= 0 && !clients[slot].connected) {
+			memset(&clients[slot], 0, sizeof(HostClient));
+			clients[slot].connected = true;
+			clients[slot].address = from;
+			std::cout << "match " << id << ": player " << slot + 1 << " joined" << std::endl;
+		}
+		if (slot >= 0)
+			clients[slot].lastHeard = now;
+		welcome(from, slot >= 0 ? slot : PROTOCOL_ANY_SLOT);
+		return;
+	}
+	if (type == PACKET_SPECTATE || type == PACKET_ACK) {
+		HostSpectator* spectator = nullptr;
+		for (size_t i = 0; i < spectators.size() && !spectator; i++) {
+			if (sameAddress(spectators[i].address, from))
+				spectator = &spectators[i];
+		}
+
+		if (type == PACKET_SPECTATE) {
+			if (packet.u8() != PROTOCOL_VERSION || packet.failed)
+				return;
+			if (!spectator) {
+				if (spectators.size() == HOST_MAX_SPECTATORS) {
+					welcome(from, PROTOCOL_ANY_SLOT);
+					return;
+				}
+				HostSpectator joined = { from, SPECTATE_NO_KEYFRAME, 0, now };
+				spectators.push_back(joined);
+				spectator = &spectators.back();
+			}
+			spectator->lastHeard = now;
+			welcome(from, PROTOCOL_SPECTATOR_SLOT);
+			return;
+		}
+
+		unsigned int number = packet.u32();
+		if (!spectator || packet.failed)
+			return;
+		spectator->lastHeard = now;
+		// Acks can come back out of order, only ever move forward to a keyframe we still have
+		if (feed.hasKeyframe(number) && (spectator->acked == SPECTATE_NO_KEYFRAME || (int)(number - spectator->acked) > 0))
+			spectator->acked = number;
+		return;
+	}
+
+	unsigned int slot = packet.u8();
+	if (packet.failed || slot > 1 || !clients[slot].connected || !sameAddress(clients[slot].address, from))
+		return;
+	HostClient& client = clients[slot];
+	client.lastHeard = now;
+
+	if (type == PACKET_INPUT) {
+		unsigned int sequence = packet.u32();
+		unsigned int input = packet.u8();
+		if (packet.failed || (sequence <= client.sequence && client.sequence != 0))
+			return;
+		client.sequence = sequence;
+		client.input = (unsigned char)input;
+		std::lock_guard<std::mutex> lock(statsLock);
+		stats.inputsReceived++;
+	}
+	else if (type == PACKET_LEAVE) {
+		std::cout << "match " << id << ": player " << slot + 1 << " left" << std::endl;
+		client.connected = false;
+	}
+}
+
+void MatchHost::restart() {
+	if (recordReplays && !replay.ticks.empty()) {
+		std::ostringstream path;
+		path << "match" << id << "-" << replaysWritten++ << ".replay";
+		replay.save(path.str());
+	}
+	match.start(stage, animations[0], animations[1]);
+	overTicks = 0;
+	if (recordReplays)
+		replay.begin(match, stageName);
+}
+
+void MatchHost::runTick() {
+	if (match.over && ++overTicks >= HOST_RESTART_TICKS)
+		restart();
+
+	unsigned char inputs[2];
+	for (int slot = 0; slot < 2; slot++)
+		inputs[slot] = clients[slot].connected ? clients[slot].input : 0;
+
+	double start = clockSeconds();
+	match.step(inputs);
+	double spent = clockSeconds() - start;
+	{
+		std::lock_guard<std::mutex> lock(statsLock);
+		stats.ticks++;
+		stats.tickTime += spent;
+		if (spent > stats.tickMax)
+			stats.tickMax = spent;
+	}
+
+	if (replay.recording())
+		replay.record(inputs, match);
+
+	if (feed.record(match) && !spectators.empty())
+		sendFeed();
+}
+
+// Spectators holding the same keyframe get the same packet, so a batch is coded once
+// per keyframe in use rather than once per spectator
+void MatchHost::sendFeed() {
+	double start = clockSeconds();
+	int cached = 0;
+	unsigned int encodes = 0, bytes = 0, packets = 0;
+	double encodeTime = 0;
+	unsigned int latest = feed.latestKeyframe();
+	for (size_t i = 0; i < spectators.size(); i++) {
+		HostSpectator& spectator = spectators[i];
+		bool withKeyframe = spectator.acked != latest && (spectator.keySent == 0 || feed.frameNumber - spectator.keySent >= SPECTATE_KEY_RESEND);
+		if (!feed.hasKeyframe(spectator.acked))
+			withKeyframe = true;
+		if (withKeyframe)
+			spectator.keySent = feed.frameNumber;
+
+		FeedPacket* packet = nullptr;
+		for (int c = 0; c < cached && !packet; c++) {
+			if (feedCache[c].acked == spectator.acked && feedCache[c].withKeyframe == withKeyframe)
+				packet = &feedCache[c];
+		}
+		if (!packet) {
+			packet = &feedCache[cached < HOST_FEED_CACHE ? cached++ : HOST_FEED_CACHE - 1];
+			packet->acked = spectator.acked;
+			packet->withKeyframe = withKeyframe;
+			double encodeStart = clockSeconds();
+			packet->size = feed.write(spectator.acked, withKeyframe, packet->data, sizeof(packet->data));
+			encodeTime += clockSeconds() - encodeStart;
+			encodes++;
+		}
+		if (packet->size > 0 && socket.send(spectator.address, packet->data, packet->size)) {
+			bytes += packet->size;
+			packets++;
+		}
+	}
+	double spent = clockSeconds() - start;
+
+	std::lock_guard<std::mutex> lock(statsLock);
+	stats.feedBatches++;
+	stats.feedEncodes += encodes;
+	stats.feedTime += spent;
+	stats.encodeTime += encodeTime;
+	stats.feedBytes += bytes;
+	stats.feedPackets += packets;
+}
+
+void MatchHost::welcome(const NetAddress& to, unsigned int slot) {
+	unsigned char data[PROTOCOL_MAX_PACKET];
+	PacketWriter reply(data, sizeof(data));
+	reply.u8(PACKET_WELCOME);
+	reply.u8(slot);
+	reply.text(stageName.c_str(), STAGE_NAME_LENGTH);
+	socket.send(to, reply.data, reply.size);
+}
+
+void MatchHost::broadcast() {
+	unsigned char data[PROTOCOL_MAX_PACKET];
+	PacketWriter packet(data, sizeof(data));
+	writeMatchState(packet, match);
+
+	unsigned int sent = 0;
+	for (int slot = 0; slot < 2; slot++) {
+		if (clients[slot].connected && socket.send(clients[slot].address, packet.data, packet.size))
+			sent++;
+	}
+	std::lock_guard<std::mutex> lock(statsLock);
+	stats.statesSent += sent;
+}
@@ -0,0 +1,110 @@
+#ifndef MatchHost_h
+#define MatchHost_h
+
+#include "Match.h"
+#include "Net.h"
+#include "Protocol.h"
+#include "Spectator.h"
+#include "Replay.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define HOST_IDLE_POLL 0.05		//seconds between packet checks while nobody is connected
+#define HOST_MAX_CATCH_UP 5		//ticks run back to back before a late match skips ahead
+#define HOST_RESTART_TICKS (3 * MATCH_TICK_RATE)	//ticks the result stays up before a rematch
+#define HOST_MAX_SPECTATORS 1024
+#define HOST_FEED_CACHE 4	//distinct feed packets kept per batch, one per keyframe spectators hold
+
+struct HostClient {
+	bool connected;
+	NetAddress address;
+	unsigned int sequence;	//newest input seen, older ones arriving late are dropped
+	unsigned char input;
+	double lastHeard;
+};
+
+struct HostSpectator {
+	NetAddress address;
+	unsigned int acked;		//keyframe number, SPECTATE_NO_KEYFRAME until the first ack
+	unsigned int keySent;	//frame number the newest keyframe was last sent at
+	double lastHeard;
+};
+
+struct FeedPacket {
+	unsigned int acked;
+	bool withKeyframe;
+	int size;
+	unsigned char data[PROTOCOL_MAX_PACKET];
+};
+
+// Totals since the last report
+struct TickStats {
+	unsigned int ticks;
+	double tickTime;	//seconds inside Match::step
+	double tickMax;
+	unsigned int late;	//ticks that ran more than a tick after they were due
+	unsigned int skipped;	//ticks dropped after falling HOST_MAX_CATCH_UP behind
+	unsigned int statesSent;
+	unsigned int inputsReceived;
+	int clients;	//connected now, not reset by takeStats
+	int spectators;	//same
+	unsigned int feedBatches;
+	unsigned int feedEncodes;	//packets actually coded, the rest were copies
+	double feedTime;	//seconds spent coding and sending the feed
+	double encodeTime;	//the coding part of feedTime
+	unsigned int feedBytes;	//payload only, each datagram also costs 28 bytes of UDP/IP header
+	unsigned int feedPackets;
+};
+
+// One match and the UDP port its two players talk to. A host is only ever serviced
+// by one thread at a time; takeStats() is the one call made from other threads.
+class MatchHost {
+public:
+	MatchHost();
+
+	int id;
+	std::string stageName;
+	double budget;	//seconds of tick time this match gets out of its thread's MATCH_TICK
+	int thread;		//worker it is pinned to, -1 when a JobSystem shares the matches out
+	unsigned short port;
+	bool recordReplays;	//write each match to match<id>-<n>.replay when it restarts
+
+	bool open(int id, unsigned short port, const std::string& stageName, const Stage* stage, const AnimationSet* p1Animation, const AnimationSet* p2Animation);
+	// Reads waiting packets and runs every tick that is due by now. Returns the time
+	// the next tick is due, so a worker can sleep until its earliest match needs it.
+	double service(double now);
+	int clientCount() const;
+	void takeStats(TickStats& out);
+
+private:
+	Match match;
+	const Stage* stage;
+	const AnimationSet* animations[2];
+	UdpSocket socket;
+	HostClient clients[2];
+	std::vector<HostSpectator> spectators;
+	SpectatorEncoder feed;
+	FeedPacket feedCache[HOST_FEED_CACHE];
+	double nextTick;
+	int overTicks;
+	Replay replay;
+	int replaysWritten;
+
+	std::mutex statsLock;
+	TickStats stats;
+
+	void receive(double now);
+	void handle(const NetAddress& from, PacketReader& packet, double now);
+	void restart();
+	void runTick();
+	void broadcast();
+	void sendFeed();
+	void welcome(const NetAddress& to, unsigned int slot);
+
+	MatchHost(const MatchHost&);
+	MatchHost& operator=(const MatchHost&);
+};
+
+#endif
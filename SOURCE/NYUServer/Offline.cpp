@@ -0,0 +1,1010 @@
+#include "Offline.h"
+#include "Match.h"
+#include "Stage.h"
+#include "Animation.h"
+#include "SaveState.h"
+#include "Replay.h"
+#include "Clock.h"
+#include "JobSystem.h"
+#include "StageStream.h"
+#include "Telemetry.h"
+#include "Projectiles.h"
+#include "Benchmark.h"
+#include "AllocTracker.h"
+#include "Collision.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#define SCRIPT_HOLD 20	//ticks a scripted player keeps the same buttons
+#define BENCH_JOB_MATCHES 256
+#define BENCH_STEP_GRAIN 4		//matches a job steps, a step is well under a microsecond
+#define BENCH_HASH_GRAIN 16
+#define STREAM_REPORT_TICKS 600
+#define BENCH_TELEMETRY_EVENTS 1000000	//--bench-telemetry pushes this many on their own
+#define BENCH_TELEMETRY_ROUNDS 1000		//and observes the scripted match this many times
+#define BENCH_PROJECTILE_WARMUP 60	//ticks for the first spray to spread out before timing starts
+#define STREAM_JUMP_EVERY 90	//the traversal bot also jumps this often, for 30 ticks, to get onto platforms
+
+const char* benchStages[] = { "FinalDestination", "Battlefield", "Temple" };
+
+static bool loadAnimations(const std::string& resources, AnimationSet& chuk, AnimationSet& iven) {
+	return chuk.load(resources + characterDefinitions[CHARACTER_CHUK].animation) && iven.load(resources + characterDefinitions[CHARACTER_IVEN].animation);
+}
+
+// Both players press random buttons, a new set every SCRIPT_HOLD ticks
+static void scriptInputs(unsigned int tick, unsigned int& random, unsigned char inputs[2]) {
+	if (tick % SCRIPT_HOLD != 0)
+		return;
+	for (int k = 0; k < 2; k++) {
+		random = random * 1103515245 + 12345;
+		inputs[k] = (unsigned char)((random >> 16) & 0x3f);
+	}
+}
+
+static void printFighters(const Match& match) {
+	for (int k = 0; k < 2; k++) {
+		const Fighter& fighter = match.fighters[k];
+		std::cout << "  p" << k + 1 << ": position " << fighter.position[0] << ", " << fighter.position[1] << " speed " << fighter.speed[0]
+			<< ", " << fighter.speed[1] << " health " << fighter.health << (fighter.dead ? " dead" : "") << std::endl;
+	}
+}
+
+int runSaveState(const std::string& path, const std::string& resources, unsigned int ticks) {
+	Match match;
+	char stageName[STAGE_NAME_LENGTH];
+	if (!loadStateFile(path, match, stageName))
+		return 1;
+	AnimationSet chukAnimation, ivenAnimation;
+	Stage stage;
+	if (!loadAnimations(resources, chukAnimation, ivenAnimation) || !stage.open(resources + stageName))
+		return 1;
+	match.stage = &stage;
+	match.animations[0] = &chukAnimation;
+	match.animations[1] = &ivenAnimation;
+
+	std::cout << path << ": " << stageName << ", tick " << match.tick << std::endl;
+	printFighters(match);
+	unsigned char idle[2] = { 0, 0 };
+	for (unsigned int i = 0; i < ticks && !match.over; i++)
+		match.step(idle);
+	std::cout << "after " << ticks << " ticks: tick " << match.tick << ", winner " << match.winner() << std::endl;
+	printFighters(match);
+	return 0;
+}
+
+int benchSaveState(const std::string& resources, const std::string& stageName, unsigned int ticks) {
+	AnimationSet chukAnimation, ivenAnimation;
+	Stage stage;
+	if (!loadAnimations(resources, chukAnimation, ivenAnimation) || !stage.open(resources + stageName))
+		return 1;
+	Match match;
+	match.start(&stage, &chukAnimation, &ivenAnimation);
+
+	unsigned char data[SAVESTATE_MAX_SIZE], check[SAVESTATE_MAX_SIZE];
+	unsigned char inputs[2] = { 0, 0 };
+	unsigned int random = 1;
+	double saveTime = 0, loadTime = 0, packTime = 0, unpackTime = 0, copyTime = 0;
+	unsigned long rawBytes = 0, packedBytes = 0;
+	unsigned int mismatches = 0, matches = 0;
+	for (unsigned int i = 0; i < ticks; i++) {
+		scriptInputs(i, random, inputs);
+		if (match.over) {
+			match.start(&stage, &chukAnimation, &ivenAnimation);
+			matches++;
+		}
+		match.step(inputs);
+
+		char name[STAGE_NAME_LENGTH];
+		double started = clockSeconds();
+		int rawSize = writeSaveState(match, stageName.c_str(), false, data, sizeof(data));
+		double saved = clockSeconds();
+		Match loaded;
+		bool ok = readSaveState(data, rawSize, loaded, name);
+		double restored = clockSeconds();
+		int packedSize = writeSaveState(match, stageName.c_str(), true, check, sizeof(check));
+		double packed = clockSeconds();
+		ok = readSaveState(check, packedSize, loaded, name) && ok;
+		double unpacked = clockSeconds();
+		MatchState rollback = match;
+		static_cast<MatchState&>(loaded) = rollback;
+		double copied = clockSeconds();
+
+		saveTime += saved - started;
+		loadTime += restored - saved;
+		packTime += packed - restored;
+		unpackTime += unpacked - packed;
+		copyTime += copied - unpacked;
+		rawBytes += rawSize;
+		packedBytes += packedSize;
+
+		// A save that reads back must write out the very same bytes
+		if (!ok || writeSaveState(loaded, name, false, check, sizeof(check)) != rawSize || memcmp(data, check, rawSize) != 0)
+			mismatches++;
+	}
+
+	std::cout << "save states over " << ticks << " ticks (" << matches << " matches finished) on " << stageName << ":" << std::endl;
+	std::cout << "  raw:        " << (double)rawBytes / ticks << " bytes, save " << saveTime / ticks * 1000000.0 << "us, load "
+		<< loadTime / ticks * 1000000.0 << "us" << std::endl;
+	std::cout << "  compressed: " << (double)packedBytes / ticks << " bytes, save " << packTime / ticks * 1000000.0 << "us, load "
+		<< unpackTime / ticks * 1000000.0 << "us" << std::endl;
+	std::cout << "  rollback copy: " << sizeof(MatchState) << " bytes, " << copyTime / ticks * 1000000.0 << "us" << std::endl;
+	std::cout << "  " << mismatches << " saves did not read back the same" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+int checkReplay(const std::string& path, const std::string& resources) {
+	Replay replay;
+	Match match;
+	char stageName[STAGE_NAME_LENGTH];
+	if (!replay.load(path) || !readSaveState(replay.snapshots[0].data, replay.snapshots[0].size, match, stageName))
+		return 1;
+	AnimationSet chukAnimation, ivenAnimation;
+	Stage stage;
+	if (!loadAnimations(resources, chukAnimation, ivenAnimation) || !stage.open(resources + replay.stageName))
+		return 1;
+	match.stage = &stage;
+	match.animations[0] = &chukAnimation;
+	match.animations[1] = &ivenAnimation;
+
+	Match start = match;
+	std::vector<MatchState> states;
+	states.reserve(replay.ticks.size());
+	size_t tick = 0;
+	for (; tick < replay.ticks.size(); tick++) {
+		match.step(replay.ticks[tick].inputs);
+		// Ticks after the match is over step nothing and fold nothing
+		if (match.tick != start.tick + states.size())
+			states.push_back(match);
+		if (match.hash != replay.ticks[tick].hash)
+			break;
+	}
+	size_t ran = states.size();
+	std::cout << path << ": " << replay.stageName << ", " << replay.ticks.size() << " ticks, " << replay.snapshots.size() << " snapshots" << std::endl;
+	if (ran > 0) {
+		// Timed again in whole passes, one tick is too short for the clock. The running
+		// hash is part of the step, refolding the states gives its share and must land
+		// on the same hash the step did. The ticks that stepped come first.
+		Match timed = start;
+		double started = clockSeconds();
+		for (size_t i = 0; i < ran; i++)
+			timed.step(replay.ticks[i].inputs);
+		double stepTime = clockSeconds() - started;
+		unsigned int folded = start.hash;
+		started = clockSeconds();
+		for (size_t i = 0; i < ran; i++)
+			folded = foldTickHash(folded, states[i]);
+		double foldTime = clockSeconds() - started;
+		std::cout << "  step " << stepTime / ran * 1000000.0 << "us a tick, of which the running hash " << foldTime / ran * 1000000.0
+			<< "us (" << foldTime / stepTime * 100.0 << "% of the step)" << std::endl;
+		if (folded != states[ran - 1].hash) {
+			std::cout << "  the running hash does not fold the same outside Match::step" << std::endl;
+			return 1;
+		}
+	}
+	if (tick == replay.ticks.size()) {
+		std::cout << "  every tick matches" << std::endl;
+		return 0;
+	}
+
+	// Ticks count from 1, the state after the first step is tick 1
+	std::cout << "  DESYNC at tick " << tick + 1 << ", the last tick that matches is " << tick << std::endl;
+	size_t shot = 0;
+	while (shot < replay.snapshots.size() && replay.snapshots[shot].tick < tick + 1)
+		shot++;
+	if (shot == replay.snapshots.size()) {
+		std::cout << "  no snapshot after it to compare against" << std::endl;
+		return 1;
+	}
+	for (size_t i = tick + 1; i < replay.snapshots[shot].tick; i++)
+		match.step(replay.ticks[i].inputs);
+	MatchState recorded;
+	memset(&recorded, 0, sizeof(recorded));
+	readSaveState(replay.snapshots[shot].data, replay.snapshots[shot].size, recorded, stageName);
+	std::cout << "  state at snapshot tick " << replay.snapshots[shot].tick << ", " << replay.snapshots[shot].tick - (tick + 1)
+		<< " ticks later:" << std::endl;
+	printStateDifferences(recorded, match);
+	return 1;
+}
+
+#define CHECK_SPEED 100000.0f	//world units a second, thousands of tiles a tick
+#define CHECK_REST_TICKS 10000
+#define CHECK_TOLERANCE 0.001f	//how far past a face still counts as at it, a few COLLISION_SKINs
+#define CHECK_BENCH_FILE "check-bench.json"	//written and removed again by --check-bench
+
+// A stage of the given tiles, each tileSize square, built in memory
+static bool buildCheckStage(Stage& stage, const float (*tiles)[2], int count) {
+	StageHeader layout;
+	memset(&layout, 0, sizeof(layout));
+	layout.magic = STAGE_MAGIC;
+	layout.version = STAGE_VERSION;
+	layout.blastLine = -100.0f;
+	layout.tileSize = 0.2f;
+	layout.cellSize = STAGE_CELL_SIZE;
+	std::vector<StageRect> rects(count);
+	for (int i = 0; i < count; i++) {
+		rects[i].position[0] = tiles[i][0];
+		rects[i].position[1] = tiles[i][1];
+		rects[i].halfSize[0] = layout.tileSize / 2;
+		rects[i].halfSize[1] = layout.tileSize / 2;
+	}
+	return stage.build(layout, rects);
+}
+
+static bool insideStage(const Stage& stage, const float position[2], const float halfSize[2]) {
+	for (unsigned int i = 0; i < stage.header->rectCount; i++) {
+		const StageRect& rect = stage.rects[i];
+		if (fabs(position[0] - rect.position[0]) < halfSize[0] + rect.halfSize[0] - CHECK_TOLERANCE &&
+			fabs(position[1] - rect.position[1]) < halfSize[1] + rect.halfSize[1] - CHECK_TOLERANCE)
+			return true;
+	}
+	return false;
+}
+
+static bool reportCheck(const char* name, bool passed, const float position[2]) {
+	std::cout << "  " << (passed ? "ok     " : "FAILED ") << name << ", ends at " << position[0] << ", " << position[1] << std::endl;
+	return passed;
+}
+
+int checkCollision() {
+	// A floor one tile thick from x -2 to 2 at y 0, and a wall one tile thick at x 5
+	float tiles[64][2];
+	int count = 0;
+	for (int i = 0; i < 21; i++) {
+		tiles[count][0] = -2.0f + i * 0.2f;
+		tiles[count++][1] = 0.0f;
+	}
+	for (int i = 0; i < 20; i++) {
+		tiles[count][0] = 5.0f;
+		tiles[count++][1] = 0.2f + i * 0.2f;
+	}
+	Stage stage;
+	if (!buildCheckStage(stage, tiles, count))
+		return 1;
+	const float floorTop = 0.1f, wallFace = 4.9f;
+	float halfSize[2] = { 0.5f, 0.5f };
+	int failed = 0;
+	std::cout << "collision against a floor and a wall one tile thick:" << std::endl;
+
+	// Falling at CHECK_SPEED, tick after tick, must land on the thin floor and stay there
+	{
+		float position[2] = { 0.0f, 50.0f };
+		bool landed = false, under = false;
+		for (int tick = 0; tick < 10; tick++) {
+			float delta[2] = { 0.0f, -CHECK_SPEED * MATCH_TICK };
+			int axis;
+			if (sweepStage(stage, position, halfSize, delta, axis) >= 0 && axis == 1)
+				landed = true;
+			if (position[1] - halfSize[1] < floorTop - CHECK_TOLERANCE)
+				under = true;
+		}
+		failed += !reportCheck("fast fall onto a thin tile", landed && !under && position[1] - halfSize[1] < floorTop + CHECK_TOLERANCE, position);
+	}
+
+	// The same straight down in a single move from far above. Floats this far out are
+	// only good to about a thousandth, so it may end that close inside the face
+	{
+		float position[2] = { 0.3f, 10000.0f };
+		float delta[2] = { 0.0f, -20000.0f };
+		int axis;
+		int hit = sweepStage(stage, position, halfSize, delta, axis);
+		float bottom = position[1] - halfSize[1];
+		failed += !reportCheck("one 20000 unit fall", hit >= 0 && axis == 1 && fabs(bottom - floorTop) < CHECK_TOLERANCE, position);
+	}
+
+	// Sideways at CHECK_SPEED must stop at the wall's face, not inside or past it
+	{
+		float position[2] = { 0.0f, 1.0f };
+		bool stopped = false, through = false;
+		for (int tick = 0; tick < 10; tick++) {
+			float delta[2] = { CHECK_SPEED * MATCH_TICK, 0.0f };
+			int axis;
+			if (sweepStage(stage, position, halfSize, delta, axis) >= 0 && axis == 0)
+				stopped = true;
+			if (position[0] + halfSize[0] > wallFace + CHECK_TOLERANCE)
+				through = true;
+		}
+		float right = position[0] + halfSize[0];
+		failed += !reportCheck("fast move into a wall", stopped && !through && right <= wallFace && right > wallFace - CHECK_TOLERANCE, position);
+	}
+
+	// Diagonally down onto the floor's far end, both axes fast at once
+	{
+		float position[2] = { 0.0f, 3.0f };
+		float delta[2] = { 3000.0f, -3000.0f };
+		int axis;
+		int hit = sweepStage(stage, position, halfSize, delta, axis);
+		failed += !reportCheck("fast diagonal move onto the floor", hit >= 0 && !insideStage(stage, position, halfSize), position);
+	}
+
+	// Standing on the floor under gravity, as Match sweeps a fighter, must not creep or sink
+	{
+		float position[2] = { 0.0f, floorTop + halfSize[1] + COLLISION_SKIN };
+		float start = position[1], speed = 0.0f, lowest = position[1], highest = position[1];
+		bool contact = true;
+		for (int tick = 0; tick < CHECK_REST_TICKS; tick++) {
+			speed += -9.8f * MATCH_TICK;
+			float delta[2] = { 0.0f, speed * MATCH_TICK };
+			int axis;
+			if (sweepStage(stage, position, halfSize, delta, axis) >= 0)
+				speed = 0.0f;
+			else
+				contact = false;
+			lowest = std::min(lowest, position[1]);
+			highest = std::max(highest, position[1]);
+		}
+		bool stable = contact && lowest - halfSize[1] >= floorTop && highest - start < CHECK_TOLERANCE && start - lowest < CHECK_TOLERANCE;
+		failed += !reportCheck("resting contact over 10000 ticks", stable, position);
+	}
+
+	std::cout << failed << " checks failed" << std::endl;
+	return failed == 0 ? 0 : 1;
+}
+
+struct BenchMatch {
+	Match match;
+	unsigned int random;
+	unsigned char inputs[2];
+	unsigned int hash;
+};
+
+struct BenchWorld {
+	std::vector<BenchMatch> matches;
+	Stage stages[3];
+	AnimationSet animations[2];
+	unsigned int tick;
+
+	void reset() {
+		for (size_t i = 0; i < matches.size(); i++) {
+			BenchMatch& bench = matches[i];
+			bench.match.start(&stages[i % 3], &animations[0], &animations[1]);
+			bench.random = (unsigned int)i + 1;
+			bench.inputs[0] = bench.inputs[1] = 0;
+			bench.hash = 0;
+		}
+		tick = 0;
+	}
+};
+
+struct StepPhase {
+	BenchWorld* world;
+
+	void operator()(int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			BenchMatch& bench = world->matches[i];
+			scriptInputs(world->tick, bench.random, bench.inputs);
+			if (bench.match.over)
+				bench.match.start(&world->stages[i % 3], &world->animations[0], &world->animations[1]);
+			bench.match.step(bench.inputs);
+		}
+	}
+};
+
+struct HashPhase {
+	BenchWorld* world;
+
+	void operator()(int begin, int end) {
+		for (int i = begin; i < end; i++)
+			world->matches[i].hash = hashMatchState(world->matches[i].match);
+	}
+};
+
+// Runs the whole benchmark once, returns the folded hash
+static unsigned int runBench(BenchWorld& world, JobSystem* jobs, unsigned int ticks) {
+	world.reset();
+	StepPhase step = { &world };
+	HashPhase hash = { &world };
+	int count = (int)world.matches.size();
+	unsigned int folded = 0;
+	for (unsigned int t = 0; t < ticks; t++) {
+		if (jobs) {
+			jobs->parallelFor(count, BENCH_STEP_GRAIN, step);
+			jobs->parallelFor(count, BENCH_HASH_GRAIN, hash);
+		}
+		else {
+			step(0, count);
+			hash(0, count);
+		}
+		for (int i = 0; i < count; i++)
+			folded = folded * 31 + world.matches[i].hash;
+		world.tick++;
+	}
+	return folded;
+}
+
+int benchJobSystem(const std::string& resources, int matches, int maxThreads, unsigned int ticks) {
+	BenchWorld world;
+	if (!loadAnimations(resources, world.animations[0], world.animations[1]))
+		return 1;
+	for (int i = 0; i < 3; i++) {
+		if (!world.stages[i].open(resources + benchStages[i]))
+			return 1;
+	}
+	world.matches.resize(matches > 0 ? matches : BENCH_JOB_MATCHES);
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	std::cout << "job system: " << world.matches.size() << " matches, " << ticks << " ticks each, up to " << maxThreads << " threads" << std::endl;
+	double started = clockSeconds();
+	unsigned int expected = runBench(world, nullptr, ticks);
+	double serial = clockSeconds() - started;
+	double matchTicks = (double)ticks * world.matches.size();
+	std::cout << "  plain loop: " << serial * 1000.0 << "ms, " << matchTicks / serial / 1000000.0 << "M match ticks/s" << std::endl;
+
+	int result = 0;
+	for (int threads = 1;; threads *= 2) {
+		if (threads > maxThreads)
+			threads = maxThreads;
+		JobSystem jobs;
+		jobs.start(threads);
+		started = clockSeconds();
+		unsigned int folded = runBench(world, &jobs, ticks);
+		double spent = clockSeconds() - started;
+		std::cout << "  " << threads << " threads: " << spent * 1000.0 << "ms, " << matchTicks / spent / 1000000.0 << "M match ticks/s, "
+			<< serial / spent << "x the plain loop, " << jobs.steals << " ranges stolen";
+		if (folded != expected) {
+			std::cout << ", RESULT DIFFERS";
+			result = 1;
+		}
+		std::cout << std::endl;
+		if (threads == maxThreads)
+			break;
+	}
+	return result;
+}
+
+int makeStage(const std::string& path, int width) {
+	std::ofstream outfile(path);
+	if (outfile.fail()) {
+		std::cout << "Could not write " << path << std::endl;
+		return 1;
+	}
+	const float tile = 0.2f;
+	int columns = (int)(width / tile);
+	unsigned long tiles = 0;
+	outfile << "# Generated by NYUServer --make-stage, " << width << " units long\n";
+	outfile << "background FinalDestination.png\nblast -19.0\nspawn 2.0 -1.0\nspawn 0.0 -1.0\ntile 0.2\n\n";
+	// A floor eight tiles deep the whole way
+	outfile << "# floor\n";
+	for (int row = 0; row < 8; row++) {
+		outfile << "run -3.0 " << -1.8f - row * tile << " 0.2 0 " << columns << "\n";
+		tiles += columns;
+	}
+	// Platforms to jump onto and low walls to jump over, one after another so a
+	// fighter can't get boxed in between two
+	outfile << "\n# platforms and walls\n";
+	unsigned int random = 7;
+	float x = 4.0f;
+	while (x < width - 12.0f) {
+		random = random * 1103515245 + 12345;
+		int kind = (random >> 16) % 4;
+		random = random * 1103515245 + 12345;
+		int length = 5 + (random >> 16) % 30;
+		if (kind == 0) {
+			outfile << "run " << x << " -1.6 0 0.2 2\n";
+			tiles += 2;
+			x += 3.0f;
+		}
+		else {
+			outfile << "run " << x << " " << 0.2f + kind * 1.0f << " 0.2 0 " << length << "\n";
+			tiles += length;
+			x += length * tile + 2.0f;
+		}
+	}
+	std::cout << path << ": " << tiles << " tiles over " << width << " units" << std::endl;
+	return outfile.good() ? 0 : 1;
+}
+
+// Runs right and jumps at walls and every so often
+static void traverseInputs(const Match& match, unsigned char inputs[2]) {
+	for (int k = 0; k < 2; k++) {
+		inputs[k] = INPUT_RIGHT;
+		if (match.fighters[k].collided[2] || match.tick % STREAM_JUMP_EVERY < 30)
+			inputs[k] |= INPUT_JUMP;
+	}
+}
+
+// Plays the traversal, speed times faster than real time (0 for as fast as it goes),
+// and returns the hash of where it ended up
+static unsigned int runTraversal(StageStream& stream, const AnimationSet* animations, unsigned int ticks, double speed, bool verbose) {
+	Match match;
+	match.startStreamed(&stream, &animations[0], &animations[1]);
+	unsigned char inputs[2];
+	float positions[2][2];
+	double started = clockSeconds();
+	for (unsigned int i = 0; i < ticks && !match.over; i++) {
+		if (speed > 0) {
+			double due = started + i * MATCH_TICK / speed;
+			double wait = due - clockSeconds();
+			if (wait > 0)
+				std::this_thread::sleep_for(std::chrono::microseconds((long long)(wait * 1000000.0)));
+		}
+		for (int k = 0; k < 2; k++) {
+			positions[k][0] = match.fighters[k].position[0];
+			positions[k][1] = match.fighters[k].position[1];
+		}
+		stream.update(positions, 2);
+		traverseInputs(match, inputs);
+		match.step(inputs);
+
+		if (verbose && (i + 1) % STREAM_REPORT_TICKS == 0) {
+			std::cout << "  tick " << i + 1 << ": p1 at x " << match.fighters[0].position[0] << ", " << stream.residentChunks() << " chunks resident, "
+				<< stream.residentBytes() / 1024 << " KB, " << stream.stats.loads << " loads, " << stream.stats.evictions << " evictions, "
+				<< stream.stats.stalls << " stalls" << std::endl;
+		}
+	}
+	if (verbose)
+		std::cout << "  ended on tick " << match.tick << (match.over ? ", off the end of the map" : "") << ", p1 at x " << match.fighters[0].position[0] << std::endl;
+	return hashMatchState(match);
+}
+
+int benchStream(const std::string& resources, const std::string& stageName, size_t budget, double speed, unsigned int ticks) {
+	AnimationSet animations[2];
+	if (!loadAnimations(resources, animations[0], animations[1]))
+		return 1;
+	StageStream stream;
+	stream.budget = budget;
+	double started = clockSeconds();
+	if (!stream.open(resources + stageName))
+		return 1;
+	std::cout << "streaming " << stageName << ": " << stream.tileCount << " tiles in " << stream.header.columns << "x" << stream.header.rows << " chunks of "
+		<< stream.header.cellSize << " units, opened in " << (clockSeconds() - started) * 1000.0 << "ms, budget " << budget / 1024 << " KB, "
+		<< speed << "x real time" << std::endl;
+
+	unsigned int streamed = runTraversal(stream, animations, ticks, speed, true);
+	const StageStreamStats& stats = stream.stats;
+	std::cout << "  chunk loads: " << stats.loads << ", " << (stats.loads ? stats.latencyTotal / stats.loads * 1000.0 : 0) << "ms avg, "
+		<< stats.latencyMax * 1000.0 << "ms max from asking to in use" << std::endl;
+	std::cout << "  stalls: " << stats.stalls << " ticks waited " << stats.stallTime * 1000.0 << "ms in all" << std::endl;
+	std::cout << "  resident: peak " << stats.peakBytes / 1024 << " KB of " << budget / 1024 << " KB, " << stats.evictions << " evictions" << std::endl;
+
+	Stage whole;
+	started = clockSeconds();
+	if (whole.compile(resources + stageName + ".stage"))
+		std::cout << "  the whole map as one Stage: " << whole.size() / 1024 << " KB, " << (clockSeconds() - started) * 1000.0 << "ms to build" << std::endl;
+
+	// Collision must not depend on what happened to be loaded, so the same run with
+	// no budget and no pacing has to end in the same state
+	StageStream everything;
+	everything.budget = (size_t)-1;
+	if (!everything.open(resources + stageName))
+		return 1;
+	unsigned int unlimited = runTraversal(everything, animations, ticks, 0, false);
+	std::cout << "  same end state with no budget: " << (unlimited == streamed ? "yes" : "NO") << std::endl;
+	return unlimited == streamed ? 0 : 1;
+}
+
+struct TelemetryMatch {
+	std::string stage;
+	unsigned int ticks;
+	int winner;		//-1 when nobody won, or the match was not finished
+	bool finished;
+	unsigned int attacks[2];
+	unsigned int hits[2];
+	unsigned int damage[2];	//dealt
+	unsigned int jumps[2];
+	int knockedOut;		//fighter, -1 for none
+	bool blastLine;
+};
+
+int summarizeTelemetry(const std::vector<std::string>& paths) {
+	std::vector<TelemetryMatch> matches;
+	unsigned int records = 0;
+	for (size_t i = 0; i < paths.size(); i++) {
+		std::vector<TelemetryEvent> events;
+		std::vector<std::string> stageNames;
+		if (!loadTelemetry(paths[i], events, stageNames))
+			return 1;
+		records += (unsigned int)events.size();
+		TelemetryMatch* match = nullptr;
+		for (size_t j = 0; j < events.size(); j++) {
+			const TelemetryEvent& event = events[j];
+			if (event.type == TELEMETRY_START) {
+				TelemetryMatch begun;
+				begun.stage = stageNames[event.value];
+				begun.ticks = 0;
+				begun.winner = -1;
+				begun.finished = false;
+				for (int k = 0; k < 2; k++) {
+					begun.attacks[k] = 0;
+					begun.hits[k] = 0;
+					begun.damage[k] = 0;
+					begun.jumps[k] = 0;
+				}
+				begun.knockedOut = -1;
+				begun.blastLine = false;
+				matches.push_back(begun);
+				match = &matches.back();
+				continue;
+			}
+			// Events before the first START belong to a match that began in an earlier file
+			if (!match)
+				continue;
+			match->ticks = event.tick;
+			int k = event.fighter;
+			switch (event.type) {
+			case TELEMETRY_ATTACK:
+				match->attacks[k]++;
+				break;
+			case TELEMETRY_HIT:
+				match->hits[k]++;
+				match->damage[k] += event.value;
+				break;
+			case TELEMETRY_JUMP:
+				match->jumps[k]++;
+				break;
+			case TELEMETRY_KNOCKOUT:
+				if (match->knockedOut < 0) {
+					match->knockedOut = k;
+					match->blastLine = event.value != 0;
+				}
+				break;
+			case TELEMETRY_END:
+				match->finished = true;
+				match->winner = (int)event.value - 1;
+				match = nullptr;
+				break;
+			}
+		}
+	}
+
+	std::cout << records << " records, " << matches.size() << " matches in " << paths.size() << " files" << std::endl;
+	unsigned int finished = 0, wins[2] = { 0, 0 }, blastLines = 0, totalTicks = 0;
+	unsigned int attacks[2] = { 0, 0 }, hits[2] = { 0, 0 }, damage[2] = { 0, 0 }, jumps[2] = { 0, 0 };
+	for (size_t i = 0; i < matches.size(); i++) {
+		const TelemetryMatch& match = matches[i];
+		std::cout << "  " << i + 1 << ": " << match.stage << ", " << match.ticks << " ticks (" << (double)match.ticks / MATCH_TICK_RATE << "s), ";
+		if (!match.finished)
+			std::cout << "not finished";
+		else if (match.winner < 0)
+			std::cout << "no winner";
+		else
+			std::cout << "p" << match.winner + 1 << " won" << (match.blastLine ? " off the blast line" : " on health");
+		std::cout << std::endl;
+		for (int k = 0; k < 2; k++) {
+			std::cout << "     p" << k + 1 << ": " << match.attacks[k] << " attacks, " << match.hits[k] << " hits, " << match.damage[k]
+				<< " damage dealt, " << match.jumps[k] << " jumps" << std::endl;
+			attacks[k] += match.attacks[k];
+			hits[k] += match.hits[k];
+			damage[k] += match.damage[k];
+			jumps[k] += match.jumps[k];
+		}
+		if (match.finished) {
+			finished++;
+			totalTicks += match.ticks;
+			if (match.winner >= 0)
+				wins[match.winner]++;
+			if (match.blastLine)
+				blastLines++;
+		}
+	}
+	if (finished > 0) {
+		std::cout << "finished matches: " << finished << ", " << (double)totalTicks / finished / MATCH_TICK_RATE << "s on average, "
+			<< blastLines << " decided off the blast line" << std::endl;
+		for (int k = 0; k < 2; k++) {
+			std::cout << "  p" << k + 1 << ": " << wins[k] * 100.0 / finished << "% won, " << (attacks[k] ? hits[k] * 100.0 / attacks[k] : 0)
+				<< "% of attacks hit, " << (double)damage[k] / matches.size() << " damage and " << (double)jumps[k] / matches.size() << " jumps a match" << std::endl;
+		}
+	}
+	return 0;
+}
+
+int benchTelemetry(const std::string& resources, const std::string& stageName, unsigned int ticks) {
+	AnimationSet chukAnimation, ivenAnimation;
+	Stage stage;
+	if (!loadAnimations(resources, chukAnimation, ivenAnimation) || !stage.open(resources + stageName))
+		return 1;
+
+	// Every tick's state first, so the timed loop is nothing but observe()
+	std::vector<Match> states;
+	states.reserve(ticks + 1);
+	Match match;
+	match.start(&stage, &chukAnimation, &ivenAnimation);
+	states.push_back(match);
+	unsigned char inputs[2] = { 0, 0 };
+	unsigned int random = 1;
+	for (unsigned int i = 0; i < ticks && !match.over; i++) {
+		scriptInputs(i, random, inputs);
+		match.step(inputs);
+		states.push_back(match);
+	}
+
+	TelemetryLog log;
+	log.flushInterval = 0.001;
+	log.rotateBytes = 64 * 1024;
+	if (!log.open("bench-telemetry"))
+		return 1;
+
+	// observe() over whole matches gives the cost a tick, most ticks log nothing
+	double observeTime = 0;
+	unsigned int rounds = 0;
+	for (; rounds < BENCH_TELEMETRY_ROUNDS; rounds++) {
+		log.begin(stageName.c_str());
+		double started = clockSeconds();
+		for (size_t i = 1; i < states.size(); i++)
+			log.observe(states[i - 1], states[i]);
+		observeTime += clockSeconds() - started;
+		while (log.written.load() < log.queued)
+			std::this_thread::yield();
+	}
+	unsigned int matchEvents = log.queued;
+
+	// push() on its own is the cost an event, timed in bursts of half the queue with
+	// the writer draining each one before the next
+	float position[2] = { 1.0f, 2.0f };
+	double pushTime = 0;
+	unsigned int pushed = 0;
+	while (pushed < BENCH_TELEMETRY_EVENTS) {
+		double started = clockSeconds();
+		for (unsigned int i = 0; i < TELEMETRY_QUEUE_SIZE / 2; i++)
+			log.push(TELEMETRY_JUMP, i & 1, 0, i, position);
+		pushTime += clockSeconds() - started;
+		pushed += TELEMETRY_QUEUE_SIZE / 2;
+		while (log.written.load() < log.queued)
+			std::this_thread::yield();
+	}
+	log.close();
+
+	double ticksObserved = (double)(states.size() - 1) * rounds;
+	std::cout << "telemetry on " << stageName << ": " << rounds << " runs of a " << states.size() - 1 << " tick match, "
+		<< (double)(matchEvents - rounds) / ticksObserved << " events a tick" << std::endl;
+	std::cout << "  observe " << observeTime / ticksObserved * 1000000000.0 << "ns a tick, push " << pushTime / pushed * 1000000000.0
+		<< "ns an event (target under 50ns), " << log.dropped << " dropped" << std::endl;
+
+	// Everything queued has to read back, across however many files it rotated through
+	unsigned int readBack = 0;
+	for (size_t i = 0; i < log.files.size(); i++) {
+		std::vector<TelemetryEvent> fileEvents;
+		std::vector<std::string> stageNames;
+		if (std::ifstream(log.files[i].c_str()) && loadTelemetry(log.files[i], fileEvents, stageNames))
+			readBack += (unsigned int)fileEvents.size();
+		remove(log.files[i].c_str());
+	}
+	std::cout << "  " << log.written.load() << " records written to " << log.files.size() << " files, the last "
+		<< (log.files.size() < (size_t)log.keepFiles ? log.files.size() : log.keepFiles) << " kept, " << readBack << " read back" << std::endl;
+	return log.dropped == 0 && log.written.load() == log.queued ? 0 : 1;
+}
+
+// A despawned handle must stay dead after its slot is reused, and clear() must kill every handle
+static bool checkHandles(ProjectilePool& pool) {
+	float from[2] = { 0.0f, 0.0f }, still[2] = { 0.0f, 0.0f };
+	ProjectileHandle first = pool.spawn(PROJECTILE_SHOT, from, still);
+	ProjectileHandle other = pool.spawn(PROJECTILE_CHERRY, from, still);
+	pool.despawn(first);
+	ProjectileHandle reused = pool.spawn(PROJECTILE_SHOT, from, still);
+	bool ok = !pool.alive(first) && pool.alive(other) && pool.alive(reused) && reused.slot == first.slot && reused.generation != first.generation;
+	pool.clear();
+	ok = ok && !pool.alive(other) && !pool.alive(reused) && pool.count == 0;
+
+	// Full means refused, not overwritten
+	for (int i = 0; i < PROJECTILE_CAPACITY; i++)
+		pool.spawn(PROJECTILE_SHOT, from, still);
+	ok = ok && pool.spawn(PROJECTILE_SHOT, from, still).generation == 0 && pool.full == 1;
+	pool.clear();
+	return ok;
+}
+
+int benchProjectiles(const std::string& resources, const std::string& stageName, unsigned int count, unsigned int ticks, int threads) {
+	AnimationSet chukAnimation, ivenAnimation;
+	Stage stage;
+	if (!loadAnimations(resources, chukAnimation, ivenAnimation) || !stage.open(resources + stageName))
+		return 1;
+	// Static, a pool is too big for the stack
+	static ProjectilePool pool, threadedPool;
+	if (!checkHandles(pool)) {
+		std::cout << "projectile handles outlived their projectiles" << std::endl;
+		return 1;
+	}
+	JobSystem jobs;
+	jobs.start(threads);
+
+	// The same match twice, its pool stepped plainly in one and through the jobs in the other
+	Match match, threadedMatch;
+	match.start(&stage, &chukAnimation, &ivenAnimation);
+	threadedMatch.start(&stage, &chukAnimation, &ivenAnimation);
+	unsigned char inputs[2] = { 0, 0 };
+	unsigned int random = 1, sprayed = 1, threadedSprayed = 1;
+	double stepTime = 0, slowest = 0, threadedTime = 0;
+	unsigned long live = 0;
+	unsigned int timed = 0, matches = 0, differs = 0;
+	for (unsigned int i = 0; i < ticks + BENCH_PROJECTILE_WARMUP; i++) {
+		scriptInputs(i, random, inputs);
+		if (match.over) {
+			match.start(&stage, &chukAnimation, &ivenAnimation);
+			threadedMatch.start(&stage, &chukAnimation, &ivenAnimation);
+			matches++;
+		}
+		match.step(inputs);
+		threadedMatch.step(inputs);
+		pool.spray(match, count, sprayed);
+		threadedPool.spray(threadedMatch, count, threadedSprayed);
+		double started = clockSeconds();
+		pool.step(match);
+		double took = clockSeconds() - started;
+		started = clockSeconds();
+		threadedPool.step(threadedMatch, &jobs);
+		double threadedTook = clockSeconds() - started;
+		if (pool.hash() != threadedPool.hash() || hashMatchState(match) != hashMatchState(threadedMatch))
+			differs++;
+		if (i < BENCH_PROJECTILE_WARMUP)
+			continue;
+		stepTime += took;
+		threadedTime += threadedTook;
+		if (took > slowest)
+			slowest = took;
+		live += pool.count;
+		timed++;
+	}
+
+	double perTick = stepTime / timed;
+	std::cout << "projectiles on " << stageName << ": " << timed << " ticks (" << matches << " matches finished), " << (double)live / timed
+		<< " live on average of " << count << " wanted" << std::endl;
+	std::cout << "  step " << perTick * 1000000.0 << "us a tick (slowest " << slowest * 1000000.0 << "us), " << stepTime / live * 1000000000.0
+		<< "ns a projectile, " << perTick / MATCH_TICK * 100.0 << "% of a tick" << std::endl;
+	std::cout << "  on " << jobs.threadCount() << " threads " << threadedTime / timed * 1000000.0 << "us a tick, " << stepTime / threadedTime
+		<< "x the plain step";
+	if (differs > 0)
+		std::cout << ", RESULT DIFFERS on " << differs << " ticks";
+	std::cout << std::endl;
+	std::cout << "  " << pool.spawned << " spawned, " << pool.pickups << " cherries picked up, " << pool.full << " refused, pool "
+		<< sizeof(ProjectilePool) / 1024 << "KB" << std::endl;
+	return differs > 0 ? 1 : 0;
+}
+
+// One replay being benchmarked, with everything its runs need loaded up front
+struct ReplayBench {
+	Replay replay;
+	Match start;
+	Stage stage;
+	unsigned int last;	//hash every run has to end on
+	std::vector<double> runTimes;
+	ReplayBenchResult result;
+};
+
+// Loads the replay and checks every hash once, untimed; the timed runs only check where they end up
+static bool loadReplayBench(ReplayBench& bench, const std::string& path, const std::string& resources, AnimationSet animations[2], unsigned int runs) {
+	ReplayBenchResult& result = bench.result;
+	size_t slash = path.find_last_of("/\\");
+	result.replay = slash == std::string::npos ? path : path.substr(slash + 1);
+	result.mode = "headless";
+	result.allocations = ALLOCATION_TRACKING ? 0 : -1;
+
+	char stageName[STAGE_NAME_LENGTH];
+	if (!bench.replay.load(path) || !readSaveState(bench.replay.snapshots[0].data, bench.replay.snapshots[0].size, bench.start, stageName) ||
+		!bench.stage.open(resources + bench.replay.stageName))
+		return false;
+	bench.start.stage = &bench.stage;
+	bench.start.animations[0] = &animations[0];
+	bench.start.animations[1] = &animations[1];
+	result.stage = bench.replay.stageName;
+	result.ticks = (unsigned int)bench.replay.ticks.size();
+	result.runs = runs;
+	result.matched = true;
+
+	Match match = bench.start;
+	for (size_t tick = 0; tick < bench.replay.ticks.size(); tick++) {
+		match.step(bench.replay.ticks[tick].inputs);
+		if (match.hash != bench.replay.ticks[tick].hash)
+			result.matched = false;
+	}
+	bench.last = match.hash;
+	// Room for every run first, so the runs themselves allocate nothing of ours
+	bench.runTimes.assign(runs, 0.0);
+	return true;
+}
+
+static void runReplayBench(ReplayBench& bench, unsigned int run) {
+	Match match = bench.start;
+	unsigned long allocationsBefore = allocationCount();
+	double started = clockSeconds();
+	for (size_t tick = 0; tick < bench.replay.ticks.size(); tick++)
+		match.step(bench.replay.ticks[tick].inputs);
+	bench.runTimes[run] = clockSeconds() - started;
+	if (ALLOCATION_TRACKING)
+		bench.result.allocations += (long)(allocationCount() - allocationsBefore);
+	if (match.hash != bench.last)
+		bench.result.matched = false;
+}
+
+int benchReplays(const std::vector<std::string>& paths, const std::string& resources, unsigned int runs, const std::string& jsonPath,
+	const std::string& baselinePath, double threshold) {
+	if (runs < 1)
+		runs = 1;
+	AnimationSet animations[2];
+	if (!loadAnimations(resources, animations[0], animations[1]))
+		return 1;
+
+	// Sized once, the matches point at their stages
+	std::vector<ReplayBench> benches(paths.size());
+	std::vector<ReplayBench*> loaded;
+	bool failed = false;
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (loadReplayBench(benches[i], paths[i], resources, animations, runs))
+			loaded.push_back(&benches[i]);
+		else
+			failed = true;
+	}
+	// A run of each in turn, so whatever else the machine does is spread over all of them
+	// rather than landing on a few runs of one
+	for (unsigned int run = 0; run < runs; run++) {
+		for (size_t i = 0; i < loaded.size(); i++)
+			runReplayBench(*loaded[i], run);
+	}
+
+	std::vector<ReplayBenchResult> results;
+	for (size_t i = 0; i < loaded.size(); i++) {
+		ReplayBenchResult& result = loaded[i]->result;
+		result.tick = spreadOfRuns(loaded[i]->runTimes, result.ticks);
+		result.ticksPerSecond = result.tick.p50 > 0 ? 1.0 / result.tick.p50 : 0;
+		printBench(result);
+		failed = failed || !result.matched;
+		results.push_back(result);
+	}
+	if (!reportBench(results, jsonPath, baselinePath, threshold))
+		failed = true;
+	return failed ? 1 : 0;
+}
+
+// A result with just the figures compareBench looks at, times in microseconds
+static ReplayBenchResult checkResult(const char* mode, double tick, double tickP99, double frame, double frameP99, long allocations) {
+	ReplayBenchResult result = ReplayBenchResult();
+	result.replay = "check.replay";
+	result.stage = "Check";
+	result.mode = mode;
+	result.ticks = 600;
+	result.runs = 10;
+	result.matched = true;
+	result.tick.p50 = tick / 1000000.0;
+	result.tick.p99 = result.tick.max = tickP99 / 1000000.0;
+	result.frame.p50 = frame / 1000000.0;
+	result.frame.p99 = result.frame.max = frameP99 / 1000000.0;
+	result.ticksPerSecond = 1000000.0 / tick;
+	result.allocations = allocations;
+	return result;
+}
+
+static bool checkComparison(const char* name, const ReplayBenchResult& before, const ReplayBenchResult& after, double threshold, int expected) {
+	std::vector<ReplayBenchResult> baseline(1, before), current(1, after);
+	int regressions = compareBench(baseline, current, threshold);
+	std::cout << "  " << (regressions == expected ? "ok     " : "FAILED ") << name << ", " << regressions << " regressions" << std::endl;
+	return regressions == expected;
+}
+
+int checkBench() {
+	int failed = 0;
+	failed += !checkComparison("headless 41% slower at 5%", checkResult("headless", 0.080, 0.1, 0, 0, -1), checkResult("headless", 0.113, 0.1, 0, 0, -1), 5.0, 1);
+	failed += !checkComparison("headless 6% slower at 5%", checkResult("headless", 0.100, 0.1, 0, 0, -1), checkResult("headless", 0.106, 0.1, 0, 0, -1), 5.0, 1);
+	failed += !checkComparison("headless 4% slower at 5%", checkResult("headless", 0.100, 0.1, 0, 0, -1), checkResult("headless", 0.104, 0.1, 0, 0, -1), 5.0, 0);
+	failed += !checkComparison("headless faster", checkResult("headless", 0.100, 0.1, 0, 0, -1), checkResult("headless", 0.050, 0.1, 0, 0, -1), 5.0, 0);
+	failed += !checkComparison("slow runs only", checkResult("headless", 0.100, 0.12, 0, 0, -1), checkResult("headless", 0.100, 0.5, 0, 0, -1), 5.0, 0);
+	failed += !checkComparison("render frame median 20% slower at 10%", checkResult("render", 0.1, 0.1, 1000, 2000, -1), checkResult("render", 0.1, 0.1, 1200, 2000, -1), 10.0, 1);
+	failed += !checkComparison("render frame spikes only", checkResult("render", 0.1, 0.1, 1000, 2000, -1), checkResult("render", 0.1, 0.1, 1000, 9000, -1), 10.0, 0);
+	failed += !checkComparison("allocations in a steady run", checkResult("headless", 0.1, 0.1, 0, 0, 0), checkResult("headless", 0.1, 0.1, 0, 0, 3), 10.0, 1);
+	failed += !checkComparison("allocations not counted", checkResult("headless", 0.1, 0.1, 0, 0, 0), checkResult("headless", 0.1, 0.1, 0, 0, -1), 10.0, 0);
+	ReplayBenchResult desynced = checkResult("headless", 0.1, 0.1, 0, 0, -1);
+	desynced.matched = false;
+	failed += !checkComparison("desynced", checkResult("headless", 0.1, 0.1, 0, 0, -1), desynced, 10.0, 1);
+
+	// What is written has to read back, with allocations left out when not counted
+	std::vector<ReplayBenchResult> written, read;
+	written.push_back(checkResult("headless", 0.113, 0.2, 0, 0, -1));
+	written.push_back(checkResult("render", 0.1, 0.2, 1500, 4000, 7));
+	bool same = writeBenchJson(CHECK_BENCH_FILE, written) && readBenchJson(CHECK_BENCH_FILE, read) && read.size() == written.size();
+	for (size_t i = 0; same && i < read.size(); i++) {
+		same = read[i].mode == written[i].mode && read[i].allocations == written[i].allocations &&
+			fabs(read[i].tick.p50 - written[i].tick.p50) < 1e-12 && fabs(read[i].frame.p99 - written[i].frame.p99) < 1e-9;
+	}
+	std::remove(CHECK_BENCH_FILE);
+	std::cout << "  " << (same ? "ok     " : "FAILED ") << "results read back as written" << std::endl;
+	failed += !same;
+
+	std::cout << failed << " checks failed" << std::endl;
+	return failed == 0 ? 0 : 1;
+}
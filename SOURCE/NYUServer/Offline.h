@@ -0,0 +1,75 @@
+#ifndef Offline_h
+#define Offline_h
+
+#include <string>
+#include <vector>
+
+// Server modes that run a match on their own, with no sockets, and exit
+
+// --load-state: picks a save state (a training save or a crash dump) back up on the
+// stage it names and runs it on with no input, printing where the fighters end up.
+// Same file, same numbers, on any machine.
+int runSaveState(const std::string& path, const std::string& resources, unsigned int ticks);
+
+// --bench-savestate: plays a match with scripted inputs and saves, loads and checks a
+// save state every tick, then prints what that costs next to a plain rollback copy
+int benchSaveState(const std::string& resources, const std::string& stageName, unsigned int ticks);
+
+// --check-replay: runs a replay's inputs from its first snapshot and compares the running
+// hash every tick, and prints what a step and the hash in it cost. On the first tick that
+// differs it plays on to the next snapshot and prints the recorded and replayed states
+// field by field.
+int checkReplay(const std::string& path, const std::string& resources);
+
+// --check-collision: sweeps boxes through a floor and a wall one tile thick at speeds far
+// past anything in a match, straight, sideways and diagonally, and rests one on the floor
+// for a few minutes of ticks. Exits non-zero if any of them ends up inside or past a tile.
+int checkCollision();
+
+// --bench-jobs: steps matches (256 by default) with scripted inputs through a JobSystem
+// on 1, 2, 4 ... maxThreads threads. Each tick is two phases, step every match then hash
+// every match, and the hashes are folded in match order, so every thread count has to
+// finish on the same value.
+int benchJobSystem(const std::string& resources, int matches, int maxThreads, unsigned int ticks);
+
+// --make-stage: writes a generated .stage width world units long, a deep floor with
+// platforms and low walls on it, for trying out stages too big to load whole
+int makeStage(const std::string& path, int width);
+
+// --bench-stream: a bot runs both fighters right across a stage streamed in chunks
+// (StageStream.h), at speed times real time, printing what is resident as it goes and
+// chunk load latency and stalls at the end. The run is repeated with everything allowed
+// to stay resident and has to end in the same state.
+int benchStream(const std::string& resources, const std::string& stageName, size_t budget, double speed, unsigned int ticks);
+
+// --summarize-telemetry: reads .tlog files (Telemetry.h) and prints every match in them,
+// who won and how, attacks, hits, damage and jumps per fighter, then the totals
+int summarizeTelemetry(const std::vector<std::string>& paths);
+
+// --bench-telemetry: logs a scripted match over and over to time observe() a tick, then
+// times a million push() calls on their own, with the writer thread running. Everything
+// queued has to be written, and whatever rotation kept has to read back.
+int benchTelemetry(const std::string& resources, const std::string& stageName, unsigned int ticks);
+
+// --bench-projectiles: plays a scripted match with the ProjectilePool (Projectiles.h)
+// kept topped up to count, and times its step() on its own: per tick, per projectile
+// and as a share of MATCH_TICK. Handles are checked against reuse first. A second copy
+// of the match steps its pool through a JobSystem on threads threads; exits non-zero if
+// its pool or match ever hashes differently from the plain one.
+int benchProjectiles(const std::string& resources, const std::string& stageName, unsigned int count, unsigned int ticks, int threads);
+
+// --bench-replay: checks every hash of each recorded match once, then plays it runs times
+// from its first snapshot as fast as it goes, timing each run whole, and prints ticks/s,
+// tick time off the median and slowest runs and allocations (Debug builds count them).
+// With a json path the results are written there (Benchmark.h); with a baseline they are
+// compared against it, and a median worse by more than threshold percent fails the run.
+int benchReplays(const std::vector<std::string>& paths, const std::string& resources, unsigned int runs, const std::string& jsonPath,
+	const std::string& baselinePath, double threshold);
+
+// --check-bench: compares made up results the way --bench-replay compares against a
+// baseline, slower and faster than the threshold, with only slow runs or frames, with
+// allocations and with a desync, and writes and reads back their JSON. Exits non-zero
+// if any of them is judged wrong.
+int checkBench();
+
+#endif
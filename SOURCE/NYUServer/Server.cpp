@@ -0,0 +1,407 @@
+// Headless match server: runs matches at MATCH_TICK_RATE with no SDL, GL or audio,
+// takes player inputs over UDP and sends every client the match state each tick.
+//
+//   NYUServer [--port N] [--matches N] [--threads N] [--stage Name] [--resources path]
+//             [--report seconds] [--duration seconds] [--bots] [--spectators N] [--record] [--jobs]
+//   NYUServer --load-state file [--ticks N] [--resources path]
+//   NYUServer --bench-savestate [--ticks N] [--stage Name] [--resources path]
+//   NYUServer --check-replay file [--resources path]
+//   NYUServer --check-collision
+//   NYUServer --check-bench
+//   NYUServer --bench-jobs [--matches N] [--threads N] [--ticks N] [--resources path]
+//   NYUServer --make-stage file.stage width
+//   NYUServer --bench-stream Name [--budget KB] [--speed x] [--ticks N] [--resources path]
+//   NYUServer --summarize-telemetry file.tlog [--summarize-telemetry file.tlog ...]
+//   NYUServer --bench-telemetry [--stage Name] [--ticks N] [--resources path]
+//   NYUServer --bench-projectiles [--count N] [--threads N] [--stage Name] [--ticks N] [--resources path]
+//   NYUServer --bench-replay file.replay [--bench-replay file.replay ...] [--runs N] [--json out.json]
+//             [--baseline base.json] [--threshold percent] [--resources path]
+//
+// Match i listens on port + i. Matches are dealt round-robin to the worker threads, so a
+// thread runs several matches when there are more matches than cores. With --jobs the
+// matches go through a work-stealing JobSystem instead, so a thread that finishes its
+// share early takes over matches from a busy one. --bots adds two
+// loopback bot clients to every match, and with --duration the exit code says whether
+// every bot got states back. --spectators N adds N loopback viewers of the spectator
+// feed to every match, and the report shows what the feed costs per spectator.
+// --record writes every finished match to match<id>-<n>.replay. --load-state,
+// --bench-savestate, --check-replay, --check-collision, --check-bench, --bench-jobs, --make-stage,
+// --bench-stream, --summarize-telemetry, --bench-telemetry, --bench-projectiles and
+// --bench-replay run offline and exit, see Offline.h. The golden replays for
+// --bench-replay, a few per stage, are in NYUCodebase/golden.
+
+#include "Match.h"
+#include "Stage.h"
+#include "Animation.h"
+#include "Net.h"
+#include "Protocol.h"
+#include "Clock.h"
+#include "MatchHost.h"
+#include "Bot.h"
+#include "Offline.h"
+#include "JobSystem.h"
+#include "StageStream.h"
+#include "Projectiles.h"
+#include "Benchmark.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WINDOWS
+#include <mmsystem.h>
+#endif
+
+#define SERVER_DEFAULT_RESOURCES "../NYUCodebase/"
+#define SERVER_REPORT_INTERVAL 5.0
+#define SERVER_OFFLINE_TICKS 3600
+#define SERVER_STREAM_SPEED 10.0	//--bench-stream runs this many times faster than real time
+#define SERVER_REPLAY_RUNS 500	//times --bench-replay plays each replay
+
+const char* stageFiles[] = { "FinalDestination", "Battlefield", "Temple" };
+
+std::atomic<bool> running(true);
+std::vector<MatchHost*> hosts;
+std::vector<Bot*> bots;
+
+void work(std::vector<MatchHost*> mine) {
+	while (running) {
+		double now = clockSeconds();
+		double next = now + HOST_IDLE_POLL;
+		for (size_t i = 0; i < mine.size(); i++) {
+			double due = mine[i]->service(now);
+			if (due < next)
+				next = due;
+		}
+		sleepSeconds(next - clockSeconds());
+	}
+}
+
+// Services every match each round on whichever job thread is free
+struct ServiceMatches {
+	double now;
+	std::vector<double> due;
+
+	void operator()(int begin, int end) {
+		for (int i = begin; i < end; i++)
+			due[i] = hosts[i]->service(now);
+	}
+};
+
+void workWithJobs(int threads) {
+	JobSystem jobs;
+	jobs.start(threads);
+	ServiceMatches body;
+	body.due.resize(hosts.size());
+	while (running) {
+		body.now = clockSeconds();
+		jobs.parallelFor((int)hosts.size(), 1, body);
+		double next = body.now + HOST_IDLE_POLL;
+		for (size_t i = 0; i < body.due.size(); i++) {
+			if (body.due[i] < next)
+				next = body.due[i];
+		}
+		sleepSeconds(next - clockSeconds());
+	}
+}
+
+void runBots() {
+	double next = clockSeconds();
+	while (running) {
+		double now = clockSeconds();
+		for (size_t i = 0; i < bots.size(); i++)
+			bots[i]->update(now);
+		next += MATCH_TICK;
+		if (next < now)
+			next = now;
+		sleepSeconds(next - clockSeconds());
+	}
+	for (size_t i = 0; i < bots.size(); i++)
+		bots[i]->leave();
+}
+
+void report(double seconds, int threads) {
+	std::cout << "---- server: " << hosts.size() << " matches on " << threads << " threads, " << seconds << "s" << std::endl;
+	unsigned int totalTicks = 0;
+	for (size_t i = 0; i < hosts.size(); i++) {
+		MatchHost& host = *hosts[i];
+		TickStats stats;
+		host.takeStats(stats);
+		totalTicks += stats.ticks;
+		std::cout << "  match " << host.id << " (" << host.stageName << ", port " << host.port << ", ";
+		if (host.thread < 0)
+			std::cout << "jobs): ";
+		else
+			std::cout << "thread " << host.thread << "): ";
+		std::cout
+			<< stats.clients << " clients, " << stats.ticks << " ticks";
+		if (stats.ticks > 0) {
+			std::cout << ", " << stats.tickTime / stats.ticks * 1000.0 << "ms avg, " << stats.tickMax * 1000.0 << "ms max of "
+				<< host.budget * 1000.0 << "ms budget";
+			if (stats.tickMax > host.budget)
+				std::cout << " OVER BUDGET";
+		}
+		std::cout << ", " << stats.late << " late, " << stats.skipped << " skipped, " << stats.inputsReceived << " inputs in, "
+			<< stats.statesSent << " states out" << std::endl;
+		if (stats.spectators > 0 && stats.feedBatches > 0) {
+			std::cout << "    feed: " << stats.spectators << " spectators, " << stats.feedBytes / seconds / stats.spectators
+				<< " B/s each (+" << stats.feedPackets * 28 / seconds / stats.spectators << " B/s UDP/IP), "
+				<< stats.feedTime / stats.feedBatches * 1000000.0 << "us per batch to send to all of them, "
+				<< (double)stats.feedEncodes / stats.feedBatches << " encodes per batch at "
+				<< (stats.feedEncodes ? stats.encodeTime / stats.feedEncodes * 1000000.0 : 0) << "us each" << std::endl;
+		}
+	}
+	std::cout << "  " << totalTicks / seconds << " ticks/s total" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned short port = PROTOCOL_DEFAULT_PORT;
+	int matchCount = 0;	//1, or BENCH_JOB_MATCHES for --bench-jobs
+	int threadCount = (int)std::thread::hardware_concurrency();
+	std::string stageName;
+	std::string resources = SERVER_DEFAULT_RESOURCES;
+	double reportInterval = SERVER_REPORT_INTERVAL;
+	double duration = 0;
+	bool withBots = false;
+	int spectatorCount = 0;
+	bool record = false;
+	bool useJobs = false;
+	bool benchJobs = false;
+	std::string loadState, replayPath;
+	bool benchSaves = false;
+	bool collisionCheck = false;
+	bool benchCheck = false;
+	std::string makeStagePath, streamStage;
+	int stageWidth = 0;
+	size_t streamBudget = STAGE_STREAM_DEFAULT_BUDGET;
+	double streamSpeed = SERVER_STREAM_SPEED;
+	unsigned int ticks = SERVER_OFFLINE_TICKS;
+	std::vector<std::string> telemetryFiles;
+	bool benchLogging = false;
+	bool benchShots = false;
+	unsigned int projectileCount = PROJECTILE_CAPACITY;
+	std::vector<std::string> benchedReplays;
+	unsigned int replayRuns = SERVER_REPLAY_RUNS;
+	std::string jsonPath, baselinePath;
+	double threshold = BENCH_DEFAULT_THRESHOLD;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--port" && hasValue)
+			port = (unsigned short)atoi(argv[++i]);
+		else if (arg == "--matches" && hasValue)
+			matchCount = atoi(argv[++i]);
+		else if (arg == "--threads" && hasValue)
+			threadCount = atoi(argv[++i]);
+		else if (arg == "--stage" && hasValue)
+			stageName = argv[++i];
+		else if (arg == "--resources" && hasValue)
+			resources = argv[++i];
+		else if (arg == "--report" && hasValue)
+			reportInterval = atof(argv[++i]);
+		else if (arg == "--duration" && hasValue)
+			duration = atof(argv[++i]);
+		else if (arg == "--bots")
+			withBots = true;
+		else if (arg == "--spectators" && hasValue)
+			spectatorCount = atoi(argv[++i]);
+		else if (arg == "--load-state" && hasValue)
+			loadState = argv[++i];
+		else if (arg == "--record")
+			record = true;
+		else if (arg == "--jobs")
+			useJobs = true;
+		else if (arg == "--bench-jobs")
+			benchJobs = true;
+		else if (arg == "--check-replay" && hasValue)
+			replayPath = argv[++i];
+		else if (arg == "--check-collision")
+			collisionCheck = true;
+		else if (arg == "--check-bench")
+			benchCheck = true;
+		else if (arg == "--bench-savestate")
+			benchSaves = true;
+		else if (arg == "--ticks" && hasValue)
+			ticks = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--make-stage" && i + 2 < argc) {
+			makeStagePath = argv[++i];
+			stageWidth = atoi(argv[++i]);
+		}
+		else if (arg == "--bench-stream" && hasValue)
+			streamStage = argv[++i];
+		else if (arg == "--budget" && hasValue)
+			streamBudget = (size_t)atoi(argv[++i]) * 1024;
+		else if (arg == "--speed" && hasValue)
+			streamSpeed = atof(argv[++i]);
+		else if (arg == "--summarize-telemetry" && hasValue)
+			telemetryFiles.push_back(argv[++i]);
+		else if (arg == "--bench-telemetry")
+			benchLogging = true;
+		else if (arg == "--bench-projectiles")
+			benchShots = true;
+		else if (arg == "--count" && hasValue)
+			projectileCount = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--bench-replay" && hasValue)
+			benchedReplays.push_back(argv[++i]);
+		else if (arg == "--runs" && hasValue)
+			replayRuns = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--json" && hasValue)
+			jsonPath = argv[++i];
+		else if (arg == "--baseline" && hasValue)
+			baselinePath = argv[++i];
+		else if (arg == "--threshold" && hasValue)
+			threshold = atof(argv[++i]);
+		else {
+			std::cout << "Unknown argument " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (!loadState.empty())
+		return runSaveState(loadState, resources, ticks);
+	if (!replayPath.empty())
+		return checkReplay(replayPath, resources);
+	if (collisionCheck)
+		return checkCollision();
+	if (benchCheck)
+		return checkBench();
+	if (benchSaves)
+		return benchSaveState(resources, stageName.empty() ? stageFiles[0] : stageName, ticks);
+
+	if (benchJobs)
+		return benchJobSystem(resources, matchCount, threadCount, ticks);
+	if (!makeStagePath.empty())
+		return makeStage(makeStagePath, stageWidth);
+	if (!streamStage.empty())
+		return benchStream(resources, streamStage, streamBudget, streamSpeed, ticks);
+	if (!telemetryFiles.empty())
+		return summarizeTelemetry(telemetryFiles);
+	if (benchLogging)
+		return benchTelemetry(resources, stageName.empty() ? stageFiles[2] : stageName, ticks);
+	if (benchShots)
+		return benchProjectiles(resources, stageName.empty() ? stageFiles[1] : stageName, projectileCount, ticks, threadCount);
+	if (!benchedReplays.empty())
+		return benchReplays(benchedReplays, resources, replayRuns, jsonPath, baselinePath, threshold);
+
+	if (matchCount < 1)
+		matchCount = 1;
+	if (threadCount < 1)
+		threadCount = 1;
+	if (threadCount > matchCount)
+		threadCount = matchCount;
+
+	if (!netInit())
+		return 1;
+#ifdef _WINDOWS
+	// Sleep() otherwise rounds up to the 15.6ms system tick, about one whole match tick
+	timeBeginPeriod(1);
+#endif
+
+	// Stages and animations are read-only once loaded, so every match shares them
+	AnimationSet chukAnimation, ivenAnimation;
+	if (!chukAnimation.load(resources + characterDefinitions[CHARACTER_CHUK].animation) || !ivenAnimation.load(resources + characterDefinitions[CHARACTER_IVEN].animation))
+		return 1;
+	std::map<std::string, Stage*> stages;
+	for (int i = 0; i < matchCount; i++) {
+		std::string name = stageName.empty() ? stageFiles[i % 3] : stageName;
+		if (stages.count(name) == 0) {
+			Stage* stage = new Stage();
+			if (!stage->open(resources + name))
+				return 1;
+			stages[name] = stage;
+		}
+
+		MatchHost* host = new MatchHost();
+		if (!host->open(i, (unsigned short)(port + i), name, stages[name], &chukAnimation, &ivenAnimation))
+			return 1;
+		host->thread = useJobs ? -1 : i % threadCount;
+		host->recordReplays = record;
+		hosts.push_back(host);
+	}
+
+	// A thread shares one MATCH_TICK between all of its matches. Job threads share
+	// theirs between all the matches.
+	std::vector<std::vector<MatchHost*> > assigned(threadCount);
+	for (size_t i = 0; i < hosts.size(); i++) {
+		if (useJobs)
+			hosts[i]->budget = MATCH_TICK * threadCount / matchCount;
+		else
+			assigned[hosts[i]->thread].push_back(hosts[i]);
+	}
+	for (size_t i = 0; i < hosts.size() && !useJobs; i++)
+		hosts[i]->budget = MATCH_TICK / assigned[hosts[i]->thread].size();
+
+	std::cout << "Serving " << matchCount << " matches on ports " << port << "-" << port + matchCount - 1 << " with "
+		<< threadCount << (useJobs ? " job" : "") << " threads at " << MATCH_TICK_RATE << " ticks/s" << std::endl;
+
+	std::vector<std::thread> workers;
+	if (useJobs)
+		workers.push_back(std::thread(workWithJobs, threadCount));
+	for (int i = 0; i < threadCount && !useJobs; i++)
+		workers.push_back(std::thread(work, assigned[i]));
+
+	std::thread botThread;
+	if (withBots || spectatorCount > 0) {
+		NetAddress loopback;
+		if (!resolveAddress("127.0.0.1", port, loopback))
+			return 1;
+		int perMatch = (withBots ? 2 : 0) + spectatorCount;
+		for (int i = 0; i < matchCount * perMatch; i++) {
+			loopback.port = (unsigned short)(port + i / perMatch);
+			Bot* bot = new Bot();
+			if (!bot->connect(loopback, i + 1, i % perMatch >= (withBots ? 2 : 0)))
+				return 1;
+			bots.push_back(bot);
+		}
+		botThread = std::thread(runBots);
+	}
+
+	double started = clockSeconds();
+	double lastReport = started;
+	while (duration <= 0 || clockSeconds() - started < duration) {
+		sleepSeconds(0.1);
+		double now = clockSeconds();
+		if (now - lastReport >= reportInterval) {
+			report(now - lastReport, threadCount);
+			lastReport = now;
+		}
+	}
+	running = false;
+	if (botThread.joinable())
+		botThread.join();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	report(clockSeconds() - lastReport, threadCount);
+
+	int result = 0;
+	unsigned int watched = 0, watchers = 0;
+	for (size_t i = 0; i < bots.size(); i++) {
+		if (bots[i]->statesReceived == 0)
+			result = 1;
+		if (bots[i]->spectating) {
+			watched += bots[i]->statesReceived;
+			watchers++;
+		}
+		else {
+			std::cout << "bot " << i << " (slot " << bots[i]->slot << "): " << bots[i]->statesReceived << " states, last tick "
+				<< bots[i]->lastTick << ", " << bots[i]->matchesSeen << " matches finished" << std::endl;
+		}
+		delete bots[i];
+	}
+	if (watchers > 0)
+		std::cout << watchers << " spectators decoded " << watched / watchers << " frames each on average" << std::endl;
+	for (size_t i = 0; i < hosts.size(); i++)
+		delete hosts[i];
+	for (std::map<std::string, Stage*>::iterator it = stages.begin(); it != stages.end(); ++it)
+		delete it->second;
+
+#ifdef _WINDOWS
+	timeEndPeriod(1);
+#endif
+	netShutdown();
+	return result;
+}